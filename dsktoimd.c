@@ -1,13 +1,19 @@
+#define _GNU_SOURCE     // SEEK_DATA/SEEK_HOLE where the system has them
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <errno.h>
 
-#define MAX_TRACKS 77
-#define MAX_SECTORS_PER_TRACK 26
-#define SECTOR_SIZE 128  // MDOS uses 128-byte sectors
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
+#include "mdos_geometry.h"
+#define MDOS_STATS_IMPLEMENTATION
+#include "mdos_stats.h"
 
 // IMD track header structure (matching your working code)
 typedef struct {
@@ -19,7 +25,7 @@ typedef struct {
 } imd_track_header_t;
 
 // Function to write IMD comment header
-int write_imd_comment(FILE *fp, const char *dsk_filename) {
+int write_imd_comment(FILE *fp, const char *dsk_filename, const mdos_geometry_t *g) {
     char comment[512];
     time_t now = time(NULL);
     struct tm *tm_info = localtime(&now);
@@ -27,10 +33,11 @@ int write_imd_comment(FILE *fp, const char *dsk_filename) {
     snprintf(comment, sizeof(comment), 
              "IMD file created from DSK: %s\r\n"
              "Created by dsktoimd.c on %04d-%02d-%02d %02d:%02d:%02d\r\n"
-             "MDOS format: 128-byte sectors, up to 26 sectors per track\r\n",
+             "MDOS format: %d-byte sectors, up to %d sectors per track%s\r\n",
              dsk_filename,
              tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
-             tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
+             tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec,
+             g->sector_size, g->sectors, (g->heads == 2) ? ", double sided" : "");
     
     // Write comment
     if (fputs(comment, fp) == EOF) {
@@ -46,8 +53,8 @@ int write_imd_comment(FILE *fp, const char *dsk_filename) {
 }
 
 // Function to check if a sector is empty (all zeros)
-bool is_sector_empty(const uint8_t *sector_data) {
-    for (int i = 0; i < SECTOR_SIZE; i++) {
+bool is_sector_empty(const uint8_t *sector_data, int sector_size) {
+    for (int i = 0; i < sector_size; i++) {
         if (sector_data[i] != 0) {
             return false;
         }
@@ -56,9 +63,9 @@ bool is_sector_empty(const uint8_t *sector_data) {
 }
 
 // Function to check if a sector is filled with the same byte
-bool is_sector_compressed(const uint8_t *sector_data, uint8_t *fill_byte) {
+bool is_sector_compressed(const uint8_t *sector_data, int sector_size, uint8_t *fill_byte) {
     *fill_byte = sector_data[0];
-    for (int i = 1; i < SECTOR_SIZE; i++) {
+    for (int i = 1; i < sector_size; i++) {
         if (sector_data[i] != *fill_byte) {
             return false;
         }
@@ -66,235 +73,236 @@ bool is_sector_compressed(const uint8_t *sector_data, uint8_t *fill_byte) {
     return true;
 }
 
-// Function to determine how many tracks contain data
-int find_last_track_with_data(FILE *dsk_fp) {
-    uint8_t sector_data[SECTOR_SIZE];
-    int last_track = -1;
-    
-    // Save current position
-    long current_pos = ftell(dsk_fp);
-    
-    // Check each track
-    for (int track = 0; track < MAX_TRACKS; track++) {
-        bool track_has_data = false;
+// Sector interleave and track skew of the written maps (1 and 0: in order)
+static int sector_interleave = 1;
+static int track_skew = 0;
+static int stats_format = 0;    // --stats[=json]
+
+// Encode the tracks of the linear image that hold data (called through
+// MDOS_GEOM_DISPATCH)
+MDOS_GEOM_INLINE uint8_t* encode_tracks(const mdos_geometry_t *g, const uint8_t *image, long image_len,
+                                        uint8_t *out, int *tracks_written, int *compressed_sectors) {
+    long tracks = (long)g->cylinders * g->heads;
+
+    for (long track = 0; track < tracks; track++) {
+        int cylinder = track / g->heads;
+        int head = track % g->heads;
         
-        for (int sector = 0; sector < MAX_SECTORS_PER_TRACK; sector++) {
-            long sector_pos = (long)track * MAX_SECTORS_PER_TRACK * SECTOR_SIZE + 
-                             (long)sector * SECTOR_SIZE;
-            
-            if (fseek(dsk_fp, sector_pos, SEEK_SET) != 0) {
-                break;
-            }
-            
-            if (fread(sector_data, SECTOR_SIZE, 1, dsk_fp) != 1) {
-                break;
-            }
+        // Include all sectors if any has data
+        bool has_data = false;
+        for (int s = 0; s < g->sectors && !has_data; s++) {
+            long offset = mdos_geometry_offset(g, cylinder, head, s + g->first_sector);
+            has_data = offset + g->sector_size <= image_len &&
+                       !is_sector_empty(image + offset, g->sector_size);
+        }
+        if (!has_data) {
+            continue;
+        }
+        
+        if (g->heads == 1) {
+            printf("Track %d: writing %d sectors\n", cylinder, g->sectors);
+        } else {
+            printf("Track %d head %d: writing %d sectors\n", cylinder, head, g->sectors);
+        }
+        
+        imd_track_header_t header;
+        header.mode = 0x00;              // FM mode (can be adjusted)
+        header.cylinder = cylinder;
+        header.head = head;              // No optional maps
+        header.sector_count = g->sectors;
+        header.sector_size = g->size_code;
+        memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        
+        // Sector number map (1-based numbering for MDOS), in rotational order
+        uint8_t map[256];
+        mdos_geometry_interleave_map(g, track, sector_interleave, track_skew, map);
+        memcpy(out, map, g->sectors);
+        out += g->sectors;
+        
+        for (int s = 0; s < g->sectors; s++) {
+            long offset = mdos_geometry_offset(g, cylinder, head, map[s]);
+            const uint8_t *sector_data = image + offset;
+            uint8_t fill_byte = 0;
             
-            if (!is_sector_empty(sector_data)) {
-                track_has_data = true;
-                break;
+            if (offset + g->sector_size > image_len) {
+                *out++ = 2;              // Past the end of the DSK: zeros
+                *out++ = 0;
+                (*compressed_sectors)++;
+            } else if (is_sector_compressed(sector_data, g->sector_size, &fill_byte)) {
+                *out++ = 2;              // Type 2: compressed
+                *out++ = fill_byte;
+                (*compressed_sectors)++;
+            } else {
+                *out++ = 1;              // Type 1: normal data
+                memcpy(out, sector_data, g->sector_size);
+                out += g->sector_size;
             }
         }
+        MDOS_STAT_ADD(MDOS_STAT_BYTES_ENCODED, (long)g->sectors * g->sector_size);
         
-        if (track_has_data) {
-            last_track = track;
-        }
+        (*tracks_written)++;
     }
-    
-    // Restore position
-    fseek(dsk_fp, current_pos, SEEK_SET);
-    
-    return last_track;
+    return out;
+}
+
+// Read a whole DSK into image (already zeroed). Holes of a sparse DSK are
+// found with SEEK_DATA/SEEK_HOLE and skipped instead of read; returns false
+// on a read error
+bool read_dsk(FILE *fp, uint8_t *image, long len) {
+#ifdef SEEK_DATA
+    int fd = fileno(fp);
+    off_t pos = 0;
+    while (pos < len) {
+        off_t data = lseek(fd, pos, SEEK_DATA);
+        MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 1);
+        if (data < 0 && errno == ENXIO) return true;    // Only holes left
+        if (data < 0) break;                            // Unsupported: read it all
+        if (data >= len) return true;
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) break;
+        if (hole > len) hole = len;
+        MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+        if (pread(fd, image + data, hole - data, data) != hole - data) return false;
+        pos = hole;
+    }
+    if (pos >= len) return true;
+#endif
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+    return fseek(fp, 0, SEEK_SET) == 0 && fread(image, 1, len, fp) == (size_t)len;
 }
 
 int convert_dsk_to_imd(const char *dsk_filename, const char *imd_filename) {
     FILE *dsk_fp, *imd_fp;
-    uint8_t sector_data[SECTOR_SIZE];
     
-    // Open input DSK file
+    // Read the whole DSK file
     dsk_fp = fopen(dsk_filename, "rb");
     if (!dsk_fp) {
         perror("Error opening DSK file");
         return -1;
     }
-    
-    // Find the last track with data
-    int last_track = find_last_track_with_data(dsk_fp);
-    if (last_track < 0) {
-        fprintf(stderr, "No data found in DSK file\n");
+    fseek(dsk_fp, 0, SEEK_END);
+    long dsk_len = ftell(dsk_fp);
+    uint8_t *image = calloc(dsk_len > 0 ? dsk_len : 1, 1);
+    if (!image || !read_dsk(dsk_fp, image, dsk_len)) {
+        fprintf(stderr, "Error reading DSK file\n");
+        free(image);
         fclose(dsk_fp);
         return -1;
     }
+    fclose(dsk_fp);
     
-    printf("Found data up to track %d\n", last_track);
-    
-    // Open output IMD file
-    imd_fp = fopen(imd_filename, "wb");
-    if (!imd_fp) {
-        perror("Error creating IMD file");
-        fclose(dsk_fp);
+    mdos_geometry_t geometry;
+    mdos_geometry_from_dsk(&geometry, dsk_len);
+    printf("Geometry: %d cylinders, %d head(s), %d sectors of %d bytes\n",
+           geometry.cylinders, geometry.heads, geometry.sectors, geometry.sector_size);
+    if (sector_interleave >= geometry.sectors && geometry.sectors > 1) {
+        fprintf(stderr, "Interleave must be below %d\n", geometry.sectors);
+        free(image);
         return -1;
     }
+    if (sector_interleave != 1 || track_skew != 0) {
+        printf("Sector interleave %d, skew %d\n", sector_interleave, track_skew);
+    }
     
-    // Write IMD comment header
-    if (write_imd_comment(imd_fp, dsk_filename) != 0) {
-        fprintf(stderr, "Error writing IMD comment\n");
-        fclose(dsk_fp);
-        fclose(imd_fp);
+    // Worst case: every track present with every sector stored in full
+    long tracks = (long)geometry.cylinders * geometry.heads;
+    uint8_t *buffer = malloc(tracks * (sizeof(imd_track_header_t) +
+                                       geometry.sectors * (2 + geometry.sector_size)));
+    if (!buffer) {
+        fprintf(stderr, "Out of memory\n");
+        free(image);
         return -1;
     }
     
     printf("Converting DSK to IMD...\n");
     
+    mdos_stats_phase("encode");
     int tracks_written = 0;
-    int total_sectors = 0;
     int compressed_sectors = 0;
+    uint8_t *end = MDOS_GEOM_DISPATCH(encode_tracks, &geometry, image, dsk_len, buffer,
+                                      &tracks_written, &compressed_sectors);
+    free(image);
     
-    // Process each track up to the last one with data
-    for (int track = 0; track <= last_track; track++) {
-        // Count non-empty sectors in this track
-        int valid_sectors = 0;
-        for (int sector = 0; sector < MAX_SECTORS_PER_TRACK; sector++) {
-            long sector_pos = (long)track * MAX_SECTORS_PER_TRACK * SECTOR_SIZE + 
-                             (long)sector * SECTOR_SIZE;
-            
-            if (fseek(dsk_fp, sector_pos, SEEK_SET) != 0) {
-                break;
-            }
-            
-            if (fread(sector_data, SECTOR_SIZE, 1, dsk_fp) != 1) {
-                break;
-            }
-            
-            if (!is_sector_empty(sector_data)) {
-                valid_sectors = MAX_SECTORS_PER_TRACK; // Include all sectors if any has data
-                break;
-            }
-        }
-        
-        if (valid_sectors == 0) {
-            printf("Track %d: empty, skipping\n", track);
-            continue;
-        }
-        
-        printf("Track %d: writing %d sectors\n", track, MAX_SECTORS_PER_TRACK);
-        
-        // Write IMD track header
-        imd_track_header_t header;
-        header.mode = 0x00;        // FM mode (can be adjusted)
-        header.cylinder = track;   // Track number
-        header.head = 0x00;        // Head 0, no optional maps
-        header.sector_count = MAX_SECTORS_PER_TRACK;
-        header.sector_size = 0x00; // 128 bytes (sector size code 0)
-        
-        if (fwrite(&header, sizeof(header), 1, imd_fp) != 1) {
-            fprintf(stderr, "Error writing track header\n");
-            fclose(dsk_fp);
-            fclose(imd_fp);
-            return -1;
-        }
-        
-        // Write sector number map (1-based numbering for MDOS)
-        uint8_t sector_map[MAX_SECTORS_PER_TRACK];
-        for (int i = 0; i < MAX_SECTORS_PER_TRACK; i++) {
-            sector_map[i] = i + 1; // 1-based sector numbering
-        }
-        
-        if (fwrite(sector_map, MAX_SECTORS_PER_TRACK, 1, imd_fp) != 1) {
-            fprintf(stderr, "Error writing sector map\n");
-            fclose(dsk_fp);
-            fclose(imd_fp);
-            return -1;
-        }
-        
-        // Write sector data with compression
-        for (int sector = 0; sector < MAX_SECTORS_PER_TRACK; sector++) {
-            long sector_pos = (long)track * MAX_SECTORS_PER_TRACK * SECTOR_SIZE + 
-                             (long)sector * SECTOR_SIZE;
-            
-            if (fseek(dsk_fp, sector_pos, SEEK_SET) != 0) {
-                fprintf(stderr, "Error seeking to sector position\n");
-                fclose(dsk_fp);
-                fclose(imd_fp);
-                return -1;
-            }
-            
-            if (fread(sector_data, SECTOR_SIZE, 1, dsk_fp) != 1) {
-                fprintf(stderr, "Error reading sector data\n");
-                fclose(dsk_fp);
-                fclose(imd_fp);
-                return -1;
-            }
-            
-            uint8_t fill_byte;
-            
-            // Check if sector can be compressed
-            if (is_sector_compressed(sector_data, &fill_byte)) {
-                // Write compressed sector
-                if (fputc(2, imd_fp) == EOF) { // Type 2: compressed
-                    fprintf(stderr, "Error writing sector type\n");
-                    fclose(dsk_fp);
-                    fclose(imd_fp);
-                    return -1;
-                }
-                
-                if (fputc(fill_byte, imd_fp) == EOF) {
-                    fprintf(stderr, "Error writing fill byte\n");
-                    fclose(dsk_fp);
-                    fclose(imd_fp);
-                    return -1;
-                }
-                
-                compressed_sectors++;
-            } else {
-                // Write normal sector
-                if (fputc(1, imd_fp) == EOF) { // Type 1: normal data
-                    fprintf(stderr, "Error writing sector type\n");
-                    fclose(dsk_fp);
-                    fclose(imd_fp);
-                    return -1;
-                }
-                
-                if (fwrite(sector_data, SECTOR_SIZE, 1, imd_fp) != 1) {
-                    fprintf(stderr, "Error writing sector data\n");
-                    fclose(dsk_fp);
-                    fclose(imd_fp);
-                    return -1;
-                }
-            }
-            
-            total_sectors++;
-        }
-        
-        tracks_written++;
+    if (tracks_written == 0) {
+        fprintf(stderr, "No data found in DSK file\n");
+        free(buffer);
+        return -1;
+    }
+    
+    // Open output IMD file
+    mdos_stats_phase("write");
+    imd_fp = fopen(imd_filename, "wb");
+    if (!imd_fp) {
+        perror("Error creating IMD file");
+        free(buffer);
+        return -1;
+    }
+    
+    // Write IMD comment header, then all tracks at once
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 1);
+    if (write_imd_comment(imd_fp, dsk_filename, &geometry) != 0 ||
+        fwrite(buffer, 1, end - buffer, imd_fp) != (size_t)(end - buffer)) {
+        fprintf(stderr, "Error writing IMD file\n");
+        fclose(imd_fp);
+        free(buffer);
+        return -1;
     }
     
-    fclose(dsk_fp);
     fclose(imd_fp);
+    free(buffer);
     
     printf("Conversion completed successfully!\n");
-    printf("Written %d tracks, %d sectors total\n", tracks_written, total_sectors);
+    printf("Written %d tracks, %d sectors total\n", tracks_written, tracks_written * geometry.sectors);
     printf("Compressed %d sectors\n", compressed_sectors);
     
     return 0;
 }
 
 void print_usage(const char *program_name) {
-    printf("Usage: %s <input.dsk> <output.imd>\n", program_name);
+    printf("Usage: %s [--interleave N] [--skew K] <input.dsk> <output.imd>\n", program_name);
     printf("Convert DSK file to ImageDisk (IMD) format\n");
     printf("Optimized for MDOS disk images with 128-byte sectors\n");
+    printf("DSK files holding two sides or more (>= 512512 bytes) are written double sided\n");
+    printf("  --interleave N   Place consecutive sectors N slots apart (default 1)\n");
+    printf("  --skew K         Rotate each track's sector layout K slots from the last\n");
+    printf("  --stats[=json]   Print I/O and encode counters and phase times on exit (stderr)\n");
+}
+
+static void print_stats(void) {
+    fflush(stdout);
+    mdos_stats_print(stderr, stats_format);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    int arg = 1;
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (mdos_stats_option(argv[arg])) {
+            stats_format = mdos_stats_option(argv[arg]);
+            arg--;              // Takes no value
+        } else if (strcmp(argv[arg], "--interleave") == 0 && arg + 1 < argc) {
+            sector_interleave = atoi(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "--skew") == 0 && arg + 1 < argc) {
+            track_skew = atoi(argv[arg + 1]);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+        arg += 2;
+    }
+    if (argc - arg != 2 || sector_interleave < 1 || track_skew < 0) {
         print_usage(argv[0]);
         return 1;
     }
     
-    const char *dsk_filename = argv[1];
-    const char *imd_filename = argv[2];
+    const char *dsk_filename = argv[arg];
+    const char *imd_filename = argv[arg + 1];
+    if (stats_format) {
+        atexit(print_stats);
+    }
+    mdos_stats_phase("read");
     
-    printf("DSK to IMD Converter v1.0 (MDOS optimized)\n");
+    printf("DSK to IMD Converter v1.1 (MDOS optimized)\n");
     printf("Input file: %s\n", dsk_filename);
     printf("Output file: %s\n", imd_filename);
     
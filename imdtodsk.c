@@ -4,23 +4,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define MAX_TRACKS 77
-#define MAX_SECTORS_PER_TRACK 26
-#define SECTOR_SIZE 128  // MDOS uses 128-byte sectors
+#include "mdos_geometry.h"
+#define MDOS_STATS_IMPLEMENTATION
+#include "mdos_stats.h"
 
-// IMD track header structure (matching your working code)
-typedef struct {
-    uint8_t mode;          // Recording mode
-    uint8_t cylinder;      // Track number
-    uint8_t head;          // Head number + flags
-    uint8_t sector_count;  // Sectors in this track
-    uint8_t sector_size;   // Sector size code
-} imd_track_header_t;
+#define CAT_SECTOR        1     // Cluster Allocation Table
+#define FIRST_DATA_SECTOR 23    // After the directory (sectors 3-22)
+#define CLUSTER_SECTORS   4
 
 // Function to read IMD comment
 int read_imd_comment(FILE *fp, char *comment, size_t max_len) {
     size_t len = 0;
-    int c;
+    int c = EOF;
     
     // Read characters until we find 0x1A marker
     while (len < max_len - 1) {
@@ -38,19 +33,26 @@ int read_imd_comment(FILE *fp, char *comment, size_t max_len) {
     return len;
 }
 
-int convert_imd_to_dsk(const char *imd_filename, const char *dsk_filename) {
+// A 128-byte sector of the linear image that can be left as a hole: all
+// zeros, or with free_holes in a cluster the CAT (sector 1) marks free
+static bool sector_droppable(const uint8_t *image, long sector, bool free_holes) {
+    if (free_holes && sector >= FIRST_DATA_SECTOR) {
+        const uint8_t *cat = image + CAT_SECTOR * MDOS_GEOM_SECTOR_SIZE;
+        long cluster = sector / CLUSTER_SECTORS;
+        if (cluster < MDOS_GEOM_SECTOR_SIZE * 8 && !(cat[cluster >> 3] & (1 << (7 - (cluster & 7))))) {
+            return true;
+        }
+    }
+    const uint8_t *data = image + sector * MDOS_GEOM_SECTOR_SIZE;
+    for (int i = 0; i < MDOS_GEOM_SECTOR_SIZE; i++) {
+        if (data[i] != 0) return false;
+    }
+    return true;
+}
+
+int convert_imd_to_dsk(const char *imd_filename, const char *dsk_filename, bool free_holes) {
     FILE *imd_fp, *dsk_fp;
     char comment[1024];
-    imd_track_header_t header;
-    uint8_t sector_data[SECTOR_SIZE];
-    
-    // Track and sector storage (like your working code)
-    uint8_t disk_sectors[MAX_TRACKS][MAX_SECTORS_PER_TRACK][SECTOR_SIZE];
-    bool sector_valid[MAX_TRACKS][MAX_SECTORS_PER_TRACK];
-    
-    // Initialize
-    memset(sector_valid, false, sizeof(sector_valid));
-    memset(disk_sectors, 0, sizeof(disk_sectors));
     
     // Open input IMD file
     imd_fp = fopen(imd_filename, "rb");
@@ -64,198 +66,175 @@ int convert_imd_to_dsk(const char *imd_filename, const char *dsk_filename) {
         printf("IMD Comment: %s\n", comment);
     }
     
-    printf("Converting IMD to DSK...\n");
+    // The track records are read in one go and walked twice: once for the
+    // geometry, once to place the sectors
+    long pos = ftell(imd_fp);
+    fseek(imd_fp, 0, SEEK_END);
+    long len = ftell(imd_fp);
+    uint8_t *imd = malloc(len > 0 ? len : 1);
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+    if (!imd || fseek(imd_fp, 0, SEEK_SET) != 0 || fread(imd, 1, len, imd_fp) != (size_t)len) {
+        fprintf(stderr, "Error reading IMD file\n");
+        free(imd);
+        fclose(imd_fp);
+        return -1;
+    }
+    fclose(imd_fp);
     
-    int tracks_parsed = 0;
-    int total_sectors = 0;
-    int valid_sectors = 0;
+    mdos_geometry_t geometry;
+    long total_sectors;
+    int tracks_parsed = mdos_geometry_scan_imd(&geometry, imd, len, pos, &total_sectors);
+    if (tracks_parsed < 0) {
+        fprintf(stderr, tracks_parsed == -2 ? "Tracks differ in sector size\n"
+                                            : "Unexpected end of file in track records\n");
+        free(imd);
+        return -1;
+    }
     
-    // Parse tracks (using your working algorithm)
-    while (tracks_parsed < 200) { // Safety limit
-        if (fread(&header, sizeof(header), 1, imd_fp) != 1) {
-            break; // End of file
-        }
-        
-        int track_num = header.cylinder; // Use actual cylinder number
-        
-        printf("Track %d: %d sectors\n", track_num, header.sector_count);
-        
-        if (header.sector_count == 0) {
-            tracks_parsed++;
-            continue;
-        }
-        
-        // Safety check
-        if (track_num >= MAX_TRACKS) {
-            printf("Warning: Track %d >= MAX_TRACKS, skipping\n", track_num);
-            tracks_parsed++;
-            continue;
-        }
-        
-        // Read sector number map
-        uint8_t sector_map[header.sector_count];
-        if (fread(sector_map, header.sector_count, 1, imd_fp) != 1) {
-            fprintf(stderr, "Error reading sector map\n");
-            break;
-        }
-        
-        // Read optional cylinder map if present
-        if (header.head & 0x80) {
-            uint8_t cylinder_map[header.sector_count];
-            if (fread(cylinder_map, header.sector_count, 1, imd_fp) != 1) {
-                fprintf(stderr, "Error reading cylinder map\n");
-                break;
-            }
-        }
-        
-        // Read optional head map if present
-        if (header.head & 0x40) {
-            uint8_t head_map[header.sector_count];
-            if (fread(head_map, header.sector_count, 1, imd_fp) != 1) {
-                fprintf(stderr, "Error reading head map\n");
-                break;
-            }
-        }
-        
-        // Read sector data (using your working algorithm)
-        for (int s = 0; s < header.sector_count; s++) {
-            uint8_t sector_type = fgetc(imd_fp);
-            if (sector_type == EOF) {
-                fprintf(stderr, "Unexpected end of file reading sector type\n");
-                fclose(imd_fp);
-                return -1;
-            }
-            
-            int sector_num = sector_map[s];
-            
-            // Handle sector types (simplified like your code)
-            switch (sector_type) {
-                case 0: // Data unavailable
-                    memset(sector_data, 0, SECTOR_SIZE);
-                    break;
-                    
-                case 1: // Normal data
-                    if (fread(sector_data, SECTOR_SIZE, 1, imd_fp) != 1) {
-                        fprintf(stderr, "Error reading normal sector data\n");
-                        fclose(imd_fp);
-                        return -1;
-                    }
-                    break;
-                    
-                case 2: // Compressed - all same byte
-                    {
-                        int fill_byte = fgetc(imd_fp);
-                        if (fill_byte == EOF) {
-                            fprintf(stderr, "Error reading compressed sector fill byte\n");
-                            fclose(imd_fp);
-                            return -1;
-                        }
-                        memset(sector_data, fill_byte, SECTOR_SIZE);
-                    }
-                    break;
-                    
-                default:
-                    // Handle other types as normal data (like your code)
-                    printf("Warning: Unknown sector type %d, treating as normal data\n", sector_type);
-                    if (fread(sector_data, SECTOR_SIZE, 1, imd_fp) != 1) {
-                        fprintf(stderr, "Error reading unknown sector type data\n");
-                        fclose(imd_fp);
-                        return -1;
-                    }
-                    break;
-            }
-            
-            // Convert from 1-based to 0-based sector numbering (like your code)
-            int mdos_sector = sector_num - 1;  // Convert 1-26 to 0-25
-            
-            if (mdos_sector >= 0 && mdos_sector < MAX_SECTORS_PER_TRACK) {
-                memcpy(disk_sectors[track_num][mdos_sector], sector_data, SECTOR_SIZE);
-                sector_valid[track_num][mdos_sector] = true;
-                valid_sectors++;
-            }
-            total_sectors++;
+    printf("Geometry: %d cylinders, %d head(s), %d sectors of %d bytes\n",
+           geometry.cylinders, geometry.heads, geometry.sectors, geometry.sector_size);
+    printf("Converting IMD to DSK...\n");
+    mdos_geometry_imd_record_t record;
+    for (long p = pos; mdos_geometry_imd_record(imd, len, p, &record) > 0; p = record.next) {
+        if (record.head_byte & 1) {
+            printf("Track %d head 1: %d sectors\n", record.cylinder, record.count);
+        } else {
+            printf("Track %d: %d sectors\n", record.cylinder, record.count);
         }
-        
-        tracks_parsed++;
     }
     
-    fclose(imd_fp);
+    long logical_sectors = mdos_geometry_bytes(&geometry) / MDOS_GEOM_SECTOR_SIZE;
+    uint8_t *image = calloc(mdos_geometry_bytes(&geometry), 1);
+    bool *sector_valid = calloc(logical_sectors, sizeof(bool));
+    if (!image || !sector_valid) {
+        fprintf(stderr, "Out of memory\n");
+        free(image);
+        free(sector_valid);
+        free(imd);
+        return -1;
+    }
     
-    printf("Parsed %d tracks, %d valid sectors out of %d total\n", 
+    mdos_stats_phase("decode");
+    long valid_sectors = mdos_geometry_place_imd(&geometry, imd, len, pos, image, sector_valid);
+    MDOS_STAT_ADD(MDOS_STAT_BYTES_DECODED, valid_sectors * geometry.sector_size);
+    free(imd);
+    
+    printf("Parsed %d tracks, %ld valid sectors out of %ld total\n", 
            tracks_parsed, valid_sectors, total_sectors);
     
     // Open output DSK file
     dsk_fp = fopen(dsk_filename, "wb");
     if (!dsk_fp) {
         perror("Error creating DSK file");
+        free(image);
+        free(sector_valid);
         return -1;
     }
     
-    // Write sectors in sequential order (track 0 sectors 0-25, track 1 sectors 0-25, etc.)
+    mdos_stats_phase("write");
+    // Write tracks in linear order through the last one holding data; tracks
+    // before it that the IMD lacks keep their addresses. Sectors that can be
+    // dropped are seeked over so the filesystem leaves holes
+    long tracks = (long)geometry.cylinders * geometry.heads;
+    long track_bytes = mdos_geometry_track_bytes(&geometry);
+    long logical_per_track = track_bytes / MDOS_GEOM_SECTOR_SIZE;
+    long last_track = -1;
+    for (long l = 0; l < logical_sectors; l++) {
+        if (sector_valid[l]) last_track = l / logical_per_track;
+    }
+    
     int written_sectors = 0;
-    for (int track = 0; track < MAX_TRACKS; track++) {
-        bool track_has_data = false;
-        
-        // Check if track has any valid sectors
-        for (int sector = 0; sector < MAX_SECTORS_PER_TRACK; sector++) {
-            if (sector_valid[track][sector]) {
-                track_has_data = true;
-                break;
+    long hole_bytes = 0;
+    bool write_error = false;
+    for (long track = 0; track <= last_track && track < tracks && !write_error; track++) {
+        printf("Writing track %ld\n", track);
+        for (long l = 0; l < logical_per_track && !write_error; l++) {
+            long sector = track * logical_per_track + l;
+            if (sector_droppable(image, sector, free_holes)) {
+                hole_bytes += MDOS_GEOM_SECTOR_SIZE;
+                continue;
             }
+            MDOS_STAT_ADD(MDOS_STAT_SECTORS_WRITTEN, 1);
+            MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+            write_error = fseek(dsk_fp, sector * MDOS_GEOM_SECTOR_SIZE, SEEK_SET) != 0 ||
+                          fwrite(image + sector * MDOS_GEOM_SECTOR_SIZE, MDOS_GEOM_SECTOR_SIZE, 1, dsk_fp) != 1;
         }
-        
-        if (track_has_data) {
-            printf("Writing track %d\n", track);
-            for (int sector = 0; sector < MAX_SECTORS_PER_TRACK; sector++) {
-                if (sector_valid[track][sector]) {
-                    if (fwrite(disk_sectors[track][sector], SECTOR_SIZE, 1, dsk_fp) != 1) {
-                        fprintf(stderr, "Error writing sector data\n");
-                        fclose(dsk_fp);
-                        return -1;
-                    }
-                    written_sectors++;
-                } else {
-                    // Write empty sector
-                    uint8_t empty_sector[SECTOR_SIZE];
-                    memset(empty_sector, 0, SECTOR_SIZE);
-                    if (fwrite(empty_sector, SECTOR_SIZE, 1, dsk_fp) != 1) {
-                        fprintf(stderr, "Error writing empty sector\n");
-                        fclose(dsk_fp);
-                        return -1;
-                    }
-                }
-            }
+        for (long l = 0; l < logical_per_track; l += geometry.sector_size / MDOS_GEOM_SECTOR_SIZE) {
+            if (sector_valid[track * logical_per_track + l]) written_sectors++;
         }
     }
     
-    fclose(dsk_fp);
+    // A trailing hole still counts towards the size: write its last byte
+    long dsk_len = (last_track + 1 < tracks ? last_track + 1 : tracks) * track_bytes;
+    if (!write_error && dsk_len > 0 && ftell(dsk_fp) < dsk_len) {
+        write_error = fseek(dsk_fp, dsk_len - 1, SEEK_SET) != 0 || fputc(0, dsk_fp) == EOF;
+    }
+    
+    if (fclose(dsk_fp) != 0 || write_error) {
+        fprintf(stderr, "Error writing sector data\n");
+        free(image);
+        free(sector_valid);
+        return -1;
+    }
+    free(image);
+    free(sector_valid);
     
     printf("Conversion completed successfully!\n");
     printf("Written %d sectors to DSK file\n", written_sectors);
+    printf("Left %ld bytes as holes\n", hole_bytes);
     
     return 0;
 }
 
 void print_usage(const char *program_name) {
-    printf("Usage: %s <input.imd> <output.dsk>\n", program_name);
+    printf("Usage: %s [--free] <input.imd> <output.dsk>\n", program_name);
     printf("Convert ImageDisk (IMD) file to DSK format\n");
     printf("Optimized for MDOS disk images with 128-byte sectors\n");
+    printf("Double-sided images and other sector sizes are laid out by cylinder, head, sector\n");
+    printf("Zero sectors are left as holes in the DSK (sparse file)\n");
+    printf("  --free   Also leave clusters the CAT marks free as holes (drops deleted data)\n");
+    printf("  --stats[=json]  Print I/O and decode counters and phase times on exit (stderr)\n");
+}
+
+// --stats[=json]: MDOS_STATS_TEXT or MDOS_STATS_JSON
+static int stats_format;
+
+static void print_stats(void) {
+    fflush(stdout);
+    mdos_stats_print(stderr, stats_format);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    // --stats may go anywhere; take it out before the positional parsing
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        int format = mdos_stats_option(argv[i]);
+        if (format) {
+            stats_format = format;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    if (stats_format) {
+        atexit(print_stats);
+    }
+    mdos_stats_phase("read");
+
+    bool free_holes = argc == 4 && strcmp(argv[1], "--free") == 0;
+    if (argc != 3 && !free_holes) {
         print_usage(argv[0]);
         return 1;
     }
     
-    const char *imd_filename = argv[1];
-    const char *dsk_filename = argv[2];
+    const char *imd_filename = argv[argc - 2];
+    const char *dsk_filename = argv[argc - 1];
     
-    printf("IMD to DSK Converter v1.2 (MDOS optimized)\n");
+    printf("IMD to DSK Converter v1.3 (MDOS optimized)\n");
     printf("Input file: %s\n", imd_filename);
     printf("Output file: %s\n", dsk_filename);
     
-    if (convert_imd_to_dsk(imd_filename, dsk_filename) == 0) {
+    if (convert_imd_to_dsk(imd_filename, dsk_filename, free_holes) == 0) {
         printf("Conversion successful!\n");
         return 0;
     } else {
@@ -0,0 +1,1071 @@
+/*
+ * MDOS Filesystem Library - Deduplicating Image Archive
+ * Copyright (C) 2025
+ *
+ * Images are split into chunks on worker threads; only appending to the
+ * pack and index is serialized, one image at a time
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* pthreads, fseeko, open_memstream, scandir */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "mdos_internal.h"
+#include "mdos_archive.h"
+#include "mdos_imd.h"
+#include "mdos_mdz.h"
+#include "mdos_hash.h"
+#include "mdos_sparse.h"
+#include "mdos_trace.h"
+
+#define ARCHIVE_PACK        "chunks.pack"
+#define ARCHIVE_INDEX       "chunks.idx"
+#define ARCHIVE_IMAGES      "images"
+#define ARCHIVE_SUFFIX      ".recipe"
+#define ARCHIVE_MAGIC       "MDOS-RECIPE 1"
+#define ARCHIVE_ENTRY_SIZE  24
+#define ARCHIVE_MAX_JOBS    64
+
+#define IMD_COMMENT_END     0x1A
+#define SKELETON_TRACK      'T'     /* Track record follows */
+#define SKELETON_RAW        'R'     /* Length and bytes that are not a track */
+
+/* Image formats a recipe can come from */
+enum { FORMAT_DSK, FORMAT_IMD, FORMAT_MDZ };
+static const char *format_names[] = { "dsk", "imd", "mdz" };
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;        /* Position in the pack */
+    uint32_t length;
+    uint32_t crc;
+} archive_entry_t;
+
+struct mdos_archive {
+    char *path;
+    FILE *pack;
+    FILE *index;
+    archive_entry_t *entries;
+    long count;
+    long capacity;
+    uint32_t *table;        /* Open addressing on the hash: entry + 1, 0 = empty */
+    long table_size;        /* Power of two, at least twice count */
+    uint64_t pack_end;
+    int failed;             /* A write failed; the store is read only from here */
+};
+
+/* A chunk of an image being added, pointing into the plan's buffers */
+typedef struct {
+    uint64_t hash;
+    uint32_t crc;
+    uint32_t length;
+    const uint8_t *data;
+} archive_chunk_t;
+
+/* Everything an image contributes, worked out before the store is touched */
+typedef struct {
+    const char *path;
+    const char *name;
+    int format;
+    uint8_t *source;        /* The file as added; kept for IMD and MDZ only */
+    long source_length;
+    uint32_t source_crc;
+    uint8_t *image;         /* Linear image as the mount shows it */
+    long length;
+    uint32_t crc;
+    mdos_geometry_t geometry;
+    uint8_t *files;         /* Data sectors of the file chunks, back to back */
+    uint8_t *skeleton;
+    long skeleton_length;
+    archive_chunk_t *chunks;
+    int nchunks;
+    int nfiles;
+    char *recipe;
+    size_t recipe_length;
+} archive_plan_t;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static char* archive_file_path(const mdos_archive_t *archive, const char *dir, const char *name,
+                               const char *suffix) {
+    size_t n = strlen(archive->path) + (dir ? strlen(dir) + 1 : 0) + strlen(name) +
+               (suffix ? strlen(suffix) : 0) + 2;
+    char *path = malloc(n);
+    if (path) {
+        snprintf(path, n, "%s/%s%s%s%s", archive->path, dir ? dir : "", dir ? "/" : "",
+                 name, suffix ? suffix : "");
+    }
+    return path;
+}
+
+/* Chunk index */
+
+static long archive_find(const mdos_archive_t *archive, uint64_t hash) {
+    if (!archive->table) {
+        return -1;
+    }
+    long mask = archive->table_size - 1;
+    for (long i = (long)(hash & mask); archive->table[i]; i = (i + 1) & mask) {
+        if (archive->entries[archive->table[i] - 1].hash == hash) {
+            return archive->table[i] - 1;
+        }
+    }
+    return -1;
+}
+
+static void archive_table_insert(mdos_archive_t *archive, long entry) {
+    long mask = archive->table_size - 1;
+    long i = (long)(archive->entries[entry].hash & mask);
+    while (archive->table[i]) {
+        i = (i + 1) & mask;
+    }
+    archive->table[i] = (uint32_t)(entry + 1);
+}
+
+/* Make room for one more entry, growing the array and rehashing as needed */
+static int archive_reserve(mdos_archive_t *archive) {
+    if (archive->count == archive->capacity) {
+        long capacity = archive->capacity ? archive->capacity * 2 : 1024;
+        archive_entry_t *entries = realloc(archive->entries, capacity * sizeof(*entries));
+        if (!entries) {
+            return MDOS_ENOSPC;
+        }
+        archive->entries = entries;
+        archive->capacity = capacity;
+    }
+    if ((archive->count + 1) * 2 > archive->table_size) {
+        long size = archive->table_size ? archive->table_size : 2048;
+        while ((archive->count + 1) * 2 > size) {
+            size *= 2;
+        }
+        uint32_t *table = calloc(size, sizeof(*table));
+        if (!table) {
+            return MDOS_ENOSPC;
+        }
+        free(archive->table);
+        archive->table = table;
+        archive->table_size = size;
+        for (long e = 0; e < archive->count; e++) {
+            archive_table_insert(archive, e);
+        }
+    }
+    return MDOS_EOK;
+}
+
+static FILE* archive_open_file(const mdos_archive_t *archive, const char *name, int create) {
+    char *path = archive_file_path(archive, NULL, name, NULL);
+    if (!path) {
+        return NULL;
+    }
+    FILE *fp = fopen(path, "r+b");
+    if (!fp && errno == ENOENT && create) {
+        fp = fopen(path, "w+b");
+    }
+    free(path);
+    return fp;
+}
+
+mdos_archive_t* mdos_archive_open(const char *store_path, int create) {
+    if (!store_path) {
+        return NULL;
+    }
+    if (create) {
+        mkdir(store_path, 0777);
+    }
+
+    mdos_archive_t *archive = calloc(1, sizeof(*archive));
+    if (!archive || !(archive->path = strdup(store_path))) {
+        free(archive);
+        return NULL;
+    }
+    char *images = archive_file_path(archive, NULL, ARCHIVE_IMAGES, NULL);
+    if (images && create) {
+        mkdir(images, 0777);
+    }
+    struct stat st;
+    int ok = images && stat(images, &st) == 0 && S_ISDIR(st.st_mode);
+    free(images);
+
+    archive->pack = ok ? archive_open_file(archive, ARCHIVE_PACK, create) : NULL;
+    archive->index = archive->pack ? archive_open_file(archive, ARCHIVE_INDEX, create) : NULL;
+    if (!archive->index || fseeko(archive->pack, 0, SEEK_END) != 0 ||
+        fseeko(archive->index, 0, SEEK_END) != 0) {
+        mdos_archive_close(archive);
+        return NULL;
+    }
+    off_t pack_size = ftello(archive->pack);
+    long n = (long)(ftello(archive->index) / ARCHIVE_ENTRY_SIZE);
+    rewind(archive->index);
+
+    /* Keep the entries whose chunks made it into the pack, in pack order */
+    uint8_t record[ARCHIVE_ENTRY_SIZE];
+    for (long i = 0; i < n; i++) {
+        if (fread(record, 1, sizeof(record), archive->index) != sizeof(record) ||
+            archive_reserve(archive) != MDOS_EOK) {
+            mdos_archive_close(archive);
+            return NULL;
+        }
+        archive_entry_t *e = &archive->entries[archive->count];
+        e->hash = get_le64(record);
+        e->offset = get_le64(record + 8);
+        e->length = get_le32(record + 16);
+        e->crc = get_le32(record + 20);
+        if (e->offset != archive->pack_end || e->offset + e->length > (uint64_t)pack_size) {
+            break;
+        }
+        archive->pack_end += e->length;
+        archive_table_insert(archive, archive->count++);
+    }
+
+    /* Drop what an interrupted add left past the last complete entry */
+    if (archive->count != n || archive->pack_end != (uint64_t)pack_size) {
+        fflush(archive->index);
+        if (ftruncate(fileno(archive->index), (off_t)archive->count * ARCHIVE_ENTRY_SIZE) != 0 ||
+            ftruncate(fileno(archive->pack), (off_t)archive->pack_end) != 0) {
+            mdos_archive_close(archive);
+            return NULL;
+        }
+    }
+    return archive;
+}
+
+int mdos_archive_close(mdos_archive_t *archive) {
+    if (!archive) {
+        return MDOS_EINVAL;
+    }
+    int result = MDOS_EOK;
+    if (archive->pack && fclose(archive->pack) != 0) result = MDOS_EIO;
+    if (archive->index && fclose(archive->index) != 0) result = MDOS_EIO;
+    free(archive->entries);
+    free(archive->table);
+    free(archive->path);
+    free(archive);
+    return result;
+}
+
+/* Read a chunk into a new buffer, checking its length and CRC */
+static uint8_t* archive_read_chunk(mdos_archive_t *archive, uint64_t hash, uint32_t *length,
+                                   int *error) {
+    long e = archive_find(archive, hash);
+    if (e < 0) {
+        *error = MDOS_ENOENT;
+        return NULL;
+    }
+    const archive_entry_t *entry = &archive->entries[e];
+    uint8_t *data = malloc(entry->length ? entry->length : 1);
+    if (!data) {
+        *error = MDOS_ENOSPC;
+        return NULL;
+    }
+    if (fseeko(archive->pack, (off_t)entry->offset, SEEK_SET) != 0 ||
+        fread(data, 1, entry->length, archive->pack) != entry->length ||
+        mdos_crc32(data, entry->length) != entry->crc) {
+        free(data);
+        *error = MDOS_EIO;
+        return NULL;
+    }
+    *length = entry->length;
+    return data;
+}
+
+/* IMD skeletons */
+
+/* Linear image offset of a sector of an IMD track, or -1 if it has none */
+static long imd_sector_offset(const archive_plan_t *plan, const uint8_t *header, int sector) {
+    const mdos_geometry_t *g = &plan->geometry;
+    if (header[4] != g->size_code) {
+        return -1;
+    }
+    long offset = mdos_geometry_offset(g, header[1], header[2] & 1, sector);
+    return (offset >= 0 && offset + g->sector_size <= plan->length) ? offset : -1;
+}
+
+/*
+ * The IMD with the data of every normal sector the linear image holds
+ * identically left out. After the comment, each track record is tagged and
+ * each such sector's type byte gets a flag: 0 = take the data from the
+ * image, 1 = the data follows. Bytes that do not parse as tracks are kept
+ * raw, so any file round-trips.
+ */
+static int imd_skeleton(archive_plan_t *plan) {
+    const uint8_t *imd = plan->source;
+    long len = plan->source_length;
+    uint8_t *out = malloc(2 * len + 16);
+    if (!out) {
+        return MDOS_ENOSPC;
+    }
+    const uint8_t *comment_end = memchr(imd, IMD_COMMENT_END, len);
+    long pos = comment_end ? comment_end - imd + 1 : len;
+    uint8_t *o = out;
+    put_le32(o, (uint32_t)pos);
+    memcpy(o + 4, imd, pos);
+    o += 4 + pos;
+
+    while (pos < len) {
+        mdos_geometry_imd_record_t r;
+        if (mdos_geometry_imd_record(imd, len, pos, &r) <= 0) {
+            *o++ = SKELETON_RAW;
+            put_le32(o, (uint32_t)(len - pos));
+            memcpy(o + 4, imd + pos, len - pos);
+            o += 4 + len - pos;
+            break;
+        }
+
+        const uint8_t *header = imd + pos;
+        long size = 128L << r.size_code;
+        *o++ = SKELETON_TRACK;
+        memcpy(o, header, r.sectors - pos);
+        o += r.sectors - pos;
+
+        long p = r.sectors;
+        for (int s = 0; s < r.count; s++) {
+            int type = imd[p++];
+            long n = mdos_geometry_imd_data_length(type, size);
+            *o++ = type;
+            if (n == 0) {
+                continue;
+            }
+            if (n == 1) {
+                *o++ = imd[p++];        /* Fill byte of a compressed sector */
+                continue;
+            }
+            /* Unknown types are data too, as the walker sizes them, but never the image's */
+            long offset = (n > 0) ? imd_sector_offset(plan, header, r.map[s]) : -1;
+            if (offset >= 0 && memcmp(plan->image + offset, imd + p, size) == 0) {
+                *o++ = 0;
+            } else {
+                *o++ = 1;
+                memcpy(o, imd + p, size);
+                o += size;
+            }
+            p += size;
+        }
+        pos = r.next;
+    }
+
+    plan->skeleton = out;
+    plan->skeleton_length = o - out;
+    return MDOS_EOK;
+}
+
+/* Inverse of imd_skeleton into out, which must come out exactly out_len bytes */
+static int imd_rebuild(const archive_plan_t *plan, const uint8_t *skeleton, long skeleton_length,
+                       uint8_t *out, long out_len) {
+    const uint8_t *s = skeleton, *s_end = skeleton + skeleton_length;
+    uint8_t *o = out, *o_end = out + out_len;
+
+#define SKELETON_TAKE(n) \
+    do { if ((n) < 0 || s_end - s < (n) || o_end - o < (n)) return MDOS_EIO; \
+         memcpy(o, s, (n)); o += (n); s += (n); } while (0)
+
+    if (s_end - s < 4) {
+        return MDOS_EIO;
+    }
+    long comment = get_le32(s);
+    s += 4;
+    SKELETON_TAKE(comment);
+
+    while (s < s_end) {
+        int tag = *s++;
+        if (tag == SKELETON_RAW && s_end - s >= 4) {
+            long n = get_le32(s);
+            s += 4;
+            SKELETON_TAKE(n);
+            continue;
+        }
+        if (tag != SKELETON_TRACK || s_end - s < 5) {
+            return MDOS_EIO;
+        }
+        const uint8_t *header = o;
+        int count = s[3];
+        long size = 128L << (s[4] & 7);
+        SKELETON_TAKE(5 + (long)count * (1 + !!(s[2] & 0x80) + !!(s[2] & 0x40)));
+
+        for (int i = 0; i < count; i++) {
+            SKELETON_TAKE(1);
+            long n = mdos_geometry_imd_data_length(o[-1], size);
+            if (n == 0) {
+                continue;
+            }
+            if (n == 1) {
+                SKELETON_TAKE(1);
+                continue;
+            }
+            if (s == s_end) {
+                return MDOS_EIO;
+            }
+            if (*s++) {
+                SKELETON_TAKE(size);
+                continue;
+            }
+            long offset = imd_sector_offset(plan, header, header[5 + i]);
+            if (offset < 0 || o_end - o < size) {
+                return MDOS_EIO;
+            }
+            memcpy(o, plan->image + offset, size);
+            o += size;
+        }
+    }
+#undef SKELETON_TAKE
+
+    return (o == o_end) ? MDOS_EOK : MDOS_EIO;
+}
+
+/* Adding images */
+
+static const char* archive_base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void archive_plan_free(archive_plan_t *plan) {
+    free(plan->source);
+    free(plan->image);
+    free(plan->files);
+    free(plan->skeleton);
+    free(plan->chunks);
+    free(plan->recipe);
+}
+
+static int archive_read_source(archive_plan_t *plan) {
+    FILE *fp = fopen(plan->path, "rb");
+    if (!fp) {
+        return MDOS_ENOENT;
+    }
+    int result = MDOS_EIO;
+    if (fseeko(fp, 0, SEEK_END) == 0 && (plan->source_length = (long)ftello(fp)) >= 0 &&
+        fseeko(fp, 0, SEEK_SET) == 0) {
+        plan->source = malloc(plan->source_length ? plan->source_length : 1);
+        if (!plan->source) {
+            result = MDOS_ENOSPC;
+        } else if (fread(plan->source, 1, plan->source_length, fp) == (size_t)plan->source_length) {
+            result = MDOS_EOK;
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+/*
+ * Read an image's linear view through a read-only mount; everything after
+ * works on the copy.
+ */
+static int archive_load(archive_plan_t *plan) {
+    plan->format = mdos_is_imd(plan->path) ? FORMAT_IMD :
+                   mdos_is_mdz(plan->path) ? FORMAT_MDZ : FORMAT_DSK;
+    if (plan->format != FORMAT_DSK) {
+        int result = archive_read_source(plan);
+        if (result != MDOS_EOK) {
+            return result;
+        }
+    }
+
+    mdos_fs_t *fs = mdos_mount_image(plan->path, 1);
+    int result = fs ? mdos_image_geometry(fs, &plan->geometry) : MDOS_EIO;
+
+    /* Each mount's stream has state of its own, so reads run in parallel */
+    if (result == MDOS_EOK) {
+        result = MDOS_EIO;
+        if (fseek(fs->fp, 0, SEEK_END) == 0 && (plan->length = ftell(fs->fp)) >= 0) {
+            plan->image = malloc(plan->length ? plan->length : 1);
+            if (!plan->image) {
+                result = MDOS_ENOSPC;
+            } else if (mdos_sparse_read(fs->fp, plan->image, plan->length) >= 0) {
+                result = MDOS_EOK;
+            }
+        }
+    }
+    if (fs) {
+        mdos_unmount_image(fs);
+    }
+    if (result != MDOS_EOK) {
+        return result;
+    }
+
+    plan->crc = mdos_crc32(plan->image, plan->length);
+    if (plan->format == FORMAT_DSK) {
+        plan->source_length = plan->length;
+        plan->source_crc = plan->crc;
+    } else {
+        plan->source_crc = mdos_crc32(plan->source, plan->source_length);
+    }
+    return MDOS_EOK;
+}
+
+static void archive_add_chunk(archive_plan_t *plan, const uint8_t *data, uint32_t length) {
+    archive_chunk_t *chunk = &plan->chunks[plan->nchunks++];
+    chunk->hash = mdos_hash64(data, length);
+    chunk->crc = mdos_crc32(data, length);
+    chunk->length = length;
+    chunk->data = data;
+}
+
+/* Physical sectors as runs: "23-30,41" */
+static void archive_write_runs(FILE *out, const int *psns, int n) {
+    for (int i = 0; i < n; ) {
+        int j = i;
+        while (j + 1 < n && psns[j + 1] == psns[j] + 1) {
+            j++;
+        }
+        fprintf(out, "%s%d", i ? "," : "", psns[i]);
+        if (j > i) {
+            fprintf(out, "-%d", psns[j]);
+        }
+        i = j + 1;
+    }
+}
+
+/* Claim the data sectors of one directory entry for a file chunk */
+static int archive_plan_file(archive_plan_t *plan, const uint8_t *entry, uint8_t *claimed,
+                             int *psns, long *files_used, FILE *recipe) {
+    long nsectors = plan->length / MDOS_SECTOR_SIZE;
+    int rib_sector = (entry[10] << 8) | entry[11];
+    if (rib_sector <= 0 || rib_sector >= nsectors) {
+        return 0;
+    }
+    mdos_rib_t rib;
+    memcpy(&rib, plan->image + (long)rib_sector * MDOS_SECTOR_SIZE, sizeof(rib));
+    int sects = (rib.size_high << 8) | rib.size_low;
+    if (sects == 0) {
+        return 0;
+    }
+
+    /* A file whose sectors are out of range or shared stays loose sectors */
+    int n = 0;
+    for (; n < sects; n++) {
+        int psn = mdos_lsn_to_psn(&rib, n + 1);
+        if (psn <= 0 || psn >= nsectors || claimed[psn]) {
+            break;
+        }
+        claimed[psn] = 1;
+        psns[n] = psn;
+    }
+    if (n < sects) {
+        while (n > 0) {
+            claimed[psns[--n]] = 0;
+        }
+        return 0;
+    }
+
+    uint8_t *data = plan->files + *files_used;
+    for (int i = 0; i < sects; i++) {
+        memcpy(data + (long)i * MDOS_SECTOR_SIZE, plan->image + (long)psns[i] * MDOS_SECTOR_SIZE,
+               MDOS_SECTOR_SIZE);
+    }
+    *files_used += (long)sects * MDOS_SECTOR_SIZE;
+    archive_add_chunk(plan, data, (uint32_t)sects * MDOS_SECTOR_SIZE);
+
+    char name[MDOS_MAX_FILENAME];
+    mdos_meta_entry_name(entry, name);
+    fprintf(recipe, "file %016llx ", (unsigned long long)plan->chunks[plan->nchunks - 1].hash);
+    archive_write_runs(recipe, psns, sects);
+    fprintf(recipe, " %s\n", name);
+    plan->nfiles++;
+    return 1;
+}
+
+/* Split a loaded image into chunks and write its recipe */
+static int archive_plan(archive_plan_t *plan) {
+    static const uint8_t zeros[MDOS_SECTOR_SIZE];
+    long nsectors = (plan->length + MDOS_SECTOR_SIZE - 1) / MDOS_SECTOR_SIZE;
+    int result = MDOS_ENOSPC;
+
+    if (plan->format == FORMAT_IMD && (result = imd_skeleton(plan)) != MDOS_EOK) {
+        return result;
+    }
+    uint8_t *claimed = calloc(nsectors + 1, 1);
+    int *psns = malloc((nsectors + 1) * sizeof(int));
+    plan->files = malloc(plan->length + 1);
+    plan->chunks = malloc((nsectors + MDOS_DIR_ENTRIES + 1) * sizeof(archive_chunk_t));
+    FILE *recipe = open_memstream(&plan->recipe, &plan->recipe_length);
+    if (!claimed || !psns || !plan->files || !plan->chunks || !recipe) {
+        if (recipe) fclose(recipe);
+        free(claimed);
+        free(psns);
+        return MDOS_ENOSPC;
+    }
+
+    const mdos_geometry_t *g = &plan->geometry;
+    fprintf(recipe, "%s\n", ARCHIVE_MAGIC);
+    fprintf(recipe, "name %s\n", plan->name);
+    fprintf(recipe, "format %s\n", format_names[plan->format]);
+    fprintf(recipe, "source %ld %08x\n", plan->source_length, (unsigned)plan->source_crc);
+    fprintf(recipe, "length %ld %08x\n", plan->length, (unsigned)plan->crc);
+    fprintf(recipe, "geometry %d %d %d %d %d\n", g->cylinders, g->heads, g->sectors,
+            g->size_code, g->first_sector);
+    if (plan->skeleton) {
+        archive_add_chunk(plan, plan->skeleton, (uint32_t)plan->skeleton_length);
+        fprintf(recipe, "skeleton %016llx\n", (unsigned long long)plan->chunks[0].hash);
+    }
+
+    /* Whole files first, so an edited file leaves the others shared */
+    long files_used = 0;
+    if (plan->length >= (long)(MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS) * MDOS_SECTOR_SIZE) {
+        mdos_meta_t meta;
+        memcpy(meta.cat, plan->image + MDOS_CAT_SECTOR * MDOS_SECTOR_SIZE, MDOS_SECTOR_SIZE);
+        memcpy(meta.dir, plan->image + MDOS_DIR_FIRST_SECTOR * MDOS_SECTOR_SIZE, sizeof(meta.dir));
+        for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+            uint8_t *entry = mdos_meta_entry(&meta, slot);
+            if (entry[0] != 0x00 && entry[0] != 0xFF) {
+                archive_plan_file(plan, entry, claimed, psns, &files_used, recipe);
+            }
+        }
+    }
+
+    for (long s = 0; s < nsectors; s++) {
+        long offset = s * MDOS_SECTOR_SIZE;
+        long n = plan->length - offset < MDOS_SECTOR_SIZE ? plan->length - offset : MDOS_SECTOR_SIZE;
+        if (claimed[s] || memcmp(plan->image + offset, zeros, n) == 0) {
+            continue;
+        }
+        archive_add_chunk(plan, plan->image + offset, (uint32_t)n);
+        fprintf(recipe, "sector %016llx %ld\n",
+                (unsigned long long)plan->chunks[plan->nchunks - 1].hash, s);
+    }
+
+    free(claimed);
+    free(psns);
+    return fclose(recipe) == 0 ? MDOS_EOK : MDOS_ENOSPC;
+}
+
+static int archive_write_recipe(mdos_archive_t *archive, const archive_plan_t *plan) {
+    char *path = archive_file_path(archive, ARCHIVE_IMAGES, plan->name, ARCHIVE_SUFFIX);
+    char *temp = archive_file_path(archive, ARCHIVE_IMAGES, plan->name, ARCHIVE_SUFFIX ".tmp");
+    int result = MDOS_ENOSPC;
+    if (path && temp) {
+        FILE *fp = fopen(temp, "wb");
+        result = MDOS_EIO;
+        if (fp) {
+            int ok = fwrite(plan->recipe, 1, plan->recipe_length, fp) == plan->recipe_length;
+            if (fclose(fp) == 0 && ok && rename(temp, path) == 0) {
+                result = MDOS_EOK;
+            } else {
+                remove(temp);
+            }
+        }
+    }
+    free(path);
+    free(temp);
+    return result;
+}
+
+/*
+ * Append the plan's new chunks to the pack, then their entries to the
+ * index, then the recipe. A crash in between leaves chunks that the next
+ * open trims or that no recipe references yet, never a recipe pointing at
+ * missing data.
+ */
+static int archive_commit(mdos_archive_t *archive, const archive_plan_t *plan,
+                          mdos_archive_stats_t *stats) {
+    if (archive->failed) {
+        return MDOS_EIO;
+    }
+    long first = archive->count;
+    long long appended = 0;
+
+    for (int i = 0; i < plan->nchunks; i++) {
+        const archive_chunk_t *chunk = &plan->chunks[i];
+        long e = archive_find(archive, chunk->hash);
+        if (e >= 0) {
+            if (archive->entries[e].length != chunk->length || archive->entries[e].crc != chunk->crc) {
+                archive->failed = 1;    /* 64-bit hash collision: refuse to alias */
+                return MDOS_EIO;
+            }
+            continue;
+        }
+        if (archive_reserve(archive) != MDOS_EOK) {
+            archive->failed = 1;
+            return MDOS_ENOSPC;
+        }
+        archive_entry_t *entry = &archive->entries[archive->count];
+        entry->hash = chunk->hash;
+        entry->offset = archive->pack_end;
+        entry->length = chunk->length;
+        entry->crc = chunk->crc;
+        if (fseeko(archive->pack, (off_t)entry->offset, SEEK_SET) != 0 ||
+            fwrite(chunk->data, 1, chunk->length, archive->pack) != chunk->length) {
+            archive->failed = 1;
+            return MDOS_EIO;
+        }
+        archive->pack_end += chunk->length;
+        appended += chunk->length;
+        archive_table_insert(archive, archive->count++);
+    }
+    if (fflush(archive->pack) != 0 ||
+        fseeko(archive->index, (off_t)first * ARCHIVE_ENTRY_SIZE, SEEK_SET) != 0) {
+        archive->failed = 1;
+        return MDOS_EIO;
+    }
+    for (long e = first; e < archive->count; e++) {
+        uint8_t record[ARCHIVE_ENTRY_SIZE];
+        put_le64(record, archive->entries[e].hash);
+        put_le64(record + 8, archive->entries[e].offset);
+        put_le32(record + 16, archive->entries[e].length);
+        put_le32(record + 20, archive->entries[e].crc);
+        if (fwrite(record, 1, sizeof(record), archive->index) != sizeof(record)) {
+            archive->failed = 1;
+            return MDOS_EIO;
+        }
+    }
+    if (fflush(archive->index) != 0) {
+        archive->failed = 1;
+        return MDOS_EIO;
+    }
+
+    int result = archive_write_recipe(archive, plan);
+    if (result == MDOS_EOK && stats) {
+        stats->images++;
+        stats->chunks += plan->nchunks;
+        stats->chunks_new += archive->count - first;
+        stats->bytes += plan->source_length;
+        stats->bytes_new += appended;
+    }
+    return result;
+}
+
+typedef struct {
+    mdos_archive_t *archive;
+    char *const *images;
+    int count;
+    int next;               /* Next image to take */
+    int result;             /* First error */
+    mdos_archive_stats_t *stats;
+    FILE *log;
+    pthread_mutex_t store_lock; /* Everything above, the store and the log */
+} archive_add_job_t;
+
+static void* archive_add_worker(void *arg) {
+    archive_add_job_t *job = arg;
+    for (;;) {
+        pthread_mutex_lock(&job->store_lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->store_lock);
+        if (i >= job->count) {
+            return NULL;
+        }
+
+        archive_plan_t plan;
+        memset(&plan, 0, sizeof(plan));
+        plan.path = job->images[i];
+        plan.name = archive_base_name(plan.path);
+        mdos_trace_span_t span = mdos_trace_begin("archive load", plan.name);
+        int result = archive_load(&plan);
+        mdos_trace_end(&span);
+        if (result == MDOS_EOK) {
+            span = mdos_trace_begin("archive plan", plan.name);
+            result = archive_plan(&plan);
+            mdos_trace_end(&span);
+        }
+
+        span = mdos_trace_begin("store lock wait", plan.name);
+        pthread_mutex_lock(&job->store_lock);
+        mdos_trace_end(&span);
+        if (result == MDOS_EOK) {
+            long before = job->archive->count;
+            span = mdos_trace_begin("archive commit", plan.name);
+            result = archive_commit(job->archive, &plan, job->stats);
+            mdos_trace_end(&span);
+            if (result == MDOS_EOK && job->log) {
+                fprintf(job->log, "%s: %s, %d files, %d chunks (%ld new)\n", plan.name,
+                        format_names[plan.format], plan.nfiles, plan.nchunks,
+                        job->archive->count - before);
+            }
+        }
+        if (result != MDOS_EOK) {
+            if (job->log) {
+                fprintf(job->log, "%s: %s\n", plan.path, mdos_strerror(result));
+            }
+            if (job->result == MDOS_EOK) {
+                job->result = result;
+            }
+        }
+        pthread_mutex_unlock(&job->store_lock);
+        archive_plan_free(&plan);
+    }
+}
+
+int mdos_archive_add(mdos_archive_t *archive, char *const images[], int count, int jobs,
+                     mdos_archive_stats_t *stats, FILE *log) {
+    if (!archive || (!images && count > 0) || count < 0 || jobs < 0) {
+        return MDOS_EINVAL;
+    }
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+    if (jobs > count) jobs = count;
+    if (jobs > ARCHIVE_MAX_JOBS) jobs = ARCHIVE_MAX_JOBS;
+
+    archive_add_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.archive = archive;
+    job.images = images;
+    job.count = count;
+    job.stats = stats;
+    job.log = log;
+    pthread_mutex_init(&job.store_lock, NULL);
+
+    pthread_t threads[ARCHIVE_MAX_JOBS];
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, archive_add_worker, &job) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        archive_add_worker(&job);
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&job.store_lock);
+    return job.result;
+}
+
+/* Rebuilding */
+
+static int archive_read_recipe(mdos_archive_t *archive, const char *name, FILE **fp) {
+    if (!name || !*name || strchr(name, '/')) {
+        return MDOS_EINVAL;
+    }
+    char *path = archive_file_path(archive, ARCHIVE_IMAGES, name, ARCHIVE_SUFFIX);
+    if (!path) {
+        return MDOS_ENOSPC;
+    }
+    *fp = fopen(path, "r");
+    free(path);
+    if (!*fp) {
+        return MDOS_ENOENT;
+    }
+
+    char line[64];
+    if (!fgets(line, sizeof(line), *fp) || strncmp(line, ARCHIVE_MAGIC, strlen(ARCHIVE_MAGIC)) != 0) {
+        fclose(*fp);
+        return MDOS_EIO;
+    }
+    return MDOS_EOK;
+}
+
+/* Copy a file chunk to the sectors its run list names */
+static int archive_scatter(uint8_t *image, long length, const uint8_t *data, uint32_t data_length,
+                           const char *runs) {
+    long used = 0;
+    const char *p = runs;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p) {
+            return MDOS_EIO;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long s = first; s <= last; s++) {
+            if (s < 0 || (s + 1) * MDOS_SECTOR_SIZE > length ||
+                used + MDOS_SECTOR_SIZE > (long)data_length) {
+                return MDOS_EIO;
+            }
+            memcpy(image + s * MDOS_SECTOR_SIZE, data + used, MDOS_SECTOR_SIZE);
+            used += MDOS_SECTOR_SIZE;
+        }
+        p = (*end == ',') ? end + 1 : end;
+        if (*end && *end != ',') {
+            return MDOS_EIO;
+        }
+    }
+    return used == (long)data_length ? MDOS_EOK : MDOS_EIO;
+}
+
+static int archive_has_suffix(const char *path, const char *suffix) {
+    size_t n = strlen(path), m = strlen(suffix);
+    return n >= m && strcasecmp(path + n - m, suffix) == 0;
+}
+
+int mdos_archive_get(mdos_archive_t *archive, const char *name, const char *out_path) {
+    if (!archive || !out_path) {
+        return MDOS_EINVAL;
+    }
+    FILE *recipe;
+    int result = archive_read_recipe(archive, name, &recipe);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+
+    archive_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    unsigned long long hash, skeleton_hash = 0;
+    int have_skeleton = 0;
+    unsigned crc = 0, source_crc = 0;
+    char line[4096], runs[4096], format[16];
+
+    while (result == MDOS_EOK && fgets(line, sizeof(line), recipe)) {
+        mdos_geometry_t *g = &plan.geometry;
+        long sector = 0;
+        if (sscanf(line, "format %15s", format) == 1) {
+            plan.format = strcmp(format, "imd") == 0 ? FORMAT_IMD : FORMAT_DSK;
+        } else if (sscanf(line, "source %ld %x", &plan.source_length, &source_crc) == 2) {
+            continue;
+        } else if (sscanf(line, "length %ld %x", &plan.length, &crc) == 2) {
+            plan.image = calloc(plan.length > 0 ? plan.length : 1, 1);
+            if (!plan.image) result = MDOS_ENOSPC;
+        } else if (sscanf(line, "geometry %d %d %d %d %d", &g->cylinders, &g->heads, &g->sectors,
+                          &g->size_code, &g->first_sector) == 5) {
+            g->sector_size = MDOS_SECTOR_SIZE << g->size_code;
+        } else if (sscanf(line, "skeleton %llx", &skeleton_hash) == 1) {
+            have_skeleton = 1;
+        } else if (sscanf(line, "file %llx %4095s", &hash, runs) == 2 ||
+                   sscanf(line, "sector %llx %ld", &hash, &sector) == 2) {
+            uint32_t n;
+            uint8_t *data = plan.image ? archive_read_chunk(archive, hash, &n, &result) : NULL;
+            if (!data) {
+                if (result == MDOS_EOK) result = MDOS_EIO;
+                break;
+            }
+            if (line[0] == 'f') {
+                result = archive_scatter(plan.image, plan.length, data, n, runs);
+            } else if (sector < 0 || sector * MDOS_SECTOR_SIZE + (long)n > plan.length) {
+                result = MDOS_EIO;
+            } else {
+                memcpy(plan.image + sector * MDOS_SECTOR_SIZE, data, n);
+            }
+            free(data);
+        }
+    }
+    fclose(recipe);
+    if (result == MDOS_EOK && (!plan.image || mdos_crc32(plan.image, plan.length) != crc)) {
+        result = MDOS_EIO;
+    }
+
+    /* Only an image added from an IMD can be given back as one */
+    int as_imd = archive_has_suffix(out_path, ".imd");
+    if (result == MDOS_EOK && as_imd && (plan.format != FORMAT_IMD || !have_skeleton)) {
+        result = MDOS_EINVAL;
+    }
+    if (result == MDOS_EOK && as_imd) {
+        uint32_t n;
+        uint8_t *skeleton = archive_read_chunk(archive, skeleton_hash, &n, &result);
+        plan.source = skeleton ? malloc(plan.source_length > 0 ? plan.source_length : 1) : NULL;
+        if (skeleton && !plan.source) {
+            result = MDOS_ENOSPC;
+        } else if (skeleton) {
+            result = imd_rebuild(&plan, skeleton, n, plan.source, plan.source_length);
+            if (result == MDOS_EOK && mdos_crc32(plan.source, plan.source_length) != source_crc) {
+                result = MDOS_EIO;
+            }
+        }
+        free(skeleton);
+    }
+
+    if (result == MDOS_EOK) {
+        FILE *fp = fopen(out_path, "wb");
+        if (!fp) {
+            result = MDOS_EIO;
+        } else {
+            if (as_imd) {
+                if (fwrite(plan.source, 1, plan.source_length, fp) != (size_t)plan.source_length) {
+                    result = MDOS_EIO;
+                }
+            } else if (mdos_sparse_write(fp, plan.image, plan.length, 0) < 0) {
+                result = MDOS_EIO;
+            }
+            if (fclose(fp) != 0) {
+                result = MDOS_EIO;
+            }
+            if (result != MDOS_EOK) {
+                remove(out_path);
+            }
+        }
+    }
+
+    archive_plan_free(&plan);
+    return result;
+}
+
+static int archive_recipe_filter(const struct dirent *entry) {
+    return archive_has_suffix(entry->d_name, ARCHIVE_SUFFIX);
+}
+
+int mdos_archive_list(mdos_archive_t *archive, FILE *out) {
+    if (!archive || !out) {
+        return MDOS_EINVAL;
+    }
+    char *images = archive_file_path(archive, NULL, ARCHIVE_IMAGES, NULL);
+    if (!images) {
+        return MDOS_ENOSPC;
+    }
+    struct dirent **names;
+    int n = scandir(images, &names, archive_recipe_filter, alphasort);
+    free(images);
+    if (n < 0) {
+        return MDOS_EIO;
+    }
+
+    long long total = 0, recipe_bytes = 0;
+    fprintf(out, "%-24s %-6s %10s %6s %8s\n", "Image", "Format", "Bytes", "Files", "Sectors");
+    for (int i = 0; i < n; i++) {
+        char name[256];
+        snprintf(name, sizeof(name), "%.*s", (int)(strlen(names[i]->d_name) - strlen(ARCHIVE_SUFFIX)),
+                 names[i]->d_name);
+        free(names[i]);
+
+        FILE *recipe;
+        if (archive_read_recipe(archive, name, &recipe) != MDOS_EOK) {
+            continue;
+        }
+        char line[4096], format[16] = "?";
+        long source = 0, files = 0, sectors = 0;
+        while (fgets(line, sizeof(line), recipe)) {
+            unsigned crc;
+            if (strncmp(line, "file ", 5) == 0) files++;
+            else if (strncmp(line, "sector ", 7) == 0) sectors++;
+            else if (sscanf(line, "format %15s", format) == 1) continue;
+            else sscanf(line, "source %ld %x", &source, &crc);
+        }
+        recipe_bytes += ftell(recipe);
+        fclose(recipe);
+        total += source;
+        fprintf(out, "%-24s %-6s %10ld %6ld %8ld\n", name, format, source, files, sectors);
+    }
+    free(names);
+
+    long long stored = (long long)archive->pack_end + (long long)archive->count * ARCHIVE_ENTRY_SIZE +
+                       recipe_bytes;
+    fprintf(out, "\n%d images, %lld bytes; %ld chunks, %lld bytes stored", n, total,
+            archive->count, stored);
+    if (stored > 0) {
+        fprintf(out, " (%.1fx)", (double)total / stored);
+    }
+    fprintf(out, "\n");
+    return MDOS_EOK;
+}
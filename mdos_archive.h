@@ -0,0 +1,76 @@
+/*
+ * MDOS Filesystem Library - Deduplicating Image Archive
+ * Copyright (C) 2025
+ *
+ * A content-addressed store for many similar disk images: every MDOS file
+ * and every loose sector is kept once, and each image is a recipe of
+ * references that rebuilds it byte for byte
+ */
+
+#ifndef MDOS_ARCHIVE_H
+#define MDOS_ARCHIVE_H
+
+#include <stdio.h>
+#include "mdos_fs.h"
+
+/*
+ * Store layout (a directory):
+ *
+ *   chunks.pack              chunk contents, appended one after another
+ *   chunks.idx               24 bytes per chunk, in pack order: FNV-1a hash,
+ *                            pack offset (64), length, CRC-32 (little endian)
+ *   images/<name>.recipe     one text recipe per image
+ *
+ * A chunk is either the data sectors of one MDOS file, concatenated in
+ * logical order, or one sector that no file claims (the system area, RIBs,
+ * leftovers of deleted files). All-zero sectors are not stored at all. For
+ * an IMD, the file minus the sector data the linear image already holds is
+ * kept as one more chunk, the skeleton, so the IMD comes back exactly as it
+ * was, sector order, maps and compressed sectors included.
+ *
+ * Chunks are keyed by their 64-bit hash; the CRC-32 and length recorded
+ * with each one are checked on every reuse and every read, so a hash
+ * collision or a damaged pack is reported rather than rebuilt wrongly.
+ */
+
+typedef struct mdos_archive mdos_archive_t;
+
+/* Totals of one mdos_archive_add call */
+typedef struct {
+    int images;             /* Images stored */
+    long chunks;            /* Chunk references in their recipes */
+    long chunks_new;        /* Chunks appended to the pack */
+    long long bytes;        /* Size of the source files */
+    long long bytes_new;    /* Bytes appended to the pack */
+} mdos_archive_stats_t;
+
+/*
+ * Open a store; with create, the directory is made if missing. A pack
+ * left longer than its index by an interrupted add is trimmed back.
+ * Returns NULL on error.
+ */
+mdos_archive_t* mdos_archive_open(const char *store_path, int create);
+int mdos_archive_close(mdos_archive_t *archive);
+
+/*
+ * Add DSK, IMD or MDZ images under their base names, replacing recipes of
+ * the same name. Images are read and hashed on up to jobs threads (0: one
+ * per CPU); chunks are appended under a lock as each image finishes. An
+ * image that fails is reported on log and skipped. Returns MDOS_EOK or the
+ * first error.
+ */
+int mdos_archive_add(mdos_archive_t *archive, char *const images[], int count, int jobs,
+                     mdos_archive_stats_t *stats, FILE *log);
+
+/*
+ * Rebuild an image. An out_path ending in .imd gets the IMD the image was
+ * added from (only possible for IMD sources); anything else gets the
+ * linear image as a sparse DSK. The result is checked against the CRC-32
+ * taken when the image was added; a mismatch returns MDOS_EIO.
+ */
+int mdos_archive_get(mdos_archive_t *archive, const char *name, const char *out_path);
+
+/* Print the stored images and the space the store saves */
+int mdos_archive_list(mdos_archive_t *archive, FILE *out);
+
+#endif /* MDOS_ARCHIVE_H */
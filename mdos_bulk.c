@@ -0,0 +1,509 @@
+/*
+ * MDOS Filesystem Library - Bulk Operations
+ * Copyright (C) 2025
+ *
+ * Multi-file import and delete that plan everything against an in-memory
+ * copy of the CAT and directory, then write each metadata sector once
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "mdos_internal.h"
+#include "mdos_bulk.h"
+
+/* Metadata helpers */
+
+void mdos_meta_load(mdos_fs_t *fs, mdos_meta_t *meta) {
+    memset(meta, 0, sizeof(*meta));
+    mdos_getsect(fs, meta->cat, MDOS_CAT_SECTOR);
+    for (int i = 0; i < MDOS_DIR_SECTORS; i++) {
+        mdos_getsect(fs, meta->dir[i], MDOS_DIR_FIRST_SECTOR + i);
+    }
+}
+
+/* Write back modified metadata sectors; returns the number written */
+int mdos_meta_commit(mdos_fs_t *fs, mdos_meta_t *meta) {
+    int written = 0;
+
+    for (int i = 0; i < MDOS_DIR_SECTORS; i++) {
+        if (meta->dir_dirty[i]) {
+            mdos_putsect(fs, meta->dir[i], MDOS_DIR_FIRST_SECTOR + i);
+            meta->dir_dirty[i] = 0;
+            written++;
+        }
+    }
+    if (meta->cat_dirty) {
+        mdos_putsect(fs, meta->cat, MDOS_CAT_SECTOR);
+        meta->cat_dirty = 0;
+        written++;
+    }
+    return written;
+}
+
+uint8_t* mdos_meta_entry(mdos_meta_t *meta, int slot) {
+    int per_sector = MDOS_SECTOR_SIZE / MDOS_DIR_ENTRY_SIZE;
+    return meta->dir[slot / per_sector] + (slot % per_sector) * MDOS_DIR_ENTRY_SIZE;
+}
+
+/* Build the lowercase "name.ext" form used by mdos_readdir */
+void mdos_meta_entry_name(const uint8_t *entry, char *name) {
+    int len = 0;
+    for (int i = 0; i < 8 && entry[i] != ' '; i++) {
+        name[len++] = tolower(entry[i]);
+    }
+    if (entry[8] != ' ') {
+        name[len++] = '.';
+        name[len++] = tolower(entry[8]);
+        if (entry[9] != ' ') {
+            name[len++] = tolower(entry[9]);
+        }
+    }
+    name[len] = '\0';
+}
+
+/* Returns the RIB sector of filename, or MDOS_ENOENT */
+int mdos_meta_find(mdos_meta_t *meta, const char *filename, int *slot) {
+    char name[MDOS_MAX_FILENAME];
+
+    for (int i = 0; i < MDOS_DIR_ENTRIES; i++) {
+        uint8_t *entry = mdos_meta_entry(meta, i);
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            continue;
+        }
+
+        mdos_meta_entry_name(entry, name);
+        if (strcasecmp(name, filename) == 0) {
+            if (slot) *slot = i;
+            return (entry[10] << 8) | entry[11];
+        }
+    }
+
+    return MDOS_ENOENT;
+}
+
+/* Same entry layout and slot choice as mdos_write_directory_entry */
+int mdos_meta_add_entry(mdos_meta_t *meta, const char *filename, int rib_sector, int file_type) {
+    uint8_t new_entry[MDOS_DIR_ENTRY_SIZE];
+    const char *dot = strchr(filename, '.');
+    size_t name_len = dot ? (size_t)(dot - filename) : strlen(filename);
+
+    if (name_len > 8) name_len = 8;
+
+    memset(new_entry, 0, sizeof(new_entry));
+    memset(new_entry, ' ', 10);
+    for (size_t i = 0; i < name_len; i++) {
+        new_entry[i] = toupper((unsigned char)filename[i]);
+    }
+    if (dot) {
+        for (int i = 0; i < 2 && dot[1 + i]; i++) {
+            new_entry[8 + i] = toupper((unsigned char)dot[1 + i]);
+        }
+    }
+    new_entry[10] = (rib_sector >> 8) & 0xFF;
+    new_entry[11] = rib_sector & 0xFF;
+    new_entry[12] = file_type;
+
+    for (int i = 0; i < MDOS_DIR_ENTRIES; i++) {
+        uint8_t *entry = mdos_meta_entry(meta, i);
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            memcpy(entry, new_entry, MDOS_DIR_ENTRY_SIZE);
+            meta->dir_dirty[i / (MDOS_SECTOR_SIZE / MDOS_DIR_ENTRY_SIZE)] = 1;
+            return i;
+        }
+    }
+
+    return MDOS_ENOSPC;
+}
+
+void mdos_meta_delete_entry(mdos_meta_t *meta, int slot) {
+    uint8_t *entry = mdos_meta_entry(meta, slot);
+    entry[0] = 0xFF;
+    entry[1] = 0xFF;
+    meta->dir_dirty[slot / (MDOS_SECTOR_SIZE / MDOS_DIR_ENTRY_SIZE)] = 1;
+}
+
+/* Clear the CAT bits of every cluster described by the RIB's SDWs */
+void mdos_cat_release(uint8_t *cat, const mdos_rib_t *rib) {
+    for (int x = 0; x < 114; x += 2) {
+        int sdw = (rib->sdw[x] << 8) | rib->sdw[x + 1];
+
+        if (sdw & 0x8000) {
+            break; /* End marker */
+        }
+
+        int cluster = sdw & 0x3FF;
+        int count = ((sdw >> 10) & 0x1F) + 1;
+        for (int c = cluster; c < cluster + count && c < MDOS_CAT_CLUSTERS; c++) {
+            cat[c >> 3] &= ~(1 << (7 - (c & 7)));
+        }
+    }
+}
+
+/* Read the raw contents of the file whose RIB is at rib_sector */
+int mdos_read_contents(mdos_fs_t *fs, int rib_sector, mdos_rib_t *rib,
+                       uint8_t **data, size_t *size) {
+    mdos_getsect(fs, (uint8_t *)rib, rib_sector);
+
+    int sects = (rib->size_high << 8) | rib->size_low;
+    int last = rib->last_size;
+    if (last == 0 || last > MDOS_SECTOR_SIZE) last = MDOS_SECTOR_SIZE;
+
+    *size = sects ? (size_t)(sects - 1) * MDOS_SECTOR_SIZE + last : 0;
+    *data = malloc(sects ? sects * MDOS_SECTOR_SIZE : 1);
+    if (!*data) {
+        return MDOS_ENOSPC;
+    }
+
+    for (int lsn = 1; lsn <= sects; lsn++) {
+        int psn = mdos_lsn_to_psn(rib, lsn);
+        if (psn < 0) {
+            free(*data);
+            *data = NULL;
+            return MDOS_EIO;
+        }
+        mdos_getsect(fs, *data + (lsn - 1) * MDOS_SECTOR_SIZE, psn);
+    }
+
+    return MDOS_EOK;
+}
+
+/* Bulk import */
+
+/* One sector write of the import plan */
+typedef struct {
+    int psn;        /* Physical sector */
+    int file;       /* Index into files[] */
+    int lsn;        /* 0 = RIB, 1.. = data */
+} bulk_write_t;
+
+static const mdos_bulk_file_t *sort_files;
+
+static int compare_size_desc(const void *a, const void *b) {
+    size_t sa = sort_files[*(const int *)a].size;
+    size_t sb = sort_files[*(const int *)b].size;
+    return (sa < sb) - (sa > sb);
+}
+
+static int compare_psn(const void *a, const void *b) {
+    return ((const bulk_write_t *)a)->psn - ((const bulk_write_t *)b)->psn;
+}
+
+/*
+ * Plan and write files against an already loaded meta, leaving the CAT and
+ * directory changes in meta for the caller to commit. Returns the number of
+ * sectors written, or an error with nothing written and meta undefined.
+ */
+int mdos_bulk_import_meta(mdos_fs_t *fs, mdos_meta_t *meta, mdos_bulk_file_t *files, int count) {
+    if (count == 0) {
+        return 0;
+    }
+
+    mdos_rib_t *ribs = calloc(count, sizeof(mdos_rib_t));
+    int *order = malloc(count * sizeof(int));
+    bulk_write_t *writes = NULL;
+    int result = MDOS_EOK;
+
+    if (!ribs || !order) {
+        result = MDOS_ENOSPC;
+        goto out;
+    }
+
+    /* Validate names, and release files that are going to be replaced */
+    for (int i = 0; i < count; i++) {
+        if (mdos_validate_filename(files[i].name) != MDOS_EOK) {
+            result = MDOS_EINVAL;
+            goto out;
+        }
+        for (int j = 0; j < i; j++) {
+            if (strcasecmp(files[i].name, files[j].name) == 0) {
+                result = MDOS_EEXIST;
+                goto out;
+            }
+        }
+
+        int slot;
+        int old_rib = mdos_meta_find(meta, files[i].name, &slot);
+        if (old_rib >= 0) {
+            mdos_rib_t rib;
+            mdos_getsect(fs, (uint8_t *)&rib, old_rib);
+            mdos_cat_release(meta->cat, &rib);
+            mdos_meta_delete_entry(meta, slot);
+        }
+        order[i] = i;
+    }
+
+    /* Plan allocations, largest first to keep big files contiguous */
+    sort_files = files;
+    qsort(order, count, sizeof(int), compare_size_desc);
+
+    int total_writes = 0;
+    for (int k = 0; k < count; k++) {
+        mdos_bulk_file_t *f = &files[order[k]];
+        mdos_rib_t *rib = &ribs[order[k]];
+        int sects = (f->size + MDOS_SECTOR_SIZE - 1) / MDOS_SECTOR_SIZE;
+
+        result = mdos_alloc_space(fs, meta->cat, rib, sects + 1);
+        if (result != MDOS_EOK) {
+            goto out;
+        }
+
+        int last = f->size % MDOS_SECTOR_SIZE;
+        rib->last_size = last ? last : MDOS_SECTOR_SIZE;
+        rib->size_high = (sects >> 8) & 0xFF;
+        rib->size_low = sects & 0xFF;
+        rib->addr_high = f->load_addr >> 8;
+        rib->addr_low = f->load_addr & 0xFF;
+        rib->pc_high = f->start_addr >> 8;
+        rib->pc_low = f->start_addr & 0xFF;
+
+        f->rib_sector = mdos_lsn_to_psn(rib, 0);
+        if (mdos_meta_add_entry(meta, f->name, f->rib_sector, f->type) < 0) {
+            result = MDOS_ENOSPC;
+            goto out;
+        }
+        total_writes += sects + 1;
+    }
+    meta->cat_dirty = 1;
+
+    /* Nothing has been written yet; now lay the data down in disk order */
+    writes = malloc(total_writes * sizeof(bulk_write_t));
+    if (!writes) {
+        result = MDOS_ENOSPC;
+        goto out;
+    }
+
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        int sects = (files[i].size + MDOS_SECTOR_SIZE - 1) / MDOS_SECTOR_SIZE;
+        for (int lsn = 0; lsn <= sects; lsn++) {
+            writes[n].psn = mdos_lsn_to_psn(&ribs[i], lsn);
+            writes[n].file = i;
+            writes[n].lsn = lsn;
+            n++;
+        }
+    }
+    qsort(writes, n, sizeof(bulk_write_t), compare_psn);
+
+    uint8_t buffer[MDOS_SECTOR_SIZE];
+    for (int w = 0; w < n; w++) {
+        mdos_bulk_file_t *f = &files[writes[w].file];
+
+        if (writes[w].lsn == 0) {
+            mdos_putsect(fs, (uint8_t *)&ribs[writes[w].file], writes[w].psn);
+            continue;
+        }
+
+        size_t offset = (size_t)(writes[w].lsn - 1) * MDOS_SECTOR_SIZE;
+        size_t chunk = f->size - offset;
+        if (chunk > MDOS_SECTOR_SIZE) chunk = MDOS_SECTOR_SIZE;
+
+        memset(buffer, 0, sizeof(buffer));
+        memcpy(buffer, f->data + offset, chunk);
+        mdos_putsect(fs, buffer, writes[w].psn);
+    }
+    result = n;
+
+out:
+    free(writes);
+    free(order);
+    free(ribs);
+    return result;
+}
+
+int mdos_bulk_import(mdos_fs_t *fs, mdos_bulk_file_t *files, int count) {
+    if (!fs || (!files && count > 0) || count < 0) {
+        return MDOS_EINVAL;
+    }
+    if (count == 0) {
+        return MDOS_EOK;
+    }
+
+    mdos_meta_t *meta = malloc(sizeof(mdos_meta_t));
+    if (!meta) {
+        return MDOS_ENOSPC;
+    }
+
+    mdos_meta_load(fs, meta);
+    int result = mdos_bulk_import_meta(fs, meta, files, count);
+    if (result >= 0) {
+        mdos_meta_commit(fs, meta);
+        result = MDOS_EOK;
+    }
+
+    free(meta);
+    return result;
+}
+
+int mdos_bulk_unlink(mdos_fs_t *fs, const char **filenames, int count) {
+    if (!fs || (!filenames && count > 0) || count < 0) {
+        return MDOS_EINVAL;
+    }
+
+    mdos_meta_t *meta = malloc(sizeof(mdos_meta_t));
+    if (!meta) {
+        return MDOS_ENOSPC;
+    }
+
+    mdos_meta_load(fs, meta);
+
+    for (int i = 0; i < count; i++) {
+        int slot;
+        int rib_sector = mdos_meta_find(meta, filenames[i], &slot);
+        if (rib_sector < 0) {
+            free(meta);
+            return MDOS_ENOENT; /* Nothing written */
+        }
+
+        mdos_rib_t rib;
+        mdos_getsect(fs, (uint8_t *)&rib, rib_sector);
+        mdos_cat_release(meta->cat, &rib);
+        mdos_meta_delete_entry(meta, slot);
+    }
+
+    if (count > 0) {
+        meta->cat_dirty = 1;
+        mdos_meta_commit(fs, meta);
+    }
+
+    free(meta);
+    return MDOS_EOK;
+}
+
+/* Loading local files */
+
+/*
+ * Fallback for local names mdos_extract_filename rejects (long stems, three
+ * letter extensions such as .asm): keep the first 8 and 2 usable characters.
+ */
+static int bulk_derive_name(const char *local_name, char *mdos_name) {
+    const char *base = strrchr(local_name, '/');
+    base = base ? base + 1 : local_name;
+    const char *dot = strrchr(base, '.');
+
+    int len = 0;
+    for (const char *p = base; *p && p != dot && len < 8; p++) {
+        if (isalnum((unsigned char)*p)) mdos_name[len++] = tolower((unsigned char)*p);
+    }
+    if (dot) {
+        int ext_len = 0;
+        for (const char *p = dot + 1; *p && ext_len < 2; p++) {
+            if (isalnum((unsigned char)*p)) {
+                if (ext_len == 0) mdos_name[len++] = '.';
+                mdos_name[len++] = tolower((unsigned char)*p);
+                ext_len++;
+            }
+        }
+    }
+    mdos_name[len] = '\0';
+
+    return mdos_validate_filename(mdos_name);
+}
+
+/* MDOS name for a local file: the explicit name, or one derived from the path */
+int mdos_bulk_name(const char *local_name, const char *mdos_name, char *name) {
+    if (mdos_name) {
+        strncpy(name, mdos_name, MDOS_MAX_FILENAME - 1);
+        name[MDOS_MAX_FILENAME - 1] = '\0';
+        return MDOS_EOK;
+    }
+    if (mdos_extract_filename(local_name, name) == MDOS_EOK) {
+        return MDOS_EOK;
+    }
+    return bulk_derive_name(local_name, name);
+}
+
+/* MDOS type a local file is imported as: binaries by extension, else ASCII */
+int mdos_bulk_host_type(const char *local_name) {
+    const char *ext = strrchr(local_name, '.');
+    if (ext && (strcasecmp(ext, ".bin") == 0 || strcasecmp(ext, ".obj") == 0)) {
+        return MDOS_TYPE_IMAGE;
+    }
+    return MDOS_TYPE_ASCII;
+}
+
+/*
+ * Take ownership of raw host file contents. Binaries are stored as-is,
+ * everything else as ASCII with CR line ends.
+ */
+int mdos_bulk_set_host_data(mdos_bulk_file_t *file, const char *local_name, uint8_t *raw, size_t size) {
+    if (mdos_bulk_host_type(local_name) == MDOS_TYPE_IMAGE) {
+        file->type = MDOS_TYPE_IMAGE;
+        file->buffer = raw;
+        file->size = size;
+    } else {
+        uint8_t *text = malloc(size ? size : 1);
+        if (!text) {
+            free(raw);
+            return MDOS_ENOSPC;
+        }
+
+        size_t len = 0;
+        for (size_t i = 0; i < size; i++) {
+            if (raw[i] == '\r' && i + 1 < size && raw[i + 1] == '\n') {
+                continue; /* CR LF -> CR */
+            }
+            text[len++] = (raw[i] == '\n') ? '\r' : raw[i];
+        }
+        free(raw);
+
+        file->type = MDOS_TYPE_ASCII;
+        file->buffer = text;
+        file->size = len;
+    }
+
+    file->data = file->buffer;
+    return MDOS_EOK;
+}
+
+int mdos_bulk_load_file(const char *local_name, const char *mdos_name, mdos_bulk_file_t *file) {
+    if (!local_name || !file) {
+        return MDOS_EINVAL;
+    }
+
+    memset(file, 0, sizeof(*file));
+
+    int result = mdos_bulk_name(local_name, mdos_name, file->name);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+
+    FILE *fp = fopen(local_name, "rb");
+    if (!fp) {
+        return MDOS_EIO;
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        fclose(fp);
+        return MDOS_EIO;
+    }
+    long size = ftell(fp);
+    if (size < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return MDOS_EIO;
+    }
+
+    uint8_t *raw = malloc(size ? size : 1);
+    if (!raw) {
+        fclose(fp);
+        return MDOS_ENOSPC;
+    }
+    if (fread(raw, 1, size, fp) != (size_t)size) {
+        free(raw);
+        fclose(fp);
+        return MDOS_EIO;
+    }
+    fclose(fp);
+
+    return mdos_bulk_set_host_data(file, local_name, raw, size);
+}
+
+void mdos_bulk_free(mdos_bulk_file_t *files, int count) {
+    for (int i = 0; i < count; i++) {
+        free(files[i].buffer);
+        files[i].buffer = NULL;
+        files[i].data = NULL;
+    }
+}
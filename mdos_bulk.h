@@ -0,0 +1,47 @@
+/*
+ * MDOS Filesystem Library - Bulk Operations
+ * Copyright (C) 2025
+ *
+ * Import and delete many files with a single pass over the CAT and
+ * directory sectors
+ */
+
+#ifndef MDOS_BULK_H
+#define MDOS_BULK_H
+
+#include "mdos_fs.h"
+
+/* One file of a bulk import */
+typedef struct {
+    char name[MDOS_MAX_FILENAME];  /* MDOS name (8.2) */
+    int type;                      /* MDOS_TYPE_* */
+    const uint8_t *data;           /* File contents */
+    size_t size;                   /* Size in bytes */
+    uint16_t load_addr;            /* Load address stored in the RIB */
+    uint16_t start_addr;           /* Start address stored in the RIB */
+    int rib_sector;                /* Set by mdos_bulk_import */
+    uint8_t *buffer;               /* Owned data from mdos_bulk_load_file */
+} mdos_bulk_file_t;
+
+/*
+ * Import all files at once. Space for every file is planned against an
+ * in-memory CAT before anything is written (largest files first), data is
+ * written in physical sector order and the CAT and modified directory
+ * sectors are written once. Existing files with the same name are replaced.
+ * Returns MDOS_EOK, or an error with the image left unmodified.
+ */
+int mdos_bulk_import(mdos_fs_t *fs, mdos_bulk_file_t *files, int count);
+
+/* Delete all named files, all or nothing, with one CAT/directory write-back */
+int mdos_bulk_unlink(mdos_fs_t *fs, const char **filenames, int count);
+
+/*
+ * Read a local file into a bulk entry, with the same naming, typing and
+ * line-ending conversion as mdos_import_file (mdos_name may be NULL)
+ */
+int mdos_bulk_load_file(const char *local_name, const char *mdos_name, mdos_bulk_file_t *file);
+
+/* Release buffers owned by bulk entries */
+void mdos_bulk_free(mdos_bulk_file_t *files, int count);
+
+#endif /* MDOS_BULK_H */
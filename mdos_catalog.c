@@ -0,0 +1,565 @@
+/*
+ * MDOS Filesystem Library - Image Catalog
+ * Copyright (C) 2025
+ *
+ * Building mounts each new or changed image once; queries only read the
+ * catalog file
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* opendir, scandir, st_mtim */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include "mdos_internal.h"
+#include "mdos_catalog.h"
+#include "mdos_imd.h"
+#include "mdos_hash.h"
+
+#define CATALOG_MAGIC       "MDOSCAT1"
+#define CATALOG_HEADER_SIZE 32
+#define CATALOG_IMAGE_SIZE  80
+#define CATALOG_FILE_SIZE   40
+#define CATALOG_NAME_SIZE   12
+#define CATALOG_ID_SIZE     38      /* Disk ID, version, revision, date, user */
+#define CATALOG_MAX_DEPTH   32
+
+typedef struct {
+    char name[CATALOG_NAME_SIZE];
+    uint32_t size;
+    uint16_t attributes;
+    uint16_t load;
+    uint16_t start;
+    uint16_t sectors;
+    uint64_t hash;
+} catalog_file_t;
+
+typedef struct {
+    char *path;
+    long long size;
+    long long mtime_sec;
+    long mtime_nsec;
+    uint64_t hash;
+    uint8_t id[CATALOG_ID_SIZE];    /* Sector 0 as recorded */
+    catalog_file_t *files;
+    int nfiles;
+} catalog_image_t;
+
+typedef struct {
+    catalog_image_t *images;
+    int count;
+    int capacity;
+} catalog_t;
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static void catalog_free(catalog_t *catalog) {
+    for (int i = 0; i < catalog->count; i++) {
+        free(catalog->images[i].path);
+        free(catalog->images[i].files);
+    }
+    free(catalog->images);
+    memset(catalog, 0, sizeof(*catalog));
+}
+
+static catalog_image_t* catalog_add_image(catalog_t *catalog) {
+    if (catalog->count == catalog->capacity) {
+        int capacity = catalog->capacity ? catalog->capacity * 2 : 64;
+        catalog_image_t *images = realloc(catalog->images, capacity * sizeof(*images));
+        if (!images) {
+            return NULL;
+        }
+        catalog->images = images;
+        catalog->capacity = capacity;
+    }
+    catalog_image_t *image = &catalog->images[catalog->count++];
+    memset(image, 0, sizeof(*image));
+    return image;
+}
+
+/* The whole catalog file, checked for size and CRC; NULL if unusable */
+static uint8_t* catalog_read(const char *catalog_path, long *length, int *error) {
+    FILE *fp = fopen(catalog_path, "rb");
+    if (!fp) {
+        *error = MDOS_ENOENT;
+        return NULL;
+    }
+    uint8_t *data = NULL;
+    *error = MDOS_EIO;
+    if (fseek(fp, 0, SEEK_END) == 0 && (*length = ftell(fp)) >= CATALOG_HEADER_SIZE &&
+        fseek(fp, 0, SEEK_SET) == 0 && (data = malloc(*length)) &&
+        fread(data, 1, *length, fp) == (size_t)*length) {
+        uint32_t nimages = get_le32(data + 8), nfiles = get_le32(data + 12);
+        uint32_t strings = get_le32(data + 16);
+        if (memcmp(data, CATALOG_MAGIC, 8) == 0 &&
+            (long long)CATALOG_HEADER_SIZE + (long long)nimages * CATALOG_IMAGE_SIZE +
+                (long long)nfiles * CATALOG_FILE_SIZE + strings == *length &&
+            mdos_crc32(data + CATALOG_HEADER_SIZE, *length - CATALOG_HEADER_SIZE) == get_le32(data + 20)) {
+            *error = MDOS_EOK;
+        }
+    }
+    fclose(fp);
+    if (*error != MDOS_EOK) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/* Decode a catalog file into memory; string and file references are checked */
+static int catalog_load(const char *catalog_path, catalog_t *catalog) {
+    long length;
+    int result;
+    uint8_t *data = catalog_read(catalog_path, &length, &result);
+    if (!data) {
+        return result;
+    }
+    uint32_t nimages = get_le32(data + 8), nfiles = get_le32(data + 12);
+    uint32_t strings = get_le32(data + 16);
+    const uint8_t *images = data + CATALOG_HEADER_SIZE;
+    const uint8_t *files = images + (size_t)nimages * CATALOG_IMAGE_SIZE;
+    const char *text = (const char *)(files + (size_t)nfiles * CATALOG_FILE_SIZE);
+
+    result = MDOS_EOK;
+    for (uint32_t i = 0; i < nimages && result == MDOS_EOK; i++) {
+        const uint8_t *r = images + (size_t)i * CATALOG_IMAGE_SIZE;
+        uint32_t path = get_le32(r + 20), first = get_le32(r + 32), count = get_le32(r + 36);
+        if (path >= strings || !memchr(text + path, '\0', strings - path) ||
+            first > nfiles || count > nfiles - first) {
+            result = MDOS_EIO;
+            break;
+        }
+        catalog_image_t *image = catalog_add_image(catalog);
+        if (!image || !(image->path = strdup(text + path)) ||
+            !(image->files = calloc(count ? count : 1, sizeof(catalog_file_t)))) {
+            result = MDOS_ENOSPC;
+            break;
+        }
+        image->size = (long long)get_le64(r);
+        image->mtime_sec = (long long)get_le64(r + 8);
+        image->mtime_nsec = (long)get_le32(r + 16);
+        image->hash = get_le64(r + 24);
+        memcpy(image->id, r + 40, CATALOG_ID_SIZE);
+        image->nfiles = (int)count;
+        for (uint32_t f = 0; f < count; f++) {
+            const uint8_t *fr = files + (size_t)(first + f) * CATALOG_FILE_SIZE;
+            catalog_file_t *file = &image->files[f];
+            memcpy(file->name, fr, CATALOG_NAME_SIZE);
+            file->name[CATALOG_NAME_SIZE - 1] = '\0';
+            file->size = get_le32(fr + 16);
+            file->attributes = get_le16(fr + 20);
+            file->load = get_le16(fr + 22);
+            file->start = get_le16(fr + 24);
+            file->sectors = get_le16(fr + 26);
+            file->hash = get_le64(fr + 32);
+        }
+    }
+    free(data);
+    if (result != MDOS_EOK) {
+        catalog_free(catalog);
+    }
+    return result;
+}
+
+static int catalog_save(const char *catalog_path, const catalog_t *catalog) {
+    long nfiles = 0, strings = 0;
+    for (int i = 0; i < catalog->count; i++) {
+        nfiles += catalog->images[i].nfiles;
+        strings += strlen(catalog->images[i].path) + 1;
+    }
+    long length = CATALOG_HEADER_SIZE + (long)catalog->count * CATALOG_IMAGE_SIZE +
+                  nfiles * CATALOG_FILE_SIZE + strings;
+    uint8_t *data = calloc(length, 1);
+    if (!data) {
+        return MDOS_ENOSPC;
+    }
+
+    uint8_t *r = data + CATALOG_HEADER_SIZE;
+    uint8_t *fr = r + (size_t)catalog->count * CATALOG_IMAGE_SIZE;
+    char *text = (char *)(fr + nfiles * CATALOG_FILE_SIZE);
+    uint32_t first = 0, path = 0;
+    for (int i = 0; i < catalog->count; i++, r += CATALOG_IMAGE_SIZE) {
+        const catalog_image_t *image = &catalog->images[i];
+        put_le64(r, (uint64_t)image->size);
+        put_le64(r + 8, (uint64_t)image->mtime_sec);
+        put_le32(r + 16, (uint32_t)image->mtime_nsec);
+        put_le32(r + 20, path);
+        put_le64(r + 24, image->hash);
+        put_le32(r + 32, first);
+        put_le32(r + 36, (uint32_t)image->nfiles);
+        memcpy(r + 40, image->id, CATALOG_ID_SIZE);
+        strcpy(text + path, image->path);
+        path += strlen(image->path) + 1;
+
+        for (int f = 0; f < image->nfiles; f++, fr += CATALOG_FILE_SIZE) {
+            const catalog_file_t *file = &image->files[f];
+            memcpy(fr, file->name, CATALOG_NAME_SIZE);
+            put_le32(fr + 12, (uint32_t)i);
+            put_le32(fr + 16, file->size);
+            put_le16(fr + 20, file->attributes);
+            put_le16(fr + 22, file->load);
+            put_le16(fr + 24, file->start);
+            put_le16(fr + 26, file->sectors);
+            put_le64(fr + 32, file->hash);
+        }
+        first += image->nfiles;
+    }
+    memcpy(data, CATALOG_MAGIC, 8);
+    put_le32(data + 8, (uint32_t)catalog->count);
+    put_le32(data + 12, (uint32_t)nfiles);
+    put_le32(data + 16, (uint32_t)strings);
+    put_le32(data + 20, mdos_crc32(data + CATALOG_HEADER_SIZE, length - CATALOG_HEADER_SIZE));
+
+    size_t n = strlen(catalog_path) + 5;
+    char *temp = malloc(n);
+    int result = MDOS_ENOSPC;
+    if (temp) {
+        snprintf(temp, n, "%s.tmp", catalog_path);
+        FILE *fp = fopen(temp, "wb");
+        result = MDOS_EIO;
+        if (fp) {
+            int ok = fwrite(data, 1, length, fp) == (size_t)length;
+            if (fclose(fp) == 0 && ok && rename(temp, catalog_path) == 0) {
+                result = MDOS_EOK;
+            } else {
+                remove(temp);
+            }
+        }
+        free(temp);
+    }
+    free(data);
+    return result;
+}
+
+/* Building */
+
+static int catalog_is_image_name(const char *name) {
+    static const char *suffixes[] = { ".dsk", ".imd", ".mdz" };
+    size_t n = strlen(name);
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        if (n > 4 && strcasecmp(name + n - 4, suffixes[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int catalog_visible(const struct dirent *entry) {
+    return entry->d_name[0] != '.';
+}
+
+/* Append the image paths below dir to *paths, in name order */
+static int catalog_scan(const char *dir, int depth, char ***paths, int *count, int *capacity) {
+    struct dirent **entries;
+    int n = scandir(dir, &entries, catalog_visible, alphasort);
+    if (n < 0) {
+        return MDOS_ENOENT;
+    }
+    int result = MDOS_EOK;
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(dir) + strlen(entries[i]->d_name) + 2;
+        char *path = (result == MDOS_EOK) ? malloc(len) : NULL;
+        struct stat st;
+        if (path) {
+            snprintf(path, len, "%s/%s", dir, entries[i]->d_name);
+        }
+        if (!path || stat(path, &st) != 0) {
+            free(path);
+        } else if (S_ISDIR(st.st_mode) && depth < CATALOG_MAX_DEPTH) {
+            result = catalog_scan(path, depth + 1, paths, count, capacity);
+            free(path);
+        } else if (S_ISREG(st.st_mode) && catalog_is_image_name(entries[i]->d_name)) {
+            if (*count == *capacity) {
+                int grown = *capacity ? *capacity * 2 : 256;
+                char **more = realloc(*paths, grown * sizeof(char *));
+                if (!more) {
+                    free(path);
+                    result = MDOS_ENOSPC;
+                    free(entries[i]);
+                    continue;
+                }
+                *paths = more;
+                *capacity = grown;
+            }
+            (*paths)[(*count)++] = path;
+        } else {
+            free(path);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return result;
+}
+
+static uint64_t catalog_hash_file(const char *path, int *error) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        *error = MDOS_ENOENT;
+        return 0;
+    }
+    uint8_t *data = NULL;
+    long length = 0;
+    uint64_t hash = 0;
+    *error = MDOS_EIO;
+    if (fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+        (data = malloc(length ? length : 1)) && fread(data, 1, length, fp) == (size_t)length) {
+        hash = mdos_hash64(data, length);
+        *error = MDOS_EOK;
+    }
+    free(data);
+    fclose(fp);
+    return hash;
+}
+
+/* Read sector 0 and every directory entry of an image through a mount */
+static int catalog_parse(catalog_image_t *image) {
+    mdos_fs_t *fs = mdos_mount_image(image->path, 1);
+    if (!fs) {
+        return MDOS_EIO;
+    }
+    uint8_t sector[MDOS_SECTOR_SIZE];
+    mdos_getsect(fs, sector, 0);
+    memcpy(image->id, sector, CATALOG_ID_SIZE);
+
+    long nsectors = 0;
+    if (fseek(fs->fp, 0, SEEK_END) == 0) {
+        nsectors = ftell(fs->fp) / MDOS_SECTOR_SIZE;
+    }
+    mdos_meta_t meta;
+    mdos_meta_load(fs, &meta);
+    image->files = calloc(MDOS_DIR_ENTRIES, sizeof(catalog_file_t));
+    if (!image->files) {
+        mdos_unmount_image(fs);
+        return MDOS_ENOSPC;
+    }
+
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+        uint8_t *entry = mdos_meta_entry(&meta, slot);
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            continue;
+        }
+        catalog_file_t *file = &image->files[image->nfiles++];
+        char name[MDOS_MAX_FILENAME];
+        mdos_meta_entry_name(entry, name);
+        size_t len = strlen(name);      /* At most 8.2, so it always fits */
+        memcpy(file->name, name, len < CATALOG_NAME_SIZE ? len : CATALOG_NAME_SIZE - 1);
+        file->attributes = (uint16_t)((entry[12] << 8) | entry[13]);
+
+        /* A file whose RIB lies outside the image keeps its name only */
+        int rib_sector = (entry[10] << 8) | entry[11];
+        if (rib_sector <= 0 || rib_sector >= nsectors) {
+            continue;
+        }
+        mdos_rib_t rib;
+        uint8_t *data = NULL;
+        size_t size = 0;
+        int result = mdos_read_contents(fs, rib_sector, &rib, &data, &size);
+        file->load = (uint16_t)((rib.addr_high << 8) | rib.addr_low);
+        file->start = (uint16_t)((rib.pc_high << 8) | rib.pc_low);
+        file->sectors = (uint16_t)((rib.size_high << 8) | rib.size_low);
+        if (result == MDOS_EOK) {
+            file->size = (uint32_t)size;
+            file->hash = mdos_hash64(data, size);
+        }
+        free(data);
+    }
+    return mdos_unmount_image(fs) == MDOS_EOK ? MDOS_EOK : MDOS_EIO;
+}
+
+static int compare_image_path(const void *a, const void *b) {
+    return strcmp(((const catalog_image_t *)a)->path, ((const catalog_image_t *)b)->path);
+}
+
+int mdos_catalog_build(const char *catalog_path, const char *dir,
+                       mdos_catalog_stats_t *stats, FILE *log) {
+    if (!catalog_path || !dir) {
+        return MDOS_EINVAL;
+    }
+    mdos_catalog_stats_t local;
+    if (!stats) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    /* A missing or damaged catalog just means everything is parsed */
+    catalog_t old = { 0 }, catalog = { 0 };
+    if (catalog_load(catalog_path, &old) == MDOS_EOK) {
+        qsort(old.images, old.count, sizeof(catalog_image_t), compare_image_path);
+    }
+
+    char **paths = NULL;
+    int count = 0, capacity = 0;
+    int result = catalog_scan(dir, 0, &paths, &count, &capacity);
+
+    for (int i = 0; i < count && result == MDOS_EOK; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) != 0) {
+            continue;
+        }
+        catalog_image_t key = { 0 };
+        key.path = paths[i];
+        catalog_image_t *prev = old.count ? bsearch(&key, old.images, old.count, sizeof(catalog_image_t),
+                                                    compare_image_path) : NULL;
+        catalog_image_t *image = catalog_add_image(&catalog);
+        if (!image) {
+            result = MDOS_ENOSPC;
+            break;
+        }
+        image->path = paths[i];
+        paths[i] = NULL;
+        image->size = (long long)st.st_size;
+        image->mtime_sec = (long long)st.st_mtim.tv_sec;
+        image->mtime_nsec = st.st_mtim.tv_nsec;
+
+        int error = MDOS_EOK;
+        int same = prev && prev->size == image->size && prev->mtime_sec == image->mtime_sec &&
+                   prev->mtime_nsec == image->mtime_nsec;
+        image->hash = same ? prev->hash : catalog_hash_file(image->path, &error);
+        if (error == MDOS_EOK && prev && prev->hash == image->hash && prev->size == image->size) {
+            /* Take the entries over; the old catalog gives them up */
+            memcpy(image->id, prev->id, CATALOG_ID_SIZE);
+            image->files = prev->files;
+            image->nfiles = prev->nfiles;
+            prev->files = NULL;
+            prev->nfiles = 0;
+            if (same) stats->unchanged++; else stats->rehashed++;
+        } else if (error == MDOS_EOK && (error = catalog_parse(image)) == MDOS_EOK) {
+            stats->parsed++;
+        }
+        if (prev) {
+            prev->hash = 0;             /* Seen: not dropped */
+            prev->size = -1;
+        }
+
+        if (error != MDOS_EOK) {
+            if (log) fprintf(log, "%s: %s\n", image->path, mdos_strerror(error));
+            free(image->path);
+            free(image->files);
+            catalog.count--;
+            continue;
+        }
+        stats->files += image->nfiles;
+        if (log && !same) {
+            fprintf(log, "%s: %d files\n", image->path, image->nfiles);
+        }
+    }
+    for (int i = 0; i < old.count; i++) {
+        if (old.images[i].size >= 0) stats->dropped++;
+    }
+    stats->images = catalog.count;
+
+    if (result == MDOS_EOK) {
+        result = catalog_save(catalog_path, &catalog);
+    }
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    catalog_free(&old);
+    catalog_free(&catalog);
+    return result;
+}
+
+/* Querying */
+
+/* Printable text of a fixed-width disk ID field, trailing blanks removed */
+static void catalog_id_text(const uint8_t *field, int width, char *out) {
+    int n = 0;
+    for (int i = 0; i < width; i++) {
+        out[i] = isprint(field[i]) ? (char)field[i] : ' ';
+        if (out[i] != ' ') n = i + 1;
+    }
+    out[n] = '\0';
+}
+
+static int catalog_glob(const char *pattern, const char *text) {
+    char p[256], t[256];
+    int i;
+    for (i = 0; pattern[i] && i < 255; i++) p[i] = (char)tolower((unsigned char)pattern[i]);
+    p[i] = '\0';
+    for (i = 0; text[i] && i < 255; i++) t[i] = (char)tolower((unsigned char)text[i]);
+    t[i] = '\0';
+    return fnmatch(p, t, 0) == 0;
+}
+
+long mdos_catalog_find(const char *catalog_path, const mdos_catalog_query_t *query, FILE *out) {
+    if (!catalog_path || !query || !out) {
+        return MDOS_EINVAL;
+    }
+    long length;
+    int result;
+    uint8_t *data = catalog_read(catalog_path, &length, &result);
+    if (!data) {
+        return result;
+    }
+    uint32_t nimages = get_le32(data + 8), nfiles = get_le32(data + 12);
+    uint32_t strings = get_le32(data + 16);
+    const uint8_t *images = data + CATALOG_HEADER_SIZE;
+    const uint8_t *files = images + (size_t)nimages * CATALOG_IMAGE_SIZE;
+    const char *text = (const char *)(files + (size_t)nfiles * CATALOG_FILE_SIZE);
+
+    long matches = 0;
+    for (uint32_t f = 0; f < nfiles; f++) {
+        const uint8_t *fr = files + (size_t)f * CATALOG_FILE_SIZE;
+        char name[CATALOG_NAME_SIZE + 1];
+        memcpy(name, fr, CATALOG_NAME_SIZE);
+        name[CATALOG_NAME_SIZE] = '\0';
+        uint32_t i = get_le32(fr + 12);
+        uint16_t load = get_le16(fr + 22), start = get_le16(fr + 24);
+        if (i >= nimages || (query->pattern && !catalog_glob(query->pattern, name)) ||
+            (query->load >= 0 && load != query->load) ||
+            (query->start >= 0 && start != query->start)) {
+            continue;
+        }
+
+        const uint8_t *r = images + (size_t)i * CATALOG_IMAGE_SIZE;
+        char id[9], date[7], user[21];
+        catalog_id_text(r + 40, 8, id);
+        catalog_id_text(r + 52, 6, date);
+        catalog_id_text(r + 58, 20, user);
+        if (query->user && !catalog_glob(query->user, user)) {
+            continue;
+        }
+        uint32_t path = get_le32(r + 20);
+        if (path >= strings || !memchr(text + path, '\0', strings - path)) {
+            free(data);
+            return MDOS_EIO;
+        }
+        fprintf(out, "%s  %-12s %7u  load=%04X start=%04X attr=%04X  %016llx  %s %s %s\n",
+                text + path, name, (unsigned)get_le32(fr + 16), load, start, get_le16(fr + 20),
+                (unsigned long long)get_le64(fr + 32), id, date, user);
+        matches++;
+    }
+    free(data);
+    return matches;
+}
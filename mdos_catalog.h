@@ -0,0 +1,69 @@
+/*
+ * MDOS Filesystem Library - Image Catalog
+ * Copyright (C) 2025
+ *
+ * One index file describing every file on every image of a collection, so
+ * lookups never open an image
+ */
+
+#ifndef MDOS_CATALOG_H
+#define MDOS_CATALOG_H
+
+#include <stdio.h>
+#include "mdos_fs.h"
+
+/* Catalog used when none is named */
+#define MDOS_CATALOG_FILE "mdos.catalog"
+
+/*
+ * File layout (little endian):
+ *
+ *   header  32 bytes   "MDOSCAT1", image count, file count, string bytes,
+ *                      CRC-32 of everything after the header, 8 zero bytes
+ *   images  80 each    size, mtime (s, ns), path offset, FNV-1a hash of the
+ *                      image file, first file, file count, then sector 0:
+ *                      disk ID (8), version, revision, date (MMDDYY), user (20)
+ *   files   40 each    name (12, NUL padded), image, size in bytes,
+ *                      attributes, load, start, sectors, 4 zero bytes,
+ *                      FNV-1a hash of the contents
+ *   strings            image paths, NUL terminated
+ *
+ * Records are fixed size, so a query is one read and a linear scan.
+ */
+
+typedef struct {
+    int images;             /* Images in the new catalog */
+    int parsed;             /* Read through a mount */
+    int unchanged;          /* Same size and mtime: taken over unread */
+    int rehashed;           /* mtime changed, contents did not */
+    int dropped;            /* In the old catalog, gone from the directory */
+    long files;
+} mdos_catalog_stats_t;
+
+/*
+ * Catalog every .dsk, .imd and .mdz below dir (recursively, hidden entries
+ * skipped) into catalog_path. An existing catalog is reused: an image with
+ * the same size and mtime is not opened, one whose mtime changed is hashed
+ * and only parsed again if its contents did. Images that cannot be mounted
+ * are reported on log and left out. The catalog is written under a
+ * temporary name and renamed into place.
+ */
+int mdos_catalog_build(const char *catalog_path, const char *dir,
+                       mdos_catalog_stats_t *stats, FILE *log);
+
+/* What mdos_catalog_find matches; NULL and -1 fields match anything */
+typedef struct {
+    const char *pattern;    /* Glob on the file name, case-insensitive */
+    const char *user;       /* Glob on the disk's user name */
+    long load;
+    long start;
+} mdos_catalog_query_t;
+
+/*
+ * Print each catalogued file matching query, one per line, from the index
+ * alone. Returns the number of matches, or an error code (MDOS_EIO for a
+ * damaged catalog).
+ */
+long mdos_catalog_find(const char *catalog_path, const mdos_catalog_query_t *query, FILE *out);
+
+#endif /* MDOS_CATALOG_H */
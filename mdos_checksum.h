@@ -0,0 +1,221 @@
+/*
+ * MDOS Filesystem Library - Checksums
+ * Copyright (C) 2025
+ *
+ * CRC32C and SHA-256 for packlist manifests. Header only, like
+ * mdos_geometry.h, so mdosextract computes exactly what the library checks.
+ */
+
+#ifndef MDOS_CHECKSUM_H
+#define MDOS_CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <nmmintrin.h>
+    #define MDOS_CRC32C_SSE42 1
+#elif defined(__GNUC__) && defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+    #define MDOS_CRC32C_ARM 1
+#endif
+
+/*
+ * CRC32C (Castagnoli, as iSCSI and ext4 use it). Start with crc = 0 and
+ * feed the data in any number of pieces. Uses the SSE4.2 crc32 instruction
+ * when the CPU has it, the ARMv8 one when built for it, and slicing-by-8
+ * tables otherwise; all three give the same result.
+ */
+#define MDOS_CRC32C_POLY 0x82F63B78u    /* Reflected Castagnoli polynomial */
+
+static inline uint32_t mdos_crc32c_soft(uint32_t crc, const uint8_t *p, size_t len) {
+    static uint32_t table[8][256];
+    if (table[0][1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ MDOS_CRC32C_POLY : c >> 1;
+            }
+            table[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int t = 1; t < 8; t++) {
+                table[t][i] = table[0][table[t - 1][i] & 0xFF] ^ (table[t - 1][i] >> 8);
+            }
+        }
+    }
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                             ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+              table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+    }
+    while (len--) {
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(MDOS_CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static inline uint32_t mdos_crc32c_hw(uint32_t crc, const uint8_t *p, size_t len) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; len >= 4; len -= 4, p += 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#elif defined(MDOS_CRC32C_ARM)
+static inline uint32_t mdos_crc32c_hw(uint32_t crc, const uint8_t *p, size_t len) {
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+/* Non-zero if mdos_crc32c uses a CPU instruction */
+static inline int mdos_crc32c_hardware(void) {
+#if defined(MDOS_CRC32C_SSE42)
+    return __builtin_cpu_supports("sse4.2");
+#elif defined(MDOS_CRC32C_ARM)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static inline uint32_t mdos_crc32c(uint32_t crc, const void *data, size_t len) {
+    const uint8_t *p = data;
+    crc = ~crc;
+#if defined(MDOS_CRC32C_SSE42) || defined(MDOS_CRC32C_ARM)
+    if (mdos_crc32c_hardware()) {
+        return ~mdos_crc32c_hw(crc, p, len);
+    }
+#endif
+    return ~mdos_crc32c_soft(crc, p, len);
+}
+
+/* SHA-256 (FIPS 180-4), incremental */
+typedef struct {
+    uint32_t state[8];
+    uint64_t bytes;
+    uint8_t block[64];
+} mdos_sha256_t;
+
+#define MDOS_SHA256_SIZE 32
+#define MDOS_SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static inline void mdos_sha256_init(mdos_sha256_t *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->bytes = 0;
+}
+
+static inline void mdos_sha256_block(uint32_t *state, const uint8_t *block) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = MDOS_SHA256_ROTR(w[i - 15], 7) ^ MDOS_SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = MDOS_SHA256_ROTR(w[i - 2], 17) ^ MDOS_SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (MDOS_SHA256_ROTR(e, 6) ^ MDOS_SHA256_ROTR(e, 11) ^ MDOS_SHA256_ROTR(e, 25)) +
+                      ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t t2 = (MDOS_SHA256_ROTR(a, 2) ^ MDOS_SHA256_ROTR(a, 13) ^ MDOS_SHA256_ROTR(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static inline void mdos_sha256_update(mdos_sha256_t *ctx, const void *data, size_t len) {
+    const uint8_t *p = data;
+    size_t used = ctx->bytes % 64;
+    ctx->bytes += len;
+    if (used) {
+        size_t n = (len < 64 - used) ? len : 64 - used;
+        memcpy(ctx->block + used, p, n);
+        p += n;
+        len -= n;
+        if (used + n < 64) {
+            return;
+        }
+        mdos_sha256_block(ctx->state, ctx->block);
+    }
+    for (; len >= 64; len -= 64, p += 64) {
+        mdos_sha256_block(ctx->state, p);
+    }
+    memcpy(ctx->block, p, len);
+}
+
+static inline void mdos_sha256_final(mdos_sha256_t *ctx, uint8_t digest[MDOS_SHA256_SIZE]) {
+    uint64_t bits = ctx->bytes * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t used = ctx->bytes % 64;
+    size_t n = (used < 56) ? 56 - used : 120 - used;
+    for (int i = 0; i < 8; i++) {
+        pad[n + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    mdos_sha256_update(ctx, pad, n + 8);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (uint8_t)(ctx->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+/* Lowercase hex of a digest into out (2 * MDOS_SHA256_SIZE + 1 bytes) */
+static inline void mdos_sha256_hex(const uint8_t digest[MDOS_SHA256_SIZE], char *out) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < MDOS_SHA256_SIZE; i++) {
+        out[2 * i] = hex[digest[i] >> 4];
+        out[2 * i + 1] = hex[digest[i] & 15];
+    }
+    out[2 * MDOS_SHA256_SIZE] = '\0';
+}
+
+#endif /* MDOS_CHECKSUM_H */
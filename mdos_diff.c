@@ -0,0 +1,511 @@
+/*
+ * MDOS Filesystem Library - Image Diff and Patch
+ * Copyright (C) 2025
+ *
+ * Sector-level comparison of two images mapped back to the filesystem,
+ * and compact patches of the changed sectors
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mdos_internal.h"
+#include "mdos_diff.h"
+#include "mdos_imd.h"
+#include "mdos_mdz.h"
+#include "mdos_hash.h"
+#include "mdos_sparse.h"
+
+#define PATCH_MAGIC       "MDOSPAT1"
+#define PATCH_HEADER_SIZE 48
+#define PATCH_RUN_SIZE    8
+#define PATCH_RAW         0
+
+#define DIFF_LOCKOUT_SECTOR 2       /* Lockout table, between CAT and directory */
+#define DIFF_RIB          0x8000    /* Owner flag: the sector is the file's RIB */
+#define DIFF_LABEL_MAX    48
+
+/* A mounted image and a copy of its linear view */
+typedef struct {
+    mdos_fs_t *fs;
+    uint8_t *image;
+    long length;
+    long track_bytes;
+    uint16_t *owner;        /* Per sector: 0 none, directory slot + 1, DIFF_RIB */
+    char names[MDOS_DIR_ENTRIES][MDOS_MAX_FILENAME];
+} diff_image_t;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static void diff_close(diff_image_t *img) {
+    if (img->fs) {
+        mdos_unmount_image(img->fs);
+    }
+    free(img->image);
+    free(img->owner);
+    memset(img, 0, sizeof(*img));
+}
+
+/* Mount an image and copy out its linear view; the mount stays open */
+static int diff_open(const char *path, int read_only, diff_image_t *img) {
+    memset(img, 0, sizeof(*img));
+    img->fs = mdos_mount_image(path, read_only);
+    if (!img->fs) {
+        return MDOS_ENOENT;
+    }
+
+    mdos_geometry_t g;
+    int result = mdos_image_geometry(img->fs, &g);
+    if (result == MDOS_EOK) {
+        img->track_bytes = (long)g.sectors * g.sector_size;
+        result = MDOS_EIO;
+        if (fseek(img->fs->fp, 0, SEEK_END) == 0 && (img->length = ftell(img->fs->fp)) >= 0) {
+            img->image = malloc(img->length ? img->length : 1);
+            if (!img->image) {
+                result = MDOS_ENOSPC;
+            } else if (mdos_sparse_read(img->fs->fp, img->image, img->length) >= 0) {
+                result = MDOS_EOK;
+            }
+        }
+    }
+    if (result == MDOS_EOK && img->track_bytes <= 0) {
+        img->track_bytes = MDOS_SECTOR_SIZE;
+    }
+    if (result != MDOS_EOK) {
+        diff_close(img);
+    }
+    return result;
+}
+
+/*
+ * Bytes up to the last sector that is not all zeros. A sparse DSK may end
+ * there while an IMD mount of the same disk runs to the full geometry, so
+ * hashes stop there too.
+ */
+static long diff_used_length(const diff_image_t *img) {
+    static const uint8_t zeros[MDOS_SECTOR_SIZE];
+    long used = img->length;
+    while (used > 0) {
+        long n = used % MDOS_SECTOR_SIZE ? used % MDOS_SECTOR_SIZE : MDOS_SECTOR_SIZE;
+        if (memcmp(img->image + used - n, zeros, n) != 0) break;
+        used -= n;
+    }
+    return used;
+}
+
+static uint64_t diff_hash(const diff_image_t *img) {
+    return mdos_hash64(img->image, diff_used_length(img));
+}
+
+/* Extend the copy with zero sectors, as a short sparse DSK reads */
+static int diff_pad(diff_image_t *img, long length) {
+    if (length <= img->length) {
+        return MDOS_EOK;
+    }
+    uint8_t *grown = realloc(img->image, length);
+    if (!grown) {
+        return MDOS_ENOSPC;
+    }
+    memset(grown + img->length, 0, length - img->length);
+    img->image = grown;
+    img->length = length;
+    return MDOS_EOK;
+}
+
+/* Record which file every sector belongs to, from the image's own directory */
+static int diff_map_owners(diff_image_t *img) {
+    long nsectors = img->length / MDOS_SECTOR_SIZE;
+    img->owner = calloc(nsectors + 1, sizeof(uint16_t));
+    if (!img->owner) {
+        return MDOS_ENOSPC;
+    }
+    if (nsectors < MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS) {
+        return MDOS_EOK;
+    }
+
+    mdos_meta_t meta;
+    memcpy(meta.dir, img->image + MDOS_DIR_FIRST_SECTOR * MDOS_SECTOR_SIZE, sizeof(meta.dir));
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+        const uint8_t *entry = mdos_meta_entry(&meta, slot);
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            continue;
+        }
+        mdos_meta_entry_name(entry, img->names[slot]);
+
+        int rib_sector = (entry[10] << 8) | entry[11];
+        if (rib_sector <= 0 || rib_sector >= nsectors) {
+            continue;
+        }
+        img->owner[rib_sector] = (uint16_t)((slot + 1) | DIFF_RIB);
+
+        mdos_rib_t rib;
+        memcpy(&rib, img->image + (long)rib_sector * MDOS_SECTOR_SIZE, sizeof(rib));
+        int sects = (rib.size_high << 8) | rib.size_low;
+        for (int lsn = 1; lsn <= sects; lsn++) {
+            int psn = mdos_lsn_to_psn(&rib, lsn);
+            if (psn <= 0 || psn >= nsectors) {
+                break;
+            }
+            img->owner[psn] = (uint16_t)(slot + 1);
+        }
+    }
+    return MDOS_EOK;
+}
+
+/* What a sector holds, preferring the new image's view */
+static void diff_label(const diff_image_t *a, const diff_image_t *b, long s, char *label) {
+    if (s == 0) {
+        strcpy(label, "disk ID");
+    } else if (s == MDOS_CAT_SECTOR) {
+        strcpy(label, "CAT");
+    } else if (s == DIFF_LOCKOUT_SECTOR) {
+        strcpy(label, "lockout table");
+    } else if (s >= MDOS_DIR_FIRST_SECTOR && s < MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS) {
+        strcpy(label, "directory");
+    } else {
+        const diff_image_t *img = (s < b->length / MDOS_SECTOR_SIZE && b->owner[s]) ? b : a;
+        uint16_t owner = (s < img->length / MDOS_SECTOR_SIZE) ? img->owner[s] : 0;
+        if (!owner) {
+            strcpy(label, "no file");
+        } else {
+            snprintf(label, DIFF_LABEL_MAX, "%s%s%s", img->names[(owner & ~DIFF_RIB) - 1],
+                     (owner & DIFF_RIB) ? " (RIB)" : "", img == a ? " (old)" : "");
+        }
+    }
+}
+
+/* Files added, deleted, and modified: owning a changed sector in either image */
+static void diff_files(const diff_image_t *a, const diff_image_t *b, const uint8_t *changed,
+                       long nsectors, mdos_diff_stats_t *stats, FILE *report) {
+    uint8_t touched_a[MDOS_DIR_ENTRIES] = { 0 };
+    uint8_t touched_b[MDOS_DIR_ENTRIES] = { 0 };
+    for (long s = 0; s < nsectors; s++) {
+        if (!changed[s]) continue;
+        if (a->owner[s]) touched_a[(a->owner[s] & ~DIFF_RIB) - 1] = 1;
+        if (b->owner[s]) touched_b[(b->owner[s] & ~DIFF_RIB) - 1] = 1;
+    }
+
+    for (int i = 0; i < MDOS_DIR_ENTRIES; i++) {
+        if (!b->names[i][0]) continue;
+        int j = 0;
+        while (j < MDOS_DIR_ENTRIES && strcmp(a->names[j], b->names[i]) != 0) j++;
+        if (j == MDOS_DIR_ENTRIES) {
+            stats->added++;
+            if (report) fprintf(report, "added     %s\n", b->names[i]);
+        } else if (touched_b[i] || touched_a[j]) {
+            stats->modified++;
+            if (report) fprintf(report, "modified  %s\n", b->names[i]);
+        }
+    }
+    for (int j = 0; j < MDOS_DIR_ENTRIES; j++) {
+        if (!a->names[j][0]) continue;
+        int i = 0;
+        while (i < MDOS_DIR_ENTRIES && strcmp(a->names[j], b->names[i]) != 0) i++;
+        if (i == MDOS_DIR_ENTRIES) {
+            stats->deleted++;
+            if (report) fprintf(report, "deleted   %s\n", a->names[j]);
+        }
+    }
+}
+
+/* Write the changed sectors of b as a patch against a */
+static int diff_write_patch(const char *patch_path, const diff_image_t *a, const diff_image_t *b,
+                            const uint8_t *changed, long nsectors, mdos_diff_stats_t *stats) {
+    size_t raw_length = (size_t)stats->changed * MDOS_SECTOR_SIZE;
+    size_t header_length = PATCH_HEADER_SIZE + (size_t)stats->runs * PATCH_RUN_SIZE;
+    uint8_t *out = malloc(header_length + 2 * raw_length + 4);
+    uint8_t *raw = malloc(raw_length ? raw_length : 1);
+    if (!out || !raw) {
+        free(out);
+        free(raw);
+        return MDOS_ENOSPC;
+    }
+
+    uint8_t *run = out + PATCH_HEADER_SIZE;
+    size_t used = 0;
+    for (long s = 0; s < nsectors; ) {
+        if (!changed[s]) {
+            s++;
+            continue;
+        }
+        long first = s;
+        while (s < nsectors && changed[s]) {
+            memcpy(raw + used, b->image + s * MDOS_SECTOR_SIZE, MDOS_SECTOR_SIZE);
+            used += MDOS_SECTOR_SIZE;
+            s++;
+        }
+        put_le32(run, (uint32_t)first);
+        put_le32(run + 4, (uint32_t)(s - first));
+        run += PATCH_RUN_SIZE;
+    }
+
+    /* Sector data of an edited file compresses well; keep it raw if not */
+    uint8_t method = MDOS_MDZ_LZ;
+    size_t stored = mdos_lz_compress(raw, raw_length, out + header_length, raw_length);
+    if (stored == 0) {
+        method = PATCH_RAW;
+        stored = raw_length;
+        memcpy(out + header_length, raw, raw_length);
+    }
+    free(raw);
+
+    memset(out, 0, PATCH_HEADER_SIZE);
+    memcpy(out, PATCH_MAGIC, 8);
+    put_le32(out + 8, (uint32_t)stats->runs);
+    put_le32(out + 12, (uint32_t)stats->changed);
+    put_le64(out + 16, (uint64_t)b->length);
+    put_le64(out + 24, diff_hash(a));
+    put_le64(out + 32, diff_hash(b));
+    put_le32(out + 40, (uint32_t)stored);
+    out[44] = method;
+    size_t total = header_length + stored;
+    put_le32(out + total, mdos_crc32(out, total));
+    total += 4;
+
+    int result = MDOS_EIO;
+    FILE *fp = fopen(patch_path, "wb");
+    if (fp) {
+        if (fwrite(out, 1, total, fp) == total) result = MDOS_EOK;
+        if (fclose(fp) != 0) result = MDOS_EIO;
+    }
+    free(out);
+    stats->patch_bytes = (long)total;
+    return result;
+}
+
+int mdos_diff(const char *old_path, const char *new_path, const char *patch_path,
+              mdos_diff_stats_t *stats, FILE *report) {
+    if (!old_path || !new_path || !stats) {
+        return MDOS_EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    diff_image_t a, b;
+    int result = diff_open(old_path, 1, &a);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+    if ((result = diff_open(new_path, 1, &b)) != MDOS_EOK) {
+        diff_close(&a);
+        return result;
+    }
+
+    long a_length = a.length, b_length = b.length;
+    long length = a.length > b.length ? a.length : b.length;
+    long nsectors = length / MDOS_SECTOR_SIZE;
+    uint8_t *changed = calloc(nsectors + 1, 1);
+    if (!changed || (result = diff_pad(&a, length)) != MDOS_EOK ||
+        (result = diff_pad(&b, length)) != MDOS_EOK || (result = diff_map_owners(&a)) != MDOS_EOK ||
+        (result = diff_map_owners(&b)) != MDOS_EOK) {
+        free(changed);
+        diff_close(&a);
+        diff_close(&b);
+        return changed ? result : MDOS_ENOSPC;
+    }
+
+    /* Whole tracks first: most of an edited disk is unchanged */
+    long track_bytes = b.track_bytes;
+    stats->sectors = nsectors;
+    for (long t = 0; t < length; t += track_bytes) {
+        long n = (length - t < track_bytes) ? length - t : track_bytes;
+        stats->tracks++;
+        if (memcmp(a.image + t, b.image + t, n) == 0) {
+            continue;
+        }
+        stats->tracks_changed++;
+        for (long off = t; off + MDOS_SECTOR_SIZE <= t + n; off += MDOS_SECTOR_SIZE) {
+            if (memcmp(a.image + off, b.image + off, MDOS_SECTOR_SIZE) != 0) {
+                changed[off / MDOS_SECTOR_SIZE] = 1;
+                stats->changed++;
+            }
+        }
+    }
+
+    if (report) {
+        fprintf(report, "--- %s\n+++ %s\n", old_path, new_path);
+        if (a_length != b_length) {
+            fprintf(report, "sizes differ: %ld and %ld bytes, missing sectors read as zeros\n",
+                    a_length, b_length);
+        }
+    }
+
+    /* Runs of changed sectors with the same owner */
+    for (long s = 0; s < nsectors; ) {
+        if (!changed[s]) {
+            s++;
+            continue;
+        }
+        char label[DIFF_LABEL_MAX], next[DIFF_LABEL_MAX];
+        long first = s;
+        diff_label(&a, &b, s, label);
+        while (++s < nsectors && changed[s]) {
+            diff_label(&a, &b, s, next);
+            if (strcmp(next, label) != 0) break;
+        }
+        if (report) {
+            char range[32];
+            snprintf(range, sizeof(range), (s - first > 1) ? "%ld-%ld" : "%ld", first, s - 1);
+            fprintf(report, "sectors %-12s %s\n", range, label);
+        }
+    }
+    for (long s = 0; s < nsectors; s++) {
+        if (changed[s] && (s == 0 || !changed[s - 1])) stats->runs++;
+    }
+
+    diff_files(&a, &b, changed, nsectors, stats, report);
+
+    if (patch_path) {
+        result = diff_write_patch(patch_path, &a, &b, changed, nsectors, stats);
+    }
+
+    free(changed);
+    diff_close(&a);
+    diff_close(&b);
+    return result;
+}
+
+/* Read and check a patch file; *data gets the whole file */
+static int patch_load(const char *patch_path, uint8_t **data, long *length) {
+    FILE *fp = fopen(patch_path, "rb");
+    if (!fp) {
+        return MDOS_ENOENT;
+    }
+    int result = MDOS_EIO;
+    *data = NULL;
+    if (fseek(fp, 0, SEEK_END) == 0 && (*length = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        *data = malloc(*length ? *length : 1);
+        if (!*data) {
+            result = MDOS_ENOSPC;
+        } else if (fread(*data, 1, *length, fp) == (size_t)*length) {
+            result = MDOS_EOK;
+        }
+    }
+    fclose(fp);
+
+    const uint8_t *p = *data;
+    if (result == MDOS_EOK &&
+        (*length < PATCH_HEADER_SIZE + 4 || memcmp(p, PATCH_MAGIC, 8) != 0 ||
+         mdos_crc32(p, *length - 4) != get_le32(p + *length - 4) ||
+         (uint64_t)*length != PATCH_HEADER_SIZE + (uint64_t)get_le32(p + 8) * PATCH_RUN_SIZE +
+                              get_le32(p + 40) + 4)) {
+        result = MDOS_EIO;
+    }
+    if (result != MDOS_EOK) {
+        free(*data);
+        *data = NULL;
+    }
+    return result;
+}
+
+long mdos_patch(const char *image_path, const char *patch_path) {
+    if (!image_path || !patch_path) {
+        return MDOS_EINVAL;
+    }
+
+    uint8_t *patch;
+    long patch_length;
+    int result = patch_load(patch_path, &patch, &patch_length);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+    uint32_t runs = get_le32(patch + 8);
+    uint32_t sectors = get_le32(patch + 12);
+    uint64_t length = get_le64(patch + 16);
+    uint64_t old_hash = get_le64(patch + 24);
+    uint64_t new_hash = get_le64(patch + 32);
+    uint32_t stored = get_le32(patch + 40);
+    const uint8_t *run = patch + PATCH_HEADER_SIZE;
+    const uint8_t *payload = run + (size_t)runs * PATCH_RUN_SIZE;
+
+    diff_image_t img;
+    if ((result = diff_open(image_path, 0, &img)) != MDOS_EOK) {
+        free(patch);
+        return result;
+    }
+
+    /* Precondition: exactly the image the patch was made against */
+    long mounted_length = img.length;
+    uint64_t hash = diff_hash(&img);
+    long written = 0;
+    if (hash != old_hash && hash != new_hash) {
+        result = MDOS_EINVAL;
+    } else if ((uint64_t)img.length < length && (mdos_is_imd(image_path) || mdos_is_mdz(image_path))) {
+        result = MDOS_EINVAL;   /* Only a DSK can grow */
+    } else if ((result = diff_pad(&img, (long)length)) != MDOS_EOK) {
+        /* Out of memory */
+    } else if (hash == new_hash) {
+        result = MDOS_EOK;      /* Already applied */
+    } else {
+        size_t raw_length = (size_t)sectors * MDOS_SECTOR_SIZE;
+        uint8_t *raw = malloc(raw_length ? raw_length : 1);
+        result = raw ? MDOS_EOK : MDOS_ENOSPC;
+        if (result == MDOS_EOK) {
+            if (patch[44] == MDOS_MDZ_LZ) {
+                result = mdos_lz_decompress(payload, stored, raw, raw_length);
+            } else if (patch[44] != PATCH_RAW || stored != raw_length) {
+                result = MDOS_EIO;
+            } else {
+                memcpy(raw, payload, raw_length);
+            }
+        }
+
+        /* Apply to the copy and check the outcome before touching the image */
+        size_t used = 0;
+        for (uint32_t r = 0; r < runs && result == MDOS_EOK; r++) {
+            uint64_t first = get_le32(run + r * PATCH_RUN_SIZE);
+            uint64_t count = get_le32(run + r * PATCH_RUN_SIZE + 4);
+            if ((first + count) * MDOS_SECTOR_SIZE > length || used + count * MDOS_SECTOR_SIZE > raw_length) {
+                result = MDOS_EIO;
+                break;
+            }
+            memcpy(img.image + first * MDOS_SECTOR_SIZE, raw + used, count * MDOS_SECTOR_SIZE);
+            used += count * MDOS_SECTOR_SIZE;
+        }
+        if (result == MDOS_EOK && diff_hash(&img) != new_hash) {
+            result = MDOS_EIO;
+        }
+
+        for (uint32_t r = 0; r < runs && result == MDOS_EOK; r++) {
+            long first = (long)get_le32(run + r * PATCH_RUN_SIZE);
+            long count = (long)get_le32(run + r * PATCH_RUN_SIZE + 4);
+            long offset = first * MDOS_SECTOR_SIZE;
+            if (offset >= mounted_length && diff_used_length(&img) <= offset) {
+                continue;       /* Zeros past the end of a short DSK read as zeros already */
+            }
+            if (fseek(img.fs->fp, offset, SEEK_SET) != 0 ||
+                fwrite(img.image + offset, MDOS_SECTOR_SIZE, count, img.fs->fp) != (size_t)count) {
+                result = MDOS_EIO;
+            }
+            written += count;
+        }
+        if (result == MDOS_EOK && fflush(img.fs->fp) != 0) {
+            result = MDOS_EIO;
+        }
+        free(raw);
+    }
+
+    /* Unmounting writes IMD and MDZ images back */
+    int unmount_result = mdos_unmount_image(img.fs);
+    img.fs = NULL;
+    diff_close(&img);
+    free(patch);
+    if (result == MDOS_EOK && unmount_result != MDOS_EOK) {
+        result = MDOS_EIO;
+    }
+    return (result == MDOS_EOK) ? written : result;
+}
@@ -0,0 +1,68 @@
+/*
+ * MDOS Filesystem Library - Image Diff and Patch
+ * Copyright (C) 2025
+ *
+ * Compare two images sector by sector, say which files the changes belong
+ * to, and carry just the changed sectors to another copy of the old image
+ */
+
+#ifndef MDOS_DIFF_H
+#define MDOS_DIFF_H
+
+#include <stdio.h>
+#include "mdos_fs.h"
+
+/*
+ * Patch file layout (little endian):
+ *
+ *   header  48 bytes   "MDOSPAT1", run count, sector count, image length
+ *                      (64), FNV-1a of the old and of the new linear image,
+ *                      stored payload bytes, payload method (0 raw,
+ *                      MDOS_MDZ_LZ), 3 zero bytes
+ *   runs    8 each     first sector, sector count
+ *   payload            the new contents of every run's sectors, in order
+ *   trailer 4 bytes    CRC-32 of everything before it
+ *
+ * The old image hash is the precondition: a patch only goes onto the image
+ * it was made against.
+ */
+
+typedef struct {
+    long sectors;           /* 128-byte sectors compared */
+    long changed;           /* Sectors that differ */
+    long runs;              /* Runs of consecutive changed sectors */
+    long tracks;
+    long tracks_changed;
+    int modified;           /* Files in both images with changed sectors */
+    int added;
+    int deleted;
+    long patch_bytes;       /* Size of the patch written, if any */
+} mdos_diff_stats_t;
+
+/*
+ * Compare new_path against old_path (DSK, IMD or MDZ, in any mix; the
+ * linear images are compared). Whole tracks are compared first and only
+ * differing ones sector by sector. With report, each run of changed
+ * sectors is printed with what it holds (disk ID, CAT, lockout table,
+ * directory, a file's data or RIB), then the files added, deleted and
+ * modified. With patch_path, a patch turning the old image into the new
+ * one is written. Images of different sizes are compared over the longer
+ * length, the shorter one reading as zero sectors past its end (as a short
+ * sparse DSK does), and the patch records the longer length. Returns
+ * MDOS_EOK.
+ */
+int mdos_diff(const char *old_path, const char *new_path, const char *patch_path,
+              mdos_diff_stats_t *stats, FILE *report);
+
+/*
+ * Apply a patch to image_path in place (through a mount, so IMD and MDZ
+ * images work too). The image must be the one the patch was made against;
+ * otherwise nothing is written and MDOS_EINVAL is returned. A DSK shorter
+ * than the patched image grows to its length; a shorter IMD or MDZ cannot
+ * and is MDOS_EINVAL. An image that already is the patched one is left
+ * alone. A damaged patch is MDOS_EIO.
+ * Returns the number of sectors written.
+ */
+long mdos_patch(const char *image_path, const char *patch_path);
+
+#endif /* MDOS_DIFF_H */
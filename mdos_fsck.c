@@ -0,0 +1,385 @@
+/*
+ * MDOS Filesystem Library - Consistency Check
+ * Copyright (C) 2025
+ *
+ * One pass over the directory builds a bitmap of the clusters the system
+ * area, the lockout table and the files claim; the CAT is then checked
+ * against it 64 clusters at a time
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mdos_internal.h"
+#include "mdos_fsck.h"
+#include "mdos_imd.h"
+#include "mdos_sparse.h"
+#include "mdos_stats.h"
+#include "mdos_geometry.h"
+
+#define FSCK_LOCKOUT_SECTOR  2      /* Lockout table, same layout as the CAT */
+#define FSCK_CLUSTER_SECTORS 4
+#define FSCK_WORDS           (MDOS_CAT_CLUSTERS / 64)
+#define FSCK_SDWS            57     /* Segment descriptors in a RIB */
+#define FSCK_RIB_LAST        117    /* RIB offsets of last_size and size */
+#define FSCK_RIB_SIZE        118
+#define FSCK_MAX_RANGES      8      /* Cluster ranges listed per report line */
+
+/* Cluster owners: 0 none, directory slot + 1, or one of these */
+#define FSCK_OWNER_SYSTEM    0xFFFF
+#define FSCK_OWNER_LOCKOUT   0xFFFE
+
+/*
+ * Cluster c is bit 63 - (c & 63) of word c >> 6, so a word is the big
+ * endian reading of 8 CAT bytes (whose clusters run from the top bit down)
+ */
+typedef uint64_t fsck_map_t[FSCK_WORDS];
+
+typedef struct {
+    const char *path;
+    uint8_t *image;
+    long sectors;           /* Sectors on the disk (the copy is padded to it) */
+    long clusters;
+    fsck_map_t used;
+    uint16_t owner[MDOS_CAT_CLUSTERS];
+    char names[MDOS_DIR_ENTRIES][MDOS_MAX_FILENAME];
+    int *dirty;             /* Sectors to write back */
+    int ndirty;
+    mdos_fsck_stats_t *stats;
+    FILE *report;
+} fsck_t;
+
+static void fsck_load_map(const uint8_t *bytes, fsck_map_t map) {
+    for (int w = 0; w < FSCK_WORDS; w++) {
+        uint64_t v = 0;
+        for (int b = 0; b < 8; b++) v = (v << 8) | bytes[w * 8 + b];
+        map[w] = v;
+    }
+}
+
+static void fsck_store_map(const fsck_map_t map, uint8_t *bytes) {
+    for (int w = 0; w < FSCK_WORDS; w++) {
+        for (int b = 0; b < 8; b++) bytes[w * 8 + b] = (uint8_t)(map[w] >> (56 - 8 * b));
+    }
+}
+
+/* The bits of clusters [first, first + count) that fall in word w */
+static uint64_t fsck_word_mask(long w, long first, long count) {
+    long lo = first - w * 64, hi = lo + count;
+    if (lo < 0) lo = 0;
+    if (hi > 64) hi = 64;
+    if (lo >= hi) {
+        return 0;
+    }
+    uint64_t ones = (hi - lo == 64) ? ~0ULL : (1ULL << (hi - lo)) - 1;
+    return ones << (64 - hi);
+}
+
+static const char* fsck_owner_name(const fsck_t *fs, uint16_t owner) {
+    return owner == FSCK_OWNER_SYSTEM ? "the system area" :
+           owner == FSCK_OWNER_LOCKOUT ? "the lockout table" : fs->names[owner - 1];
+}
+
+static void fsck_problem(fsck_t *fs, const char *file, const char *what) {
+    fs->stats->problems++;
+    if (fs->report) {
+        fprintf(fs->report, "%s: %s%s%s\n", fs->path, file ? file : "", file ? ": " : "", what);
+    }
+}
+
+/*
+ * Claim clusters for owner. Returns how many were claimed already and the
+ * owner of the first of those.
+ */
+static long fsck_claim(fsck_t *fs, long first, long count, uint16_t owner, uint16_t *other) {
+    long twice = 0;
+    *other = 0;
+    for (long w = first >> 6; w <= (first + count - 1) >> 6; w++) {
+        uint64_t mask = fsck_word_mask(w, first, count);
+        uint64_t overlap = fs->used[w] & mask;
+        if (overlap) {
+            twice += __builtin_popcountll(overlap);
+            if (!*other) *other = fs->owner[w * 64 + __builtin_clzll(overlap)];
+        }
+        fs->used[w] |= mask;
+    }
+    for (long c = first; c < first + count; c++) {
+        if (!fs->owner[c]) fs->owner[c] = owner;
+    }
+    return twice;
+}
+
+static void fsck_mark_dirty(fsck_t *fs, int sector) {
+    for (int i = 0; i < fs->ndirty; i++) {
+        if (fs->dirty[i] == sector) return;
+    }
+    fs->dirty[fs->ndirty++] = sector;
+}
+
+/* Claim one file's segments and check its RIB's size fields */
+static void fsck_file(fsck_t *fs, int slot, const uint8_t *entry, int repair) {
+    const char *name = fs->names[slot];
+    char what[160];
+    int rib_sector = (entry[10] << 8) | entry[11];
+    if (rib_sector <= 0 || rib_sector >= fs->sectors) {
+        snprintf(what, sizeof(what), "RIB sector %d is outside the disk", rib_sector);
+        fsck_problem(fs, name, what);
+        fs->stats->bad_entries++;
+        return;
+    }
+    uint8_t *rib = fs->image + (long)rib_sector * MDOS_SECTOR_SIZE;
+
+    /* Segments up to the end marker, or up to the first one off the disk */
+    long allocated = 0;
+    int end = -1, next = 0, cut = 0;
+    for (int i = 0; i < FSCK_SDWS; i++) {
+        int sdw = (rib[2 * i] << 8) | rib[2 * i + 1];
+        MDOS_STAT_ADD(MDOS_STAT_SDWS, 1);
+        if (sdw & 0x8000) {
+            end = sdw & 0x7FFF;
+            break;
+        }
+        if (sdw == 0) {
+            continue;
+        }
+        long cluster = sdw & 0x3FF;
+        long count = ((sdw >> 10) & 0x1F) + 1;
+        if (cluster + count > fs->clusters) {
+            snprintf(what, sizeof(what), "segment at cluster %ld (%ld clusters) runs past the "
+                     "end of the disk (%ld clusters)", cluster, count, fs->clusters);
+            fsck_problem(fs, name, what);
+            fs->stats->out_of_range++;
+            cut = 1;
+            next = i;
+            break;
+        }
+        uint16_t other;
+        long twice = fsck_claim(fs, cluster, count, (uint16_t)(slot + 1), &other);
+        if (twice) {
+            snprintf(what, sizeof(what), "%ld of clusters %ld-%ld also used by %s",
+                     twice, cluster, cluster + count - 1, fsck_owner_name(fs, other));
+            fsck_problem(fs, name, what);
+            fs->stats->cross_linked += twice;
+        }
+        allocated += count * FSCK_CLUSTER_SECTORS;
+        next = i + 1;
+    }
+    if (allocated == 0) {
+        fsck_problem(fs, name, "RIB has no segments");
+        fs->stats->bad_entries++;
+        return;
+    }
+
+    /* The RIB takes the first allocated sector; the end marker wins if it fits */
+    long capacity = allocated - 1;
+    int size = (rib[FSCK_RIB_SIZE] << 8) | rib[FSCK_RIB_SIZE + 1];
+    int last = rib[FSCK_RIB_LAST];
+    long target = (end >= 0 && end <= capacity) ? end : (size <= capacity) ? size : capacity;
+    int bad_last = (last == 0 || last > MDOS_SECTOR_SIZE);
+    if (size == target && end == target && !bad_last && !cut) {
+        return;
+    }
+    if (!cut) {
+        fs->stats->bad_sizes++;
+        if (end < 0) {
+            snprintf(what, sizeof(what), "no end marker; size %d, %ld sectors allocated", size, capacity);
+        } else if (size != target || end != target) {
+            snprintf(what, sizeof(what), "size %d but end marker %d, %ld sectors allocated",
+                     size, end, capacity);
+        } else {
+            snprintf(what, sizeof(what), "last_size %d", last);
+        }
+        if (bad_last && (size != target || end != target)) {
+            size_t n = strlen(what);
+            snprintf(what + n, sizeof(what) - n, "; last_size %d", last);
+        }
+        fsck_problem(fs, name, what);
+    }
+
+    /* Size and last_size in place, then the end marker right after the last segment */
+    if (!repair || next >= FSCK_SDWS) {
+        return;
+    }
+    memset(rib + 2 * next, 0, 2 * (FSCK_SDWS - next));
+    rib[2 * next] = (uint8_t)(0x80 | (target >> 8));
+    rib[2 * next + 1] = (uint8_t)target;
+    rib[FSCK_RIB_SIZE] = (uint8_t)(target >> 8);
+    rib[FSCK_RIB_SIZE + 1] = (uint8_t)target;
+    if (bad_last) {
+        rib[FSCK_RIB_LAST] = MDOS_SECTOR_SIZE;
+    }
+    fsck_mark_dirty(fs, rib_sector);
+    fs->stats->repaired++;
+}
+
+/* "first-last, ..." for the set bits of map */
+static void fsck_ranges(const fsck_map_t map, char *out, size_t cap) {
+    size_t used = 0;
+    int ranges = 0;
+    out[0] = '\0';
+    for (long c = 0; c < MDOS_CAT_CLUSTERS && ranges <= FSCK_MAX_RANGES; c++) {
+        if (!(map[c >> 6] & (1ULL << (63 - (c & 63))))) {
+            continue;
+        }
+        long first = c;
+        while (c + 1 < MDOS_CAT_CLUSTERS && (map[(c + 1) >> 6] & (1ULL << (63 - ((c + 1) & 63))))) {
+            c++;
+        }
+        if (++ranges > FSCK_MAX_RANGES) {
+            snprintf(out + used, cap - used, ", ...");
+        } else if (first == c) {
+            used += snprintf(out + used, cap - used, "%s%ld", used ? ", " : "", first);
+        } else {
+            used += snprintf(out + used, cap - used, "%s%ld-%ld", used ? ", " : "", first, c);
+        }
+        if (used >= cap) break;
+    }
+}
+
+/* The CAT against the claimed clusters: XOR finds every difference at once */
+static void fsck_cat(fsck_t *fs, int repair) {
+    uint8_t *cat_bytes = fs->image + MDOS_CAT_SECTOR * MDOS_SECTOR_SIZE;
+    fsck_map_t cat, disk, leaked, unallocated;
+    fsck_load_map(cat_bytes, cat);
+
+    for (long w = 0; w < FSCK_WORDS; w++) {
+        disk[w] = fsck_word_mask(w, 0, fs->clusters);
+        uint64_t differ = (cat[w] ^ fs->used[w]) & disk[w];
+        leaked[w] = differ & cat[w];
+        unallocated[w] = differ & fs->used[w];
+        fs->stats->allocated += __builtin_popcountll(cat[w] & disk[w]);
+        fs->stats->claimed += __builtin_popcountll(fs->used[w]);
+        fs->stats->leaked += __builtin_popcountll(leaked[w]);
+        fs->stats->unallocated += __builtin_popcountll(unallocated[w]);
+    }
+
+    char what[200], ranges[128];
+    if (fs->stats->leaked) {
+        fsck_ranges(leaked, ranges, sizeof(ranges));
+        snprintf(what, sizeof(what), "%ld clusters allocated in the CAT but used by nothing: %s",
+                 fs->stats->leaked, ranges);
+        fsck_problem(fs, NULL, what);
+    }
+    if (fs->stats->unallocated) {
+        fsck_ranges(unallocated, ranges, sizeof(ranges));
+        snprintf(what, sizeof(what), "%ld clusters in use but free in the CAT: %s",
+                 fs->stats->unallocated, ranges);
+        fsck_problem(fs, NULL, what);
+    }
+    if (!repair || !(fs->stats->leaked || fs->stats->unallocated)) {
+        return;
+    }
+
+    /* Bits past the end of the disk are kept as they are */
+    for (long w = 0; w < FSCK_WORDS; w++) {
+        cat[w] = fs->used[w] | (cat[w] & ~disk[w]);
+    }
+    fsck_store_map(cat, cat_bytes);
+    fsck_mark_dirty(fs, MDOS_CAT_SECTOR);
+    fs->stats->repaired += (fs->stats->leaked ? 1 : 0) + (fs->stats->unallocated ? 1 : 0);
+}
+
+static int compare_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+int mdos_fsck(const char *image_path, int flags, mdos_fsck_stats_t *stats, FILE *report) {
+    if (!image_path || !stats) {
+        return MDOS_EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+    int repair = (flags & MDOS_FSCK_REPAIR) != 0;
+
+    fsck_t *fs = calloc(1, sizeof(fsck_t));
+    if (!fs) {
+        return MDOS_ENOSPC;
+    }
+    fs->path = image_path;
+    fs->stats = stats;
+    fs->report = report;
+
+    mdos_fs_t *mount = mdos_mount_image(image_path, !repair);
+    if (!mount) {
+        free(fs);
+        return MDOS_ENOENT;
+    }
+
+    /* The whole image, padded to what its geometry holds */
+    mdos_geometry_t g;
+    long length = -1;
+    int result = mdos_image_geometry(mount, &g);
+    if (result == MDOS_EOK && (fseek(mount->fp, 0, SEEK_END) != 0 || (length = ftell(mount->fp)) < 0)) {
+        result = MDOS_EIO;
+    }
+    if (result == MDOS_EOK) {
+        long geometry_sectors = (long)g.cylinders * g.heads * g.sectors * g.sector_size / MDOS_SECTOR_SIZE;
+        fs->sectors = length / MDOS_SECTOR_SIZE;
+        if (fs->sectors < geometry_sectors) fs->sectors = geometry_sectors;
+        fs->clusters = fs->sectors / FSCK_CLUSTER_SECTORS;
+        if (fs->clusters > MDOS_CAT_CLUSTERS) fs->clusters = MDOS_CAT_CLUSTERS;
+        fs->image = calloc(fs->sectors ? fs->sectors : 1, MDOS_SECTOR_SIZE);
+        fs->dirty = malloc((MDOS_DIR_ENTRIES + 1) * sizeof(int));
+        if (!fs->image || !fs->dirty) {
+            result = MDOS_ENOSPC;
+        } else if (mdos_sparse_read(mount->fp, fs->image, length) < 0) {
+            result = MDOS_EIO;
+        } else if (fs->sectors < MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS) {
+            result = MDOS_EINVAL;
+        }
+    }
+
+    if (result == MDOS_EOK) {
+        stats->clusters = fs->clusters;
+
+        /* System area and locked-out clusters are claimed before any file */
+        uint16_t other;
+        fsck_claim(fs, 0, (MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS + FSCK_CLUSTER_SECTORS - 1) /
+                          FSCK_CLUSTER_SECTORS, FSCK_OWNER_SYSTEM, &other);
+        fsck_map_t lockout;
+        fsck_load_map(fs->image + FSCK_LOCKOUT_SECTOR * MDOS_SECTOR_SIZE, lockout);
+        for (long c = 0; c < fs->clusters; c++) {
+            if ((lockout[c >> 6] & (1ULL << (63 - (c & 63)))) && !fs->owner[c]) {
+                fsck_claim(fs, c, 1, FSCK_OWNER_LOCKOUT, &other);
+            }
+        }
+
+        mdos_meta_t meta;
+        memcpy(meta.dir, fs->image + MDOS_DIR_FIRST_SECTOR * MDOS_SECTOR_SIZE, sizeof(meta.dir));
+        for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+            const uint8_t *entry = mdos_meta_entry(&meta, slot);
+            if (entry[0] == 0x00 || entry[0] == 0xFF) {
+                continue;
+            }
+            mdos_meta_entry_name(entry, fs->names[slot]);
+            stats->files++;
+            fsck_file(fs, slot, entry, repair);
+        }
+        fsck_cat(fs, repair);
+    }
+
+    /* Every changed sector once, in order, under the one mount */
+    if (result == MDOS_EOK && fs->ndirty) {
+        qsort(fs->dirty, fs->ndirty, sizeof(int), compare_int);
+        for (int i = 0; i < fs->ndirty && result == MDOS_EOK; i++) {
+            long offset = (long)fs->dirty[i] * MDOS_SECTOR_SIZE;
+            if (fseek(mount->fp, offset, SEEK_SET) != 0 ||
+                fwrite(fs->image + offset, MDOS_SECTOR_SIZE, 1, mount->fp) != 1) {
+                result = MDOS_EIO;
+            }
+        }
+        if (result == MDOS_EOK && fflush(mount->fp) != 0) {
+            result = MDOS_EIO;
+        }
+        stats->sectors_written = (result == MDOS_EOK) ? fs->ndirty : 0;
+    }
+
+    int unmount_result = mdos_unmount_image(mount);
+    if (result == MDOS_EOK) result = unmount_result;
+    if (result != MDOS_EOK) {
+        stats->repaired = 0;
+    }
+    free(fs->image);
+    free(fs->dirty);
+    free(fs);
+    return result;
+}
@@ -0,0 +1,52 @@
+/*
+ * MDOS Filesystem Library - Consistency Check
+ * Copyright (C) 2025
+ *
+ * Cross-check the directory, every RIB and the CAT of an image in one pass,
+ * and optionally repair what can be repaired safely
+ */
+
+#ifndef MDOS_FSCK_H
+#define MDOS_FSCK_H
+
+#include <stdio.h>
+#include "mdos_fs.h"
+
+/* mdos_fsck flags */
+#define MDOS_FSCK_REPAIR 0x01   /* Rewrite bad RIBs and the CAT */
+
+typedef struct {
+    int files;
+    long clusters;          /* Clusters on the disk */
+    long allocated;         /* Set in the CAT */
+    long claimed;           /* Used by the system area and the files */
+    long cross_linked;      /* Clusters claimed twice */
+    long leaked;            /* Allocated in the CAT, used by nothing */
+    long unallocated;       /* Used by a file, free in the CAT */
+    int out_of_range;       /* Segments running past the end of the disk */
+    int bad_sizes;          /* RIBs with a wrong size, last_size or end marker */
+    int bad_entries;        /* Directory entries whose RIB lies outside the disk */
+    int problems;           /* Everything above that needs fixing */
+    int repaired;           /* Of those, fixed by MDOS_FSCK_REPAIR */
+    int sectors_written;
+} mdos_fsck_stats_t;
+
+/*
+ * Check image_path (DSK, IMD or MDZ). Every directory entry and its RIB's
+ * segment descriptors are decoded into a bitmap of claimed clusters, which
+ * is compared with the CAT a 64-bit word at a time: clusters claimed twice
+ * are cross-linked, allocated ones nobody claims are leaked, claimed ones
+ * the CAT marks free are unallocated. Segments past the end of the disk
+ * and RIBs whose size, last_size or end marker disagree are reported too.
+ * Each problem is printed on report as "image: what".
+ *
+ * With MDOS_FSCK_REPAIR, RIB sizes are corrected (the end marker wins when
+ * it fits the allocation), segment lists are cut before a segment past the
+ * end of the disk, and the CAT is rebuilt from the claimed clusters and the
+ * lockout table. Cross-linked clusters and entries without a RIB are left
+ * alone. The changed sectors are written in one pass, in sector order.
+ * Returns MDOS_EOK whether or not problems were found.
+ */
+int mdos_fsck(const char *image_path, int flags, mdos_fsck_stats_t *stats, FILE *report);
+
+#endif /* MDOS_FSCK_H */
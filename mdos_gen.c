@@ -0,0 +1,449 @@
+/*
+ * MDOS Filesystem Library - Synthetic Image Generator
+ * Copyright (C) 2025
+ *
+ * mkfs, then every file is planned against the in-memory CAT and written
+ * sector by sector; the CAT and directory go back once at the end
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mdos_internal.h"
+#include "mdos_gen.h"
+#include "mdos_imd.h"
+#include "mdos_geometry.h"
+
+#define GEN_CLUSTER_SECTORS 4
+#define GEN_SDWS            57      /* Segment descriptors in a RIB, the end marker included */
+#define GEN_EXTENT_MAX      32      /* Clusters one SDW describes */
+#define GEN_MAX_SIZE        (48 * 1024L)
+
+typedef struct {
+    uint64_t rng;
+    uint8_t *cat;
+    int limit;              /* Clusters inside the disk's geometry */
+    int cursor;             /* Next cluster to allocate from */
+} gen_t;
+
+/* splitmix64: any seed, 0 included, gives a full-period stream */
+static uint64_t gen_next(gen_t *g) {
+    uint64_t z = (g->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static long gen_range(gen_t *g, long low, long high) {
+    return low + (long)(gen_next(g) % (uint64_t)(high - low + 1));
+}
+
+static int gen_chance(gen_t *g, double p) {
+    return (gen_next(g) >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+static long gen_size(gen_t *g, const mdos_gen_opts_t *opts) {
+    switch (opts->size_dist) {
+    case MDOS_GEN_SIZES_SMALL:
+        return gen_range(g, 64, 2048);
+    case MDOS_GEN_SIZES_LARGE:
+        return gen_range(g, 8 * 1024, GEN_MAX_SIZE);
+    case MDOS_GEN_SIZES_UNIFORM:
+        return gen_range(g, opts->min_size, opts->max_size);
+    default:
+        /* 64 << 0..8, then uniform within the octave: 64 bytes to 32K */
+        {
+            long low = 64L << gen_range(g, 0, 8);
+            return gen_range(g, low, low * 2);
+        }
+    }
+}
+
+/* Text */
+
+static const char *const gen_opcodes[] = {
+    "LDAA", "LDAB", "STAA", "STAB", "LDX", "STX", "JSR", "JMP", "BRA", "BEQ",
+    "BNE", "BCC", "CMPA", "ADDA", "SUBA", "ANDA", "INX", "DEX", "RTS", "TSTA",
+};
+
+static const char *const gen_operands[] = {
+    "#$20", "#$0D", "0,X", "1,X", "BUFFER", "TABLE,X", "COUNT", "$E000", "#MSG", "PTR",
+};
+
+static const char *const gen_words[] = {
+    "LOOP", "NEXT", "DONE", "GETC", "PUTC", "INIT", "SCAN", "MOVE", "TEST", "EXIT",
+};
+
+/* Append a run of n spaces, compressed as MDOS does when it is longer than one */
+static size_t gen_spaces(uint8_t *out, size_t n, int spaces) {
+    if (spaces == 1) {
+        out[n++] = ' ';
+    } else if (spaces > 1) {
+        out[n++] = 0x80 | spaces;
+    }
+    return n;
+}
+
+static size_t gen_append(uint8_t *out, size_t n, const char *s) {
+    size_t len = strlen(s);
+    memcpy(out + n, s, len);
+    return n + len;
+}
+
+/* Assembler source: label, opcode, operand and comment columns, CR line ends */
+static void gen_text(gen_t *g, uint8_t *out, size_t size) {
+    size_t n = 0;
+    char label[16];
+
+    while (n < size) {
+        uint8_t line[96];
+        size_t len = 0;
+        int kind = (int)gen_range(g, 0, 9);
+        if (kind == 0) {
+            len = gen_append(line, len, "* ");
+            len = gen_append(line, len, gen_words[gen_next(g) % 10]);
+            len = gen_append(line, len, " ROUTINE");
+        } else {
+            int column = 0;
+            if (kind == 1) {
+                snprintf(label, sizeof(label), "%s%d", gen_words[gen_next(g) % 10], (int)gen_range(g, 0, 99));
+                len = gen_append(line, len, label);
+                column = (int)len;
+            }
+            len = gen_spaces(line, len, column < 7 ? 8 - column : 1);
+            len = gen_append(line, len, gen_opcodes[gen_next(g) % 20]);
+            len = gen_spaces(line, len, 2);
+            len = gen_append(line, len, gen_operands[gen_next(g) % 10]);
+            if (kind >= 7) {
+                len = gen_spaces(line, len, (int)gen_range(g, 4, 12));
+                len = gen_append(line, len, gen_words[gen_next(g) % 10]);
+            }
+        }
+        line[len++] = '\r';
+
+        size_t chunk = (len < size - n) ? len : size - n;
+        memcpy(out + n, line, chunk);
+        n += chunk;
+    }
+}
+
+/* 6800-like code: opcodes and operands, with fill runs and message strings */
+static void gen_binary(gen_t *g, uint8_t *out, size_t size) {
+    size_t n = 0;
+    while (n < size) {
+        int kind = (int)gen_range(g, 0, 15);
+        size_t run;
+        if (kind == 0) {
+            run = (size_t)gen_range(g, 8, 64);
+            uint8_t fill = (gen_next(g) & 1) ? 0xFF : 0x00;
+            if (run > size - n) run = size - n;
+            memset(out + n, fill, run);
+        } else if (kind == 1) {
+            const char *text = gen_words[gen_next(g) % 10];
+            run = strlen(text);
+            if (run > size - n) run = size - n;
+            memcpy(out + n, text, run);
+        } else {
+            uint64_t r = gen_next(g);
+            uint8_t insn[3] = { (uint8_t)(0x80 | (r & 0x7F)), (uint8_t)(r >> 8), (uint8_t)(r >> 16) };
+            run = 1 + (r >> 24) % 3;
+            if (run > size - n) run = size - n;
+            memcpy(out + n, insn, run);
+        }
+        n += run;
+    }
+}
+
+/* Allocation */
+
+static int gen_cluster_used(const uint8_t *cat, int c) {
+    return cat[c >> 3] & (1 << (7 - (c & 7)));
+}
+
+static void gen_cluster_take(uint8_t *cat, int c) {
+    cat[c >> 3] |= 1 << (7 - (c & 7));
+}
+
+/* The next free cluster from the cursor on, wrapping once; -1 if the disk is full */
+static int gen_find_free(gen_t *g) {
+    for (int i = 0; i < g->limit; i++) {
+        int c = (g->cursor + i) % g->limit;
+        if (!gen_cluster_used(g->cat, c)) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Allocate clusters as up to `pieces` runs with 1-3 free clusters skipped
+ * between them; a run also ends where a used cluster or the end of the disk
+ * interrupts it. Fills the RIB's SDWs and returns the number of extents
+ * (contiguous runs, which take one SDW per 32 clusters), or MDOS_ENOSPC
+ * with nothing taken.
+ */
+static int gen_alloc(gen_t *g, mdos_rib_t *rib, int clusters, int pieces) {
+    int x = 0, left = clusters, extents = 0, end = -1;
+
+    memset(rib->sdw, 0, sizeof(rib->sdw));
+    while (left > 0) {
+        int piece = (pieces > 1) ? (left + pieces - 1) / pieces : left;
+        int start = gen_find_free(g);
+        if (start < 0 || x == (GEN_SDWS - 1) * 2) {
+            rib->sdw[x] = 0x80;
+            mdos_cat_release(g->cat, rib);
+            return MDOS_ENOSPC;
+        }
+
+        /* One extent: consecutive free clusters, at most GEN_EXTENT_MAX */
+        int count = 0;
+        while (count < piece && count < GEN_EXTENT_MAX && start + count < g->limit &&
+               !gen_cluster_used(g->cat, start + count)) {
+            gen_cluster_take(g->cat, start + count);
+            count++;
+        }
+        extents += start != end;
+        end = start + count;
+        int sdw = ((count - 1) << 10) | start;
+        rib->sdw[x] = (uint8_t)(sdw >> 8);
+        rib->sdw[x + 1] = sdw & 0xFF;
+        x += 2;
+        left -= count;
+        g->cursor = start + count;
+
+        if (count == piece && pieces > 1) {
+            pieces--;
+            /* Leave a gap for a later file */
+            for (int skip = (int)gen_range(g, 1, 3); skip > 0 && g->cursor < g->limit; g->cursor++) {
+                if (!gen_cluster_used(g->cat, g->cursor)) skip--;
+            }
+        }
+        if (g->cursor >= g->limit) {
+            g->cursor = 0;
+        }
+    }
+    return extents;
+}
+
+/* Write one file's RIB and data; returns its extents or an error with nothing changed */
+static int gen_file(mdos_fs_t *fs, mdos_meta_t *meta, gen_t *g, const char *name, int type,
+                    const uint8_t *data, size_t size, int pieces) {
+    mdos_rib_t rib;
+    int sects = (int)((size + MDOS_SECTOR_SIZE - 1) / MDOS_SECTOR_SIZE);
+    int clusters = (sects + 1 + GEN_CLUSTER_SECTORS - 1) / GEN_CLUSTER_SECTORS;
+
+    memset(&rib, 0, sizeof(rib));
+    int extents = gen_alloc(g, &rib, clusters, pieces < clusters ? pieces : clusters);
+    if (extents < 0) {
+        return extents;
+    }
+    int x = 0;
+    while (rib.sdw[x] || rib.sdw[x + 1]) x += 2;  /* Cluster 0 is the system area's, never a file's */
+    rib.sdw[x] = 0x80 | ((sects >> 8) & 0x7F);
+    rib.sdw[x + 1] = sects & 0xFF;
+
+    int last = size % MDOS_SECTOR_SIZE;
+    rib.last_size = last ? last : MDOS_SECTOR_SIZE;
+    rib.size_high = (sects >> 8) & 0xFF;
+    rib.size_low = sects & 0xFF;
+    if (type == MDOS_TYPE_IMAGE) {
+        uint16_t load = (uint16_t)(gen_next(g) & 0x7F00);
+        uint16_t start = load + (uint16_t)(gen_next(g) % (size < 256 ? size : 256));
+        rib.addr_high = load >> 8;
+        rib.addr_low = load & 0xFF;
+        rib.pc_high = start >> 8;
+        rib.pc_low = start & 0xFF;
+    }
+
+    int rib_sector = mdos_lsn_to_psn(&rib, 0);
+    if (mdos_meta_add_entry(meta, name, rib_sector, type) < 0) {
+        mdos_cat_release(g->cat, &rib);
+        return MDOS_ENOSPC;
+    }
+
+    uint8_t buffer[MDOS_SECTOR_SIZE];
+    mdos_putsect(fs, (uint8_t *)&rib, rib_sector);
+    for (int lsn = 1; lsn <= sects; lsn++) {
+        size_t offset = (size_t)(lsn - 1) * MDOS_SECTOR_SIZE;
+        size_t chunk = size - offset;
+        if (chunk > MDOS_SECTOR_SIZE) chunk = MDOS_SECTOR_SIZE;
+
+        memset(buffer, 0, sizeof(buffer));
+        memcpy(buffer, data + offset, chunk);
+        mdos_putsect(fs, buffer, mdos_lsn_to_psn(&rib, lsn));
+    }
+    return extents;
+}
+
+/* Damage */
+
+/*
+ * Rewrite an IMD with the chosen sectors recorded as "data unavailable"
+ * (type 0, no data). Sectors of clusters marked in system are never chosen.
+ */
+static int gen_damage(const char *imd_path, gen_t *g, const mdos_geometry_t *geometry,
+                      const uint8_t *system, double p, long *damaged) {
+    FILE *fp = fopen(imd_path, "rb");
+    if (!fp) {
+        return MDOS_EIO;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    uint8_t *in = malloc(size > 0 ? size : 1);
+    uint8_t *out = malloc(size > 0 ? size : 1);
+    int ok = in && out && fseek(fp, 0, SEEK_SET) == 0 && fread(in, 1, size, fp) == (size_t)size;
+    fclose(fp);
+
+    /* Comment block, up to and including the 0x1A terminator */
+    long i = 0, o = 0;
+    while (ok && i < size && in[i] != 0x1A) i++;
+    ok = ok && i < size;
+    if (ok) {
+        memcpy(out, in, ++i);
+        o = i;
+    }
+
+    while (ok && i < size) {
+        if (i + 5 > size) {
+            ok = 0;
+            break;
+        }
+        int cylinder = in[i + 1], head = in[i + 2] & 1, count = in[i + 3], size_code = in[i + 4];
+        long maps = 5 + count + ((in[i + 2] & 0x80) ? count : 0) + ((in[i + 2] & 0x40) ? count : 0);
+        long sector_size = 128L << size_code;
+        if (size_code > 6 || i + maps > size) {
+            ok = 0;
+            break;
+        }
+        const uint8_t *map = in + i + 5;
+        memcpy(out + o, in + i, maps);
+        i += maps;
+        o += maps;
+
+        for (int s = 0; s < count && ok; s++) {
+            int type = (i < size) ? in[i] : 9;
+            long length = 1 + mdos_geometry_imd_data_length(type, sector_size);
+            if (length == 0 || i + length > size) {
+                ok = 0;
+                break;
+            }
+
+            long offset = mdos_geometry_offset(geometry, cylinder, head, map[s]);
+            long cluster = (offset < 0) ? -1 : offset / (MDOS_SECTOR_SIZE * GEN_CLUSTER_SECTORS);
+            if (type != 0 && cluster >= 0 && cluster < MDOS_CAT_CLUSTERS &&
+                !gen_cluster_used(system, (int)cluster) && gen_chance(g, p)) {
+                out[o++] = 0x00;
+                (*damaged)++;
+            } else {
+                memcpy(out + o, in + i, length);
+                o += length;
+            }
+            i += length;
+        }
+    }
+
+    if (ok) {
+        fp = fopen(imd_path, "wb");
+        ok = fp && fwrite(out, 1, o, fp) == (size_t)o;
+        if (fp && fclose(fp) != 0) ok = 0;
+    }
+    free(in);
+    free(out);
+    return ok ? MDOS_EOK : MDOS_EIO;
+}
+
+/* Generator */
+
+int mdos_gen(const char *path, const mdos_gen_opts_t *opts, mdos_gen_stats_t *stats) {
+    static const mdos_gen_opts_t defaults = MDOS_GEN_DEFAULTS;
+    if (!opts) {
+        opts = &defaults;
+    }
+    if (!path || !stats || opts->files < 0 || (opts->sides != 1 && opts->sides != 2) ||
+        (opts->size_dist == MDOS_GEN_SIZES_UNIFORM &&
+         (opts->min_size < 1 || opts->max_size < opts->min_size || opts->max_size > GEN_MAX_SIZE)) ||
+        opts->fragmentation < 0 || opts->fragmentation > 1 ||
+        opts->text_ratio < 0 || opts->text_ratio > 1 ||
+        opts->missing_sectors < 0 || opts->missing_sectors > 1 ||
+        (opts->missing_sectors > 0 && !opts->imd)) {
+        return MDOS_EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    char dsk_path[1024];
+    snprintf(dsk_path, sizeof(dsk_path), opts->imd ? "%s.gen" : "%s", path);
+    int result = mdos_mkfs(dsk_path, opts->sides);
+    mdos_fs_t *fs = (result == MDOS_EOK) ? mdos_mount(dsk_path, 0) : NULL;
+    if (!fs) {
+        if (opts->imd) remove(dsk_path);
+        return (result != MDOS_EOK) ? result : MDOS_EIO;
+    }
+
+    mdos_meta_t *meta = malloc(sizeof(mdos_meta_t));
+    uint8_t *data = malloc(GEN_MAX_SIZE);
+    uint8_t system[MDOS_SECTOR_SIZE];
+    mdos_geometry_t geometry;
+    gen_t g = { opts->seed, NULL, 0, 0 };
+    if (!meta || !data) {
+        result = MDOS_ENOSPC;
+    } else if ((result = mdos_image_geometry(fs, &geometry)) == MDOS_EOK) {
+        mdos_meta_load(fs, meta);
+        memcpy(system, meta->cat, sizeof(system));
+        g.cat = meta->cat;
+        g.limit = (int)(mdos_geometry_bytes(&geometry) / (MDOS_SECTOR_SIZE * GEN_CLUSTER_SECTORS));
+        if (g.limit > MDOS_CAT_CLUSTERS) g.limit = MDOS_CAT_CLUSTERS;
+    }
+
+    for (int i = 0; i < opts->files && result == MDOS_EOK; i++) {
+        static const char *const prefixes[] = { "prog", "test", "edit", "asm", "link", "data", "util", "main" };
+        int text = gen_chance(&g, opts->text_ratio);
+        int type = text ? MDOS_TYPE_ASCII : (gen_chance(&g, 0.75) ? MDOS_TYPE_IMAGE : MDOS_TYPE_OBJECT);
+        size_t size = (size_t)gen_size(&g, opts);
+        int pieces = gen_chance(&g, opts->fragmentation) ? (int)gen_range(&g, 2, 4) : 1;
+        char name[MDOS_MAX_FILENAME];
+        snprintf(name, sizeof(name), "%s%d.%s", prefixes[gen_next(&g) % 8], i,
+                 text ? "sa" : (type == MDOS_TYPE_IMAGE) ? "lo" : "ro");
+
+        if (text) {
+            gen_text(&g, data, size);
+        } else {
+            gen_binary(&g, data, size);
+        }
+        int extents = gen_file(fs, meta, &g, name, type, data, size, pieces);
+        if (extents == MDOS_ENOSPC) {
+            stats->full = 1;
+            break;
+        }
+        if (extents < 0) {
+            result = extents;
+            break;
+        }
+        stats->files++;
+        stats->text_files += text;
+        stats->bytes += (long)size;
+        stats->extents += extents;
+        stats->fragmented += extents > 1;
+    }
+
+    if (meta) {
+        meta->cat_dirty = 1;
+        mdos_meta_commit(fs, meta);
+    }
+    if (result == MDOS_EOK && opts->imd) {
+        result = mdos_save_imd(fs, path, NULL);
+    }
+    int unmount_result = mdos_unmount(fs);
+    if (result == MDOS_EOK) {
+        result = unmount_result;
+    }
+    if (opts->imd) {
+        remove(dsk_path);
+    }
+    if (result == MDOS_EOK && opts->missing_sectors > 0) {
+        result = gen_damage(path, &g, &geometry, system, opts->missing_sectors, &stats->missing_sectors);
+    }
+
+    free(data);
+    free(meta);
+    return result;
+}
@@ -0,0 +1,60 @@
+/*
+ * MDOS Filesystem Library - Synthetic Image Generator
+ * Copyright (C) 2025
+ *
+ * Build valid MDOS images from a seed: a mix of space-compressed assembler
+ * source and binary files, with a chosen share of fragmented files and,
+ * for IMD output, unreadable sectors. The same options and seed always
+ * give the same image.
+ */
+
+#ifndef MDOS_GEN_H
+#define MDOS_GEN_H
+
+#include <stdint.h>
+#include "mdos_fs.h"
+
+/* File size distributions */
+#define MDOS_GEN_SIZES_MIXED    0   /* Log-uniform 64 bytes - 32K: mostly small, some large */
+#define MDOS_GEN_SIZES_SMALL    1   /* Uniform 64 bytes - 2K */
+#define MDOS_GEN_SIZES_LARGE    2   /* Uniform 8K - 48K */
+#define MDOS_GEN_SIZES_UNIFORM  3   /* Uniform min_size - max_size */
+
+typedef struct {
+    uint64_t seed;
+    int files;              /* Files to create; fewer if the disk or directory fills up */
+    int sides;              /* 1 or 2 */
+    int size_dist;          /* MDOS_GEN_SIZES_* */
+    long min_size, max_size;    /* Bytes, for MDOS_GEN_SIZES_UNIFORM */
+    double fragmentation;   /* Chance a file of two clusters or more is split into 2-4 extents */
+    double text_ratio;      /* Share of ASCII source files; the rest are binaries */
+    int imd;                /* Write an IMD instead of a DSK */
+    double missing_sectors; /* IMD only: chance a sector outside the system area is unreadable */
+} mdos_gen_opts_t;
+
+#define MDOS_GEN_DEFAULTS { 1, 40, 1, MDOS_GEN_SIZES_MIXED, 0, 0, 0.0, 0.5, 0, 0.0 }
+
+typedef struct {
+    int files;              /* Files created */
+    int text_files;         /* Of those, ASCII */
+    long bytes;             /* File bytes */
+    int extents;            /* Contiguous cluster runs of every file */
+    int fragmented;         /* Files in more than one extent */
+    long missing_sectors;   /* Sectors written to the IMD as "data unavailable" */
+    int full;               /* Stopped before opts->files: no room for the next file */
+} mdos_gen_stats_t;
+
+/*
+ * Generate an image at path (NULL opts: MDOS_GEN_DEFAULTS). Files are laid
+ * out from the first free cluster on; a fragmented file leaves 1-3 free
+ * clusters between its extents, which later files fill once the end of the
+ * disk is reached. Clusters past the disk's geometry (the slack of a
+ * single-sided DSK) are not used, so the DSK and IMD of a seed hold the
+ * same files. An IMD is built through a scratch DSK next to it and its
+ * damaged sectors are chosen from the clusters the new filesystem did not
+ * reserve, so it still mounts. Returns MDOS_EOK, with stats->full set if
+ * not every file fitted, or an error code.
+ */
+int mdos_gen(const char *path, const mdos_gen_opts_t *opts, mdos_gen_stats_t *stats);
+
+#endif /* MDOS_GEN_H */
@@ -0,0 +1,380 @@
+/*
+ * MDOS Filesystem Library - Disk Geometry
+ * Copyright (C) 2025
+ *
+ * One geometry descriptor for the library and the standalone tools
+ * (header only, so mdosextract, imdtodsk and dsktoimd still build from a
+ * single .c file)
+ */
+
+#ifndef MDOS_GEOMETRY_H
+#define MDOS_GEOMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Standard MDOS floppy: 77 cylinders, 26 sectors of 128 bytes, one side */
+#define MDOS_GEOM_CYLINDERS     77
+#define MDOS_GEOM_SECTORS       26
+#define MDOS_GEOM_SECTOR_SIZE   128
+#define MDOS_GEOM_MAX_CYLINDERS 256     /* IMD cylinder numbers are one byte */
+
+typedef struct {
+    int cylinders;
+    int heads;              /* 1 or 2 */
+    int sectors;            /* Sectors per track */
+    int size_code;          /* IMD size code: sector_size = 128 << size_code */
+    int sector_size;
+    int first_sector;       /* Lowest sector number (1 on MDOS disks) */
+} mdos_geometry_t;
+
+#define MDOS_GEOMETRY_STANDARD \
+    { MDOS_GEOM_CYLINDERS, 1, MDOS_GEOM_SECTORS, 0, MDOS_GEOM_SECTOR_SIZE, 1 }
+
+/*
+ * Address helpers are forced inline: called with a constant standard
+ * geometry they fold to constant arithmetic. That is how callers build
+ * their fast path: a forced-inline loop taking the geometry, called through
+ * MDOS_GEOM_DISPATCH, which checks mdos_geometry_is_standard once per image
+ * and passes the constant descriptor to one copy of the loop.
+ */
+#if defined(__GNUC__)
+#define MDOS_GEOM_INLINE static inline __attribute__((always_inline))
+#else
+#define MDOS_GEOM_INLINE static inline
+#endif
+
+MDOS_GEOM_INLINE int mdos_geometry_is_standard(const mdos_geometry_t *g) {
+    return g->cylinders == MDOS_GEOM_CYLINDERS && g->heads == 1 &&
+           g->sectors == MDOS_GEOM_SECTORS && g->size_code == 0 && g->first_sector == 1;
+}
+
+static const mdos_geometry_t mdos_geometry_standard = MDOS_GEOMETRY_STANDARD;
+
+/* fn(g, ...), with the constant standard descriptor when g is standard */
+#define MDOS_GEOM_DISPATCH(fn, g, ...) \
+    (mdos_geometry_is_standard(g) ? fn(&mdos_geometry_standard, __VA_ARGS__) : fn((g), __VA_ARGS__))
+
+MDOS_GEOM_INLINE long mdos_geometry_track_bytes(const mdos_geometry_t *g) {
+    return (long)g->sectors * g->sector_size;
+}
+
+MDOS_GEOM_INLINE long mdos_geometry_bytes(const mdos_geometry_t *g) {
+    return (long)g->cylinders * g->heads * mdos_geometry_track_bytes(g);
+}
+
+/* Byte offset of a sector in the linear (DSK) image, or -1 outside it */
+MDOS_GEOM_INLINE long mdos_geometry_offset(const mdos_geometry_t *g, int cylinder, int head, int sector) {
+    int index = sector - g->first_sector;
+    if (cylinder < 0 || cylinder >= g->cylinders || head < 0 || head >= g->heads ||
+        index < 0 || index >= g->sectors) {
+        return -1;
+    }
+    return (((long)cylinder * g->heads + head) * g->sectors + index) * g->sector_size;
+}
+
+/* Cylinder, head and sector number holding a byte of the linear image */
+MDOS_GEOM_INLINE void mdos_geometry_locate(const mdos_geometry_t *g, long offset,
+                                           int *cylinder, int *head, int *sector) {
+    long physical = offset / g->sector_size;
+    long track = physical / g->sectors;
+    *sector = (int)(physical % g->sectors) + g->first_sector;
+    *cylinder = (int)(track / g->heads);
+    *head = (int)(track % g->heads);
+}
+
+/*
+ * Widen a geometry to cover one IMD track record. Start from a zeroed
+ * descriptor; head_byte is the raw IMD head field (bit 0 = head, bits 6-7
+ * flag the optional maps). Returns -1 if the track's sector size differs
+ * from the tracks seen before, which a linear image cannot represent.
+ */
+static inline int mdos_geometry_add_track(mdos_geometry_t *g, int cylinder, int head_byte,
+                                          int count, int size_code, const uint8_t *map) {
+    if (count == 0) {
+        return 0;
+    }
+    if (g->sectors == 0) {
+        g->size_code = size_code;
+        g->sector_size = MDOS_GEOM_SECTOR_SIZE << size_code;
+        g->first_sector = map[0];
+        g->heads = 1;
+    } else if (g->size_code != size_code) {
+        return -1;
+    }
+
+    if (cylinder + 1 > g->cylinders) g->cylinders = cylinder + 1;
+    if ((head_byte & 1) + 1 > g->heads) g->heads = (head_byte & 1) + 1;
+    for (int s = 0; s < count; s++) {
+        if (map[s] < g->first_sector) {
+            g->sectors += g->first_sector - map[s];
+            g->first_sector = map[s];
+        }
+        if (map[s] - g->first_sector + 1 > g->sectors) {
+            g->sectors = map[s] - g->first_sector + 1;
+        }
+    }
+    return 0;
+}
+
+/* Finish a geometry built with mdos_geometry_add_track */
+static inline void mdos_geometry_finish(mdos_geometry_t *g) {
+    if (g->sectors == 0) {
+        mdos_geometry_t standard = MDOS_GEOMETRY_STANDARD;
+        *g = standard;
+    } else if (g->cylinders < MDOS_GEOM_CYLINDERS) {
+        g->cylinders = MDOS_GEOM_CYLINDERS; /* Trailing empty tracks are often omitted */
+    }
+}
+
+/* Bytes of sector data following an IMD sector type byte (-1: unknown type) */
+static inline long mdos_geometry_imd_data_length(int sector_type, int sector_size) {
+    if (sector_type == 0) return 0;             /* Data unavailable */
+    if (sector_type > 8) return -1;
+    return (sector_type & 1) ? sector_size : 1; /* Odd: data, even: fill byte */
+}
+
+/* One IMD track record, as mdos_geometry_imd_record finds it */
+typedef struct {
+    int cylinder;
+    int head_byte;          /* Head in bit 0, map flags in bits 6-7 */
+    int count;
+    int size_code;
+    const uint8_t *map;     /* count sector numbers */
+    long sectors;           /* Offset of the first sector type byte */
+    long next;              /* Offset of the next record */
+} mdos_geometry_imd_record_t;
+
+/*
+ * Parse the track record at pos of the track records imd[0..len). Sectors
+ * of an unknown type are taken to hold data. Returns 1, 0 when fewer bytes
+ * than a header are left, or -1 if the record is truncated or has a bad
+ * size code.
+ */
+static inline int mdos_geometry_imd_record(const uint8_t *imd, long len, long pos,
+                                           mdos_geometry_imd_record_t *r) {
+    if (pos + 5 > len) {
+        return 0;
+    }
+    const uint8_t *header = imd + pos;
+    r->cylinder = header[1];
+    r->head_byte = header[2];
+    r->count = header[3];
+    r->size_code = header[4];
+    r->map = header + 5;
+    pos += 5 + r->count;
+    if (r->head_byte & 0x80) pos += r->count;  /* Optional cylinder map */
+    if (r->head_byte & 0x40) pos += r->count;  /* Optional head map */
+    if (r->size_code > 6 || pos > len) {
+        return -1;
+    }
+    r->sectors = pos;
+
+    int sector_size = MDOS_GEOM_SECTOR_SIZE << r->size_code;
+    for (int s = 0; s < r->count; s++) {
+        if (pos >= len) return -1;
+        long data = mdos_geometry_imd_data_length(imd[pos], sector_size);
+        pos += 1 + (data < 0 ? sector_size : data);
+    }
+    if (pos > len) {
+        return -1;
+    }
+    r->next = pos;
+    return 1;
+}
+
+/*
+ * Build the geometry of the track records imd[pos..len) (the bytes after
+ * the comment). Returns the number of tracks, -1 if a record is truncated
+ * or bad, -2 if the tracks mix sector sizes; *sectors counts the sectors.
+ */
+static inline int mdos_geometry_scan_imd(mdos_geometry_t *g, const uint8_t *imd, long len, long pos,
+                                         long *sectors) {
+    mdos_geometry_imd_record_t r;
+    int tracks = 0, found;
+    memset(g, 0, sizeof(*g));
+    *sectors = 0;
+
+    while ((found = mdos_geometry_imd_record(imd, len, pos, &r)) > 0) {
+        if (mdos_geometry_add_track(g, r.cylinder, r.head_byte, r.count, r.size_code, r.map) != 0) {
+            return -2;
+        }
+        *sectors += r.count;
+        tracks++;
+        pos = r.next;
+    }
+    if (found < 0) {
+        return -1;
+    }
+    mdos_geometry_finish(g);
+    return tracks;
+}
+
+/*
+ * Copy every sector of the track records at its offset in image (a linear
+ * image of mdos_geometry_bytes(g)) and set valid[] for each 128-byte sector
+ * covered. Records must have passed mdos_geometry_scan_imd. Returns the
+ * sectors placed; those outside the geometry are skipped.
+ */
+MDOS_GEOM_INLINE long mdos_geometry_place_imd_tracks(const mdos_geometry_t *g, const uint8_t *imd,
+                                                     long len, long pos, uint8_t *image, bool *valid) {
+    mdos_geometry_imd_record_t r;
+    long placed = 0;
+
+    while (mdos_geometry_imd_record(imd, len, pos, &r) > 0) {
+        const uint8_t *p = imd + r.sectors;
+        for (int s = 0; s < r.count; s++) {
+            int sector_type = *p++;
+            long data = mdos_geometry_imd_data_length(sector_type, g->sector_size);
+            long offset = mdos_geometry_offset(g, r.cylinder, r.head_byte & 1, r.map[s]);
+            if (data < 0) {
+                data = g->sector_size;          /* Unknown type: treat as data */
+                sector_type = 1;
+            }
+
+            if (offset >= 0) {
+                uint8_t *sector = image + offset;
+                if (sector_type == 0) {
+                    memset(sector, 0, g->sector_size);
+                } else if (sector_type & 1) {
+                    memcpy(sector, p, g->sector_size);
+                } else {
+                    memset(sector, *p, g->sector_size);
+                }
+                for (int i = 0; i < g->sector_size / MDOS_GEOM_SECTOR_SIZE; i++) {
+                    valid[offset / MDOS_GEOM_SECTOR_SIZE + i] = true;
+                }
+                placed++;
+            }
+            p += data;
+        }
+        pos = r.next;
+    }
+    return placed;
+}
+
+static inline long mdos_geometry_place_imd(const mdos_geometry_t *g, const uint8_t *imd, long len, long pos,
+                                           uint8_t *image, bool *valid) {
+    return MDOS_GEOM_DISPATCH(mdos_geometry_place_imd_tracks, g, imd, len, pos, image, valid);
+}
+
+/*
+ * Geometry of a raw DSK image. DSK files carry no geometry, so it is
+ * inferred from the size. mdos_mkfs writes 315392 bytes for a single-sided
+ * disk (the standard 77x26 side plus slack, which the conversions ignore) and
+ * 630784 for a double-sided one; anything larger than the single-sided file
+ * is taken as double sided, with as many sectors per track as divide the size
+ * evenly over 77 cylinders (32 for 630784, 26 for 512512).
+ */
+#define MDOS_GEOM_DSK_SINGLE_BYTES 315392L
+
+static inline void mdos_geometry_from_dsk(mdos_geometry_t *g, long bytes) {
+    mdos_geometry_t standard = MDOS_GEOMETRY_STANDARD;
+    *g = standard;
+    if (bytes > MDOS_GEOM_DSK_SINGLE_BYTES) {
+        long cylinder_pair = 2L * MDOS_GEOM_CYLINDERS * MDOS_GEOM_SECTOR_SIZE;
+        g->heads = 2;
+        if (bytes % cylinder_pair == 0 && bytes / cylinder_pair <= 255) {
+            g->sectors = (int)(bytes / cylinder_pair);
+        }
+    }
+}
+
+/*
+ * Interleave: a host that needs time between sectors misses the next one if
+ * it follows immediately and waits a whole revolution for it. Spreading
+ * consecutive sectors `interleave` slots apart around the track gives it
+ * that time; skew rotates each track's layout by a number of slots so the
+ * first sector of the next track arrives after the head has stepped.
+ *
+ * Fill map (g->sectors entries, in rotational order) for linear track
+ * `track`. Interleave 1 with skew 0 is the plain 1..n order.
+ */
+static inline void mdos_geometry_interleave_map(const mdos_geometry_t *g, long track,
+                                                int interleave, int skew, uint8_t *map) {
+    uint8_t used[256] = { 0 };
+    int n = g->sectors;
+    int pos = (int)((track * skew) % n);
+
+    for (int i = 0; i < n; i++) {
+        while (used[pos]) pos = (pos + 1) % n;
+        map[pos] = (uint8_t)(g->first_sector + i);
+        used[pos] = 1;
+        pos = (pos + interleave) % n;
+    }
+}
+
+/*
+ * Interleave a map was written with: the most common distance in slots
+ * from each sector to the next-numbered one. 0 if map is not a
+ * permutation of first_sector..first_sector + count - 1.
+ */
+static inline int mdos_geometry_detect_interleave(const uint8_t *map, int count, int first_sector) {
+    int slot[256];
+    int votes[256] = { 0 };
+    for (int i = 0; i < count; i++) slot[i] = -1;
+    for (int p = 0; p < count; p++) {
+        int s = map[p] - first_sector;
+        if (s < 0 || s >= count || slot[s] >= 0) return 0;
+        slot[s] = p;
+    }
+
+    int best = (count == 1) ? 1 : 0;
+    for (int s = 0; s + 1 < count; s++) {
+        int gap = (slot[s + 1] - slot[s] + count) % count;
+        if (++votes[gap] > votes[best]) best = gap;
+    }
+    return best;
+}
+
+/* Drive and host timing for mdos_geometry_read_us */
+typedef struct {
+    double rpm;             /* Spindle speed */
+    double host_ms;         /* Host time per sector before it can ask for the next */
+    double step_ms;         /* Step to the next cylinder, settling included */
+} mdos_drive_timing_t;
+
+/* 8-inch drive at 360 rpm with MDOS on a 1 MHz 6800 */
+#define MDOS_DRIVE_TIMING_DEFAULT { 360.0, 5.0, 10.0 }
+
+/*
+ * Rotational latency model: microseconds to read every sector of the disk
+ * in logical order. maps holds g->sectors entries per linear track, each
+ * a permutation of the track's sector numbers (as recorded, or as
+ * mdos_geometry_interleave_map builds them); every track's slot 0 passes
+ * the head at the index hole. Only tracks flagged in present are read
+ * (all if it is NULL). Each read waits for its sector to come round, takes
+ * one slot, then the host is busy for host_ms; moving the head costs
+ * step_ms per cylinder while the disk keeps turning.
+ */
+static inline long long mdos_geometry_read_us(const mdos_geometry_t *g, const uint8_t *maps,
+                                              const uint8_t *present, const mdos_drive_timing_t *timing) {
+    long long revolution = (long long)(60e6 / timing->rpm);
+    long long slot_time = revolution / g->sectors;
+    long long host = (long long)(timing->host_ms * 1000);
+    long long step = (long long)(timing->step_ms * 1000);
+    long long now = 0;
+    long tracks = (long)g->cylinders * g->heads;
+    long cylinder = 0;
+
+    for (long t = 0; t < tracks; t++) {
+        if (present && !present[t]) {
+            continue;
+        }
+        const uint8_t *map = maps + t * g->sectors;
+        int slot[256];
+        for (int p = 0; p < g->sectors; p++) slot[(uint8_t)(map[p] - g->first_sector)] = p;
+
+        now += (t / g->heads - cylinder) * step;
+        cylinder = t / g->heads;
+        for (int s = 0; s < g->sectors; s++) {
+            long long start = slot[s] * slot_time;
+            now += (start - now % revolution + revolution) % revolution;
+            now += slot_time + host;
+        }
+    }
+    return now;
+}
+
+#endif /* MDOS_GEOMETRY_H */
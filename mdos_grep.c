@@ -0,0 +1,366 @@
+/*
+ * MDOS Filesystem Library - Text Search Across Images
+ * Copyright (C) 2025
+ *
+ * Each worker reads one image's linear view, decodes its text files into
+ * memory and scans them with a memchr prefilter; results are buffered per
+ * image and printed in image order
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* pthreads, open_memstream */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "mdos_internal.h"
+#include "mdos_grep.h"
+#include "mdos_imd.h"
+#include "mdos_sparse.h"
+#include "mdos_stats.h"
+#include "mdos_trace.h"
+
+#define GREP_MAX_JOBS 64
+
+size_t mdos_text_decode(const uint8_t *in, size_t len, char *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        int c = in[i];
+        if (c & 0x80) {
+            /* Compressed run of spaces */
+            if (out) memset(out + n, ' ', c & 0x7F);
+            n += c & 0x7F;
+        } else if (c == 0x0D) {
+            if (out) out[n] = '\n';
+            n++;
+        } else if (c == 0x7F || (c < 0x20 && c != 0x09 && c != 0x0A)) {
+            continue;   /* NUL and SUB padding, DEL, other control characters */
+        } else {
+            if (out) out[n] = (char)c;
+            n++;
+        }
+    }
+    return n;
+}
+
+int mdos_is_text_file(const char *name, uint16_t attributes) {
+    if ((attributes & 0x07) == MDOS_TYPE_ASCII) {
+        return 1;
+    }
+    const char *ext = strrchr(name, '.');
+    if (!ext) {
+        return 0;
+    }
+    static const char *const text_exts[] = { "sa", "al", "sb", "sc" };
+    for (size_t i = 0; i < sizeof(text_exts) / sizeof(text_exts[0]); i++) {
+        if (tolower((unsigned char)ext[1]) == text_exts[i][0] &&
+            tolower((unsigned char)ext[2]) == text_exts[i][1] && ext[3] == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * First occurrence of pat (n > 0 bytes) in [p, end). memchr skips to each
+ * candidate first byte, which glibc does a vector at a time, so only those
+ * positions are compared in full.
+ */
+static const char* grep_find(const char *p, const char *end, const char *pat, size_t n) {
+    while ((size_t)(end - p) >= n) {
+        p = memchr(p, pat[0], (end - p) - n + 1);
+        if (!p) {
+            return NULL;
+        }
+        if (memcmp(p + 1, pat + 1, n - 1) == 0) {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/* Print each line of text holding the pattern; returns the lines printed */
+static long grep_text(const char *image, const char *file, const char *text, size_t len,
+                      const char *pattern, size_t plen, int flags, FILE *out) {
+    /* Case-insensitive: search a folded copy, print the original */
+    char *folded = NULL;
+    const char *hay = text;
+    if (flags & MDOS_GREP_ICASE) {
+        folded = malloc(len ? len : 1);
+        if (!folded) {
+            return 0;
+        }
+        for (size_t i = 0; i < len; i++) {
+            folded[i] = (char)tolower((unsigned char)text[i]);
+        }
+        hay = folded;
+    }
+
+    long matches = 0;
+    long line = 1;
+    size_t line_start = 0;      /* Start of line number `line` */
+    const char *end = hay + len;
+    const char *hit;
+    for (const char *p = hay; (hit = grep_find(p, end, pattern, plen)); ) {
+        /* Count lines only up to each match */
+        size_t at = hit - hay;
+        const char *nl;
+        while ((nl = memchr(hay + line_start, '\n', at - line_start))) {
+            line_start = nl - hay + 1;
+            line++;
+        }
+        nl = memchr(hay + at, '\n', len - at);
+        size_t line_end = nl ? (size_t)(nl - hay) : len;
+
+        fprintf(out, "%s:%s:%ld:%.*s\n", image, file, line,
+                (int)(line_end - line_start), text + line_start);
+        matches++;
+
+        /* One report per line */
+        if (!nl) {
+            break;
+        }
+        line_start = line_end + 1;
+        line++;
+        p = hay + line_start;
+    }
+    free(folded);
+    return matches;
+}
+
+typedef struct {
+    const char *pattern;
+    size_t plen;
+    char *const *images;
+    int count;
+    int flags;
+    int next;               /* Next image to take */
+    int printed;            /* Images whose results went out */
+    char **results;         /* Per image: buffered output, until printed */
+    size_t *result_sizes;
+    uint8_t *finished;
+    mdos_grep_stats_t stats;
+    FILE *out;
+    FILE *log;
+    pthread_mutex_t lock;   /* Everything above from next on */
+} grep_job_t;
+
+/* Read an image's linear view through a read-only mount */
+static int grep_load(const char *path, uint8_t **image, long *length) {
+    mdos_fs_t *fs = mdos_mount_image(path, 1);
+    if (!fs) {
+        return MDOS_EIO;
+    }
+
+    int result = MDOS_EIO;
+    *image = NULL;
+    if (fseek(fs->fp, 0, SEEK_END) == 0 && (*length = ftell(fs->fp)) >= 0) {
+        *image = malloc(*length ? *length : 1);
+        if (!*image) {
+            result = MDOS_ENOSPC;
+        } else if (mdos_sparse_read(fs->fp, *image, *length) >= 0) {
+            result = MDOS_EOK;
+        }
+    }
+    mdos_unmount_image(fs);
+    if (result != MDOS_EOK) {
+        free(*image);
+        *image = NULL;
+    }
+    return result;
+}
+
+/* Search every text file of one image, writing the matching lines to out */
+static int grep_image(grep_job_t *job, const char *path, FILE *out, mdos_grep_stats_t *stats) {
+    uint8_t *image;
+    long length;
+    mdos_trace_span_t span = mdos_trace_begin("grep load", path);
+    int result = grep_load(path, &image, &length);
+    mdos_trace_end(&span);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+    long nsectors = length / MDOS_SECTOR_SIZE;
+    if (nsectors < MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS) {
+        free(image);
+        return MDOS_EIO;
+    }
+
+    mdos_meta_t meta;
+    memcpy(meta.dir, image + MDOS_DIR_FIRST_SECTOR * MDOS_SECTOR_SIZE, sizeof(meta.dir));
+    uint8_t *data = NULL;
+    char *text = NULL;
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES && result == MDOS_EOK; slot++) {
+        const uint8_t *entry = mdos_meta_entry(&meta, slot);
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            continue;
+        }
+        char name[MDOS_MAX_FILENAME];
+        mdos_meta_entry_name(entry, name);
+        if (!mdos_is_text_file(name, entry[12])) {
+            continue;
+        }
+        int rib_sector = (entry[10] << 8) | entry[11];
+        if (rib_sector <= 0 || rib_sector >= nsectors) {
+            continue;
+        }
+
+        /* Gather the data sectors, cut to the size the RIB records */
+        mdos_rib_t rib;
+        memcpy(&rib, image + (long)rib_sector * MDOS_SECTOR_SIZE, sizeof(rib));
+        int sects = (rib.size_high << 8) | rib.size_low;
+        int last = rib.last_size;
+        if (last == 0 || last > MDOS_SECTOR_SIZE) last = MDOS_SECTOR_SIZE;
+        size_t size = sects ? (size_t)(sects - 1) * MDOS_SECTOR_SIZE + last : 0;
+        uint8_t *grown = realloc(data, sects ? (size_t)sects * MDOS_SECTOR_SIZE : 1);
+        if (!grown) {
+            result = MDOS_ENOSPC;
+            break;
+        }
+        data = grown;
+        int lsn;
+        for (lsn = 1; lsn <= sects; lsn++) {
+            int psn = mdos_lsn_to_psn(&rib, lsn);
+            if (psn < 0 || psn >= nsectors) {
+                break;
+            }
+            memcpy(data + (size_t)(lsn - 1) * MDOS_SECTOR_SIZE,
+                   image + (long)psn * MDOS_SECTOR_SIZE, MDOS_SECTOR_SIZE);
+        }
+        if (lsn <= sects) {
+            continue;       /* Chain runs off the image */
+        }
+
+        size_t text_len = mdos_text_decode(data, size, NULL);
+        char *buffer = realloc(text, text_len ? text_len : 1);
+        if (!buffer) {
+            result = MDOS_ENOSPC;
+            break;
+        }
+        text = buffer;
+        mdos_text_decode(data, size, text);
+        MDOS_STAT_ADD(MDOS_STAT_BYTES_DECODED, size);
+
+        stats->files++;
+        stats->bytes += text_len;
+        stats->matches += grep_text(path, name, text, text_len, job->pattern, job->plen,
+                                    job->flags, out);
+    }
+    free(text);
+    free(data);
+    free(image);
+    return result;
+}
+
+static void* grep_worker(void *arg) {
+    grep_job_t *job = arg;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->count) {
+            return NULL;
+        }
+
+        char *buffer = NULL;
+        size_t size = 0;
+        mdos_grep_stats_t stats;
+        memset(&stats, 0, sizeof(stats));
+        FILE *out = open_memstream(&buffer, &size);
+        mdos_trace_span_t span = mdos_trace_begin("grep image", job->images[i]);
+        int result = out ? grep_image(job, job->images[i], out, &stats) : MDOS_ENOSPC;
+        mdos_trace_end(&span);
+        if (out) fclose(out);
+
+        pthread_mutex_lock(&job->lock);
+        job->stats.images++;
+        job->stats.files += stats.files;
+        job->stats.bytes += stats.bytes;
+        job->stats.matches += stats.matches;
+        if (result != MDOS_EOK) {
+            job->stats.failed++;
+            if (job->log) {
+                fprintf(job->log, "%s: %s\n", job->images[i], mdos_strerror(result));
+            }
+        }
+        job->results[i] = buffer;
+        job->result_sizes[i] = size;
+        job->finished[i] = 1;
+
+        /* Hand out everything now complete in image order */
+        while (job->printed < job->count && job->finished[job->printed]) {
+            int p = job->printed++;
+            if (job->results[p]) {
+                fwrite(job->results[p], 1, job->result_sizes[p], job->out);
+                free(job->results[p]);
+                job->results[p] = NULL;
+            }
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+long mdos_grep(const char *pattern, char *const images[], int count, int jobs, int flags,
+               mdos_grep_stats_t *stats, FILE *out, FILE *log) {
+    if (!pattern || !*pattern || (!images && count > 0) || count < 0 || jobs < 0 || !out) {
+        return MDOS_EINVAL;
+    }
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+    if (jobs > count) jobs = count;
+    if (jobs > GREP_MAX_JOBS) jobs = GREP_MAX_JOBS;
+
+    grep_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.plen = strlen(pattern);
+    char *folded = malloc(job.plen + 1);
+    job.results = calloc(count ? count : 1, sizeof(char *));
+    job.result_sizes = calloc(count ? count : 1, sizeof(size_t));
+    job.finished = calloc(count ? count : 1, 1);
+    if (!folded || !job.results || !job.result_sizes || !job.finished) {
+        free(folded);
+        free(job.results);
+        free(job.result_sizes);
+        free(job.finished);
+        return MDOS_ENOSPC;
+    }
+    for (size_t i = 0; i <= job.plen; i++) {
+        folded[i] = (flags & MDOS_GREP_ICASE) ? (char)tolower((unsigned char)pattern[i]) : pattern[i];
+    }
+    job.pattern = folded;
+    job.images = images;
+    job.count = count;
+    job.flags = flags;
+    job.out = out;
+    job.log = log;
+    pthread_mutex_init(&job.lock, NULL);
+
+    pthread_t threads[GREP_MAX_JOBS];
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, grep_worker, &job) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        grep_worker(&job);
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    if (stats) {
+        *stats = job.stats;
+    }
+    free(folded);
+    free(job.results);
+    free(job.result_sizes);
+    free(job.finished);
+    return job.stats.matches;
+}
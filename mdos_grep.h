@@ -0,0 +1,54 @@
+/*
+ * MDOS Filesystem Library - Text Search Across Images
+ * Copyright (C) 2025
+ *
+ * Search the text files of many images at once, decoding MDOS space
+ * compression in memory
+ */
+
+#ifndef MDOS_GREP_H
+#define MDOS_GREP_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mdos_fs.h"
+
+/* mdos_grep flags */
+#define MDOS_GREP_ICASE 0x01    /* Ignore case */
+
+typedef struct {
+    int images;             /* Images searched */
+    int failed;             /* Images that could not be read */
+    long files;             /* Text files searched */
+    long bytes;             /* Decoded text scanned */
+    long matches;           /* Matching lines */
+} mdos_grep_stats_t;
+
+/*
+ * Decode MDOS text as mdosextract does: a byte with the high bit set is
+ * that many spaces (low 7 bits), CR becomes LF, NUL, SUB, DEL and other
+ * control characters except TAB are dropped. Writes to out (NULL to only
+ * measure) and returns the decoded length.
+ */
+size_t mdos_text_decode(const uint8_t *in, size_t len, char *out);
+
+/*
+ * Non-zero for a file worth searching as text: ASCII record format
+ * (format 5 in the low bits of attributes, directory entry byte 12) or a
+ * source/listing extension (.SA, .AL, .SB, .SC).
+ */
+int mdos_is_text_file(const char *name, uint16_t attributes);
+
+/*
+ * Print every line of every text file on the images (DSK, IMD or MDZ)
+ * that contains pattern, a fixed string, as "image:file:line:text".
+ * Images are read and searched on up to jobs threads (0: one per CPU);
+ * the output still comes in image order. Images that cannot be read are
+ * reported on log and skipped. Returns the number of matching lines, or
+ * MDOS_EINVAL for bad arguments.
+ */
+long mdos_grep(const char *pattern, char *const images[], int count, int jobs, int flags,
+               mdos_grep_stats_t *stats, FILE *out, FILE *log);
+
+#endif /* MDOS_GREP_H */
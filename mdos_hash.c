@@ -0,0 +1,68 @@
+/*
+ * MDOS Filesystem Library - Content Hashing
+ * Copyright (C) 2025
+ *
+ * FNV-1a: MDOS files are at most a few hundred KB, so a simple byte-wise
+ * hash is far cheaper than the I/O it saves. CRC-32 guards stored blocks
+ * against corruption.
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* pthread_once */
+
+#include <pthread.h>
+#include "mdos_hash.h"
+
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME  0x100000001b3ULL
+
+uint64_t mdos_hash64(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint64_t hash = FNV64_OFFSET;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= FNV64_PRIME;
+    }
+    return hash;
+}
+
+#define CRC32_POLY 0xEDB88320u     /* Reflected IEEE polynomial */
+
+/* Slicing-by-8: table k advances the CRC over a byte followed by k zeros */
+static uint32_t crc32_table[8][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        crc32_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = crc32_table[t - 1][i];
+            crc32_table[t][i] = crc32_table[0][c & 0xFF] ^ (c >> 8);
+        }
+    }
+}
+
+uint32_t mdos_crc32(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint32_t crc = 0xFFFFFFFFu;
+
+    pthread_once(&crc32_once, crc32_init); /* Mounts on several threads verify blocks */
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                             ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        crc = crc32_table[7][lo & 0xFF] ^ crc32_table[6][(lo >> 8) & 0xFF] ^
+              crc32_table[5][(lo >> 16) & 0xFF] ^ crc32_table[4][lo >> 24] ^
+              crc32_table[3][p[4]] ^ crc32_table[2][p[5]] ^
+              crc32_table[1][p[6]] ^ crc32_table[0][p[7]];
+    }
+    for (; len > 0; len--, p++) {
+        crc = crc32_table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
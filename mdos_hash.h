@@ -0,0 +1,20 @@
+/*
+ * MDOS Filesystem Library - Content Hashing
+ * Copyright (C) 2025
+ *
+ * Hashes used to compare file contents without keeping copies around
+ */
+
+#ifndef MDOS_HASH_H
+#define MDOS_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 64-bit FNV-1a of a buffer */
+uint64_t mdos_hash64(const void *data, size_t len);
+
+/* CRC-32 (IEEE 802.3, as zlib computes it) of a buffer */
+uint32_t mdos_crc32(const void *data, size_t len);
+
+#endif /* MDOS_HASH_H */
@@ -0,0 +1,1517 @@
+/*
+ * MDOS Filesystem Library - Direct IMD Access
+ * Copyright (C) 2025
+ *
+ * An IMD mount hands the library a stdio stream whose reads and writes are
+ * served from a per-track cache, so every module keeps working on the
+ * linear sector view it gets from a DSK
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "mdos_internal.h"
+#include "mdos_imd.h"
+#include "mdos_sparse.h"
+#include "mdos_mdz.h"
+#include "mdos_overlay.h"
+#include "mdos_stats.h"
+#include "mdos_trace.h"
+
+#define IMD_MAX_CYLINDERS MDOS_GEOM_MAX_CYLINDERS
+#define IMD_COMMENT_END   0x1A
+#define IMD_SIDECAR_MAGIC "MDOSIDX1"
+
+/* Index entry: data offset << 4 | sector type, 0 if the sector is absent */
+#define IMD_ENTRY(offset, type) (((uint32_t)(offset) << 4) | (uint32_t)(type))
+#define IMD_ENTRY_OFFSET(e)     ((e) >> 4)
+#define IMD_ENTRY_TYPE(e)       ((e) & 0x0F)
+#define IMD_MAX_OFFSET          0x0FFFFFFF
+
+typedef struct {
+    uint32_t offset;        /* Track record in the file */
+    uint32_t length;
+    uint8_t header[5];      /* Mode, cylinder, head + map flags, count, size code */
+    uint16_t span;          /* Highest sector number + 1 */
+    uint32_t base;          /* First index entry of the track */
+} imd_index_track_t;
+
+struct mdos_imd_index {
+    FILE *fp;
+    long long file_size;    /* Identify the IMD a sidecar belongs to */
+    long long mtime_sec;
+    long mtime_nsec;
+    uint32_t comment_length;
+    imd_index_track_t *tracks;
+    int ntracks;
+    uint32_t *entries;
+    uint32_t nentries;
+    short where[IMD_MAX_CYLINDERS][2];  /* (cylinder, head) -> track */
+};
+
+/* One track record of the IMD file */
+typedef struct {
+    long offset;            /* Record position in the source file, -1 if added */
+    long length;            /* Record length in bytes */
+    uint8_t header[5];      /* Mode, cylinder, head + map flags, count, size code */
+    uint8_t *map;           /* Sector numbers, in recorded order */
+    uint8_t *cmap;          /* Optional cylinder and head maps */
+    uint8_t *hmap;
+    uint8_t *types;         /* Sector types as recorded */
+    uint8_t *data;          /* Decoded sectors in map order; NULL until used */
+    int dirty;
+} imd_track_t;
+
+typedef struct imd_image {
+    FILE *fp;
+    char *path;
+    int read_only;
+    long comment_length;    /* Comment including its 0x1A terminator */
+    imd_track_t *tracks;
+    int ntracks;
+    int capacity;
+    short where[IMD_MAX_CYLINDERS][2];  /* (cylinder, head) -> track */
+    mdos_geometry_t geometry;           /* Layout of the linear view */
+    /* Linear sector lookup: the standard or the generic path, picked at mount */
+    uint8_t* (*sector)(struct imd_image *imd, long lsn, int create, int *error);
+    off64_t pos;
+    int dirty;
+    FILE *stream;           /* The stream handed to the library */
+    struct imd_image *next; /* Open IMD mounts */
+} imd_image_t;
+
+static imd_image_t *imd_mounts;
+static pthread_mutex_t mounts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void mdos_mounts_lock(void) {
+    pthread_mutex_lock(&mounts_lock);
+}
+
+void mdos_mounts_unlock(void) {
+    pthread_mutex_unlock(&mounts_lock);
+}
+
+int mdos_is_imd(const char *path) {
+    char magic[4];
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return 0;
+    }
+    int is_imd = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "IMD ", 4) == 0;
+    fclose(fp);
+    return is_imd;
+}
+
+static void imd_free(imd_image_t *imd) {
+    mdos_mounts_lock();
+    for (imd_image_t **p = &imd_mounts; *p; p = &(*p)->next) {
+        if (*p == imd) {
+            *p = imd->next;
+            break;
+        }
+    }
+    mdos_mounts_unlock();
+    for (int t = 0; t < imd->ntracks; t++) {
+        imd_track_t *track = &imd->tracks[t];
+        free(track->map);
+        free(track->cmap);
+        free(track->hmap);
+        free(track->types);
+        free(track->data);
+    }
+    free(imd->tracks);
+    free(imd->path);
+    if (imd->fp) fclose(imd->fp);
+    free(imd);
+}
+
+static imd_track_t* imd_add_track(imd_image_t *imd) {
+    if (imd->ntracks == imd->capacity) {
+        int new_capacity = imd->capacity ? imd->capacity * 2 : 160;
+        imd_track_t *grown = realloc(imd->tracks, new_capacity * sizeof(*grown));
+        if (!grown) {
+            return NULL;
+        }
+        imd->tracks = grown;
+        imd->capacity = new_capacity;
+    }
+    imd_track_t *track = &imd->tracks[imd->ntracks++];
+    memset(track, 0, sizeof(*track));
+    return track;
+}
+
+/*
+ * Index pass: walk the track records using only their headers, sector maps
+ * and sector type bytes, seeking over the data itself.
+ */
+static int imd_index_scan(mdos_imd_index_t *index) {
+    FILE *fp = index->fp;
+    long pos = 0;
+    int c;
+
+    while ((c = fgetc(fp)) != EOF && c != IMD_COMMENT_END) {
+        pos++;
+    }
+    if (c == EOF) {
+        return MDOS_EIO;
+    }
+    index->comment_length = ++pos;
+
+    int capacity = 0;
+    uint32_t entry_capacity = 0;
+    for (;;) {
+        uint8_t header[5], map[256];
+        size_t n = fread(header, 1, sizeof(header), fp);
+        if (n == 0) {
+            break;
+        }
+        int count = header[3];
+        if (n != sizeof(header) || header[4] > 6 ||
+            fread(map, 1, count, fp) != (size_t)count) {
+            return MDOS_EIO;
+        }
+
+        if (index->ntracks == capacity) {
+            capacity = capacity ? capacity * 2 : 160;
+            imd_index_track_t *grown = realloc(index->tracks, capacity * sizeof(*grown));
+            if (!grown) return MDOS_ENOSPC;
+            index->tracks = grown;
+        }
+        imd_index_track_t *track = &index->tracks[index->ntracks++];
+        memcpy(track->header, header, sizeof(header));
+        track->offset = pos;
+        track->base = index->nentries;
+        track->span = 0;
+        for (int s = 0; s < count; s++) {
+            if (map[s] + 1 > track->span) track->span = map[s] + 1;
+        }
+
+        if (index->nentries + track->span > entry_capacity) {
+            entry_capacity = entry_capacity ? entry_capacity * 2 : 4096;
+            if (entry_capacity < index->nentries + track->span) entry_capacity += track->span;
+            uint32_t *grown = realloc(index->entries, entry_capacity * sizeof(*grown));
+            if (!grown) return MDOS_ENOSPC;
+            index->entries = grown;
+        }
+        memset(index->entries + track->base, 0, track->span * sizeof(uint32_t));
+        index->nentries += track->span;
+
+        long sector_size = MDOS_SECTOR_SIZE << header[4];
+        long skip = ((header[2] & 0x80) ? count : 0) + ((header[2] & 0x40) ? count : 0);
+        pos += 5 + count + skip;
+        for (int s = 0; s < count; s++) {
+            if (skip && fseek(fp, skip, SEEK_CUR) != 0) {
+                return MDOS_EIO;
+            }
+            int type = fgetc(fp);
+            if (type == EOF || type > 8 || pos + 1 > IMD_MAX_OFFSET) {
+                return MDOS_EIO;
+            }
+            pos++;
+
+            uint32_t *entry = &index->entries[track->base + map[s]];
+            if (*entry == 0) {
+                *entry = IMD_ENTRY(pos, type); /* A repeated number keeps the first */
+            }
+            skip = mdos_geometry_imd_data_length(type, sector_size);
+            pos += skip;
+        }
+        if (skip && fseek(fp, skip, SEEK_CUR) != 0) {
+            return MDOS_EIO;
+        }
+        track->length = pos - track->offset;
+
+        int cylinder = header[1], head = header[2] & 1;
+        if (index->where[cylinder][head] < 0) {
+            index->where[cylinder][head] = index->ntracks - 1;
+        }
+    }
+
+    /* fseek happily goes past the end; make sure the data is really there */
+    if (fseek(fp, 0, SEEK_END) != 0 || ftell(fp) < pos) {
+        return MDOS_EIO;
+    }
+    return MDOS_EOK;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#define IMD_SIDECAR_HEADER 36
+#define IMD_SIDECAR_TRACK  19
+
+static char* imd_sidecar_path(const char *imd_path) {
+    size_t len = strlen(imd_path) + sizeof(MDOS_IMD_SIDECAR_EXT);
+    char *path = malloc(len);
+    if (path) {
+        snprintf(path, len, "%s%s", imd_path, MDOS_IMD_SIDECAR_EXT);
+    }
+    return path;
+}
+
+/*
+ * Sidecar layout, little-endian: magic, IMD size (8), mtime seconds (8) and
+ * nanoseconds (4), comment length, track count, entry count; then per track
+ * offset, length, header (5), span (2), base; then the entries.
+ */
+int mdos_imd_index_save(const mdos_imd_index_t *index, const char *imd_path) {
+    if (!index || !imd_path) {
+        return MDOS_EINVAL;
+    }
+
+    size_t size = IMD_SIDECAR_HEADER + (size_t)index->ntracks * IMD_SIDECAR_TRACK +
+                  (size_t)index->nentries * 4;
+    uint8_t *buffer = malloc(size);
+    char *path = imd_sidecar_path(imd_path);
+    if (!buffer || !path) {
+        free(buffer);
+        free(path);
+        return MDOS_ENOSPC;
+    }
+
+    uint8_t *p = buffer;
+    memcpy(p, IMD_SIDECAR_MAGIC, 8);
+    put_le32(p + 8, (uint32_t)index->file_size);
+    put_le32(p + 12, (uint32_t)(index->file_size >> 32));
+    put_le32(p + 16, (uint32_t)index->mtime_sec);
+    put_le32(p + 20, (uint32_t)(index->mtime_sec >> 32));
+    put_le32(p + 24, (uint32_t)index->mtime_nsec);
+    put_le32(p + 28, index->comment_length);
+    put_le32(p + 32, index->ntracks);
+    p += IMD_SIDECAR_HEADER;
+    for (int t = 0; t < index->ntracks; t++) {
+        const imd_index_track_t *track = &index->tracks[t];
+        put_le32(p, track->offset);
+        put_le32(p + 4, track->length);
+        memcpy(p + 8, track->header, 5);
+        p[13] = track->span;
+        p[14] = track->span >> 8;
+        put_le32(p + 15, track->base);
+        p += IMD_SIDECAR_TRACK;
+    }
+    for (uint32_t e = 0; e < index->nentries; e++) {
+        put_le32(p, index->entries[e]);
+        p += 4;
+    }
+
+    int result = MDOS_EOK;
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        result = MDOS_EIO;
+    } else {
+        int ok = fwrite(buffer, 1, size, fp) == size;
+        if (fclose(fp) != 0 || !ok) {
+            remove(path);
+            result = MDOS_EIO;
+        }
+    }
+
+    free(path);
+    free(buffer);
+    return result;
+}
+
+/*
+ * Check a sidecar track against the rules imd_index_scan enforces, so that
+ * a damaged sidecar cannot describe a record larger than its bytes: a known
+ * size code, a record that holds at least its maps and type bytes and at
+ * most full sectors, inside the image, with entries pointing into it.
+ */
+static int imd_index_track_valid(const mdos_imd_index_t *index, const imd_index_track_t *track,
+                                 const uint32_t *entries) {
+    const uint8_t *header = track->header;
+    int count = header[3];
+    if (header[4] > 6 || track->span > 256 || (count == 0) != (track->span == 0)) {
+        return 0;
+    }
+
+    long long sector_size = MDOS_SECTOR_SIZE << header[4];
+    long long maps = 5 + count + ((header[2] & 0x80) ? count : 0) + ((header[2] & 0x40) ? count : 0);
+    long long end = (long long)track->offset + track->length;
+    if (track->offset < index->comment_length || end > index->file_size ||
+        track->length < maps + count || track->length > maps + count * (1 + sector_size)) {
+        return 0;
+    }
+
+    for (int s = 0; s < track->span; s++) {
+        uint32_t entry = entries[track->base + s];
+        if (entry == 0) {
+            continue;
+        }
+        int type = IMD_ENTRY_TYPE(entry);
+        long long data = IMD_ENTRY_OFFSET(entry);
+        long long bytes = mdos_geometry_imd_data_length(type, sector_size);
+        if (bytes < 0 || data <= track->offset + maps || data + bytes > end) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Load the sidecar if it describes this very file. 0 on success, -1 if
+ * there is no sidecar for this version of the file, 1 if it matches the
+ * file but its contents are damaged.
+ */
+static int imd_index_load(mdos_imd_index_t *index, const char *imd_path) {
+    char *path = imd_sidecar_path(imd_path);
+    FILE *fp = path ? fopen(path, "rb") : NULL;
+    free(path);
+    if (!fp) {
+        return -1;
+    }
+
+    uint8_t header[IMD_SIDECAR_HEADER];
+    int ok = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+             memcmp(header, IMD_SIDECAR_MAGIC, 8) == 0 &&
+             (get_le32(header + 8) | ((long long)get_le32(header + 12) << 32)) == index->file_size &&
+             (get_le32(header + 16) | ((long long)get_le32(header + 20) << 32)) == index->mtime_sec &&
+             (long)get_le32(header + 24) == index->mtime_nsec;
+    if (!ok) {
+        fclose(fp);
+        return -1;
+    }
+
+    /* Every track record takes at least its 5 header bytes */
+    uint32_t ntracks = get_le32(header + 32);
+    index->comment_length = get_le32(header + 28);
+    ok = ntracks <= index->file_size / 5 && index->comment_length <= index->file_size;
+    uint8_t *tracks = ok ? malloc((size_t)ntracks * IMD_SIDECAR_TRACK + 1) : NULL;
+    ok = tracks && fread(tracks, IMD_SIDECAR_TRACK, ntracks, fp) == ntracks;
+
+    if (ok) {
+        index->tracks = malloc((ntracks ? ntracks : 1) * sizeof(imd_index_track_t));
+        ok = index->tracks != NULL;
+    }
+    for (uint32_t t = 0; ok && t < ntracks; t++) {
+        const uint8_t *p = tracks + t * IMD_SIDECAR_TRACK;
+        imd_index_track_t *track = &index->tracks[t];
+        track->offset = get_le32(p);
+        track->length = get_le32(p + 4);
+        memcpy(track->header, p + 8, 5);
+        track->span = p[13] | (p[14] << 8);
+        track->base = get_le32(p + 15);
+        index->nentries = track->base + track->span;
+        ok = track->span <= 256 &&
+             (t == 0 ? track->base == 0 : track->base == index->tracks[t - 1].base + index->tracks[t - 1].span);
+    }
+    if (ok) {
+        index->entries = malloc((index->nentries ? index->nentries : 1) * 4);
+        uint8_t *raw = malloc((index->nentries ? index->nentries : 1) * 4);
+        ok = index->entries && raw && fread(raw, 4, index->nentries, fp) == index->nentries;
+        for (uint32_t e = 0; ok && e < index->nentries; e++) {
+            index->entries[e] = get_le32(raw + e * 4);
+        }
+        free(raw);
+    }
+    for (uint32_t t = 0; ok && t < ntracks; t++) {
+        ok = imd_index_track_valid(index, &index->tracks[t], index->entries);
+    }
+    fclose(fp);
+    free(tracks);
+
+    if (!ok) {
+        free(index->tracks);
+        free(index->entries);
+        index->tracks = NULL;
+        index->entries = NULL;
+        index->nentries = 0;
+        index->comment_length = 0;
+        return 1;
+    }
+
+    index->ntracks = ntracks;
+    for (uint32_t t = 0; t < ntracks; t++) {
+        int cylinder = index->tracks[t].header[1], head = index->tracks[t].header[2] & 1;
+        if (index->where[cylinder][head] < 0) {
+            index->where[cylinder][head] = t;
+        }
+    }
+    return 0;
+}
+
+void mdos_imd_index_close(mdos_imd_index_t *index) {
+    if (!index) {
+        return;
+    }
+    if (index->fp) fclose(index->fp);
+    free(index->tracks);
+    free(index->entries);
+    free(index);
+}
+
+mdos_imd_index_t* mdos_imd_index_open(const char *imd_path, int flags) {
+    if (!imd_path) {
+        return NULL;
+    }
+
+    struct stat st;
+    mdos_imd_index_t *index = calloc(1, sizeof(mdos_imd_index_t));
+    if (!index) {
+        return NULL;
+    }
+    memset(index->where, 0xFF, sizeof(index->where));
+
+    index->fp = fopen(imd_path, "rb");
+    if (!index->fp || fstat(fileno(index->fp), &st) != 0) {
+        mdos_imd_index_close(index);
+        return NULL;
+    }
+    index->file_size = st.st_size;
+    index->mtime_sec = st.st_mtim.tv_sec;
+    index->mtime_nsec = st.st_mtim.tv_nsec;
+
+    if (flags & MDOS_IMD_INDEX_LOAD) {
+        int loaded = imd_index_load(index, imd_path);
+        if (loaded == 0) {
+            return index;
+        }
+        if (loaded > 0) {
+            flags |= MDOS_IMD_INDEX_SAVE; /* Replace the damaged sidecar with a fresh scan */
+        }
+    }
+
+    char magic[4];
+    if (fread(magic, 1, 4, index->fp) != 4 || memcmp(magic, "IMD ", 4) != 0 ||
+        fseek(index->fp, 0, SEEK_SET) != 0 || imd_index_scan(index) != MDOS_EOK) {
+        mdos_imd_index_close(index);
+        return NULL;
+    }
+
+    if (flags & MDOS_IMD_INDEX_SAVE) {
+        mdos_imd_index_save(index, imd_path); /* The index is usable either way */
+    }
+    return index;
+}
+
+int mdos_imd_read_sector(mdos_imd_index_t *index, int cylinder, int head, int sector, uint8_t *buf) {
+    if (!index || !buf || cylinder < 0 || cylinder >= IMD_MAX_CYLINDERS || head < 0 || head > 1) {
+        return MDOS_EINVAL;
+    }
+
+    int t = index->where[cylinder][head];
+    if (t < 0 || sector < 0 || sector >= index->tracks[t].span) {
+        return MDOS_ENOENT;
+    }
+    uint32_t entry = index->entries[index->tracks[t].base + sector];
+    if (entry == 0) {
+        return MDOS_ENOENT;
+    }
+
+    int size = MDOS_SECTOR_SIZE << index->tracks[t].header[4];
+    int type = IMD_ENTRY_TYPE(entry);
+    if (type == 0) {
+        memset(buf, 0, size);
+        return size;
+    }
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+    MDOS_STAT_ADD(MDOS_STAT_BYTES_DECODED, size);
+    if (fseek(index->fp, IMD_ENTRY_OFFSET(entry), SEEK_SET) != 0) {
+        return MDOS_EIO;
+    }
+    if (type & 1) {
+        if (fread(buf, 1, size, index->fp) != (size_t)size) return MDOS_EIO;
+    } else {
+        int fill = fgetc(index->fp);
+        if (fill == EOF) return MDOS_EIO;
+        memset(buf, fill, size);
+    }
+    return size;
+}
+
+int mdos_imd_sector_type(const mdos_imd_index_t *index, int cylinder, int head, int sector) {
+    if (!index || cylinder < 0 || cylinder >= IMD_MAX_CYLINDERS || head < 0 || head > 1) {
+        return MDOS_EINVAL;
+    }
+
+    int t = index->where[cylinder][head];
+    if (t < 0 || sector < 0 || sector >= index->tracks[t].span) {
+        return MDOS_ENOENT;
+    }
+    uint32_t entry = index->entries[index->tracks[t].base + sector];
+    return entry ? (int)IMD_ENTRY_TYPE(entry) : MDOS_ENOENT;
+}
+
+int mdos_imd_sector_map(mdos_imd_index_t *index, int cylinder, int head, uint8_t *map) {
+    if (!index || !map || cylinder < 0 || cylinder >= IMD_MAX_CYLINDERS || head < 0 || head > 1) {
+        return MDOS_EINVAL;
+    }
+
+    int t = index->where[cylinder][head];
+    if (t < 0) {
+        return MDOS_ENOENT;
+    }
+    const imd_index_track_t *track = &index->tracks[t];
+    if (fseek(index->fp, track->offset + 5, SEEK_SET) != 0 ||
+        fread(map, 1, track->header[3], index->fp) != track->header[3]) {
+        return MDOS_EIO;
+    }
+    return track->header[3];
+}
+
+/*
+ * Mount tracks start out as the index describes them, undecoded. The
+ * geometry of the linear view comes from the same pass: the index knows each
+ * track's lowest and highest sector number, which is all it needs.
+ */
+static int imd_from_index(imd_image_t *imd, const mdos_imd_index_t *index) {
+    mdos_geometry_t *g = &imd->geometry;
+    memset(g, 0, sizeof(*g));
+
+    for (int t = 0; t < index->ntracks; t++) {
+        const imd_index_track_t *entry = &index->tracks[t];
+        int lowest = 0;
+        while (lowest < entry->span && index->entries[entry->base + lowest] == 0) {
+            lowest++;
+        }
+        if (lowest < entry->span) {
+            uint8_t range[2] = { lowest, entry->span - 1 };
+            if (mdos_geometry_add_track(g, entry->header[1], entry->header[2], 2,
+                                        entry->header[4], range) != 0) {
+                return MDOS_EINVAL; /* Mixed sector sizes have no linear view */
+            }
+        }
+
+        imd_track_t *track = imd_add_track(imd);
+        if (!track) {
+            return MDOS_ENOSPC;
+        }
+        track->offset = entry->offset;
+        track->length = entry->length;
+        memcpy(track->header, entry->header, 5);
+    }
+    mdos_geometry_finish(g);
+    memcpy(imd->where, index->where, sizeof(imd->where));
+    imd->comment_length = index->comment_length;
+    return MDOS_EOK;
+}
+
+static int imd_track_sector_size(const imd_track_t *track) {
+    return MDOS_SECTOR_SIZE << track->header[4];
+}
+
+/* Drop a partly decoded track so that the next access decodes it afresh */
+static void imd_unload_track(imd_track_t *track) {
+    free(track->map);
+    free(track->cmap);
+    free(track->hmap);
+    free(track->types);
+    free(track->data);
+    track->map = track->cmap = track->hmap = track->types = track->data = NULL;
+}
+
+/* Decode a whole track on first access */
+static int imd_load_track(imd_image_t *imd, imd_track_t *track) {
+    if (track->data) {
+        MDOS_STAT_ADD(MDOS_STAT_CACHE_HITS, 1);
+        return MDOS_EOK;
+    }
+    MDOS_STAT_ADD(MDOS_STAT_CACHE_MISSES, 1);
+
+    int count = track->header[3];
+    int size = imd_track_sector_size(track);
+    uint8_t *record = malloc(track->length ? track->length : 1);
+    track->map = malloc(count ? count : 1);
+    track->data = calloc(count ? count : 1, size);
+    track->types = malloc(count ? count : 1);
+    if (!record || !track->map || !track->data || !track->types) {
+        free(record);
+        imd_unload_track(track);
+        return MDOS_ENOSPC;
+    }
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+    if (fseek(imd->fp, track->offset, SEEK_SET) != 0 ||
+        fread(record, 1, track->length, imd->fp) != (size_t)track->length) {
+        free(record);
+        imd_unload_track(track);
+        return MDOS_EIO;
+    }
+
+    /* The record must hold what its header promises */
+    uint8_t *p = record + 5 + count;
+    uint8_t *end = record + track->length;
+    int result = track->length < 5 + count ? MDOS_EIO : MDOS_EOK;
+    if (result == MDOS_EOK) {
+        memcpy(track->map, record + 5, count);
+    }
+    if (result == MDOS_EOK && (track->header[2] & 0x80)) {
+        track->cmap = malloc(count ? count : 1);
+        if (!track->cmap) result = MDOS_ENOSPC;
+        else if (end - p < count) result = MDOS_EIO;
+        else memcpy(track->cmap, p, count);
+        p += count;
+    }
+    if (result == MDOS_EOK && (track->header[2] & 0x40)) {
+        track->hmap = malloc(count ? count : 1);
+        if (!track->hmap) result = MDOS_ENOSPC;
+        else if (end - p < count) result = MDOS_EIO;
+        else memcpy(track->hmap, p, count);
+        p += count;
+    }
+
+    for (int s = 0; result == MDOS_EOK && s < count; s++) {
+        uint8_t *sector = track->data + s * size;
+        if (p >= end) {
+            result = MDOS_EIO;
+            break;
+        }
+        int type = *p++;
+        track->types[s] = type;
+        if (type == 0) {
+            continue; /* Data unavailable: reads as zeros */
+        }
+        if (type > 8 || end - p < ((type & 1) ? size : 1)) {
+            result = MDOS_EIO;
+        } else if (type & 1) {
+            memcpy(sector, p, size);
+            p += size;
+        } else {
+            memset(sector, *p++, size);
+        }
+    }
+
+    free(record);
+    if (result != MDOS_EOK) {
+        imd_unload_track(track);
+        return result;
+    }
+    MDOS_STAT_ADD(MDOS_STAT_BYTES_DECODED, (long)count * size);
+    return MDOS_EOK;
+}
+
+/* Append a sector number to a track, growing its maps and data */
+static int imd_grow_track(imd_track_t *track, int id) {
+    int count = track->header[3];
+    int size = imd_track_sector_size(track);
+    if (count == 255) {
+        return MDOS_ENOSPC;
+    }
+
+    uint8_t *map = realloc(track->map, count + 1);
+    if (map) track->map = map;
+    uint8_t *types = realloc(track->types, count + 1);
+    if (types) track->types = types;
+    uint8_t *data = realloc(track->data, (count + 1) * size);
+    if (data) track->data = data;
+    if (!map || !types || !data) {
+        return MDOS_ENOSPC;
+    }
+
+    if (track->cmap) {
+        uint8_t *cmap = realloc(track->cmap, count + 1);
+        if (!cmap) return MDOS_ENOSPC;
+        track->cmap = cmap;
+        track->cmap[count] = track->header[1];
+    }
+    if (track->hmap) {
+        uint8_t *hmap = realloc(track->hmap, count + 1);
+        if (!hmap) return MDOS_ENOSPC;
+        track->hmap = hmap;
+        track->hmap[count] = track->header[2] & 1;
+    }
+
+    track->map[count] = id;
+    track->types[count] = 1;
+    memset(track->data + count * size, 0, size);
+    track->header[3] = count + 1;
+    return MDOS_EOK;
+}
+
+/* A new track laid out like the image's geometry, numbered in order */
+static imd_track_t* imd_create_track(imd_image_t *imd, int cylinder, int head) {
+    imd_track_t *track = imd_add_track(imd);
+    if (!track) {
+        return NULL;
+    }
+
+    const mdos_geometry_t *g = &imd->geometry;
+    int count = g->sectors;
+    track->offset = -1;
+    track->header[1] = cylinder;
+    track->header[2] = head;
+    track->header[3] = count;
+    track->header[4] = g->size_code;
+    track->map = malloc(count);
+    track->types = malloc(count);
+    track->data = calloc(count, g->sector_size);
+    if (!track->map || !track->types || !track->data) {
+        return NULL;
+    }
+    for (int s = 0; s < count; s++) {
+        track->map[s] = g->first_sector + s;
+        track->types[s] = 1;
+    }
+
+    imd->where[cylinder][head] = imd->ntracks - 1;
+    return track;
+}
+
+/*
+ * Sector lsn of the linear view, or NULL if the image has no such sector.
+ * With create, a missing track or sector is added to the image. Sectors
+ * larger than 128 bytes hold several consecutive logical sectors.
+ */
+MDOS_GEOM_INLINE uint8_t* imd_sector_at(imd_image_t *imd, const mdos_geometry_t *g,
+                                        long lsn, int create, int *error) {
+    long byte = lsn * MDOS_SECTOR_SIZE;
+    int cylinder, head, id;
+    mdos_geometry_locate(g, byte, &cylinder, &head, &id);
+
+    *error = MDOS_EOK;
+    if (cylinder >= IMD_MAX_CYLINDERS) {
+        *error = create ? MDOS_ENOSPC : MDOS_EOK;
+        return NULL;
+    }
+
+    imd_track_t *track;
+    int t = imd->where[cylinder][head];
+    if (t < 0) {
+        if (!create) return NULL;
+        track = imd_create_track(imd, cylinder, head);
+        if (!track) {
+            *error = MDOS_ENOSPC;
+            return NULL;
+        }
+    } else {
+        track = &imd->tracks[t];
+        if ((*error = imd_load_track(imd, track)) != MDOS_EOK) {
+            return NULL;
+        }
+    }
+
+    int count = track->header[3];
+    int s = 0;
+    while (s < count && track->map[s] != id) {
+        s++;
+    }
+    if (s == count) {
+        if (!create) return NULL;
+        if ((*error = imd_grow_track(track, id)) != MDOS_EOK) return NULL;
+    }
+
+    if (create) {
+        track->dirty = 1;
+        imd->dirty = 1;
+    }
+    return track->data + (long)s * g->sector_size + byte % g->sector_size;
+}
+
+static uint8_t* imd_sector_standard(imd_image_t *imd, long lsn, int create, int *error) {
+    static const mdos_geometry_t standard = MDOS_GEOMETRY_STANDARD;
+    return imd_sector_at(imd, &standard, lsn, create, error);
+}
+
+static uint8_t* imd_sector_generic(imd_image_t *imd, long lsn, int create, int *error) {
+    return imd_sector_at(imd, &imd->geometry, lsn, create, error);
+}
+
+static ssize_t imd_stream_read(void *cookie, char *buf, size_t size) {
+    imd_image_t *imd = cookie;
+    size_t done = 0;
+
+    while (done < size) {
+        long lsn = imd->pos / MDOS_SECTOR_SIZE;
+        int offset = imd->pos % MDOS_SECTOR_SIZE;
+        size_t chunk = MDOS_SECTOR_SIZE - offset;
+        if (chunk > size - done) chunk = size - done;
+
+        int error;
+        uint8_t *sector = imd->sector(imd, lsn, 0, &error);
+        if (error != MDOS_EOK) {
+            errno = EIO;
+            return done ? (ssize_t)done : -1;
+        }
+        if (sector) {
+            memcpy(buf + done, sector + offset, chunk);
+        } else {
+            memset(buf + done, 0, chunk);
+        }
+        MDOS_STAT_ADD(MDOS_STAT_SECTORS_READ, 1);
+
+        done += chunk;
+        imd->pos += chunk;
+    }
+    return done;
+}
+
+static ssize_t imd_stream_write(void *cookie, const char *buf, size_t size) {
+    imd_image_t *imd = cookie;
+    size_t done = 0;
+
+    if (imd->read_only) {
+        errno = EBADF;
+        return -1;
+    }
+
+    while (done < size) {
+        long lsn = imd->pos / MDOS_SECTOR_SIZE;
+        int offset = imd->pos % MDOS_SECTOR_SIZE;
+        size_t chunk = MDOS_SECTOR_SIZE - offset;
+        if (chunk > size - done) chunk = size - done;
+
+        int error;
+        uint8_t *sector = imd->sector(imd, lsn, 0, &error);
+        if (sector && memcmp(sector + offset, buf + done, chunk) != 0) {
+            sector = imd->sector(imd, lsn, 1, &error); /* Marks the track dirty */
+        } else if (!sector && error == MDOS_EOK) {
+            /* Zeros over a sector the image lacks change nothing */
+            int zero = 1;
+            for (size_t i = 0; i < chunk && zero; i++) {
+                zero = buf[done + i] == 0;
+            }
+            if (!zero) sector = imd->sector(imd, lsn, 1, &error);
+        }
+        if (error != MDOS_EOK) {
+            errno = (error == MDOS_ENOSPC) ? ENOSPC : EIO;
+            return done ? (ssize_t)done : -1;
+        }
+        if (sector) {
+            memcpy(sector + offset, buf + done, chunk);
+        }
+        MDOS_STAT_ADD(MDOS_STAT_SECTORS_WRITTEN, 1);
+
+        done += chunk;
+        imd->pos += chunk;
+    }
+    return done;
+}
+
+static int imd_stream_seek(void *cookie, off64_t *offset, int whence) {
+    imd_image_t *imd = cookie;
+    off64_t base = 0;
+
+    if (whence == SEEK_CUR) {
+        base = imd->pos;
+    } else if (whence == SEEK_END) {
+        const mdos_geometry_t *g = &imd->geometry;
+        int cylinders = g->cylinders;
+        for (int t = 0; t < imd->ntracks; t++) {
+            if (imd->tracks[t].header[1] >= cylinders) cylinders = imd->tracks[t].header[1] + 1;
+        }
+        base = (off64_t)cylinders * g->heads * mdos_geometry_track_bytes(g);
+    }
+    if (base + *offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    imd->pos = base + *offset;
+    *offset = imd->pos;
+    return 0;
+}
+
+/* Bytes a dirty track takes once re-encoded, at most */
+static long imd_encoded_bound(const imd_track_t *track) {
+    int count = track->header[3];
+    return 5 + 3L * count + count * (1L + imd_track_sector_size(track));
+}
+
+static uint8_t* imd_encode_track(const imd_track_t *track, uint8_t *out) {
+    int count = track->header[3];
+    int size = imd_track_sector_size(track);
+
+    memcpy(out, track->header, 5);
+    out += 5;
+    memcpy(out, track->map, count);
+    out += count;
+    if (track->cmap) {
+        memcpy(out, track->cmap, count);
+        out += count;
+    }
+    if (track->hmap) {
+        memcpy(out, track->hmap, count);
+        out += count;
+    }
+
+    for (int s = 0; s < count; s++) {
+        const uint8_t *sector = track->data + s * size;
+        int uniform = 1;
+        for (int i = 1; i < size && uniform; i++) {
+            uniform = sector[i] == sector[0];
+        }
+
+        /* Keep the deleted-data and error flags the sector was recorded with */
+        int type = track->types[s];
+        if (type == 0 && uniform && sector[0] == 0) {
+            *out++ = 0;
+            continue;
+        }
+        int flags = type ? (type - 1) / 2 : 0;
+        if (uniform) {
+            *out++ = 2 + 2 * flags;
+            *out++ = sector[0];
+        } else {
+            *out++ = 1 + 2 * flags;
+            memcpy(out, sector, size);
+            out += size;
+        }
+    }
+    MDOS_STAT_ADD(MDOS_STAT_BYTES_ENCODED, (long)count * size);
+    return out;
+}
+
+static int imd_track_key(const imd_track_t *track) {
+    return track->header[1] * 2 + (track->header[2] & 1);
+}
+
+/*
+ * Rebuild the file in memory: the comment and clean tracks are copied from
+ * the source, dirty tracks re-encoded, and added tracks slotted in before
+ * the first original track that follows them. One write, then a rename.
+ */
+static int imd_write_back(imd_image_t *imd) {
+    long total = imd->comment_length;
+    for (int t = 0; t < imd->ntracks; t++) {
+        imd_track_t *track = &imd->tracks[t];
+        total += track->dirty ? imd_encoded_bound(track) : track->length;
+    }
+
+    uint8_t *buffer = malloc(total);
+    if (!buffer) {
+        return MDOS_ENOSPC;
+    }
+
+    uint8_t *out = buffer;
+    int result = MDOS_EOK;
+    if (fseek(imd->fp, 0, SEEK_SET) != 0 ||
+        fread(out, 1, imd->comment_length, imd->fp) != (size_t)imd->comment_length) {
+        result = MDOS_EIO;
+    }
+    out += imd->comment_length;
+
+    /* Added tracks sit at the end of the array; emit them in key order */
+    int first_added = 0;
+    while (first_added < imd->ntracks && imd->tracks[first_added].offset >= 0) {
+        first_added++;
+    }
+    int nadded = imd->ntracks - first_added;
+    char *emitted = calloc(nadded ? nadded : 1, 1);
+    if (!emitted) {
+        free(buffer);
+        return MDOS_ENOSPC;
+    }
+
+    for (int t = 0; t <= first_added && result == MDOS_EOK; t++) {
+        int limit = (t < first_added) ? imd_track_key(&imd->tracks[t]) : 1 << 30;
+
+        for (;;) {
+            int next = -1;
+            for (int a = 0; a < nadded; a++) {
+                imd_track_t *added = &imd->tracks[first_added + a];
+                if (!emitted[a] && imd_track_key(added) < limit &&
+                    (next < 0 || imd_track_key(added) < imd_track_key(&imd->tracks[first_added + next]))) {
+                    next = a;
+                }
+            }
+            if (next < 0) break;
+            emitted[next] = 1;
+            out = imd_encode_track(&imd->tracks[first_added + next], out);
+        }
+
+        if (t == first_added) break;
+        imd_track_t *track = &imd->tracks[t];
+        if (track->dirty) {
+            out = imd_encode_track(track, out);
+        } else if (fseek(imd->fp, track->offset, SEEK_SET) != 0 ||
+                   fread(out, 1, track->length, imd->fp) != (size_t)track->length) {
+            result = MDOS_EIO;
+        } else {
+            out += track->length;
+        }
+    }
+    free(emitted);
+
+    if (result == MDOS_EOK) {
+        size_t len = strlen(imd->path) + 5;
+        char *tmp_path = malloc(len);
+        FILE *fp = NULL;
+        if (tmp_path) {
+            snprintf(tmp_path, len, "%s.tmp", imd->path);
+            fp = fopen(tmp_path, "wb");
+        }
+
+        if (!fp) {
+            result = MDOS_EIO;
+        } else {
+            size_t n = out - buffer;
+            MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 1);
+            int ok = fwrite(buffer, 1, n, fp) == n;
+            struct stat st;
+            if (fstat(fileno(imd->fp), &st) == 0) {
+                fchmod(fileno(fp), st.st_mode & 07777); /* The rename must not change the permissions */
+            }
+            ok = (fclose(fp) == 0) && ok;
+            if (!ok || rename(tmp_path, imd->path) != 0) {
+                remove(tmp_path);
+                result = MDOS_EIO;
+            } else {
+                /* A sidecar would describe the old layout */
+                char *sidecar = imd_sidecar_path(imd->path);
+                if (sidecar) remove(sidecar);
+                free(sidecar);
+            }
+        }
+        free(tmp_path);
+    }
+
+    free(buffer);
+    return result;
+}
+
+static int imd_stream_close(void *cookie) {
+    imd_image_t *imd = cookie;
+    int result = MDOS_EOK;
+
+    if (imd->dirty && !imd->read_only) {
+        result = imd_write_back(imd);
+    }
+    imd_free(imd);
+    return (result == MDOS_EOK) ? 0 : -1;
+}
+
+static imd_image_t* imd_open(const char *path, int read_only) {
+    imd_image_t *imd = calloc(1, sizeof(imd_image_t));
+    if (!imd) {
+        return NULL;
+    }
+    memset(imd->where, 0xFF, sizeof(imd->where));
+    imd->read_only = read_only;
+    imd->path = malloc(strlen(path) + 1);
+    imd->fp = fopen(path, "rb");
+    if (!imd->path || !imd->fp) {
+        imd_free(imd);
+        return NULL;
+    }
+    strcpy(imd->path, path);
+
+    /* A current sidecar saves even the header pass */
+    mdos_trace_span_t span = mdos_trace_begin("imd parse", path);
+    mdos_imd_index_t *index = mdos_imd_index_open(path, MDOS_IMD_INDEX_LOAD);
+    int result = index ? imd_from_index(imd, index) : MDOS_EIO;
+    mdos_imd_index_close(index);
+    mdos_trace_end(&span);
+    if (result != MDOS_EOK) {
+        imd_free(imd);
+        return NULL;
+    }
+    imd->sector = mdos_geometry_is_standard(&imd->geometry) ? imd_sector_standard : imd_sector_generic;
+    return imd;
+}
+
+/* The IMD behind a mount, NULL for other images */
+static imd_image_t* imd_find(mdos_fs_t *fs) {
+    mdos_mounts_lock();
+    imd_image_t *imd = imd_mounts;
+    while (imd && imd->stream != fs->fp) {
+        imd = imd->next;
+    }
+    mdos_mounts_unlock();
+    return imd;
+}
+
+mdos_fs_t* mdos_mount_image(const char *disk_path, int read_only) {
+    if (!disk_path) {
+        return NULL;
+    }
+    if (mdos_is_mdz(disk_path)) {
+        return mdos_mdz_mount(disk_path, read_only);
+    }
+    if (!mdos_is_imd(disk_path)) {
+        return mdos_mount(disk_path, read_only);
+    }
+
+    imd_image_t *imd = imd_open(disk_path, read_only);
+    if (!imd) {
+        return NULL;
+    }
+
+    cookie_io_functions_t io = {
+        .read = imd_stream_read,
+        .write = imd_stream_write,
+        .seek = imd_stream_seek,
+        .close = imd_stream_close,
+    };
+    FILE *stream = fopencookie(imd, read_only ? "rb" : "r+b", io);
+    if (!stream) {
+        imd_free(imd);
+        return NULL;
+    }
+
+    /* Mount normally, then route the library's I/O through the track cache */
+    mdos_fs_t *fs = mdos_mount(disk_path, read_only);
+    if (!fs) {
+        imd->dirty = 0;
+        fclose(stream);
+        return NULL;
+    }
+    fclose(fs->fp);
+    fs->fp = stream;
+    imd->stream = stream;
+    mdos_mounts_lock();
+    imd->next = imd_mounts;
+    imd_mounts = imd;
+    mdos_mounts_unlock();
+    return fs;
+}
+
+int mdos_unmount_image(mdos_fs_t *fs) {
+    if (!fs) {
+        return MDOS_EINVAL;
+    }
+
+    /* Write an IMD back here, where a failure can still be reported */
+    int result = MDOS_EOK;
+    imd_image_t *imd = imd_find(fs);
+    if (imd) {
+        if (fflush(fs->fp) != 0) {
+            result = MDOS_EIO;
+        } else if (imd->dirty && !imd->read_only) {
+            result = imd_write_back(imd);
+        }
+        imd->dirty = 0;
+    }
+    int mdz_result = mdos_mdz_write_back(fs);
+    if (mdz_result != MDOS_ENOENT) {
+        result = mdz_result;
+    }
+    int overlay_result = mdos_overlay_write_back(fs);
+    if (overlay_result != MDOS_ENOENT) {
+        result = overlay_result;
+    }
+
+    int unmount_result = mdos_unmount(fs);
+    return (result == MDOS_EOK) ? unmount_result : result;
+}
+
+long mdos_imd_to_dsk(const char *imd_path, const char *dsk_path, int flags) {
+    if (!imd_path || !dsk_path) {
+        return MDOS_EINVAL;
+    }
+    imd_image_t *imd = imd_open(imd_path, 1);
+    if (!imd) {
+        return MDOS_EIO;
+    }
+
+    /* Tracks through the last one the IMD has, as imdtodsk writes them */
+    const mdos_geometry_t *g = &imd->geometry;
+    long track_bytes = mdos_geometry_track_bytes(g);
+    long last_track = -1;
+    for (int t = 0; t < imd->ntracks; t++) {
+        const imd_track_t *track = &imd->tracks[t];
+        long linear = (long)track->header[1] * g->heads + (track->header[2] & 1);
+        if (track->header[3] && (track->header[2] & 1) < g->heads && linear > last_track) {
+            last_track = linear;
+        }
+    }
+
+    long length = (last_track + 1) * track_bytes;
+    uint8_t *image = calloc(length ? length : 1, 1);
+    long result = image ? MDOS_EOK : MDOS_ENOSPC;
+    for (long lsn = 0; lsn < length / MDOS_SECTOR_SIZE && result == MDOS_EOK; lsn++) {
+        int error;
+        const uint8_t *sector = imd->sector(imd, lsn, 0, &error);
+        if (error != MDOS_EOK) {
+            result = error;
+        } else if (sector) {
+            memcpy(image + lsn * MDOS_SECTOR_SIZE, sector, MDOS_SECTOR_SIZE);
+        }
+    }
+
+    if (result == MDOS_EOK) {
+        FILE *fp = fopen(dsk_path, "wb");
+        if (!fp) {
+            result = MDOS_EIO;
+        } else {
+            result = mdos_sparse_write(fp, image, length, flags);
+            if (fclose(fp) != 0 && result >= 0) result = MDOS_EIO;
+        }
+    }
+
+    free(image);
+    imd_free(imd);
+    return result;
+}
+
+int mdos_image_geometry(mdos_fs_t *fs, mdos_geometry_t *geometry) {
+    if (!fs || !geometry) {
+        return MDOS_EINVAL;
+    }
+    imd_image_t *imd = imd_find(fs);
+    if (imd) {
+        *geometry = imd->geometry;
+        return MDOS_EOK;
+    }
+    if (mdos_mdz_geometry(fs, geometry) == MDOS_EOK ||
+        mdos_overlay_geometry(fs, geometry) == MDOS_EOK) {
+        return MDOS_EOK;
+    }
+
+    struct stat st;
+    if (fstat(fileno(fs->fp), &st) != 0) {
+        return MDOS_EIO;
+    }
+    mdos_geometry_from_dsk(geometry, (long)st.st_size);
+    return MDOS_EOK;
+}
+
+/* Comment block and track layouts taken over by mdos_save_imd */
+typedef struct {
+    uint8_t *comment;       /* Including the 0x1A terminator */
+    long comment_length;
+    uint8_t mode[IMD_MAX_CYLINDERS * 2];        /* By cylinder * 2 + head */
+    uint8_t map[IMD_MAX_CYLINDERS * 2][255];
+    uint8_t known[IMD_MAX_CYLINDERS * 2];
+} imd_layout_t;
+
+/*
+ * Keep the source comment, and for each track its mode and sector order
+ * when the track matches the geometry being written and its map holds each
+ * sector number of a track exactly once.
+ */
+static int imd_load_layout(const char *source, const mdos_geometry_t *g, imd_layout_t *layout) {
+    mdos_imd_index_t *index = mdos_imd_index_open(source, MDOS_IMD_INDEX_LOAD);
+    if (!index) {
+        return MDOS_EIO;
+    }
+
+    int result = MDOS_EOK;
+    layout->comment_length = index->comment_length;
+    layout->comment = malloc(layout->comment_length);
+    if (!layout->comment) {
+        result = MDOS_ENOSPC;
+    } else if (fseek(index->fp, 0, SEEK_SET) != 0 ||
+               fread(layout->comment, 1, layout->comment_length, index->fp) != (size_t)layout->comment_length) {
+        result = MDOS_EIO;
+    }
+
+    for (int t = 0; t < index->ntracks && result == MDOS_EOK; t++) {
+        const imd_index_track_t *track = &index->tracks[t];
+        int key = track->header[1] * 2 + (track->header[2] & 1);
+        if ((track->header[2] & 1) >= g->heads || track->header[3] != g->sectors ||
+            track->header[4] != g->size_code || layout->known[key]) {
+            continue;
+        }
+
+        uint8_t *map = layout->map[key];
+        if (fseek(index->fp, track->offset + 5, SEEK_SET) != 0 ||
+            fread(map, 1, g->sectors, index->fp) != (size_t)g->sectors) {
+            result = MDOS_EIO;
+            break;
+        }
+        uint8_t seen[256] = { 0 };
+        int distinct = 0;
+        for (int s = 0; s < g->sectors; s++) {
+            int index_in_track = map[s] - g->first_sector;
+            if (index_in_track >= 0 && index_in_track < g->sectors && !seen[map[s]]) {
+                seen[map[s]] = 1;
+                distinct++;
+            }
+        }
+        if (distinct == g->sectors) {
+            layout->mode[key] = track->header[0];
+            layout->known[key] = 1;
+        }
+    }
+
+    mdos_imd_index_close(index);
+    return result;
+}
+
+/* The default comment, as the DSK to IMD conversions write it */
+static long imd_default_comment(char *out, size_t size, const char *source, const mdos_geometry_t *g) {
+    time_t now = time(NULL);
+    struct tm *tm_info = localtime(&now);
+
+    int len = snprintf(out, size,
+                       "IMD file created from MDOS image: %s\r\n"
+                       "Created by MDOS library on %04d-%02d-%02d %02d:%02d:%02d\r\n"
+                       "MDOS format: %d-byte sectors, up to %d sectors per track%s\r\n%c",
+                       source,
+                       tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
+                       tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec,
+                       g->sector_size, g->sectors, (g->heads == 2) ? ", double sided" : "",
+                       IMD_COMMENT_END);
+    return (len < (int)size) ? len : (long)size - 1;
+}
+
+int mdos_save_imd(mdos_fs_t *fs, const char *imd_path, const mdos_imd_save_opts_t *opts) {
+    if (!fs || !imd_path) {
+        return MDOS_EINVAL;
+    }
+
+    /* The mounted image, for its path and as the default layout source */
+    imd_image_t *imd = imd_find(fs);
+    const char *mounted = imd ? imd->path : NULL;
+
+    mdos_geometry_t g;
+    int result = mdos_image_geometry(fs, &g);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+
+    imd_layout_t *layout = calloc(1, sizeof(imd_layout_t));
+    if (!layout) {
+        return MDOS_ENOSPC;
+    }
+    const char *source = (opts && opts->source) ? opts->source : mounted;
+    if (opts && opts->preserve) {
+        result = source ? imd_load_layout(source, &g, layout) : MDOS_EINVAL;
+    }
+    int interleave = (opts && (opts->interleave > 0 || opts->skew > 0)) ?
+                     (opts->interleave > 0 ? opts->interleave : 1) : 0;
+    if (opts && (opts->interleave < 0 || opts->skew < 0 ||
+                 (interleave > 1 && interleave >= g.sectors))) {
+        result = MDOS_EINVAL;
+    }
+
+    /* Sectors of the linear view, whole tracks in cylinder, head order */
+    long sectors = 0;
+    if (result == MDOS_EOK) {
+        if (fflush(fs->fp) != 0 || fseek(fs->fp, 0, SEEK_END) != 0) {
+            result = MDOS_EIO;
+        } else {
+            sectors = ftell(fs->fp) / MDOS_SECTOR_SIZE;
+        }
+    }
+    int per_sector = g.sector_size / MDOS_SECTOR_SIZE;
+    long track_sectors = (long)g.sectors * per_sector;
+    long tracks = (sectors + track_sectors - 1) / track_sectors;
+    if (tracks > (long)IMD_MAX_CYLINDERS * g.heads) tracks = (long)IMD_MAX_CYLINDERS * g.heads;
+
+    char comment[1024];
+    long comment_length = 0;
+    if (!layout->comment) {
+        if (opts && opts->comment) {
+            comment_length = snprintf(comment, sizeof(comment) - 1, "%s", opts->comment);
+            if (comment_length > (long)sizeof(comment) - 2) comment_length = sizeof(comment) - 2;
+            comment[comment_length++] = IMD_COMMENT_END;
+        } else {
+            comment_length = imd_default_comment(comment, sizeof(comment),
+                                                 source ? source : "mounted image", &g);
+        }
+    }
+
+    /* Worst case: every track present with every sector stored in full */
+    const long track_bound = 5 + g.sectors * (2L + g.sector_size);
+    uint8_t *track_data = malloc(mdos_geometry_track_bytes(&g));
+    uint8_t *buffer = (result == MDOS_EOK) ?
+        malloc(layout->comment_length + comment_length + (size_t)tracks * track_bound) : NULL;
+    if (result == MDOS_EOK && (!buffer || !track_data)) {
+        result = MDOS_ENOSPC;
+    }
+
+    uint8_t *out = buffer;
+    if (result == MDOS_EOK) {
+        if (layout->comment) {
+            memcpy(out, layout->comment, layout->comment_length);
+            out += layout->comment_length;
+        } else {
+            memcpy(out, comment, comment_length);
+            out += comment_length;
+        }
+    }
+
+    for (long t = 0; t < tracks && result == MDOS_EOK; t++) {
+        int cylinder = t / g.heads, head = t % g.heads, key = cylinder * 2 + head;
+        if (mdos_sparse_is_hole(fs->fp, t * track_sectors * MDOS_SECTOR_SIZE,
+                                track_sectors * MDOS_SECTOR_SIZE)) {
+            continue; /* A hole in a sparse DSK: nothing to read */
+        }
+        int used = 0;
+        for (long l = 0; l < track_sectors; l++) {
+            uint8_t *logical = track_data + l * MDOS_SECTOR_SIZE;
+            long lsn = t * track_sectors + l;
+            if (lsn < sectors) {
+                mdos_getsect(fs, logical, lsn);
+            } else {
+                memset(logical, 0, MDOS_SECTOR_SIZE);
+            }
+            for (int i = 0; i < MDOS_SECTOR_SIZE && !used; i++) {
+                used = logical[i] != 0;
+            }
+        }
+        if (!used) {
+            continue; /* Empty tracks are left out */
+        }
+
+        /* An explicit interleave wins over the preserved sector order */
+        uint8_t map[256];
+        if (interleave) {
+            mdos_geometry_interleave_map(&g, t, interleave, opts->skew, map);
+        } else if (layout->known[key]) {
+            memcpy(map, layout->map[key], g.sectors);
+        } else {
+            mdos_geometry_interleave_map(&g, t, 1, 0, map);
+        }
+
+        *out++ = layout->known[key] ? layout->mode[key] : 0x00;
+        *out++ = cylinder;
+        *out++ = head;
+        *out++ = g.sectors;
+        *out++ = g.size_code;
+        memcpy(out, map, g.sectors);
+        out += g.sectors;
+
+        for (int s = 0; s < g.sectors; s++) {
+            const uint8_t *sector = track_data + (long)(map[s] - g.first_sector) * g.sector_size;
+            int uniform = 1;
+            for (int i = 1; i < g.sector_size && uniform; i++) {
+                uniform = sector[i] == sector[0];
+            }
+            if (uniform) {
+                *out++ = 2;
+                *out++ = sector[0];
+            } else {
+                *out++ = 1;
+                memcpy(out, sector, g.sector_size);
+                out += g.sector_size;
+            }
+        }
+        MDOS_STAT_ADD(MDOS_STAT_BYTES_ENCODED, (long)g.sectors * g.sector_size);
+    }
+
+    if (result == MDOS_EOK) {
+        size_t len = strlen(imd_path) + 5;
+        char *tmp_path = malloc(len);
+        FILE *fp = NULL;
+        if (tmp_path) {
+            snprintf(tmp_path, len, "%s.tmp", imd_path);
+            fp = fopen(tmp_path, "wb");
+        }
+
+        if (!fp) {
+            result = MDOS_EIO;
+        } else {
+            size_t n = out - buffer;
+            MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 1);
+            int ok = fwrite(buffer, 1, n, fp) == n;
+            /* Permissions of the mounted image: its path for an IMD, else its file */
+            struct stat st;
+            if (mounted ? stat(mounted, &st) == 0 :
+                          fileno(fs->fp) >= 0 && fstat(fileno(fs->fp), &st) == 0) {
+                fchmod(fileno(fp), st.st_mode & 07777);
+            }
+            ok = (fclose(fp) == 0) && ok;
+            if (!ok || rename(tmp_path, imd_path) != 0) {
+                remove(tmp_path);
+                result = MDOS_EIO;
+            }
+        }
+        free(tmp_path);
+    }
+
+    free(buffer);
+    free(track_data);
+    free(layout->comment);
+    free(layout);
+    return result;
+}
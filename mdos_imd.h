@@ -0,0 +1,124 @@
+/*
+ * MDOS Filesystem Library - Direct IMD Access
+ * Copyright (C) 2025
+ *
+ * Mount ImageDisk files in place, without a DSK intermediate
+ */
+
+#ifndef MDOS_IMD_H
+#define MDOS_IMD_H
+
+#include "mdos_fs.h"
+#include "mdos_geometry.h"
+
+/* Sector layout the library's IMD<->DSK conversion uses */
+#define MDOS_IMD_SECTORS_PER_TRACK MDOS_GEOM_SECTORS
+
+/* Sidecar index written next to an IMD: disk.imd -> disk.imd.idx */
+#define MDOS_IMD_SIDECAR_EXT ".idx"
+
+/* mdos_imd_index_open flags */
+#define MDOS_IMD_INDEX_LOAD 1   /* Use the sidecar if it matches the file */
+#define MDOS_IMD_INDEX_SAVE 2   /* Write the sidecar after scanning */
+
+typedef struct mdos_imd_index mdos_imd_index_t;
+
+/* Non-zero if path starts with the "IMD " signature */
+int mdos_is_imd(const char *path);
+
+/*
+ * Index an IMD for random access. The scan reads only track headers, sector
+ * maps and sector type bytes and seeks over the data, giving a table of
+ * 4 bytes per sector. The sidecar holds the same table and is trusted only
+ * while the IMD's size and modification time are unchanged, and is
+ * rewritten from a fresh scan if its records are damaged. Returns NULL
+ * if the file cannot be read or is not a well-formed IMD.
+ */
+mdos_imd_index_t* mdos_imd_index_open(const char *imd_path, int flags);
+int mdos_imd_index_save(const mdos_imd_index_t *index, const char *imd_path);
+void mdos_imd_index_close(mdos_imd_index_t *index);
+
+/*
+ * Read sector number `sector` (as recorded in the IMD sector map, usually
+ * from 1) of a cylinder and head with one seek and one read. buf must hold
+ * 128 << size code bytes. Returns the sector size, MDOS_ENOENT if the image
+ * has no such sector, or another negative error code.
+ */
+int mdos_imd_read_sector(mdos_imd_index_t *index, int cylinder, int head, int sector, uint8_t *buf);
+
+/*
+ * IMD type of a sector, from the index alone: 0 data unavailable, 1-8 as
+ * ImageDisk records them (even: compressed, 3-4 and 7-8: deleted data
+ * mark, 5-8: read with a data error). Returns MDOS_ENOENT if the image
+ * has no such sector, or MDOS_EINVAL.
+ */
+int mdos_imd_sector_type(const mdos_imd_index_t *index, int cylinder, int head, int sector);
+
+/*
+ * Copy a track's sector map (sector numbers in rotational order) into map,
+ * which must hold 255 entries. Returns the number of sectors, MDOS_ENOENT
+ * if the image has no such track, or another negative error code.
+ */
+int mdos_imd_sector_map(mdos_imd_index_t *index, int cylinder, int head, uint8_t *map);
+
+/*
+ * Mount a DSK, IMD or .mdz image; IMD and .mdz are detected from the file
+ * signature (.mdz mounts are described in mdos_mdz.h).
+ * An IMD mount indexes the track headers up front (or loads a current
+ * sidecar) and decodes each track
+ * the first time one of its sectors is accessed. The linear sector view
+ * follows the geometry the tracks describe (heads, sectors per track, sector
+ * size; see mdos_geometry_offset), with a specialized path for the standard
+ * 77x26x128 single-sided layout. If anything was written,
+ * unmounting rewrites the IMD: untouched track records are copied
+ * verbatim, modified tracks are re-encoded with their original mode, sector
+ * numbering and flags, and tracks the image lacked are added. The new file
+ * replaces the old one only once it is complete.
+ */
+mdos_fs_t* mdos_mount_image(const char *disk_path, int read_only);
+
+/*
+ * Unmount an image mounted with mdos_mount_image. Unlike mdos_unmount it
+ * reports a failure to write an IMD back.
+ */
+int mdos_unmount_image(mdos_fs_t *fs);
+
+/*
+ * Convert an IMD to a DSK laid out by the IMD's geometry, through the last
+ * track the IMD holds. The DSK is written with mdos_sparse_write, so zero
+ * sectors (and with MDOS_SPARSE_FREE, free clusters) become holes. Unlike
+ * mdos_convert_imd_to_dsk this handles double-sided images. Returns the
+ * bytes left as holes or a negative error code.
+ */
+long mdos_imd_to_dsk(const char *imd_path, const char *dsk_path, int flags);
+
+/*
+ * Geometry of a mounted image: what the tracks of an IMD mount describe,
+ * what an .mdz header records, or for a DSK what mdos_geometry_from_dsk
+ * infers from its size.
+ */
+int mdos_image_geometry(mdos_fs_t *fs, mdos_geometry_t *geometry);
+
+/* mdos_save_imd options; a NULL options pointer means all defaults */
+typedef struct {
+    int preserve;           /* Keep the source's comment block and track modes */
+    const char *source;     /* Source IMD; NULL: the mounted image if it is one */
+    const char *comment;    /* Comment text instead of the generated one */
+    int interleave;         /* Sector interleave; 0 keeps 1..n (or the preserved order) */
+    int skew;               /* Slots each track's layout is rotated by the one before */
+} mdos_imd_save_opts_t;
+
+/*
+ * Write the mounted filesystem as an IMD, reading sectors through the mount
+ * (so unsaved changes of an IMD mount are included). Encoding follows
+ * dsktoimd: tracks laid out by mdos_image_geometry, tracks without data
+ * left out, sectors filled with one byte stored compressed. With preserve, the
+ * comment is copied byte for byte and each track keeps the source's mode
+ * and sector order. An interleave or skew lays sectors out with
+ * mdos_geometry_interleave_map instead, for drives whose host cannot read
+ * consecutive sectors; MDOS_EINVAL if the interleave is not below the
+ * sectors per track. The file is built in memory and written once.
+ */
+int mdos_save_imd(mdos_fs_t *fs, const char *imd_path, const mdos_imd_save_opts_t *opts);
+
+#endif /* MDOS_IMD_H */
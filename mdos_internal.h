@@ -9,6 +9,7 @@
 #define MDOS_INTERNAL_H
 
 #include "mdos_fs.h"
+#include "mdos_bulk.h"
 
 /* Internal disk I/O functions (mdos_diskio.c) */
 void mdos_getsect(mdos_fs_t *fs, uint8_t *buf, int sect);
@@ -28,4 +29,48 @@ mdos_file_t* mdos_get_file_handle(mdos_fs_t *fs, int fd);
 int mdos_allocate_fd(mdos_fs_t *fs);
 void mdos_free_fd(mdos_fs_t *fs, int fd);
 
+/* On-disk layout of the system area */
+#define MDOS_CAT_SECTOR        1    /* Cluster Allocation Table */
+#define MDOS_DIR_FIRST_SECTOR  3    /* Directory: sectors 3-22 */
+#define MDOS_DIR_SECTORS       20
+#define MDOS_DIR_ENTRY_SIZE    16
+#define MDOS_DIR_ENTRIES       (MDOS_DIR_SECTORS * MDOS_SECTOR_SIZE / MDOS_DIR_ENTRY_SIZE)
+#define MDOS_CAT_CLUSTERS      1024 /* Bits in the CAT */
+
+/*
+ * In-memory copy of the CAT and directory, so that operations touching many
+ * files read each metadata sector once and write each modified one once.
+ */
+typedef struct {
+    uint8_t cat[MDOS_SECTOR_SIZE];
+    uint8_t dir[MDOS_DIR_SECTORS][MDOS_SECTOR_SIZE];
+    int dir_dirty[MDOS_DIR_SECTORS];
+    int cat_dirty;
+} mdos_meta_t;
+
+/* Internal metadata functions (mdos_bulk.c) */
+void mdos_meta_load(mdos_fs_t *fs, mdos_meta_t *meta);
+int mdos_meta_commit(mdos_fs_t *fs, mdos_meta_t *meta);
+uint8_t* mdos_meta_entry(mdos_meta_t *meta, int slot);
+void mdos_meta_entry_name(const uint8_t *entry, char *name);
+int mdos_meta_find(mdos_meta_t *meta, const char *filename, int *slot);
+int mdos_meta_add_entry(mdos_meta_t *meta, const char *filename, int rib_sector, int file_type);
+void mdos_meta_delete_entry(mdos_meta_t *meta, int slot);
+void mdos_cat_release(uint8_t *cat, const mdos_rib_t *rib);
+
+/* Internal bulk helpers (mdos_bulk.c) */
+int mdos_bulk_name(const char *local_name, const char *mdos_name, char *name);
+int mdos_bulk_host_type(const char *local_name);
+int mdos_bulk_set_host_data(mdos_bulk_file_t *file, const char *local_name, uint8_t *raw, size_t size);
+int mdos_bulk_import_meta(mdos_fs_t *fs, mdos_meta_t *meta, mdos_bulk_file_t *files, int count);
+int mdos_read_contents(mdos_fs_t *fs, int rib_sector, mdos_rib_t *rib, uint8_t **data, size_t *size);
+
+/*
+ * One lock over the lists of open IMD, MDZ and overlay mounts (mdos_imd.c),
+ * held only while a list is walked or changed, so that threads may mount
+ * and unmount images of their own at the same time.
+ */
+void mdos_mounts_lock(void);
+void mdos_mounts_unlock(void);
+
 #endif /* MDOS_INTERNAL_H */
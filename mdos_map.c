@@ -0,0 +1,274 @@
+/*
+ * MDOS Filesystem Library - Cluster Map and Damage Report
+ * Copyright (C) 2025
+ *
+ * The map is the reverse of the RIBs: one pass over every segment list
+ * fills a table indexed by cluster. The damage report walks the IMD's
+ * sector status in disk order and looks each bad sector up in it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mdos_internal.h"
+#include "mdos_map.h"
+#include "mdos_imd.h"
+#include "mdos_stats.h"
+#include "mdos_geometry.h"
+
+#if MDOS_MAP_CLUSTERS != MDOS_CAT_CLUSTERS || MDOS_MAP_SLOTS != MDOS_DIR_ENTRIES
+#error "mdos_map.h sizes do not match the on-disk layout"
+#endif
+
+#define MAP_CLUSTER_SECTORS 4
+#define MAP_SDWS            57      /* Segment descriptors in a RIB */
+#define MAP_LOCKOUT_SECTOR  2       /* Lockout table, same layout as the CAT */
+#define MAP_SYSTEM_SECTORS  (MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS)
+#define MAP_ENTRIES_PER_SECTOR (MDOS_SECTOR_SIZE / MDOS_DIR_ENTRY_SIZE)
+
+/* Sector status in the damage report */
+#define DAMAGE_OK           0
+#define DAMAGE_UNAVAILABLE  1
+#define DAMAGE_ERROR        2
+
+/* What part of its owner a damaged sector is */
+enum { PART_DATA, PART_RIB, PART_SLACK, PART_UNKNOWN, PART_ID, PART_CAT, PART_LOCKOUT, PART_DIR, PART_UNUSED };
+
+static void map_claim(mdos_cluster_map_t *map, long cluster, int slot, int lsn) {
+    if (map->cluster[cluster].slot != MDOS_MAP_FREE) {
+        map->cross_linked++;
+        return;
+    }
+    map->cluster[cluster].slot = (int16_t)slot;
+    map->cluster[cluster].lsn = (uint16_t)lsn;
+}
+
+int mdos_cluster_map(mdos_fs_t *fs, mdos_cluster_map_t *map) {
+    if (!fs || !map) {
+        return MDOS_EINVAL;
+    }
+    memset(map, 0, sizeof(*map));
+    mdos_geometry_t g;
+    int result = mdos_image_geometry(fs, &g);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+    map->sectors = mdos_geometry_bytes(&g) / MDOS_SECTOR_SIZE;
+    map->clusters = map->sectors / MAP_CLUSTER_SECTORS;
+    if (map->clusters > MDOS_MAP_CLUSTERS) map->clusters = MDOS_MAP_CLUSTERS;
+    for (long c = 0; c < MDOS_MAP_CLUSTERS; c++) {
+        map->cluster[c].slot = MDOS_MAP_FREE;
+    }
+
+    for (long c = 0; c * MAP_CLUSTER_SECTORS < MAP_SYSTEM_SECTORS; c++) {
+        map_claim(map, c, MDOS_MAP_SYSTEM, (int)(c * MAP_CLUSTER_SECTORS));
+    }
+
+    /* Each file's segments in SDW order; logical sectors run on across them */
+    mdos_meta_t meta;
+    mdos_meta_load(fs, &meta);
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+        const uint8_t *entry = mdos_meta_entry(&meta, slot);
+        int rib_sector = (entry[10] << 8) | entry[11];
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            continue;
+        }
+        mdos_map_file_t *file = &map->file[slot];
+        mdos_meta_entry_name(entry, file->name);
+        file->rib_sector = rib_sector;
+        if (rib_sector < MAP_SYSTEM_SECTORS || rib_sector >= map->sectors) {
+            continue;
+        }
+
+        mdos_rib_t rib;
+        mdos_getsect(fs, (uint8_t *)&rib, rib_sector);
+        int last = rib.last_size;
+        file->sectors = (rib.size_high << 8) | rib.size_low;
+        file->size = file->sectors ? (long)(file->sectors - 1) * MDOS_SECTOR_SIZE +
+                                     ((last == 0 || last > MDOS_SECTOR_SIZE) ? MDOS_SECTOR_SIZE : last) : 0;
+
+        int lsn = 0;
+        for (int i = 0; i < MAP_SDWS; i++) {
+            int sdw = (rib.sdw[2 * i] << 8) | rib.sdw[2 * i + 1];
+            MDOS_STAT_ADD(MDOS_STAT_SDWS, 1);
+            if (sdw & 0x8000) {
+                break;
+            }
+            long cluster = sdw & 0x3FF;
+            long count = ((sdw >> 10) & 0x1F) + 1;
+            for (long c = cluster; sdw && c < cluster + count; c++, lsn += MAP_CLUSTER_SECTORS) {
+                if (c < map->clusters) map_claim(map, c, slot, lsn);
+            }
+        }
+        /* An unreadable RIB still owns its own cluster */
+        if (lsn == 0 && rib_sector % MAP_CLUSTER_SECTORS == 0) {
+            map_claim(map, rib_sector / MAP_CLUSTER_SECTORS, slot, 0);
+        }
+    }
+
+    uint8_t lockout[MDOS_SECTOR_SIZE];
+    mdos_getsect(fs, lockout, MAP_LOCKOUT_SECTOR);
+    for (long c = 0; c < map->clusters; c++) {
+        if ((lockout[c >> 3] & (1 << (7 - (c & 7)))) && map->cluster[c].slot == MDOS_MAP_FREE) {
+            map_claim(map, c, MDOS_MAP_LOCKOUT, 0);
+        }
+    }
+    return MDOS_EOK;
+}
+
+int mdos_map_sector(const mdos_cluster_map_t *map, long sector, int *lsn) {
+    long cluster = sector / MAP_CLUSTER_SECTORS;
+    if (!map || sector < 0 || cluster >= map->clusters) {
+        if (lsn) *lsn = -1;
+        return MDOS_MAP_FREE;
+    }
+    const mdos_map_cluster_t *c = &map->cluster[cluster];
+    if (lsn) {
+        *lsn = (c->slot >= 0 || c->slot == MDOS_MAP_SYSTEM) ? c->lsn + (int)(sector % MAP_CLUSTER_SECTORS) : -1;
+    }
+    return c->slot;
+}
+
+/* A run of damaged sectors with the same owner, part and status */
+typedef struct {
+    int owner, part, status;
+    long first, last;       /* Sectors */
+    int lsn_first, lsn_last;
+    int cylinder, head, sector;  /* Where the run starts */
+} damage_run_t;
+
+static int damage_part(const mdos_cluster_map_t *map, const uint8_t *rib_lost, int owner,
+                       long sector, int lsn) {
+    if (owner >= 0) {
+        return lsn == 0 ? PART_RIB : rib_lost[owner] ? PART_UNKNOWN :
+               lsn > map->file[owner].sectors ? PART_SLACK : PART_DATA;
+    }
+    if (owner != MDOS_MAP_SYSTEM) {
+        return PART_UNUSED;
+    }
+    return sector == 0 ? PART_ID : sector == MDOS_CAT_SECTOR ? PART_CAT :
+           sector == MAP_LOCKOUT_SECTOR ? PART_LOCKOUT : sector < MAP_SYSTEM_SECTORS ? PART_DIR : PART_UNUSED;
+}
+
+static void damage_flush(const char *path, const mdos_cluster_map_t *map, const damage_run_t *run,
+                         uint8_t *hit, mdos_damage_stats_t *stats, FILE *report) {
+    long n = run->last - run->first + 1;
+    const char *owner = run->owner >= 0 ? map->file[run->owner].name :
+                        run->owner == MDOS_MAP_SYSTEM ? "system area" :
+                        run->owner == MDOS_MAP_LOCKOUT ? "locked-out clusters" : "free space";
+    char what[96];
+    if (run->owner >= 0 && run->part != PART_SLACK) {
+        stats->file_sectors += n;
+        if (!hit[run->owner]) {
+            hit[run->owner] = 1;
+            stats->files++;
+        }
+    } else if (run->owner == MDOS_MAP_SYSTEM && run->part != PART_UNUSED) {
+        stats->system_sectors += n;
+    } else {
+        stats->spare_sectors += n;
+    }
+
+    switch (run->part) {
+    case PART_DATA: {
+        long start = (long)(run->lsn_first - 1) * MDOS_SECTOR_SIZE;
+        long end = (long)run->lsn_last * MDOS_SECTOR_SIZE;
+        if (end > map->file[run->owner].size) end = map->file[run->owner].size;
+        stats->bytes += end - start;
+        snprintf(what, sizeof(what), "bytes %ld-%ld", start, end - 1);
+        break;
+    }
+    case PART_RIB:      snprintf(what, sizeof(what), "RIB (segment list)"); break;
+    case PART_SLACK:    snprintf(what, sizeof(what), "allocated sectors past the data"); break;
+    case PART_UNKNOWN:  snprintf(what, sizeof(what), "sectors at an unknown offset"); break;
+    case PART_ID:       snprintf(what, sizeof(what), "disk ID"); break;
+    case PART_CAT:      snprintf(what, sizeof(what), "CAT"); break;
+    case PART_LOCKOUT:  snprintf(what, sizeof(what), "lockout table"); break;
+    case PART_DIR:
+        snprintf(what, sizeof(what), "directory entries %ld-%ld",
+                 (run->first - MDOS_DIR_FIRST_SECTOR) * MAP_ENTRIES_PER_SECTOR,
+                 (run->last - MDOS_DIR_FIRST_SECTOR + 1) * MAP_ENTRIES_PER_SECTOR - 1);
+        break;
+    default:            snprintf(what, sizeof(what), "unused sectors"); break;
+    }
+
+    if (!report) {
+        return;
+    }
+    fprintf(report, "%s: %s: %s %s (sector", path, owner, what,
+            run->status == DAMAGE_UNAVAILABLE ? "unavailable" : "read with data errors");
+    if (n > 1) {
+        fprintf(report, "s %ld-%ld", run->first, run->last);
+    } else {
+        fprintf(report, " %ld", run->first);
+    }
+    fprintf(report, " at %d/%d/%d)\n", run->cylinder, run->head, run->sector);
+}
+
+int mdos_damage(const char *imd_path, mdos_damage_stats_t *stats, FILE *report) {
+    if (!imd_path || !stats) {
+        return MDOS_EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (!mdos_is_imd(imd_path)) {
+        return MDOS_EINVAL;
+    }
+    mdos_imd_index_t *index = mdos_imd_index_open(imd_path, MDOS_IMD_INDEX_LOAD);
+    if (!index) {
+        return MDOS_EIO;
+    }
+    mdos_fs_t *mount = mdos_mount_image(imd_path, 1);
+    mdos_cluster_map_t *map = malloc(sizeof(mdos_cluster_map_t));
+    mdos_geometry_t g;
+    int result = (!mount || !map) ? (mount ? MDOS_ENOSPC : MDOS_ENOENT) : mdos_cluster_map(mount, map);
+    if (result == MDOS_EOK) {
+        result = mdos_image_geometry(mount, &g);
+    }
+
+    /* Sectors in disk order; each physical sector's status covers its 128-byte parts */
+    if (result == MDOS_EOK) {
+        uint8_t hit[MDOS_MAP_SLOTS] = { 0 }, rib_lost[MDOS_MAP_SLOTS] = { 0 };
+        damage_run_t run;
+        int status = DAMAGE_OK, cylinder = 0, head = 0, sector = 0, open = 0;
+        stats->sectors = map->sectors;
+        for (long s = 0; s < map->sectors; s++) {
+            if ((s * MDOS_SECTOR_SIZE) % g.sector_size == 0) {
+                mdos_geometry_locate(&g, s * MDOS_SECTOR_SIZE, &cylinder, &head, &sector);
+                int type = mdos_imd_sector_type(index, cylinder, head, sector);
+                status = type == 0 ? DAMAGE_UNAVAILABLE : type >= 5 ? DAMAGE_ERROR : DAMAGE_OK;
+            }
+            if (status == DAMAGE_UNAVAILABLE) stats->unavailable++;
+            if (status == DAMAGE_ERROR) stats->data_errors++;
+            if (status == DAMAGE_OK) {
+                if (open) damage_flush(imd_path, map, &run, hit, stats, report);
+                open = 0;
+                continue;
+            }
+
+            int lsn;
+            int owner = mdos_map_sector(map, s, &lsn);
+            int part = damage_part(map, rib_lost, owner, s, lsn);
+            if (part == PART_RIB) {
+                rib_lost[owner] = 1;    /* The sectors after it cannot be placed in the file */
+            }
+            if (open && run.owner == owner && run.part == part && run.status == status &&
+                run.last == s - 1 && (part != PART_DATA || run.lsn_last == lsn - 1)) {
+                run.last = s;
+                run.lsn_last = lsn;
+                continue;
+            }
+            if (open) damage_flush(imd_path, map, &run, hit, stats, report);
+            run = (damage_run_t){ owner, part, status, s, s, lsn, lsn, cylinder, head, sector };
+            open = 1;
+        }
+        if (open) damage_flush(imd_path, map, &run, hit, stats, report);
+    }
+
+    if (mount) {
+        int unmount_result = mdos_unmount_image(mount);
+        if (result == MDOS_EOK) result = unmount_result;
+    }
+    mdos_imd_index_close(index);
+    free(map);
+    return result;
+}
@@ -0,0 +1,82 @@
+/*
+ * MDOS Filesystem Library - Cluster Map and Damage Report
+ * Copyright (C) 2025
+ *
+ * Map every cluster to the file (and logical sector) or system structure
+ * that owns it, and combine that with an IMD's sector status to tell which
+ * files unreadable sectors hurt
+ */
+
+#ifndef MDOS_MAP_H
+#define MDOS_MAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mdos_fs.h"
+
+#define MDOS_MAP_CLUSTERS 1024  /* Clusters the CAT can describe */
+#define MDOS_MAP_SLOTS    160   /* Directory entries */
+
+/* Cluster owners other than a directory slot */
+#define MDOS_MAP_FREE     (-1)  /* Used by nothing */
+#define MDOS_MAP_SYSTEM   (-2)  /* Disk ID, CAT, lockout table, directory */
+#define MDOS_MAP_LOCKOUT  (-3)  /* Locked out and not used by a file */
+
+typedef struct {
+    int16_t slot;           /* Directory slot, or one of MDOS_MAP_* */
+    uint16_t lsn;           /* Owner's logical sector at the cluster's first sector */
+} mdos_map_cluster_t;
+
+typedef struct {
+    char name[MDOS_MAX_FILENAME];  /* "" for an empty slot */
+    int rib_sector;
+    int sectors;            /* Data sectors, after the RIB */
+    long size;              /* Bytes */
+} mdos_map_file_t;
+
+typedef struct {
+    long sectors;           /* Sectors on the disk */
+    long clusters;
+    long cross_linked;      /* Clusters claimed twice; the first claim keeps them */
+    mdos_map_cluster_t cluster[MDOS_MAP_CLUSTERS];
+    mdos_map_file_t file[MDOS_MAP_SLOTS];
+} mdos_cluster_map_t;
+
+/*
+ * Build the map of a mounted image in one pass over the directory and the
+ * segment descriptors of every RIB. A file's clusters get its slot and
+ * their logical sector numbers (0 is the RIB); the system area's clusters
+ * get MDOS_MAP_SYSTEM and their sector numbers; locked-out clusters no file
+ * uses get MDOS_MAP_LOCKOUT.
+ */
+int mdos_cluster_map(mdos_fs_t *fs, mdos_cluster_map_t *map);
+
+/*
+ * Owner of a sector: a directory slot or one of MDOS_MAP_*. For a slot,
+ * *lsn is the file's logical sector (0: the RIB, past file[slot].sectors:
+ * allocated but unused); for MDOS_MAP_SYSTEM, the sector number.
+ */
+int mdos_map_sector(const mdos_cluster_map_t *map, long sector, int *lsn);
+
+typedef struct {
+    long sectors;           /* Sectors whose status was checked */
+    long unavailable;       /* Recorded as "data unavailable" */
+    long data_errors;       /* Recorded with a data error */
+    long file_sectors;      /* Damaged sectors holding file data or a RIB */
+    long system_sectors;    /* Damaged sectors of the disk ID, CAT, lockout table, directory */
+    long spare_sectors;     /* Damaged but unused: free, locked out, or past a file's end */
+    int files;              /* Files with damaged data or RIB */
+    long bytes;             /* File bytes in damaged sectors */
+} mdos_damage_stats_t;
+
+/*
+ * Report which files, byte ranges and system structures the damaged
+ * sectors of an IMD hit: those ImageDisk recorded as unavailable or read
+ * with a data error. Each run of damaged sectors with one owner is one line
+ * on report, as "image: owner: what". Nothing is extracted or written.
+ * Returns MDOS_EINVAL if the image is not an IMD (other formats carry no
+ * sector status).
+ */
+int mdos_damage(const char *imd_path, mdos_damage_stats_t *stats, FILE *report);
+
+#endif /* MDOS_MAP_H */
@@ -0,0 +1,782 @@
+/*
+ * MDOS Filesystem Library - Compressed Image Container (.mdz)
+ * Copyright (C) 2025
+ *
+ * An .mdz mount works like an IMD mount: the library gets a stdio stream
+ * whose reads and writes are served from a per-track cache, filled by
+ * decompressing a track's block the first time it is touched
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "mdos_internal.h"
+#include "mdos_mdz.h"
+#include "mdos_imd.h"
+#include "mdos_hash.h"
+#include "mdos_sparse.h"
+#include "mdos_stats.h"
+
+#define MDZ_HEADER_SIZE 16
+#define MDZ_ENTRY_SIZE  16
+#define MDZ_FOOTER_SIZE 16
+#define MDZ_MAX_BYTES   0xFFFFFFFFL /* Offsets and the length are 32 bits */
+
+/* 128-byte sectors a stream transfer of n bytes at pos touches */
+#define MDZ_SECTORS_SPANNED(pos, n) (((pos) + (n) - 1) / MDOS_SECTOR_SIZE - (pos) / MDOS_SECTOR_SIZE + 1)
+
+#define LZ_WINDOW       4096
+#define LZ_MIN_MATCH    3
+#define LZ_HASH_BITS    12
+#define LZ_MAX_CHAIN    32          /* Candidates tried per position */
+
+typedef struct {
+    uint32_t offset;        /* Block position in the file */
+    uint32_t length;        /* Stored bytes */
+    uint32_t crc;           /* CRC-32 of the decoded track */
+    uint8_t method;
+} mdz_block_t;
+
+typedef struct mdz_image {
+    FILE *fp;
+    char *path;
+    int read_only;
+    mdos_geometry_t geometry;
+    long track_bytes;
+    long length;            /* Bytes in the linear image */
+    long ntracks;
+    mdz_block_t *blocks;
+    uint8_t **cache;        /* Decoded tracks, track_bytes each; NULL until used */
+    uint8_t *modified;      /* Per track: cache differs from the stored block */
+    off64_t pos;
+    int dirty;
+    FILE *stream;           /* The stream handed to the library */
+    struct mdz_image *next; /* Open .mdz mounts */
+} mdz_image_t;
+
+static mdz_image_t *mdz_mounts;
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int mdos_is_mdz(const char *path) {
+    char magic[4];
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return 0;
+    }
+    int is_mdz = fread(magic, 1, 4, fp) == 4 && memcmp(magic, MDOS_MDZ_MAGIC, 4) == 0;
+    fclose(fp);
+    return is_mdz;
+}
+
+static uint32_t lz_hash(const uint8_t *p) {
+    uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+size_t mdos_lz_compress(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    int head[1 << LZ_HASH_BITS];
+    int prev[LZ_WINDOW];        /* Previous position with the same hash */
+    memset(head, 0xFF, sizeof(head));
+
+    size_t o = 0;
+    size_t flag_pos = 0;
+    int nitems = 8;
+    size_t i = 0;
+
+    while (i < len) {
+        if (nitems == 8) {
+            if (o >= cap) return 0;
+            flag_pos = o;
+            out[o++] = 0;
+            nitems = 0;
+        }
+
+        /* Longest match among the recent positions with the same hash */
+        size_t best_len = 0;
+        size_t best_dist = 0;
+        if (i + LZ_MIN_MATCH <= len) {
+            int candidate = head[lz_hash(in + i)];
+            for (int chain = LZ_MAX_CHAIN; candidate >= 0 && i - candidate <= LZ_WINDOW && chain > 0; chain--) {
+                size_t n = 0;
+                while (i + n < len && in[candidate + n] == in[i + n]) n++;
+                if (n > best_len) {
+                    best_len = n;
+                    best_dist = i - candidate;
+                    if (i + n == len) break;
+                }
+                int next = prev[candidate & (LZ_WINDOW - 1)];
+                if (next >= candidate) break;
+                candidate = next;
+            }
+        }
+
+        size_t step;
+        if (best_len >= LZ_MIN_MATCH) {
+            size_t extra = best_len - LZ_MIN_MATCH;
+            size_t need = 2 + ((extra >= 15) ? 1 + (extra - 15) / 255 : 0);
+            if (o + need > cap) return 0;
+            out[o++] = (uint8_t)((best_dist - 1) >> 4);
+            out[o++] = (uint8_t)((((best_dist - 1) & 0x0F) << 4) | (extra < 15 ? extra : 15));
+            if (extra >= 15) {
+                for (extra -= 15; extra >= 255; extra -= 255) {
+                    out[o++] = 255;
+                }
+                out[o++] = (uint8_t)extra;
+            }
+            out[flag_pos] |= 1 << nitems;
+            step = best_len;
+        } else {
+            if (o >= cap) return 0;
+            out[o++] = in[i];
+            step = 1;
+        }
+        nitems++;
+
+        for (size_t end = i + step; i < end; i++) {
+            if (i + LZ_MIN_MATCH <= len) {
+                uint32_t h = lz_hash(in + i);
+                prev[i & (LZ_WINDOW - 1)] = head[h];
+                head[h] = (int)i;
+            }
+        }
+    }
+    return o;
+}
+
+int mdos_lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t out_len) {
+    size_t i = 0;
+    size_t o = 0;
+
+    while (o < out_len) {
+        if (i >= len) return MDOS_EIO;
+        uint8_t flags = in[i++];
+
+        for (int item = 0; item < 8 && o < out_len; item++) {
+            if (!(flags & (1 << item))) {
+                if (i >= len) return MDOS_EIO;
+                out[o++] = in[i++];
+                continue;
+            }
+
+            if (i + 2 > len) return MDOS_EIO;
+            size_t dist = (((size_t)in[i] << 4) | (in[i + 1] >> 4)) + 1;
+            size_t n = in[i + 1] & 0x0F;
+            i += 2;
+            if (n == 15) {
+                uint8_t more;
+                do {
+                    if (i >= len) return MDOS_EIO;
+                    more = in[i++];
+                    n += more;
+                } while (more == 255);
+            }
+            n += LZ_MIN_MATCH;
+            if (dist > o || n > out_len - o) return MDOS_EIO;
+
+            uint8_t *src = out + o - dist;
+            if (dist >= n) {
+                memcpy(out + o, src, n);
+            } else if (dist == 1) {
+                memset(out + o, *src, n);
+            } else {
+                /* Overlapping run: the pattern repeats every dist bytes,
+                   so copy what is already there in doubling chunks */
+                memcpy(out + o, src, dist);
+                for (size_t k = dist; k < n; ) {
+                    size_t chunk = (k < n - k) ? k : n - k;
+                    memcpy(out + o + k, out + o, chunk);
+                    k += chunk;
+                }
+            }
+            o += n;
+        }
+    }
+    return (i == len) ? MDOS_EOK : MDOS_EIO;
+}
+
+/* Bytes of track t in the linear image (the last track may be short) */
+static long mdz_track_length(const mdz_image_t *mdz, long t) {
+    long rest = mdz->length - t * mdz->track_bytes;
+    return (rest < mdz->track_bytes) ? rest : mdz->track_bytes;
+}
+
+/*
+ * Compress one track into out, which must hold n bytes, and fill in the
+ * block's method, length and checksum. Falls back to storing the track
+ * when compressing would not make it smaller.
+ */
+static void mdz_encode_block(const uint8_t *data, long n, uint8_t *out, mdz_block_t *block) {
+    MDOS_STAT_ADD(MDOS_STAT_BYTES_ENCODED, n);
+    block->crc = mdos_crc32(data, n);
+
+    long zero = 0;
+    while (zero < n && data[zero] == 0) zero++;
+    if (zero == n) {
+        block->method = MDOS_MDZ_ZERO;
+        block->length = 0;
+        return;
+    }
+
+    size_t packed = mdos_lz_compress(data, n, out, n - 1);
+    if (packed > 0) {
+        block->method = MDOS_MDZ_LZ;
+        block->length = packed;
+    } else {
+        block->method = MDOS_MDZ_STORED;
+        block->length = n;
+        memcpy(out, data, n);
+    }
+}
+
+/* Decode a stored block into out (n bytes) and check it */
+static int mdz_decode_block(const mdz_block_t *block, const uint8_t *stored, uint8_t *out, long n) {
+    int result = MDOS_EOK;
+    switch (block->method) {
+    case MDOS_MDZ_ZERO:
+        memset(out, 0, n);      /* Nothing stored that could be damaged */
+        return MDOS_EOK;
+    case MDOS_MDZ_STORED:
+        if (block->length != (uint32_t)n) return MDOS_EIO;
+        memcpy(out, stored, n);
+        break;
+    case MDOS_MDZ_LZ:
+        result = mdos_lz_decompress(stored, block->length, out, n);
+        break;
+    default:
+        return MDOS_EIO;
+    }
+    if (result == MDOS_EOK && mdos_crc32(out, n) != block->crc) {
+        result = MDOS_EIO;
+    }
+    return result;
+}
+
+/*
+ * Header, blocks, index and footer, under a temporary name renamed into
+ * place. The new file takes the permissions of source, the image it is
+ * written from, when that is a plain file.
+ */
+static int mdz_write_file(const char *path, FILE *source, const mdos_geometry_t *g, long length,
+                          mdz_block_t *blocks, uint8_t **payloads, long ntracks) {
+    uint8_t header[MDZ_HEADER_SIZE] = { 0 };
+    memcpy(header, MDOS_MDZ_MAGIC, 4);
+    header[4] = MDOS_MDZ_VERSION;
+    header[5] = g->heads;
+    header[6] = g->sectors;
+    header[7] = g->size_code;
+    header[8] = g->first_sector;
+    put_le16(header + 10, g->cylinders);
+    put_le32(header + 12, length);
+
+    size_t index_size = ntracks * MDZ_ENTRY_SIZE;
+    uint8_t *index = malloc(index_size + MDZ_FOOTER_SIZE);
+    size_t len = strlen(path) + 5;
+    char *tmp_path = malloc(len);
+    if (!index || !tmp_path) {
+        free(index);
+        free(tmp_path);
+        return MDOS_ENOSPC;
+    }
+    snprintf(tmp_path, len, "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "wb");
+    int ok = fp && fwrite(header, 1, MDZ_HEADER_SIZE, fp) == MDZ_HEADER_SIZE;
+    long offset = MDZ_HEADER_SIZE;
+    for (long t = 0; t < ntracks && ok; t++) {
+        mdz_block_t *block = &blocks[t];
+        block->offset = offset;
+        ok = fwrite(payloads[t], 1, block->length, fp) == block->length;
+        offset += block->length;
+        ok = ok && offset <= MDZ_MAX_BYTES;
+
+        uint8_t *entry = index + t * MDZ_ENTRY_SIZE;
+        memset(entry, 0, MDZ_ENTRY_SIZE);
+        put_le32(entry, block->offset);
+        put_le32(entry + 4, block->length);
+        put_le32(entry + 8, block->crc);
+        entry[12] = block->method;
+    }
+
+    uint8_t *footer = index + index_size;
+    put_le32(footer, offset);
+    put_le32(footer + 4, ntracks);
+    put_le32(footer + 8, mdos_crc32(index, index_size));
+    memcpy(footer + 12, MDOS_MDZ_INDEX_MAGIC, 4);
+    ok = ok && fwrite(index, 1, index_size + MDZ_FOOTER_SIZE, fp) == index_size + MDZ_FOOTER_SIZE;
+
+    struct stat st;
+    if (ok && source && fileno(source) >= 0 && fstat(fileno(source), &st) == 0) {
+        fchmod(fileno(fp), st.st_mode & 07777);
+    }
+    if (fp) ok = (fclose(fp) == 0) && ok;
+    int result = MDOS_EOK;
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        result = MDOS_EIO;
+    }
+    free(tmp_path);
+    free(index);
+    return result;
+}
+
+static void mdz_free(mdz_image_t *mdz) {
+    mdos_mounts_lock();
+    for (mdz_image_t **p = &mdz_mounts; *p; p = &(*p)->next) {
+        if (*p == mdz) {
+            *p = mdz->next;
+            break;
+        }
+    }
+    mdos_mounts_unlock();
+    for (long t = 0; mdz->cache && t < mdz->ntracks; t++) {
+        free(mdz->cache[t]);
+    }
+    free(mdz->cache);
+    free(mdz->modified);
+    free(mdz->blocks);
+    free(mdz->path);
+    if (mdz->fp) fclose(mdz->fp);
+    free(mdz);
+}
+
+/* Read the header, footer and index; no block is touched */
+static mdz_image_t* mdz_open(const char *path, int read_only) {
+    mdz_image_t *mdz = calloc(1, sizeof(mdz_image_t));
+    if (!mdz) {
+        return NULL;
+    }
+    mdz->read_only = read_only;
+    mdz->path = malloc(strlen(path) + 1);
+    mdz->fp = fopen(path, "rb");
+    if (!mdz->path || !mdz->fp) {
+        mdz_free(mdz);
+        return NULL;
+    }
+    strcpy(mdz->path, path);
+
+    uint8_t header[MDZ_HEADER_SIZE];
+    uint8_t footer[MDZ_FOOTER_SIZE];
+    if (fread(header, 1, MDZ_HEADER_SIZE, mdz->fp) != MDZ_HEADER_SIZE ||
+        memcmp(header, MDOS_MDZ_MAGIC, 4) != 0 || header[4] != MDOS_MDZ_VERSION ||
+        fseek(mdz->fp, -MDZ_FOOTER_SIZE, SEEK_END) != 0 ||
+        fread(footer, 1, MDZ_FOOTER_SIZE, mdz->fp) != MDZ_FOOTER_SIZE ||
+        memcmp(footer + 12, MDOS_MDZ_INDEX_MAGIC, 4) != 0) {
+        mdz_free(mdz);
+        return NULL;
+    }
+
+    mdos_geometry_t *g = &mdz->geometry;
+    g->heads = header[5];
+    g->sectors = header[6];
+    g->size_code = header[7];
+    g->first_sector = header[8];
+    g->cylinders = header[10] | (header[11] << 8);
+    g->sector_size = MDOS_GEOM_SECTOR_SIZE << (g->size_code & 7);
+    mdz->length = get_le32(header + 12);
+    mdz->track_bytes = mdos_geometry_track_bytes(g);
+    mdz->ntracks = get_le32(footer + 4);
+    if (g->heads < 1 || g->heads > 2 || g->sectors < 1 || g->size_code > 6 ||
+        mdz->ntracks != (mdz->length + mdz->track_bytes - 1) / mdz->track_bytes) {
+        mdz_free(mdz);
+        return NULL;
+    }
+
+    size_t index_size = mdz->ntracks * MDZ_ENTRY_SIZE;
+    uint8_t *index = malloc(index_size ? index_size : 1);
+    mdz->blocks = calloc(mdz->ntracks ? mdz->ntracks : 1, sizeof(mdz_block_t));
+    mdz->cache = calloc(mdz->ntracks ? mdz->ntracks : 1, sizeof(uint8_t *));
+    mdz->modified = calloc(mdz->ntracks ? mdz->ntracks : 1, 1);
+    int ok = index && mdz->blocks && mdz->cache && mdz->modified &&
+             fseek(mdz->fp, get_le32(footer), SEEK_SET) == 0 &&
+             fread(index, 1, index_size, mdz->fp) == index_size &&
+             mdos_crc32(index, index_size) == get_le32(footer + 8);
+    for (long t = 0; ok && t < mdz->ntracks; t++) {
+        const uint8_t *entry = index + t * MDZ_ENTRY_SIZE;
+        mdz->blocks[t].offset = get_le32(entry);
+        mdz->blocks[t].length = get_le32(entry + 4);
+        mdz->blocks[t].crc = get_le32(entry + 8);
+        mdz->blocks[t].method = entry[12];
+    }
+    free(index);
+    if (!ok) {
+        mdz_free(mdz);
+        return NULL;
+    }
+    return mdz;
+}
+
+/* The decoded track t, reading it on first use */
+static uint8_t* mdz_track(mdz_image_t *mdz, long t, int *error) {
+    *error = MDOS_EOK;
+    if (mdz->cache[t]) {
+        MDOS_STAT_ADD(MDOS_STAT_CACHE_HITS, 1);
+        return mdz->cache[t];
+    }
+    MDOS_STAT_ADD(MDOS_STAT_CACHE_MISSES, 1);
+
+    const mdz_block_t *block = &mdz->blocks[t];
+    uint8_t *data = calloc(mdz->track_bytes, 1);
+    uint8_t *stored = malloc(block->length ? block->length : 1);
+    if (!data || !stored) {
+        *error = MDOS_ENOSPC;
+    } else if (block->length &&
+               (fseek(mdz->fp, block->offset, SEEK_SET) != 0 ||
+                fread(stored, 1, block->length, mdz->fp) != block->length)) {
+        *error = MDOS_EIO;
+    } else {
+        if (block->length) MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+        MDOS_STAT_ADD(MDOS_STAT_BYTES_DECODED, mdz_track_length(mdz, t));
+        *error = mdz_decode_block(block, stored, data, mdz_track_length(mdz, t));
+    }
+    free(stored);
+    if (*error != MDOS_EOK) {
+        free(data);
+        return NULL;
+    }
+    mdz->cache[t] = data;
+    return data;
+}
+
+/* Extend the image to length bytes; the old last track is re-encoded */
+static int mdz_grow(mdz_image_t *mdz, long length) {
+    long ntracks = (length + mdz->track_bytes - 1) / mdz->track_bytes;
+    int error;
+
+    if (mdz->ntracks > 0 && !mdz_track(mdz, mdz->ntracks - 1, &error)) {
+        return error;
+    }
+    if (ntracks > mdz->ntracks) {
+        mdz_block_t *blocks = realloc(mdz->blocks, ntracks * sizeof(*blocks));
+        if (blocks) mdz->blocks = blocks;
+        uint8_t **cache = realloc(mdz->cache, ntracks * sizeof(*cache));
+        if (cache) mdz->cache = cache;
+        uint8_t *modified = realloc(mdz->modified, ntracks);
+        if (modified) mdz->modified = modified;
+        if (!blocks || !cache || !modified) {
+            return MDOS_ENOSPC;
+        }
+        for (long t = mdz->ntracks; t < ntracks; t++) {
+            memset(&mdz->blocks[t], 0, sizeof(mdz_block_t));
+            mdz->cache[t] = calloc(mdz->track_bytes, 1);
+            mdz->modified[t] = 1;
+            if (!mdz->cache[t]) {
+                mdz->ntracks = t;   /* Keep what was set up for mdz_free */
+                return MDOS_ENOSPC;
+            }
+        }
+    }
+    if (mdz->ntracks > 0) {
+        mdz->modified[mdz->ntracks - 1] = 1;
+    }
+    mdz->ntracks = ntracks;
+    mdz->length = length;
+    mdz->dirty = 1;
+    return MDOS_EOK;
+}
+
+static ssize_t mdz_stream_read(void *cookie, char *buf, size_t size) {
+    mdz_image_t *mdz = cookie;
+    size_t done = 0;
+
+    while (done < size && mdz->pos < mdz->length) {
+        long t = mdz->pos / mdz->track_bytes;
+        long offset = mdz->pos % mdz->track_bytes;
+        size_t chunk = mdz_track_length(mdz, t) - offset;
+        if (chunk > size - done) chunk = size - done;
+
+        int error;
+        uint8_t *track = mdz_track(mdz, t, &error);
+        if (!track) {
+            errno = EIO;
+            return done ? (ssize_t)done : -1;
+        }
+        memcpy(buf + done, track + offset, chunk);
+        MDOS_STAT_ADD(MDOS_STAT_SECTORS_READ, MDZ_SECTORS_SPANNED(mdz->pos, chunk));
+
+        done += chunk;
+        mdz->pos += chunk;
+    }
+    return done;
+}
+
+static ssize_t mdz_stream_write(void *cookie, const char *buf, size_t size) {
+    mdz_image_t *mdz = cookie;
+    size_t done = 0;
+
+    if (mdz->read_only) {
+        errno = EBADF;
+        return -1;
+    }
+    if (mdz->pos + (off64_t)size > mdz->length) {
+        int error = (mdz->pos + (off64_t)size > MDZ_MAX_BYTES) ? MDOS_ENOSPC
+                                                                : mdz_grow(mdz, mdz->pos + size);
+        if (error != MDOS_EOK) {
+            errno = (error == MDOS_ENOSPC) ? ENOSPC : EIO;
+            return -1;
+        }
+    }
+
+    while (done < size) {
+        long t = mdz->pos / mdz->track_bytes;
+        long offset = mdz->pos % mdz->track_bytes;
+        size_t chunk = mdz->track_bytes - offset;
+        if (chunk > size - done) chunk = size - done;
+
+        int error;
+        uint8_t *track = mdz_track(mdz, t, &error);
+        if (!track) {
+            errno = (error == MDOS_ENOSPC) ? ENOSPC : EIO;
+            return done ? (ssize_t)done : -1;
+        }
+        if (memcmp(track + offset, buf + done, chunk) != 0) {
+            memcpy(track + offset, buf + done, chunk);
+            mdz->modified[t] = 1;
+            mdz->dirty = 1;
+        }
+        MDOS_STAT_ADD(MDOS_STAT_SECTORS_WRITTEN, MDZ_SECTORS_SPANNED(mdz->pos, chunk));
+
+        done += chunk;
+        mdz->pos += chunk;
+    }
+    return done;
+}
+
+static int mdz_stream_seek(void *cookie, off64_t *offset, int whence) {
+    mdz_image_t *mdz = cookie;
+    off64_t base = (whence == SEEK_CUR) ? mdz->pos : (whence == SEEK_END) ? mdz->length : 0;
+
+    if (base + *offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    mdz->pos = base + *offset;
+    *offset = mdz->pos;
+    return 0;
+}
+
+/* Rewrite the file: blocks of untouched tracks are copied as stored */
+static int mdz_commit(mdz_image_t *mdz) {
+    uint8_t **payloads = calloc(mdz->ntracks ? mdz->ntracks : 1, sizeof(uint8_t *));
+    if (!payloads) {
+        return MDOS_ENOSPC;
+    }
+
+    int result = MDOS_EOK;
+    for (long t = 0; t < mdz->ntracks && result == MDOS_EOK; t++) {
+        mdz_block_t *block = &mdz->blocks[t];
+        long n = mdz_track_length(mdz, t);
+        long size = (n > (long)block->length) ? n : (long)block->length;
+        payloads[t] = malloc(size ? size : 1);
+        if (!payloads[t]) {
+            result = MDOS_ENOSPC;
+        } else if (mdz->modified[t]) {
+            mdz_encode_block(mdz->cache[t], n, payloads[t], block);
+        } else if (block->length &&
+                   (fseek(mdz->fp, block->offset, SEEK_SET) != 0 ||
+                    fread(payloads[t], 1, block->length, mdz->fp) != block->length)) {
+            result = MDOS_EIO;
+        }
+    }
+
+    if (result == MDOS_EOK) {
+        result = mdz_write_file(mdz->path, mdz->fp, &mdz->geometry, mdz->length, mdz->blocks, payloads, mdz->ntracks);
+    }
+    for (long t = 0; t < mdz->ntracks; t++) {
+        free(payloads[t]);
+    }
+    free(payloads);
+
+    /* Later reads of clean tracks must come from the new file */
+    if (result == MDOS_EOK) {
+        FILE *fp = fopen(mdz->path, "rb");
+        if (fp) {
+            fclose(mdz->fp);
+            mdz->fp = fp;
+        }
+        memset(mdz->modified, 0, mdz->ntracks);
+        mdz->dirty = 0;
+    }
+    return result;
+}
+
+static int mdz_stream_close(void *cookie) {
+    mdz_image_t *mdz = cookie;
+    int result = MDOS_EOK;
+
+    if (mdz->dirty && !mdz->read_only) {
+        result = mdz_commit(mdz);
+    }
+    mdz_free(mdz);
+    return (result == MDOS_EOK) ? 0 : -1;
+}
+
+static mdz_image_t* mdz_find(mdos_fs_t *fs) {
+    mdos_mounts_lock();
+    mdz_image_t *mdz = fs ? mdz_mounts : NULL;
+    while (mdz && mdz->stream != fs->fp) {
+        mdz = mdz->next;
+    }
+    mdos_mounts_unlock();
+    return mdz;
+}
+
+mdos_fs_t* mdos_mdz_mount(const char *mdz_path, int read_only) {
+    if (!mdz_path) {
+        return NULL;
+    }
+    mdz_image_t *mdz = mdz_open(mdz_path, read_only);
+    if (!mdz) {
+        return NULL;
+    }
+
+    cookie_io_functions_t io = {
+        .read = mdz_stream_read,
+        .write = mdz_stream_write,
+        .seek = mdz_stream_seek,
+        .close = mdz_stream_close,
+    };
+    FILE *stream = fopencookie(mdz, read_only ? "rb" : "r+b", io);
+    if (!stream) {
+        mdz_free(mdz);
+        return NULL;
+    }
+
+    /* Mount normally, then route the library's I/O through the track cache */
+    mdos_fs_t *fs = mdos_mount(mdz_path, read_only);
+    if (!fs) {
+        fclose(stream);
+        return NULL;
+    }
+    fclose(fs->fp);
+    fs->fp = stream;
+    mdz->stream = stream;
+    mdos_mounts_lock();
+    mdz->next = mdz_mounts;
+    mdz_mounts = mdz;
+    mdos_mounts_unlock();
+    return fs;
+}
+
+int mdos_mdz_write_back(mdos_fs_t *fs) {
+    mdz_image_t *mdz = mdz_find(fs);
+    if (!mdz) {
+        return MDOS_ENOENT;
+    }
+    if (fflush(fs->fp) != 0) {
+        return MDOS_EIO;
+    }
+    return (mdz->dirty && !mdz->read_only) ? mdz_commit(mdz) : MDOS_EOK;
+}
+
+int mdos_mdz_geometry(mdos_fs_t *fs, mdos_geometry_t *geometry) {
+    mdz_image_t *mdz = mdz_find(fs);
+    if (!mdz) {
+        return MDOS_ENOENT;
+    }
+    *geometry = mdz->geometry;
+    return MDOS_EOK;
+}
+
+int mdos_save_mdz(mdos_fs_t *fs, const char *mdz_path) {
+    if (!fs || !mdz_path) {
+        return MDOS_EINVAL;
+    }
+
+    mdos_geometry_t g;
+    int result = mdos_image_geometry(fs, &g);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+    if (fflush(fs->fp) != 0 || fseek(fs->fp, 0, SEEK_END) != 0) {
+        return MDOS_EIO;
+    }
+    long length = ftell(fs->fp);
+    if (length < 0 || length > MDZ_MAX_BYTES) {
+        return MDOS_EIO;
+    }
+
+    long track_bytes = mdos_geometry_track_bytes(&g);
+    long ntracks = (length + track_bytes - 1) / track_bytes;
+    uint8_t *image = malloc(length ? length : 1);
+    mdz_block_t *blocks = calloc(ntracks ? ntracks : 1, sizeof(mdz_block_t));
+    uint8_t **payloads = calloc(ntracks ? ntracks : 1, sizeof(uint8_t *));
+    result = (image && blocks && payloads) ? MDOS_EOK : MDOS_ENOSPC;
+    if (result == MDOS_EOK && mdos_sparse_read(fs->fp, image, length) < 0) {
+        result = MDOS_EIO;
+    }
+
+    for (long t = 0; t < ntracks && result == MDOS_EOK; t++) {
+        long n = (t == ntracks - 1) ? length - t * track_bytes : track_bytes;
+        payloads[t] = malloc(n);
+        if (!payloads[t]) {
+            result = MDOS_ENOSPC;
+        } else {
+            mdz_encode_block(image + t * track_bytes, n, payloads[t], &blocks[t]);
+        }
+    }
+    if (result == MDOS_EOK) {
+        result = mdz_write_file(mdz_path, fs->fp, &g, length, blocks, payloads, ntracks);
+    }
+
+    for (long t = 0; payloads && t < ntracks; t++) {
+        free(payloads[t]);
+    }
+    free(payloads);
+    free(blocks);
+    free(image);
+    return result;
+}
+
+long mdos_mdz_to_dsk(const char *mdz_path, const char *dsk_path, int flags) {
+    if (!mdz_path || !dsk_path) {
+        return MDOS_EINVAL;
+    }
+    mdz_image_t *mdz = mdz_open(mdz_path, 1);
+    if (!mdz) {
+        return MDOS_EIO;
+    }
+
+    uint8_t *image = malloc(mdz->length ? mdz->length : 1);
+    long result = image ? MDOS_EOK : MDOS_ENOSPC;
+    for (long t = 0; t < mdz->ntracks && result == MDOS_EOK; t++) {
+        int error;
+        const uint8_t *track = mdz_track(mdz, t, &error);
+        if (!track) {
+            result = error;
+        } else {
+            memcpy(image + t * mdz->track_bytes, track, mdz_track_length(mdz, t));
+        }
+    }
+
+    if (result == MDOS_EOK) {
+        FILE *fp = fopen(dsk_path, "wb");
+        if (!fp) {
+            result = MDOS_EIO;
+        } else {
+            result = mdos_sparse_write(fp, image, mdz->length, flags);
+            if (fclose(fp) != 0 && result >= 0) result = MDOS_EIO;
+        }
+    }
+
+    free(image);
+    mdz_free(mdz);
+    return result;
+}
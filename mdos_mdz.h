@@ -0,0 +1,87 @@
+/*
+ * MDOS Filesystem Library - Compressed Image Container (.mdz)
+ * Copyright (C) 2025
+ *
+ * A seekable archive format: each track compressed on its own, a block
+ * index at the end, a checksum per block
+ */
+
+#ifndef MDOS_MDZ_H
+#define MDOS_MDZ_H
+
+#include <stddef.h>
+#include "mdos_fs.h"
+#include "mdos_geometry.h"
+
+/*
+ * File layout (all integers little endian):
+ *
+ *   header  16 bytes   "MDZ1", version, heads, sectors, size code,
+ *                      first sector, 0, cylinders (16), image length (32)
+ *   blocks             one per track of the linear image, in track order
+ *   index   16 * n     offset, stored length, CRC-32 of the decoded track,
+ *                      method, 3 zero bytes
+ *   footer  16 bytes   index offset, n, CRC-32 of the index, "MDZI"
+ *
+ * The footer sits at a fixed distance from the end of the file, so any
+ * track can be found with two reads and fetched with a third.
+ */
+#define MDOS_MDZ_MAGIC       "MDZ1"
+#define MDOS_MDZ_INDEX_MAGIC "MDZI"
+#define MDOS_MDZ_VERSION     1
+
+/* Block methods */
+#define MDOS_MDZ_ZERO   0   /* Track is all zeros; nothing stored */
+#define MDOS_MDZ_STORED 1   /* Stored as is: compressing did not help */
+#define MDOS_MDZ_LZ     2   /* mdos_lz_compress output */
+
+/* Non-zero if path starts with the "MDZ1" signature */
+int mdos_is_mdz(const char *path);
+
+/*
+ * LZ77 codec used for the blocks; no external library. A flag byte
+ * announces the next eight items, a set bit meaning a match. A literal is
+ * one byte; a match is two, the distance minus one in the top 12 bits and
+ * the length minus 3 in the low 4, where 15 continues in extra bytes that
+ * are added on until one is below 255. Matches reach back 4096 bytes, which
+ * covers a whole track of a standard disk.
+ *
+ * mdos_lz_compress returns the compressed size, or 0 if the result would
+ * not fit in cap bytes. mdos_lz_decompress fills exactly out_len bytes and
+ * returns MDOS_EOK, or MDOS_EIO if the input is malformed.
+ */
+size_t mdos_lz_compress(const uint8_t *in, size_t len, uint8_t *out, size_t cap);
+int mdos_lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t out_len);
+
+/*
+ * Write the mounted filesystem (DSK, IMD or MDZ) as an .mdz, reading the
+ * linear image through the mount. Tracks follow mdos_image_geometry; the
+ * image keeps its exact length, so a DSK round-trips byte for byte. The
+ * file is written under a temporary name and renamed into place.
+ */
+int mdos_save_mdz(mdos_fs_t *fs, const char *mdz_path);
+
+/*
+ * Convert an .mdz to a DSK, written with mdos_sparse_write (flags as
+ * there). Returns the bytes left as holes or a negative error code.
+ */
+long mdos_mdz_to_dsk(const char *mdz_path, const char *dsk_path, int flags);
+
+/*
+ * Mount an .mdz in place; mdos_mount_image calls this for files with the
+ * MDZ signature. Only the index is read up front. A track is read,
+ * checked against its CRC and decompressed the first time one of its
+ * sectors is accessed; a checksum mismatch fails that access with EIO. If
+ * anything was written, unmounting rewrites the file: untouched blocks are
+ * copied as stored, modified tracks are compressed again.
+ */
+mdos_fs_t* mdos_mdz_mount(const char *mdz_path, int read_only);
+
+/*
+ * Hooks for mdos_unmount_image and mdos_image_geometry. Both return
+ * MDOS_ENOENT if fs is not an .mdz mount.
+ */
+int mdos_mdz_write_back(mdos_fs_t *fs);
+int mdos_mdz_geometry(mdos_fs_t *fs, mdos_geometry_t *geometry);
+
+#endif /* MDOS_MDZ_H */
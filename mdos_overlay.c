@@ -0,0 +1,420 @@
+/*
+ * MDOS Filesystem Library - Copy-on-Write Overlays
+ * Copyright (C) 2025
+ *
+ * An overlay mount works like an IMD mount: the library gets a stdio
+ * stream, here one that serves each sector from the delta file if the
+ * dirty bitmap says it was written and from the base mount otherwise
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include "mdos_internal.h"
+#include "mdos_overlay.h"
+#include "mdos_imd.h"
+#include "mdos_mdz.h"
+#include "mdos_hash.h"
+#include "mdos_sparse.h"
+#include "mdos_stats.h"
+
+#define OVL_HEADER_SIZE 32
+#define OVL_DATA_ALIGN  4096
+
+typedef struct overlay {
+    FILE *delta;            /* The delta file, read-write */
+    mdos_fs_t *base;        /* Read-only mount of the base image */
+    long length;            /* Linear image length, same as the base */
+    long sectors;
+    uint64_t base_hash;
+    uint8_t *bitmap;        /* One bit per sector held by the delta */
+    long bitmap_bytes;
+    long data_offset;       /* Where sector 0 sits in the delta */
+    off64_t pos;            /* Stream position in the linear image */
+    FILE *stream;           /* The stream handed to the library */
+    struct overlay *next;   /* Open overlay mounts */
+} overlay_t;
+
+static overlay_t *overlay_mounts;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static int overlay_dirty(const overlay_t *ovl, long s) {
+    return (ovl->bitmap[s / 8] >> (s % 8)) & 1;
+}
+
+/* Length and hash of a mounted image's linear view */
+static int overlay_hash_image(mdos_fs_t *fs, long *length, uint64_t *hash) {
+    if (fflush(fs->fp) != 0 || fseek(fs->fp, 0, SEEK_END) != 0 || (*length = ftell(fs->fp)) < 0) {
+        return MDOS_EIO;
+    }
+    uint8_t *image = malloc(*length ? *length : 1);
+    if (!image) {
+        return MDOS_ENOSPC;
+    }
+    int result = (mdos_sparse_read(fs->fp, image, *length) < 0) ? MDOS_EIO : MDOS_EOK;
+    *hash = mdos_hash64(image, *length);
+    free(image);
+    return result;
+}
+
+static void overlay_free(overlay_t *ovl) {
+    mdos_mounts_lock();
+    for (overlay_t **p = &overlay_mounts; *p; p = &(*p)->next) {
+        if (*p == ovl) {
+            *p = ovl->next;
+            break;
+        }
+    }
+    mdos_mounts_unlock();
+    if (ovl->delta) fclose(ovl->delta);
+    if (ovl->base) mdos_unmount_image(ovl->base);
+    free(ovl->bitmap);
+    free(ovl);
+}
+
+/* Open (or with create, start) the delta for a base mounted read-only */
+static overlay_t* overlay_open(const char *base_path, const char *delta_path, int create) {
+    overlay_t *ovl = calloc(1, sizeof(overlay_t));
+    if (!ovl) {
+        return NULL;
+    }
+    ovl->base = mdos_mount_image(base_path, 1);
+    if (!ovl->base || overlay_hash_image(ovl->base, &ovl->length, &ovl->base_hash) != MDOS_EOK) {
+        overlay_free(ovl);
+        return NULL;
+    }
+    ovl->sectors = (ovl->length + MDOS_SECTOR_SIZE - 1) / MDOS_SECTOR_SIZE;
+    ovl->bitmap_bytes = (ovl->sectors + 7) / 8;
+    ovl->data_offset = (OVL_HEADER_SIZE + ovl->bitmap_bytes + OVL_DATA_ALIGN - 1) /
+                       OVL_DATA_ALIGN * OVL_DATA_ALIGN;
+    ovl->bitmap = calloc(ovl->bitmap_bytes ? ovl->bitmap_bytes : 1, 1);
+    if (!ovl->bitmap) {
+        overlay_free(ovl);
+        return NULL;
+    }
+
+    uint8_t header[OVL_HEADER_SIZE];
+    ovl->delta = fopen(delta_path, "r+b");
+    if (!ovl->delta && create && errno == ENOENT) {
+        /* New delta: header, empty bitmap, and a data area that is all hole */
+        ovl->delta = fopen(delta_path, "w+b");
+        memset(header, 0, sizeof(header));
+        memcpy(header, MDOS_OVERLAY_MAGIC, 8);
+        put_le32(header + 8, (uint32_t)ovl->sectors);
+        put_le64(header + 16, (uint64_t)ovl->length);
+        put_le64(header + 24, ovl->base_hash);
+        if (ovl->delta &&
+            (fwrite(header, 1, sizeof(header), ovl->delta) != sizeof(header) ||
+             fwrite(ovl->bitmap, 1, ovl->bitmap_bytes, ovl->delta) != (size_t)ovl->bitmap_bytes ||
+             fflush(ovl->delta) != 0 ||
+             ftruncate(fileno(ovl->delta), ovl->data_offset + ovl->length) != 0)) {
+            fclose(ovl->delta);
+            ovl->delta = NULL;
+            remove(delta_path);
+        }
+        if (!ovl->delta) {
+            overlay_free(ovl);
+            return NULL;
+        }
+        return ovl;
+    }
+    if (!ovl->delta ||
+        fread(header, 1, sizeof(header), ovl->delta) != sizeof(header) ||
+        memcmp(header, MDOS_OVERLAY_MAGIC, 8) != 0 ||
+        get_le32(header + 8) != (uint32_t)ovl->sectors ||
+        get_le64(header + 16) != (uint64_t)ovl->length ||
+        get_le64(header + 24) != ovl->base_hash ||
+        fread(ovl->bitmap, 1, ovl->bitmap_bytes, ovl->delta) != (size_t)ovl->bitmap_bytes) {
+        overlay_free(ovl);
+        return NULL;
+    }
+    return ovl;
+}
+
+/* One sector of the combined view, zero-filled past the end of the base */
+static int overlay_read_sector(overlay_t *ovl, long s, uint8_t *out) {
+    FILE *fp = ovl->base->fp;
+    long offset = s * MDOS_SECTOR_SIZE;
+
+    if (overlay_dirty(ovl, s)) {
+        fp = ovl->delta;
+        offset += ovl->data_offset;
+    }
+    memset(out, 0, MDOS_SECTOR_SIZE);
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+    if (fseek(fp, offset, SEEK_SET) != 0) {
+        return MDOS_EIO;
+    }
+    size_t n = fread(out, 1, MDOS_SECTOR_SIZE, fp);
+    return (n < MDOS_SECTOR_SIZE && ferror(fp)) ? MDOS_EIO : MDOS_EOK;
+}
+
+static ssize_t overlay_stream_read(void *cookie, char *buf, size_t size) {
+    overlay_t *ovl = cookie;
+    size_t done = 0;
+
+    while (done < size && ovl->pos < ovl->length) {
+        long s = ovl->pos / MDOS_SECTOR_SIZE;
+        long offset = ovl->pos % MDOS_SECTOR_SIZE;
+        size_t chunk = MDOS_SECTOR_SIZE - offset;
+        if (chunk > size - done) chunk = size - done;
+        if ((off64_t)chunk > ovl->length - ovl->pos) chunk = ovl->length - ovl->pos;
+
+        uint8_t sector[MDOS_SECTOR_SIZE];
+        if (overlay_read_sector(ovl, s, sector) != MDOS_EOK) {
+            errno = EIO;
+            return done ? (ssize_t)done : -1;
+        }
+        memcpy(buf + done, sector + offset, chunk);
+        MDOS_STAT_ADD(MDOS_STAT_SECTORS_READ, 1);
+
+        done += chunk;
+        ovl->pos += chunk;
+    }
+    return done;
+}
+
+static ssize_t overlay_stream_write(void *cookie, const char *buf, size_t size) {
+    overlay_t *ovl = cookie;
+    size_t done = 0;
+
+    /* The delta covers exactly the base's sectors */
+    if (ovl->pos + (off64_t)size > ovl->length) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    while (done < size) {
+        long s = ovl->pos / MDOS_SECTOR_SIZE;
+        long offset = ovl->pos % MDOS_SECTOR_SIZE;
+        size_t chunk = MDOS_SECTOR_SIZE - offset;
+        if (chunk > size - done) chunk = size - done;
+
+        /* Copy up a partially overwritten sector before changing it */
+        uint8_t sector[MDOS_SECTOR_SIZE];
+        if (chunk < MDOS_SECTOR_SIZE && overlay_read_sector(ovl, s, sector) != MDOS_EOK) {
+            errno = EIO;
+            return done ? (ssize_t)done : -1;
+        }
+        memcpy(sector + offset, buf + done, chunk);
+        MDOS_STAT_ADD(MDOS_STAT_SECTORS_WRITTEN, 1);
+        MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+
+        if (fseek(ovl->delta, ovl->data_offset + s * MDOS_SECTOR_SIZE, SEEK_SET) != 0 ||
+            fwrite(sector, 1, MDOS_SECTOR_SIZE, ovl->delta) != MDOS_SECTOR_SIZE) {
+            errno = EIO;
+            return done ? (ssize_t)done : -1;
+        }
+        if (!overlay_dirty(ovl, s)) {
+            ovl->bitmap[s / 8] |= 1 << (s % 8);
+            MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 3);
+            if (fflush(ovl->delta) != 0 ||
+                fseek(ovl->delta, OVL_HEADER_SIZE + s / 8, SEEK_SET) != 0 ||
+                fputc(ovl->bitmap[s / 8], ovl->delta) == EOF) {
+                errno = EIO;
+                return done ? (ssize_t)done : -1;
+            }
+        }
+
+        done += chunk;
+        ovl->pos += chunk;
+    }
+    return done;
+}
+
+static int overlay_stream_seek(void *cookie, off64_t *offset, int whence) {
+    overlay_t *ovl = cookie;
+    off64_t base = (whence == SEEK_CUR) ? ovl->pos : (whence == SEEK_END) ? ovl->length : 0;
+
+    if (base + *offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    ovl->pos = base + *offset;
+    *offset = ovl->pos;
+    return 0;
+}
+
+static int overlay_stream_close(void *cookie) {
+    overlay_t *ovl = cookie;
+    int result = (fflush(ovl->delta) == 0) ? 0 : -1;
+    overlay_free(ovl);
+    return result;
+}
+
+static overlay_t* overlay_find(mdos_fs_t *fs) {
+    mdos_mounts_lock();
+    overlay_t *ovl = fs ? overlay_mounts : NULL;
+    while (ovl && ovl->stream != fs->fp) {
+        ovl = ovl->next;
+    }
+    mdos_mounts_unlock();
+    return ovl;
+}
+
+mdos_fs_t* mdos_mount_overlay(const char *base_path, const char *delta_path) {
+    if (!base_path || !delta_path) {
+        return NULL;
+    }
+    overlay_t *ovl = overlay_open(base_path, delta_path, 1);
+    if (!ovl) {
+        return NULL;
+    }
+
+    cookie_io_functions_t io = {
+        .read = overlay_stream_read,
+        .write = overlay_stream_write,
+        .seek = overlay_stream_seek,
+        .close = overlay_stream_close,
+    };
+    FILE *stream = fopencookie(ovl, "r+b", io);
+    if (!stream) {
+        overlay_free(ovl);
+        return NULL;
+    }
+
+    /* Mount the (writable) delta, then route the library's I/O through the overlay */
+    mdos_fs_t *fs = mdos_mount(delta_path, 0);
+    if (!fs) {
+        fclose(stream);
+        return NULL;
+    }
+    fclose(fs->fp);
+    fs->fp = stream;
+    ovl->stream = stream;
+    mdos_mounts_lock();
+    ovl->next = overlay_mounts;
+    overlay_mounts = ovl;
+    mdos_mounts_unlock();
+    return fs;
+}
+
+int mdos_overlay_write_back(mdos_fs_t *fs) {
+    overlay_t *ovl = overlay_find(fs);
+    if (!ovl) {
+        return MDOS_ENOENT;
+    }
+    return (fflush(fs->fp) == 0 && fflush(ovl->delta) == 0) ? MDOS_EOK : MDOS_EIO;
+}
+
+int mdos_overlay_geometry(mdos_fs_t *fs, mdos_geometry_t *geometry) {
+    overlay_t *ovl = overlay_find(fs);
+    if (!ovl) {
+        return MDOS_ENOENT;
+    }
+    return mdos_image_geometry(ovl->base, geometry);
+}
+
+long mdos_overlay_commit(const char *base_path, const char *delta_path) {
+    if (!base_path || !delta_path) {
+        return MDOS_EINVAL;
+    }
+    overlay_t *ovl = overlay_open(base_path, delta_path, 0);
+    if (!ovl) {
+        return MDOS_EINVAL;
+    }
+    /* The base has to be remounted for writing */
+    mdos_unmount_image(ovl->base);
+    ovl->base = NULL;
+
+    mdos_fs_t *fs = mdos_mount_image(base_path, 0);
+    if (!fs) {
+        overlay_free(ovl);
+        return MDOS_EIO;
+    }
+    long written = 0;
+    long result = MDOS_EOK;
+    uint8_t sector[MDOS_SECTOR_SIZE];
+    for (long s = 0; s < ovl->sectors && result == MDOS_EOK; s++) {
+        if (!overlay_dirty(ovl, s)) {
+            continue;
+        }
+        long n = ovl->length - s * MDOS_SECTOR_SIZE;
+        if (n > MDOS_SECTOR_SIZE) n = MDOS_SECTOR_SIZE;
+        if (fseek(ovl->delta, ovl->data_offset + s * MDOS_SECTOR_SIZE, SEEK_SET) != 0 ||
+            fread(sector, 1, n, ovl->delta) != (size_t)n ||
+            fseek(fs->fp, s * MDOS_SECTOR_SIZE, SEEK_SET) != 0 ||
+            fwrite(sector, 1, n, fs->fp) != (size_t)n) {
+            result = MDOS_EIO;
+        }
+        written++;
+    }
+    if (result == MDOS_EOK && fflush(fs->fp) != 0) {
+        result = MDOS_EIO;
+    }
+    int unmount_result = mdos_unmount_image(fs);
+    if (result == MDOS_EOK) result = unmount_result;
+    overlay_free(ovl);
+
+    /* Only a delta that made it into the base is dropped */
+    if (result == MDOS_EOK && remove(delta_path) != 0) {
+        result = MDOS_EIO;
+    }
+    return (result == MDOS_EOK) ? written : result;
+}
+
+int mdos_overlay_flatten(const char *base_path, const char *delta_path, const char *out_path) {
+    if (!base_path || !delta_path || !out_path) {
+        return MDOS_EINVAL;
+    }
+    /* A missing delta would be created by the mount; flattening must not do that */
+    if (access(delta_path, F_OK) != 0) {
+        return MDOS_ENOENT;
+    }
+    mdos_fs_t *fs = mdos_mount_overlay(base_path, delta_path);
+    if (!fs) {
+        return MDOS_EINVAL;
+    }
+
+    int result;
+    const char *ext = strrchr(out_path, '.');
+    if (ext && strcasecmp(ext, ".imd") == 0) {
+        result = mdos_save_imd(fs, out_path, NULL);
+    } else if (ext && strcasecmp(ext, ".mdz") == 0) {
+        result = mdos_save_mdz(fs, out_path);
+    } else {
+        overlay_t *ovl = overlay_find(fs);
+        uint8_t *image = malloc(ovl->length ? ovl->length : 1);
+        result = image ? MDOS_EOK : MDOS_ENOSPC;
+        if (result == MDOS_EOK && mdos_sparse_read(fs->fp, image, ovl->length) < 0) {
+            result = MDOS_EIO;
+        }
+        if (result == MDOS_EOK) {
+            FILE *fp = fopen(out_path, "wb");
+            if (!fp) {
+                result = MDOS_EIO;
+            } else {
+                long written = mdos_sparse_write(fp, image, ovl->length, 0);
+                if (written < 0) result = (int)written;
+                if (fclose(fp) != 0 && result == MDOS_EOK) result = MDOS_EIO;
+            }
+        }
+        free(image);
+    }
+
+    int unmount_result = mdos_unmount_image(fs);
+    return (result == MDOS_EOK) ? unmount_result : result;
+}
@@ -0,0 +1,60 @@
+/*
+ * MDOS Filesystem Library - Copy-on-Write Overlays
+ * Copyright (C) 2025
+ *
+ * Mount a shared base image read-only with a private delta file on top:
+ * reads fall through to the base, writes land in the delta
+ */
+
+#ifndef MDOS_OVERLAY_H
+#define MDOS_OVERLAY_H
+
+#include "mdos_fs.h"
+#include "mdos_geometry.h"
+
+/*
+ * Delta file layout (little endian):
+ *
+ *   header  32 bytes   "MDOSOVL1", sector count (32), 0 (32), base image
+ *                      length (64), FNV-1a of the base linear image (64)
+ *   bitmap             one bit per sector, set once the delta holds it
+ *   data               from the next 4096-byte boundary, sector s at
+ *                      s * 128; sectors never written stay holes
+ *
+ * A sector's data is written before its bitmap bit, so a delta cut short
+ * by a crash never points at sectors it does not have.
+ */
+#define MDOS_OVERLAY_MAGIC "MDOSOVL1"
+
+/*
+ * Mount base_path (DSK, IMD or MDZ) read-only with delta_path over it. The
+ * delta is created if it does not exist; an existing one must have been
+ * made against this very base (same length and hash), otherwise NULL is
+ * returned. The base file is never written. Unmount with
+ * mdos_unmount_image; the delta is flushed there.
+ */
+mdos_fs_t* mdos_mount_overlay(const char *base_path, const char *delta_path);
+
+/*
+ * Write the delta's sectors into the base image (through a mount, so IMD
+ * and MDZ bases work too) and remove the delta. Refused with MDOS_EINVAL
+ * if the base changed since the delta was made. Returns the number of
+ * sectors written.
+ */
+long mdos_overlay_commit(const char *base_path, const char *delta_path);
+
+/*
+ * Write base plus delta as a new standalone image, leaving both alone. The
+ * output format follows out_path's extension: .imd, .mdz, otherwise a
+ * sparse DSK.
+ */
+int mdos_overlay_flatten(const char *base_path, const char *delta_path, const char *out_path);
+
+/*
+ * Hooks for mdos_unmount_image and mdos_image_geometry. Both return
+ * MDOS_ENOENT if fs is not an overlay mount.
+ */
+int mdos_overlay_write_back(mdos_fs_t *fs);
+int mdos_overlay_geometry(mdos_fs_t *fs, mdos_geometry_t *geometry);
+
+#endif /* MDOS_OVERLAY_H */
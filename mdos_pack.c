@@ -0,0 +1,625 @@
+/*
+ * MDOS Filesystem Library - Packlist Rebuild
+ * Copyright (C) 2025
+ *
+ * Rebuild an image from an mdosextract packlist with one allocation plan
+ * and one metadata write-back, and write or check packlist checksums
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "mdos_internal.h"
+#include "mdos_pack.h"
+#include "mdos_imd.h"
+#include "mdos_mdz.h"
+#include "mdos_sparse.h"
+#include "mdos_checksum.h"
+
+#define PACK_LINE_MAX 1024
+
+/* One parsed packlist line */
+typedef struct {
+    char path[PACK_LINE_MAX];
+    long load;
+    long start;
+    long attr;
+    long size;      /* Sectors */
+    long last;      /* Bytes in the last sector */
+    int has_crc32c;
+    uint32_t crc32c;
+    char sha256[2 * MDOS_SHA256_SIZE + 1];  /* Empty if not given */
+} pack_entry_t;
+
+/* Split "path key=value ..." into the entry; returns 0 for blank/comment lines */
+static int pack_parse_line(char *line, pack_entry_t *entry) {
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char *p = line;
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '\0' || *p == '#') {
+        return 0;
+    }
+
+    entry->load = entry->start = entry->attr = -1;
+    entry->size = entry->last = -1;
+    entry->has_crc32c = 0;
+    entry->sha256[0] = '\0';
+
+    /* The path runs up to the first " key=" token (it may contain blanks) */
+    char *keys = NULL;
+    for (char *q = p; *q; q++) {
+        if (*q == ' ' && q[1] && q[1] != ' ') {
+            char *eq = strchr(q + 1, '=');
+            char *sp = strchr(q + 1, ' ');
+            if (eq && (!sp || eq < sp)) {
+                keys = q;
+                break;
+            }
+        }
+    }
+    if (!keys) {
+        return MDOS_EINVAL;
+    }
+
+    *keys++ = '\0';
+    strncpy(entry->path, p, sizeof(entry->path) - 1);
+    entry->path[sizeof(entry->path) - 1] = '\0';
+
+    for (char *tok = strtok(keys, " \t"); tok; tok = strtok(NULL, " \t")) {
+        char *eq = strchr(tok, '=');
+        if (!eq) continue;
+        *eq = '\0';
+
+        long value = strtol(eq + 1, NULL, 16);
+        if (strcmp(tok, "load") == 0) entry->load = value;
+        else if (strcmp(tok, "start") == 0) entry->start = value;
+        else if (strcmp(tok, "attr") == 0) entry->attr = value;
+        else if (strcmp(tok, "size") == 0) entry->size = value;
+        else if (strcmp(tok, "last") == 0) entry->last = value;
+        else if (strcmp(tok, "crc32c") == 0) {
+            entry->crc32c = (uint32_t)strtoul(eq + 1, NULL, 16);
+            entry->has_crc32c = 1;
+        } else if (strcmp(tok, "sha256") == 0) {
+            snprintf(entry->sha256, sizeof(entry->sha256), "%s", eq + 1);
+        }
+    }
+
+    return 1;
+}
+
+/* Open a packlist path as written, or failing that next to the packlist */
+static FILE* pack_open_data(const char *packlist_path, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp || path[0] == '/') {
+        return fp;
+    }
+
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *slash = strrchr(packlist_path, '/');
+    int dir_len = slash ? (int)(slash - packlist_path) : 1;
+
+    char alt[2 * PACK_LINE_MAX];
+    snprintf(alt, sizeof(alt), "%.*s/%s", dir_len, slash ? packlist_path : ".", base);
+    return fopen(alt, "rb");
+}
+
+/* Read the host file, truncated or zero padded to the packlist length */
+static int pack_read_data(FILE *fp, const pack_entry_t *entry, mdos_bulk_file_t *file) {
+    if (fseek(fp, 0, SEEK_END) != 0) return MDOS_EIO;
+    long host_size = ftell(fp);
+    if (host_size < 0 || fseek(fp, 0, SEEK_SET) != 0) return MDOS_EIO;
+
+    long size = host_size;
+    if (entry->size > 0) {
+        long last = (entry->last > 0 && entry->last <= MDOS_SECTOR_SIZE) ? entry->last : MDOS_SECTOR_SIZE;
+        size = (entry->size - 1) * MDOS_SECTOR_SIZE + last;
+    } else if (entry->size == 0) {
+        size = 0;
+    }
+
+    file->buffer = calloc(size ? size : 1, 1);
+    if (!file->buffer) return MDOS_ENOSPC;
+
+    long n = (host_size < size) ? host_size : size;
+    if (n > 0 && fread(file->buffer, 1, n, fp) != (size_t)n) {
+        return MDOS_EIO;
+    }
+
+    file->data = file->buffer;
+    file->size = size;
+    return MDOS_EOK;
+}
+
+int mdos_pack_load(const char *packlist_path, mdos_bulk_file_t **files, int *count, FILE *log) {
+    if (!packlist_path || !files || !count) {
+        return MDOS_EINVAL;
+    }
+
+    FILE *list = fopen(packlist_path, "r");
+    if (!list) {
+        return MDOS_ENOENT;
+    }
+
+    mdos_bulk_file_t *out = NULL;
+    int n = 0, capacity = 0, line_no = 0;
+    int result = MDOS_EOK;
+    char line[PACK_LINE_MAX];
+    pack_entry_t entry;
+
+    while (fgets(line, sizeof(line), list)) {
+        line_no++;
+
+        int parsed = pack_parse_line(line, &entry);
+        if (parsed == 0) continue;
+        if (parsed < 0) {
+            if (log) fprintf(log, "%s:%d: not a packlist entry\n", packlist_path, line_no);
+            result = parsed;
+            break;
+        }
+
+        if (n == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 32;
+            mdos_bulk_file_t *grown = realloc(out, new_capacity * sizeof(*out));
+            if (!grown) {
+                result = MDOS_ENOSPC;
+                break;
+            }
+            out = grown;
+            capacity = new_capacity;
+        }
+
+        mdos_bulk_file_t *file = &out[n];
+        memset(file, 0, sizeof(*file));
+
+        const char *base = strrchr(entry.path, '/');
+        result = mdos_bulk_name(base ? base + 1 : entry.path, NULL, file->name);
+        if (result != MDOS_EOK) {
+            if (log) fprintf(log, "%s:%d: bad MDOS name '%s'\n", packlist_path, line_no, entry.path);
+            break;
+        }
+
+        FILE *fp = pack_open_data(packlist_path, entry.path);
+        if (!fp) {
+            if (log) fprintf(log, "%s:%d: cannot open '%s'\n", packlist_path, line_no, entry.path);
+            result = MDOS_ENOENT;
+            break;
+        }
+        result = pack_read_data(fp, &entry, file);
+        fclose(fp);
+        n++; /* Owns file->buffer from here on */
+        if (result != MDOS_EOK) break;
+
+        /* Packlist attr is directory bytes 12-13; byte 12 holds the type */
+        file->type = (entry.attr >= 0) ? (entry.attr >> 8) & 0xFF : MDOS_TYPE_USER_DEFINED;
+        if (entry.load >= 0) file->load_addr = entry.load;
+        if (entry.start >= 0) file->start_addr = entry.start;
+    }
+
+    fclose(list);
+
+    if (result != MDOS_EOK) {
+        mdos_bulk_free(out, n);
+        free(out);
+        return result;
+    }
+
+    *files = out;
+    *count = n;
+    return MDOS_EOK;
+}
+
+int mdos_pack(const char *disk_path, const char *packlist_path, int sides, FILE *log) {
+    if (!disk_path || !packlist_path || (sides != 1 && sides != 2)) {
+        return MDOS_EINVAL;
+    }
+
+    /* Read everything first so a bad packlist leaves no half-built image */
+    mdos_bulk_file_t *files;
+    int count;
+    int result = mdos_pack_load(packlist_path, &files, &count, log);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+
+    /*
+     * The filesystem is built as a DSK, in place or, for IMD output, under
+     * a scratch name that mdos_save_imd encodes from. Its rename then only
+     * replaces disk_path, which nothing has mounted.
+     */
+    size_t len = strlen(disk_path);
+    int to_imd = len > 4 && strcasecmp(disk_path + len - 4, ".imd") == 0;
+    char dsk_path[1024];
+    snprintf(dsk_path, sizeof(dsk_path), to_imd ? "%s.pack" : "%s", disk_path);
+    result = mdos_mkfs(dsk_path, sides);
+    if (result == MDOS_EOK) {
+        mdos_fs_t *fs = mdos_mount(dsk_path, 0);
+        if (!fs) {
+            result = MDOS_EIO;
+        } else {
+            result = mdos_bulk_import(fs, files, count);
+            if (result == MDOS_EOK && to_imd) {
+                result = mdos_save_imd(fs, disk_path, NULL);
+            }
+            int unmount_result = mdos_unmount(fs);
+            if (result == MDOS_EOK) result = unmount_result;
+        }
+    }
+    if (to_imd) {
+        remove(dsk_path);
+    }
+
+    if (result == MDOS_EOK && log) {
+        for (int i = 0; i < count; i++) {
+            fprintf(log, "  %-12s %6zu bytes  rib=%04X load=%04X start=%04X type=%d\n",
+                    files[i].name, files[i].size, files[i].rib_sector,
+                    files[i].load_addr, files[i].start_addr, files[i].type);
+        }
+    }
+
+    mdos_bulk_free(files, count);
+    free(files);
+    return (result == MDOS_EOK) ? count : result;
+}
+
+/* Checksums */
+
+/* An image read for checksumming: the file as it is and its linear view */
+typedef struct {
+    const char *format;     /* "dsk", "imd" or "mdz" */
+    uint8_t *source;
+    long source_length;
+    uint8_t *image;         /* Same buffer as source for a DSK */
+    long length;
+} pack_image_t;
+
+static void pack_image_free(pack_image_t *img) {
+    if (img->image != img->source) {
+        free(img->image);
+    }
+    free(img->source);
+}
+
+/*
+ * Read the image file in one go. A DSK is its own linear view; an IMD or
+ * MDZ is mounted read-only and its linear view copied out.
+ */
+static int pack_read_image(const char *path, pack_image_t *img) {
+    memset(img, 0, sizeof(*img));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return MDOS_ENOENT;
+    }
+    int result = MDOS_EIO;
+    if (fseek(fp, 0, SEEK_END) == 0 && (img->source_length = ftell(fp)) >= 0 &&
+        fseek(fp, 0, SEEK_SET) == 0) {
+        img->source = malloc(img->source_length ? img->source_length : 1);
+        if (!img->source) {
+            result = MDOS_ENOSPC;
+        } else if (fread(img->source, 1, img->source_length, fp) == (size_t)img->source_length) {
+            result = MDOS_EOK;
+        }
+    }
+    fclose(fp);
+    if (result != MDOS_EOK) {
+        pack_image_free(img);
+        return result;
+    }
+
+    img->format = mdos_is_imd(path) ? "imd" : mdos_is_mdz(path) ? "mdz" : "dsk";
+    if (strcmp(img->format, "dsk") == 0) {
+        img->image = img->source;
+        img->length = img->source_length;
+        return MDOS_EOK;
+    }
+
+    mdos_fs_t *fs = mdos_mount_image(path, 1);
+    result = MDOS_EIO;
+    if (fs && fseek(fs->fp, 0, SEEK_END) == 0 && (img->length = ftell(fs->fp)) >= 0) {
+        img->image = malloc(img->length ? img->length : 1);
+        if (!img->image) {
+            result = MDOS_ENOSPC;
+        } else if (mdos_sparse_read(fs->fp, img->image, img->length) >= 0) {
+            result = MDOS_EOK;
+        }
+    }
+    if (fs) {
+        mdos_unmount_image(fs);
+    }
+    if (result != MDOS_EOK) {
+        pack_image_free(img);
+    }
+    return result;
+}
+
+/* The CAT and directory of a linear image */
+static int pack_image_meta(const pack_image_t *img, mdos_meta_t *meta) {
+    if (img->length < (long)(MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS) * MDOS_SECTOR_SIZE) {
+        return MDOS_EIO;
+    }
+    memset(meta, 0, sizeof(*meta));
+    memcpy(meta->cat, img->image + MDOS_CAT_SECTOR * MDOS_SECTOR_SIZE, MDOS_SECTOR_SIZE);
+    memcpy(meta->dir, img->image + MDOS_DIR_FIRST_SECTOR * MDOS_SECTOR_SIZE, sizeof(meta->dir));
+    return MDOS_EOK;
+}
+
+/*
+ * Contents of the file at a directory entry, read from the linear image as
+ * mdos_read_contents reads them from a mount. NULL if its RIB or a data
+ * sector lies outside the image.
+ */
+static uint8_t* pack_file_contents(const pack_image_t *img, const uint8_t *entry,
+                                   mdos_rib_t *rib, size_t *size) {
+    long nsectors = img->length / MDOS_SECTOR_SIZE;
+    int rib_sector = (entry[10] << 8) | entry[11];
+    if (rib_sector <= 0 || rib_sector >= nsectors) {
+        return NULL;
+    }
+    memcpy(rib, img->image + (long)rib_sector * MDOS_SECTOR_SIZE, sizeof(*rib));
+
+    int sects = (rib->size_high << 8) | rib->size_low;
+    int last = rib->last_size;
+    if (last == 0 || last > MDOS_SECTOR_SIZE) last = MDOS_SECTOR_SIZE;
+    *size = sects ? (size_t)(sects - 1) * MDOS_SECTOR_SIZE + last : 0;
+
+    uint8_t *data = malloc(sects ? (size_t)sects * MDOS_SECTOR_SIZE : 1);
+    if (!data) {
+        return NULL;
+    }
+    for (int lsn = 1; lsn <= sects; lsn++) {
+        int psn = mdos_lsn_to_psn(rib, lsn);
+        if (psn < 0 || psn >= nsectors) {
+            free(data);
+            return NULL;
+        }
+        memcpy(data + (size_t)(lsn - 1) * MDOS_SECTOR_SIZE,
+               img->image + (long)psn * MDOS_SECTOR_SIZE, MDOS_SECTOR_SIZE);
+    }
+    return data;
+}
+
+static void pack_sha256_hex(const void *data, size_t len, char *hex) {
+    uint8_t digest[MDOS_SHA256_SIZE];
+    mdos_sha256_t sha;
+    mdos_sha256_init(&sha);
+    mdos_sha256_update(&sha, data, len);
+    mdos_sha256_final(&sha, digest);
+    mdos_sha256_hex(digest, hex);
+}
+
+int mdos_pack_manifest(const char *image_path, FILE *out, int flags) {
+    if (!image_path || !out) {
+        return MDOS_EINVAL;
+    }
+
+    pack_image_t img;
+    int result = pack_read_image(image_path, &img);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+    mdos_meta_t meta;
+    if ((result = pack_image_meta(&img, &meta)) != MDOS_EOK) {
+        pack_image_free(&img);
+        return result;
+    }
+
+    char hex[2 * MDOS_SHA256_SIZE + 1];
+    fprintf(out, "# MDOS Packlist with checksums\n");
+    fprintf(out, "# Source image: %s\n", image_path);
+    fprintf(out, "#\n");
+    fprintf(out, "# Format: filename load_addr start_addr attr file_size last_bytes rib_sector crc32c [sha256]\n");
+    fprintf(out, "# All addresses and values in hexadecimal\n");
+    fprintf(out, "# image format=%s bytes=%lX crc32c=%08X", img.format, img.source_length,
+            (unsigned)mdos_crc32c(0, img.source, img.source_length));
+    if (flags & MDOS_PACK_SHA256) {
+        pack_sha256_hex(img.source, img.source_length, hex);
+        fprintf(out, " sha256=%s", hex);
+    }
+    fprintf(out, "\n#\n\n");
+
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+        const uint8_t *entry = mdos_meta_entry(&meta, slot);
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            continue;
+        }
+        char name[MDOS_MAX_FILENAME];
+        mdos_meta_entry_name(entry, name);
+
+        mdos_rib_t rib;
+        size_t size;
+        uint8_t *data = pack_file_contents(&img, entry, &rib, &size);
+        if (!data) {
+            fprintf(out, "# FAILED: %s (RIB sector %d not accessible)\n",
+                    name, (entry[10] << 8) | entry[11]);
+            continue;
+        }
+        fprintf(out, "%s load=%04X start=%04X attr=%04X size=%04X last=%02X rib=%04X crc32c=%08X",
+                name, (rib.addr_high << 8) | rib.addr_low, (rib.pc_high << 8) | rib.pc_low,
+                (entry[12] << 8) | entry[13], (rib.size_high << 8) | rib.size_low,
+                rib.last_size, (entry[10] << 8) | entry[11],
+                (unsigned)mdos_crc32c(0, data, size));
+        if (flags & MDOS_PACK_SHA256) {
+            pack_sha256_hex(data, size, hex);
+            fprintf(out, " sha256=%s", hex);
+        }
+        fprintf(out, "\n");
+        free(data);
+    }
+
+    pack_image_free(&img);
+    return ferror(out) ? MDOS_EIO : MDOS_EOK;
+}
+
+/* The "# image format=... bytes=... crc32c=... [sha256=...]" comment line */
+typedef struct {
+    char format[8];
+    long bytes;             /* -1: no image line */
+    uint32_t crc32c;
+    char sha256[2 * MDOS_SHA256_SIZE + 1];
+} pack_image_sums_t;
+
+static void pack_parse_image_line(char *line, pack_image_sums_t *sums) {
+    sums->bytes = -1;
+    sums->format[0] = sums->sha256[0] = '\0';
+    for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        if (strncmp(tok, "format=", 7) == 0) snprintf(sums->format, sizeof(sums->format), "%s", tok + 7);
+        else if (strncmp(tok, "bytes=", 6) == 0) sums->bytes = strtol(tok + 6, NULL, 16);
+        else if (strncmp(tok, "crc32c=", 7) == 0) sums->crc32c = (uint32_t)strtoul(tok + 7, NULL, 16);
+        else if (strncmp(tok, "sha256=", 7) == 0) snprintf(sums->sha256, sizeof(sums->sha256), "%s", tok + 7);
+    }
+}
+
+/* Compare one packlist entry with the file it names; returns 1 if they match */
+static int pack_verify_file(const pack_image_t *img, const uint8_t *entry,
+                            const pack_entry_t *expect, mdos_pack_verify_t *result, FILE *log) {
+    mdos_rib_t rib;
+    size_t size;
+    uint8_t *data = pack_file_contents(img, entry, &rib, &size);
+    const char *problem = NULL;
+    char hex[2 * MDOS_SHA256_SIZE + 1];
+
+    if (!data) {
+        problem = "unreadable";
+    } else if (expect->size >= 0) {
+        long last = (expect->last > 0 && expect->last <= MDOS_SECTOR_SIZE) ? expect->last : MDOS_SECTOR_SIZE;
+        size_t expect_size = expect->size ? (size_t)(expect->size - 1) * MDOS_SECTOR_SIZE + last : 0;
+        if (size != expect_size) problem = "length";
+    }
+    if (!problem && expect->has_crc32c && mdos_crc32c(0, data, size) != expect->crc32c) {
+        problem = "crc32c";
+    }
+    if (!problem && expect->sha256[0]) {
+        pack_sha256_hex(data, size, hex);
+        if (strcasecmp(hex, expect->sha256) != 0) problem = "sha256";
+    }
+    free(data);
+
+    if (problem) {
+        result->changed++;
+        if (log) fprintf(log, "CHANGED  %s (%s)\n", expect->path, problem);
+        return 0;
+    }
+    if (!expect->has_crc32c && !expect->sha256[0]) {
+        result->unchecked++;
+        if (log) fprintf(log, "NOSUM    %s (length only)\n", expect->path);
+    }
+    result->ok++;
+    return 1;
+}
+
+int mdos_pack_verify(const char *image_path, const char *packlist_path,
+                     mdos_pack_verify_t *result, FILE *log) {
+    if (!image_path || !packlist_path || !result) {
+        return MDOS_EINVAL;
+    }
+    memset(result, 0, sizeof(*result));
+    result->image = -1;
+
+    FILE *list = fopen(packlist_path, "r");
+    if (!list) {
+        return MDOS_ENOENT;
+    }
+    pack_entry_t *entries = NULL;
+    int n = 0, capacity = 0, line_no = 0;
+    int status = MDOS_EOK;
+    pack_image_sums_t sums = { .bytes = -1 };
+    char line[PACK_LINE_MAX];
+
+    while (fgets(line, sizeof(line), list)) {
+        line_no++;
+        if (strncmp(line, "# image ", 8) == 0) {
+            pack_parse_image_line(line + 8, &sums);
+            continue;
+        }
+        if (n == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 32;
+            pack_entry_t *grown = realloc(entries, new_capacity * sizeof(*entries));
+            if (!grown) {
+                status = MDOS_ENOSPC;
+                break;
+            }
+            entries = grown;
+            capacity = new_capacity;
+        }
+        int parsed = pack_parse_line(line, &entries[n]);
+        if (parsed < 0) {
+            if (log) fprintf(log, "%s:%d: not a packlist entry\n", packlist_path, line_no);
+            status = parsed;
+            break;
+        }
+        n += parsed;
+    }
+    fclose(list);
+
+    pack_image_t img;
+    mdos_meta_t meta;
+    if (status == MDOS_EOK && (status = pack_read_image(image_path, &img)) == MDOS_EOK &&
+        (status = pack_image_meta(&img, &meta)) != MDOS_EOK) {
+        pack_image_free(&img);
+    }
+    if (status != MDOS_EOK) {
+        free(entries);
+        return status;
+    }
+
+    /* The image file itself, if the packlist has it in this format */
+    if (sums.bytes >= 0 && sums.format[0] && strcasecmp(sums.format, img.format) != 0) {
+        if (log) fprintf(log, "IMAGE    packlist has the %s file, not the %s: files only\n",
+                         sums.format, img.format);
+    } else if (sums.bytes >= 0) {
+        uint32_t crc = mdos_crc32c(0, img.source, img.source_length);
+        result->image = (img.source_length == sums.bytes && crc == sums.crc32c);
+        if (result->image && sums.sha256[0]) {
+            char hex[2 * MDOS_SHA256_SIZE + 1];
+            pack_sha256_hex(img.source, img.source_length, hex);
+            result->image = strcasecmp(hex, sums.sha256) == 0;
+        }
+        if (!result->image && log) {
+            fprintf(log, "IMAGE    %s differs (%ld bytes, crc32c %08X; packlist %ld bytes, crc32c %08X)\n",
+                    image_path, img.source_length, (unsigned)crc, sums.bytes, (unsigned)sums.crc32c);
+        }
+    }
+
+    /* Then every listed file, by base name */
+    uint8_t listed[MDOS_DIR_ENTRIES] = { 0 };
+    char names[MDOS_DIR_ENTRIES][MDOS_MAX_FILENAME];
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+        const uint8_t *entry = mdos_meta_entry(&meta, slot);
+        names[slot][0] = '\0';
+        if (entry[0] != 0x00 && entry[0] != 0xFF) {
+            mdos_meta_entry_name(entry, names[slot]);
+        }
+    }
+
+    result->files = n;
+    for (int i = 0; i < n; i++) {
+        const char *base = strrchr(entries[i].path, '/');
+        base = base ? base + 1 : entries[i].path;
+        int slot = 0;
+        while (slot < MDOS_DIR_ENTRIES && (listed[slot] || !names[slot][0] ||
+                                           strcasecmp(names[slot], base) != 0)) {
+            slot++;
+        }
+        if (slot == MDOS_DIR_ENTRIES) {
+            result->missing++;
+            if (log) fprintf(log, "MISSING  %s\n", entries[i].path);
+            continue;
+        }
+        listed[slot] = 1;
+        pack_verify_file(&img, mdos_meta_entry(&meta, slot), &entries[i], result, log);
+    }
+
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+        if (names[slot][0] && !listed[slot]) {
+            result->extra++;
+            if (log) fprintf(log, "EXTRA    %s\n", names[slot]);
+        }
+    }
+
+    pack_image_free(&img);
+    free(entries);
+    return MDOS_EOK;
+}
@@ -0,0 +1,71 @@
+/*
+ * MDOS Filesystem Library - Packlist Rebuild
+ * Copyright (C) 2025
+ *
+ * Build a new image from the packlist written by mdosextract
+ */
+
+#ifndef MDOS_PACK_H
+#define MDOS_PACK_H
+
+#include "mdos_fs.h"
+#include "mdos_bulk.h"
+
+/*
+ * Read a packlist. Each line is
+ *   path load=XXXX start=XXXX attr=XXXX size=XXXX last=XX [rib=XXXX ...]
+ * with hex values; '#' lines are comments and unknown keys (the crc32c and
+ * sha256 checksums among them) are ignored here.
+ * size (sectors) and last (bytes in the last sector) give the file length;
+ * the host file is truncated or zero padded to it. Paths that do not exist
+ * as written are looked up next to the packlist. On success *files holds
+ * *count entries to be released with mdos_bulk_free and free.
+ */
+int mdos_pack_load(const char *packlist_path, mdos_bulk_file_t **files, int *count, FILE *log);
+
+/*
+ * Create disk_path (mkfs with the given sides) and write every file of the
+ * packlist in one mdos_bulk_import: contiguous extents, data in cluster
+ * order, RIB load/start addresses and attributes set, and each metadata
+ * sector written once. For a disk_path ending in .imd the DSK is built
+ * beside it as disk_path.pack, saved with mdos_save_imd and removed; on
+ * failure disk_path is left as it was.
+ * Returns the number of files packed or a negative error code.
+ */
+int mdos_pack(const char *disk_path, const char *packlist_path, int sides, FILE *log);
+
+/* mdos_pack_manifest flags */
+#define MDOS_PACK_SHA256 0x01   /* Add SHA-256 next to every CRC32C */
+
+/*
+ * Write a packlist for image_path with checksums, as mdosextract does while
+ * extracting: one line per file with crc32c= (and sha256=) of its contents,
+ * and a "# image format=... bytes=... crc32c=..." line for the image file
+ * itself. A DSK is read once; an IMD or MDZ once more through its mount.
+ */
+int mdos_pack_manifest(const char *image_path, FILE *out, int flags);
+
+/* Outcome of mdos_pack_verify */
+typedef struct {
+    int files;              /* File lines in the packlist */
+    int ok;
+    int changed;            /* Length or checksum differs */
+    int missing;            /* Not on the image */
+    int extra;              /* On the image, not in the packlist */
+    int unchecked;          /* Line without a checksum: length only */
+    int image;              /* 1 image file matches, 0 differs, -1 not checked */
+} mdos_pack_verify_t;
+
+/*
+ * Check image_path against a packlist written by mdosextract or
+ * mdos_pack_manifest, reading the image once. Files are matched by the
+ * base name of their packlist path. The image file checksum is only
+ * checked against an image of the format it was taken from; the file
+ * checksums hold across DSK, IMD and MDZ copies of the same disk. Each
+ * difference goes to log. Returns MDOS_EOK once the check ran (the result
+ * is in *result).
+ */
+int mdos_pack_verify(const char *image_path, const char *packlist_path,
+                     mdos_pack_verify_t *result, FILE *log);
+
+#endif /* MDOS_PACK_H */
@@ -0,0 +1,336 @@
+/*
+ * MDOS Filesystem Library - Deleted File Recovery
+ * Copyright (C) 2025
+ *
+ * A RIB always sits at the start of its first segment, so only cluster
+ * boundaries are candidates, and a pre-filter of a few word tests throws
+ * out nearly all of them before any segment list is decoded
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mdos_internal.h"
+#include "mdos_recover.h"
+#include "mdos_imd.h"
+#include "mdos_sparse.h"
+#include "mdos_stats.h"
+#include "mdos_geometry.h"
+
+#define RECOVER_CLUSTER_SECTORS 4
+#define RECOVER_SDWS            57      /* Segment descriptors in a RIB */
+#define RECOVER_RIB_LAST        117     /* RIB offsets of last_size and size */
+#define RECOVER_RIB_SIZE        118
+#define RECOVER_RIB_SPARE       124     /* Zero filler at the end of a RIB */
+#define RECOVER_FIRST_CLUSTER   ((MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS + RECOVER_CLUSTER_SECTORS - 1) / \
+                                 RECOVER_CLUSTER_SECTORS)
+
+/* The end marker bit of each of the four SDWs in a big endian word */
+#define RECOVER_END_BITS        0x8000800080008000ULL
+
+/* Score weights, adding up to 100 */
+#define RECOVER_SCORE_VALID     30      /* Segments on the disk, end marker within them */
+#define RECOVER_SCORE_SIZE      10      /* Size field equal to the end marker */
+#define RECOVER_SCORE_LAST      10      /* last_size 1-128 */
+#define RECOVER_SCORE_TIGHT     10      /* No more clusters than the size needs */
+#define RECOVER_SCORE_INTACT    30      /* Scaled by the clusters not reused */
+#define RECOVER_SCORE_ENTRY     10      /* A deleted directory entry points at it */
+
+typedef struct {
+    int end;                /* End marker: data sectors */
+    int segments;
+    long first[RECOVER_SDWS];
+    long count[RECOVER_SDWS];
+    long clusters;
+} recover_rib_t;
+
+static uint64_t load_be64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int b = 0; b < 8; b++) v = (v << 8) | p[b];
+    return v;
+}
+
+/*
+ * Could the first sector of this cluster be a RIB? Its first SDW must be
+ * a segment starting at this very cluster, the spare bytes must be zero
+ * and some SDW must carry the end marker bit, looked for four at a time.
+ */
+static int recover_prefilter(const uint8_t *s, long cluster) {
+    if ((((s[0] << 8) | s[1]) & 0x83FF) != cluster) {
+        return 0;
+    }
+    if ((s[RECOVER_RIB_LAST - 3] | s[RECOVER_RIB_LAST - 2] | s[RECOVER_RIB_LAST - 1]) ||
+        (load_be64(s + RECOVER_RIB_SPARE - 4) & 0xFFFFFFFFULL)) {
+        return 0;
+    }
+    for (int offset = 0; offset + 8 <= 2 * RECOVER_SDWS; offset += 8) {
+        if (load_be64(s + offset) & RECOVER_END_BITS) return 1;
+    }
+    return s[2 * RECOVER_SDWS - 2] & 0x80;
+}
+
+/*
+ * Decode a candidate's segments: contiguous up to the end marker, past
+ * the system area, on the disk, not overlapping, with room for the end
+ * marker's sectors after the RIB
+ */
+static int recover_decode(const uint8_t *s, long clusters, recover_rib_t *rib) {
+    uint8_t seen[MDOS_CAT_CLUSTERS];
+    memset(seen, 0, sizeof(seen));
+    memset(rib, 0, sizeof(*rib));
+    rib->end = -1;
+    for (int i = 0; i < RECOVER_SDWS; i++) {
+        int sdw = (s[2 * i] << 8) | s[2 * i + 1];
+        MDOS_STAT_ADD(MDOS_STAT_SDWS, 1);
+        if (sdw & 0x8000) {
+            rib->end = sdw & 0x7FFF;
+            break;
+        }
+        long cluster = sdw & 0x3FF;
+        long count = ((sdw >> 10) & 0x1F) + 1;
+        if (sdw == 0 || cluster < RECOVER_FIRST_CLUSTER || cluster + count > clusters) {
+            return 0;
+        }
+        for (long c = cluster; c < cluster + count; c++) {
+            if (seen[c]++) return 0;
+        }
+        rib->first[rib->segments] = cluster;
+        rib->count[rib->segments++] = count;
+        rib->clusters += count;
+    }
+    return rib->end >= 0 && rib->end <= rib->clusters * RECOVER_CLUSTER_SECTORS - 1;
+}
+
+static int recover_add(mdos_recover_t *scan, int *cap, const mdos_recover_file_t *file) {
+    if (scan->count == *cap) {
+        int grown = *cap ? *cap * 2 : 16;
+        mdos_recover_file_t *files = realloc(scan->files, grown * sizeof(*files));
+        if (!files) {
+            return MDOS_ENOSPC;
+        }
+        scan->files = files;
+        *cap = grown;
+    }
+    scan->files[scan->count++] = *file;
+    return MDOS_EOK;
+}
+
+static void recover_score(mdos_recover_file_t *file, const uint8_t *s, const recover_rib_t *rib,
+                          const uint8_t *live) {
+    int size = (s[RECOVER_RIB_SIZE] << 8) | s[RECOVER_RIB_SIZE + 1];
+    int last = s[RECOVER_RIB_LAST];
+
+    file->sectors = rib->end;
+    file->clusters = (int)rib->clusters;
+    file->size = rib->end ? (long)(rib->end - 1) * MDOS_SECTOR_SIZE +
+                            ((last == 0 || last > MDOS_SECTOR_SIZE) ? MDOS_SECTOR_SIZE : last) : 0;
+    file->overwritten = 0;
+    for (int i = 0; i < rib->segments; i++) {
+        for (long c = rib->first[i]; c < rib->first[i] + rib->count[i]; c++) {
+            file->overwritten += live[c];
+        }
+    }
+
+    file->score = RECOVER_SCORE_VALID;
+    if (size == rib->end) file->score += RECOVER_SCORE_SIZE;
+    if (last > 0 && last <= MDOS_SECTOR_SIZE) file->score += RECOVER_SCORE_LAST;
+    if (rib->end > rib->clusters * RECOVER_CLUSTER_SECTORS - 1 - RECOVER_CLUSTER_SECTORS) {
+        file->score += RECOVER_SCORE_TIGHT;
+    }
+    file->score += (int)(RECOVER_SCORE_INTACT * (rib->clusters - file->overwritten) / rib->clusters);
+    if (file->slot >= 0) file->score += RECOVER_SCORE_ENTRY;
+}
+
+/* Read the whole image, padded to what its geometry holds */
+static int recover_load(const char *image_path, mdos_recover_t *scan) {
+    mdos_fs_t *mount = mdos_mount_image(image_path, 1);
+    if (!mount) {
+        return MDOS_ENOENT;
+    }
+    mdos_geometry_t g;
+    long length = -1;
+    int result = mdos_image_geometry(mount, &g);
+    if (result == MDOS_EOK && (fseek(mount->fp, 0, SEEK_END) != 0 || (length = ftell(mount->fp)) < 0)) {
+        result = MDOS_EIO;
+    }
+    if (result == MDOS_EOK) {
+        long geometry_sectors = (long)g.cylinders * g.heads * g.sectors * g.sector_size / MDOS_SECTOR_SIZE;
+        scan->sectors = length / MDOS_SECTOR_SIZE;
+        if (scan->sectors < geometry_sectors) scan->sectors = geometry_sectors;
+        scan->image = calloc(scan->sectors ? scan->sectors : 1, MDOS_SECTOR_SIZE);
+        if (!scan->image) {
+            result = MDOS_ENOSPC;
+        } else if (mdos_sparse_read(mount->fp, scan->image, length) < 0) {
+            result = MDOS_EIO;
+        } else if (scan->sectors < MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS) {
+            result = MDOS_EINVAL;
+        }
+    }
+    int unmount_result = mdos_unmount_image(mount);
+    return result == MDOS_EOK ? unmount_result : result;
+}
+
+int mdos_recover_scan(const char *image_path, mdos_recover_t *scan) {
+    if (!image_path || !scan) {
+        return MDOS_EINVAL;
+    }
+    memset(scan, 0, sizeof(*scan));
+    int result = recover_load(image_path, scan);
+    if (result != MDOS_EOK) {
+        mdos_recover_free(scan);
+        return result;
+    }
+
+    long clusters = scan->sectors / RECOVER_CLUSTER_SECTORS;
+    if (clusters > MDOS_CAT_CLUSTERS) clusters = MDOS_CAT_CLUSTERS;
+    mdos_meta_t meta;
+    memcpy(meta.dir, scan->image + MDOS_DIR_FIRST_SECTOR * MDOS_SECTOR_SIZE, sizeof(meta.dir));
+
+    /* Clusters live files use now, read as leniently as fsck does */
+    uint8_t live[MDOS_CAT_CLUSTERS];
+    memset(live, 0, sizeof(live));
+    memset(live, 1, RECOVER_FIRST_CLUSTER);
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+        const uint8_t *entry = mdos_meta_entry(&meta, slot);
+        int rib_sector = (entry[10] << 8) | entry[11];
+        if (entry[0] == 0x00 || entry[0] == 0xFF || rib_sector <= 0 || rib_sector >= scan->sectors) {
+            continue;
+        }
+        const uint8_t *s = scan->image + (long)rib_sector * MDOS_SECTOR_SIZE;
+        for (int i = 0; i < RECOVER_SDWS; i++) {
+            int sdw = (s[2 * i] << 8) | s[2 * i + 1];
+            MDOS_STAT_ADD(MDOS_STAT_SDWS, 1);
+            if (sdw & 0x8000) break;
+            long cluster = sdw & 0x3FF;
+            long count = ((sdw >> 10) & 0x1F) + 1;
+            for (long c = cluster; sdw && c < cluster + count && c < clusters; c++) live[c] = 1;
+        }
+    }
+
+    /* Sweep every cluster; valid RIBs outside live files are what is left */
+    int *rib_at = calloc(clusters ? clusters : 1, sizeof(int));
+    recover_rib_t *ribs = malloc((clusters ? clusters : 1) * sizeof(recover_rib_t));
+    int nribs = 0;
+    if (!rib_at || !ribs) {
+        free(rib_at);
+        free(ribs);
+        mdos_recover_free(scan);
+        return MDOS_ENOSPC;
+    }
+    for (long c = RECOVER_FIRST_CLUSTER; c < clusters; c++) {
+        const uint8_t *s = scan->image + c * RECOVER_CLUSTER_SECTORS * MDOS_SECTOR_SIZE;
+        if (!recover_prefilter(s, c)) {
+            continue;
+        }
+        scan->candidates++;
+        if (live[c]) {
+            scan->live++;
+        } else if (recover_decode(s, clusters, &ribs[nribs])) {
+            rib_at[c] = ++nribs;
+        }
+    }
+
+    /* Deleted entries take the RIBs they point at; an entry whose RIB is gone is lost */
+    int cap = 0;
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES && result == MDOS_EOK; slot++) {
+        const uint8_t *entry = mdos_meta_entry(&meta, slot);
+        if (entry[0] != 0xFF) {
+            continue;
+        }
+        scan->deleted++;
+        uint8_t named[MDOS_DIR_ENTRY_SIZE];
+        memcpy(named, entry, sizeof(named));
+        for (int i = 0; i < 10; i++) {
+            if (named[i] < 0x20 || named[i] > 0x7E) named[i] = '?';
+        }
+        mdos_recover_file_t file;
+        memset(&file, 0, sizeof(file));
+        file.slot = slot;
+        file.rib_sector = (entry[10] << 8) | entry[11];
+        file.attributes = (uint16_t)((entry[12] << 8) | entry[13]);
+        mdos_meta_entry_name(named, file.name);
+        long c = file.rib_sector / RECOVER_CLUSTER_SECTORS;
+        int found = (file.rib_sector % RECOVER_CLUSTER_SECTORS == 0 && c < clusters) ? rib_at[c] : 0;
+        if (found > 0) {
+            recover_score(&file, scan->image + (long)file.rib_sector * MDOS_SECTOR_SIZE,
+                          &ribs[found - 1], live);
+            rib_at[c] = -found;
+        } else {
+            file.rib_sector = -1;
+        }
+        result = recover_add(scan, &cap, &file);
+    }
+    for (long c = RECOVER_FIRST_CLUSTER; c < clusters && result == MDOS_EOK; c++) {
+        if (rib_at[c] <= 0) {
+            continue;
+        }
+        mdos_recover_file_t file;
+        memset(&file, 0, sizeof(file));
+        file.slot = -1;
+        file.rib_sector = (int)(c * RECOVER_CLUSTER_SECTORS);
+        recover_score(&file, scan->image + (long)file.rib_sector * MDOS_SECTOR_SIZE,
+                      &ribs[rib_at[c] - 1], live);
+        result = recover_add(scan, &cap, &file);
+    }
+
+    free(rib_at);
+    free(ribs);
+    if (result != MDOS_EOK) {
+        mdos_recover_free(scan);
+    }
+    return result;
+}
+
+int mdos_recover_extract(const mdos_recover_t *scan, int index, const char *out_path) {
+    if (!scan || !scan->image || index < 0 || index >= scan->count || !out_path) {
+        return MDOS_EINVAL;
+    }
+    const mdos_recover_file_t *file = &scan->files[index];
+    if (file->rib_sector < 0) {
+        return MDOS_ENOENT;
+    }
+    long clusters = scan->sectors / RECOVER_CLUSTER_SECTORS;
+    if (clusters > MDOS_CAT_CLUSTERS) clusters = MDOS_CAT_CLUSTERS;
+    recover_rib_t rib;
+    const uint8_t *s = scan->image + (long)file->rib_sector * MDOS_SECTOR_SIZE;
+    if (!recover_decode(s, clusters, &rib)) {
+        return MDOS_EINVAL;
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        return MDOS_EIO;
+    }
+    /* Logical sector 0 is the RIB itself; the data follows it through the segments */
+    long lsn = 0, left = file->size;
+    int result = MDOS_EOK;
+    for (int i = 0; i < rib.segments && left > 0 && result == MDOS_EOK; i++) {
+        for (long psn = rib.first[i] * RECOVER_CLUSTER_SECTORS;
+             psn < (rib.first[i] + rib.count[i]) * RECOVER_CLUSTER_SECTORS && left > 0; psn++, lsn++) {
+            if (lsn == 0) {
+                continue;
+            }
+            size_t n = left < MDOS_SECTOR_SIZE ? (size_t)left : MDOS_SECTOR_SIZE;
+            if (fwrite(scan->image + psn * MDOS_SECTOR_SIZE, 1, n, out) != n) {
+                result = MDOS_EIO;
+                break;
+            }
+            left -= n;
+        }
+    }
+    if (fclose(out) != 0 && result == MDOS_EOK) {
+        result = MDOS_EIO;
+    }
+    return result;
+}
+
+void mdos_recover_free(mdos_recover_t *scan) {
+    if (!scan) {
+        return;
+    }
+    free(scan->files);
+    free(scan->image);
+    scan->files = NULL;
+    scan->image = NULL;
+    scan->count = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * MDOS Filesystem Library - Deleted File Recovery
+ * Copyright (C) 2025
+ *
+ * Find the RIBs of deleted files, and of files whose directory sector is
+ * lost, by scanning every cluster of an image, and extract what is left
+ */
+
+#ifndef MDOS_RECOVER_H
+#define MDOS_RECOVER_H
+
+#include <stdint.h>
+#include "mdos_fs.h"
+
+typedef struct {
+    int slot;               /* Deleted directory entry, -1 for an orphan RIB */
+    int rib_sector;         /* -1 when the entry's RIB has been overwritten */
+    char name[MDOS_MAX_FILENAME];  /* "??ad.sa" from a deleted entry, "" for an orphan */
+    uint16_t attributes;    /* From the deleted entry, 0 for an orphan */
+    int sectors;            /* Data sectors, after the RIB */
+    long size;              /* Bytes */
+    int clusters;           /* Clusters the RIB's segments cover */
+    int overwritten;        /* Of those, now used by live files */
+    int score;              /* Confidence, 0-100 */
+} mdos_recover_file_t;
+
+typedef struct {
+    long sectors;           /* Sectors on the disk */
+    long candidates;        /* Sectors that passed the pre-filter */
+    int live;               /* Of those, RIBs or data of live files */
+    int deleted;            /* Deleted directory entries */
+    int count;
+    mdos_recover_file_t *files;
+    uint8_t *image;         /* Private copy of the image for mdos_recover_extract */
+} mdos_recover_t;
+
+/*
+ * Scan image_path (DSK, IMD or MDZ) for recoverable files. Every cluster
+ * boundary is a RIB candidate: a cheap pre-filter (first segment at the
+ * RIB's own cluster, zero filler bytes, an end marker found with 64-bit
+ * word tests) discards almost all of them before the segment list is
+ * decoded and checked against the disk. Deleted directory entries
+ * (first byte 0xFF) are matched to the RIBs they point at, the rest are
+ * orphans. Each file is scored on how consistent its RIB is and on how
+ * many of its clusters live files have reused since.
+ *
+ * Files are listed deleted entries first, in slot order, then orphans in
+ * sector order. Free the result with mdos_recover_free.
+ */
+int mdos_recover_scan(const char *image_path, mdos_recover_t *scan);
+
+/* Write the contents of scan->files[index] to out_path */
+int mdos_recover_extract(const mdos_recover_t *scan, int index, const char *out_path);
+
+void mdos_recover_free(mdos_recover_t *scan);
+
+#endif /* MDOS_RECOVER_H */
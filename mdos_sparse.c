@@ -0,0 +1,203 @@
+/*
+ * MDOS Filesystem Library - Sparse DSK Images
+ * Copyright (C) 2025
+ *
+ * A DSK is mostly unused sectors; writing them as holes keeps the image's
+ * size while the filesystem stores only what is used
+ */
+
+#define _GNU_SOURCE  /* SEEK_DATA/SEEK_HOLE, fallocate */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "mdos_internal.h"
+#include "mdos_sparse.h"
+#include "mdos_stats.h"
+
+#define SPARSE_CLUSTER_SECTORS 4
+#define SPARSE_FIRST_DATA      (MDOS_DIR_FIRST_SECTOR + MDOS_DIR_SECTORS)
+
+/* Whether sector s of a linear image can be left out */
+static int sparse_droppable(const uint8_t *image, long sectors, long s, int flags) {
+    if ((flags & MDOS_SPARSE_FREE) && s >= SPARSE_FIRST_DATA && sectors > MDOS_CAT_SECTOR) {
+        const uint8_t *cat = image + MDOS_CAT_SECTOR * MDOS_SECTOR_SIZE;
+        long cluster = s / SPARSE_CLUSTER_SECTORS;
+        if (cluster < MDOS_CAT_CLUSTERS && !(cat[cluster >> 3] & (1 << (7 - (cluster & 7))))) {
+            return 1;
+        }
+    }
+
+    const uint8_t *sector = image + s * MDOS_SECTOR_SIZE;
+    for (int i = 0; i < MDOS_SECTOR_SIZE; i++) {
+        if (sector[i]) return 0;
+    }
+    return 1;
+}
+
+long mdos_sparse_write(FILE *fp, const uint8_t *image, long length, int flags) {
+    if (!fp || (!image && length > 0) || length < 0) {
+        return MDOS_EINVAL;
+    }
+
+    /* A trailing partial sector is always written */
+    long sectors = length / MDOS_SECTOR_SIZE;
+    long skipped = 0;
+    long run = -1;
+
+    for (long s = 0; s <= sectors; s++) {
+        int keep = (s < sectors) && !sparse_droppable(image, sectors, s, flags);
+        if (keep) {
+            if (run < 0) run = s;
+            continue;
+        }
+        if (run >= 0) {
+            size_t n = (size_t)(s - run) * MDOS_SECTOR_SIZE;
+            MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+            if (fseek(fp, run * MDOS_SECTOR_SIZE, SEEK_SET) != 0 ||
+                fwrite(image + run * MDOS_SECTOR_SIZE, 1, n, fp) != n) {
+                return MDOS_EIO;
+            }
+            run = -1;
+        }
+        if (s < sectors) skipped += MDOS_SECTOR_SIZE;
+    }
+
+    long tail = sectors * MDOS_SECTOR_SIZE;
+    if (tail < length &&
+        (fseek(fp, tail, SEEK_SET) != 0 ||
+         fwrite(image + tail, 1, length - tail, fp) != (size_t)(length - tail))) {
+        return MDOS_EIO;
+    }
+
+    /* Trailing holes: set the size without writing anything */
+    if (fflush(fp) != 0 || ftruncate(fileno(fp), length) != 0) {
+        return MDOS_EIO;
+    }
+    return skipped;
+}
+
+long mdos_sparse_read(FILE *fp, uint8_t *buf, long length) {
+    if (!fp || (!buf && length > 0) || length < 0) {
+        return MDOS_EINVAL;
+    }
+    memset(buf, 0, length);
+
+#ifdef SEEK_DATA
+    int fd = fileno(fp);
+    if (fd >= 0 && fflush(fp) == 0) {
+        long total = 0;
+        off_t pos = 0;
+        while (pos < length) {
+            off_t data = lseek(fd, pos, SEEK_DATA);
+            MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 1);
+            if (data < 0) {
+                if (errno == ENXIO) break;      /* Only holes from here on */
+                goto dense;                     /* SEEK_DATA unsupported */
+            }
+            if (data >= length) break;
+            off_t hole = lseek(fd, data, SEEK_HOLE);
+            if (hole < 0) goto dense;
+            if (hole > length) hole = length;
+
+            ssize_t n = pread(fd, buf + data, hole - data, data);
+            MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+            if (n < 0) return MDOS_EIO;
+            total += n;
+            pos = hole;
+        }
+        fseek(fp, 0, SEEK_SET);                 /* Resync the stream */
+        return total;
+    }
+dense:
+#endif
+    if (fseek(fp, 0, SEEK_SET) != 0) {
+        return MDOS_EIO;
+    }
+    size_t n = fread(buf, 1, length, fp);
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 2);
+    if (ferror(fp)) {
+        return MDOS_EIO;
+    }
+    return (long)n;
+}
+
+int mdos_sparse_is_hole(FILE *fp, long offset, long length) {
+#ifdef SEEK_DATA
+    int fd = fp ? fileno(fp) : -1;
+    if (fd < 0 || fflush(fp) != 0) {
+        return 0;
+    }
+    long saved = ftell(fp);
+    off_t data = lseek(fd, offset, SEEK_DATA);
+    int hole = (data < 0) ? (errno == ENXIO) : (data >= offset + length);
+    fseek(fp, saved, SEEK_SET);
+    return hole;
+#else
+    (void)fp;
+    (void)offset;
+    (void)length;
+    return 0;
+#endif
+}
+
+long mdos_punch_holes(const char *dsk_path, int flags) {
+    if (!dsk_path) {
+        return MDOS_EINVAL;
+    }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    FILE *fp = fopen(dsk_path, "r+b");
+    if (!fp) {
+        return MDOS_EIO;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) {
+        fclose(fp);
+        return MDOS_EIO;
+    }
+
+    long length = (long)st.st_size;
+    uint8_t *image = malloc(length ? length : 1);
+    if (!image) {
+        fclose(fp);
+        return MDOS_ENOSPC;
+    }
+    long result = mdos_sparse_read(fp, image, length);
+
+    /* Punch each run of droppable sectors that is not a hole already */
+    long sectors = length / MDOS_SECTOR_SIZE;
+    long punched = 0;
+    long run = -1;
+    for (long s = 0; s <= sectors && result >= 0; s++) {
+        if (s < sectors && sparse_droppable(image, sectors, s, flags)) {
+            if (run < 0) run = s;
+            continue;
+        }
+        if (run < 0) {
+            continue;
+        }
+        off_t offset = (off_t)run * MDOS_SECTOR_SIZE;
+        off_t len = (off_t)(s - run) * MDOS_SECTOR_SIZE;
+        run = -1;
+        if (mdos_sparse_is_hole(fp, offset, len)) {
+            continue;
+        }
+        if (fallocate(fileno(fp), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) != 0) {
+            result = (errno == EOPNOTSUPP) ? MDOS_EINVAL : MDOS_EIO;
+        } else {
+            punched += len;
+        }
+    }
+
+    free(image);
+    fclose(fp);
+    return (result < 0) ? result : punched;
+#else
+    (void)flags;
+    return MDOS_EINVAL;
+#endif
+}
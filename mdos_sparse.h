@@ -0,0 +1,46 @@
+/*
+ * MDOS Filesystem Library - Sparse DSK Images
+ * Copyright (C) 2025
+ *
+ * Leave the unused parts of a DSK as filesystem holes instead of zeros
+ */
+
+#ifndef MDOS_SPARSE_H
+#define MDOS_SPARSE_H
+
+#include <stdio.h>
+#include "mdos_fs.h"
+
+/* Sparse flags */
+#define MDOS_SPARSE_FREE 1  /* Also drop clusters the CAT marks free */
+
+/*
+ * Write a linear image to fp from offset 0, seeking over all-zero 128-byte
+ * sectors so the filesystem can leave holes. With MDOS_SPARSE_FREE, clusters
+ * the image's own CAT (sector 1) marks free are skipped whatever they hold,
+ * which drops the data of deleted files; the system area is always kept.
+ * The file ends up exactly length bytes long. Returns the number of bytes
+ * skipped, or MDOS_EIO.
+ */
+long mdos_sparse_write(FILE *fp, const uint8_t *image, long length, int flags);
+
+/*
+ * Read length bytes from offset 0 of fp into buf. Holes are found with
+ * SEEK_DATA/SEEK_HOLE and zero-filled without reading them; where those are
+ * unsupported the whole range is read. Returns the bytes actually read from
+ * data extents, or MDOS_EIO.
+ */
+long mdos_sparse_read(FILE *fp, uint8_t *buf, long length);
+
+/* Non-zero if [offset, offset + length) of fp lies entirely in a hole */
+int mdos_sparse_is_hole(FILE *fp, long offset, long length);
+
+/*
+ * Turn the zero sectors of an existing DSK (and, with MDOS_SPARSE_FREE, its
+ * free clusters) into holes in place with fallocate(FALLOC_FL_PUNCH_HOLE).
+ * The file size is unchanged. Returns the number of bytes punched,
+ * MDOS_EINVAL where punching holes is unsupported, or another error.
+ */
+long mdos_punch_holes(const char *dsk_path, int flags);
+
+#endif /* MDOS_SPARSE_H */
@@ -0,0 +1,11 @@
+/*
+ * MDOS Filesystem Library - Hot-Path Counters
+ * Copyright (C) 2025
+ *
+ * The library's one copy of the counter list and the phase table
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* clock_gettime */
+
+#define MDOS_STATS_IMPLEMENTATION
+#include "mdos_stats.h"
@@ -0,0 +1,220 @@
+/*
+ * MDOS Filesystem Library - Hot-Path Counters
+ * Copyright (C) 2025
+ *
+ * Counters for sector I/O, caches, codecs and segment walks, plus wall and
+ * CPU time per phase. Header only, like mdos_checksum.h, so the standalone
+ * tools count the same things: exactly one file of a program defines
+ * MDOS_STATS_IMPLEMENTATION before including it (mdos_stats.c for the
+ * library). Compiled in by default; build with -DMDOS_NO_STATS to make
+ * MDOS_STAT_ADD expand to nothing.
+ */
+
+#ifndef MDOS_STATS_H
+#define MDOS_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum {
+    MDOS_STAT_SECTORS_READ,     /* 128-byte sectors read through an image stream */
+    MDOS_STAT_SECTORS_WRITTEN,  /* ... and written */
+    MDOS_STAT_CACHE_HITS,       /* IMD tracks and .mdz blocks found decoded */
+    MDOS_STAT_CACHE_MISSES,     /* ... and ones that had to be read and decoded */
+    MDOS_STAT_BYTES_DECODED,    /* Sector data decoded from IMD and .mdz records, text decoded */
+    MDOS_STAT_BYTES_ENCODED,    /* Sector data encoded into IMD and .mdz records */
+    MDOS_STAT_SYSCALLS,         /* Reads, writes and seeks issued on image files */
+    MDOS_STAT_SDWS,             /* Segment descriptors walked */
+    MDOS_STAT_COUNT
+} mdos_stat_t;
+
+#if defined(__GNUC__) && !defined(MDOS_NO_STATS)
+#define MDOS_STATS_ENABLED 1
+#endif
+
+#define MDOS_STATS_MAX_PHASES 16
+
+/* mdos_stats_option results */
+#define MDOS_STATS_TEXT 1
+#define MDOS_STATS_JSON 2
+
+/*
+ * Each thread counts into its own block, so counting is a plain add with
+ * no lock and no shared cache line. Blocks are pushed on a global list the
+ * first time a thread counts and never removed, so the counts of threads
+ * that have exited still add up.
+ */
+typedef struct mdos_stats_block {
+    uint64_t count[MDOS_STAT_COUNT];
+    struct mdos_stats_block *next;
+} mdos_stats_block_t;
+
+#ifdef MDOS_STATS_ENABLED
+extern __thread mdos_stats_block_t *mdos_stats_self;
+mdos_stats_block_t* mdos_stats_attach(void);
+
+/* Only this thread writes its block; the relaxed store lets others read it */
+static inline void mdos_stats_add(mdos_stat_t id, uint64_t n) {
+    mdos_stats_block_t *b = mdos_stats_self ? mdos_stats_self : mdos_stats_attach();
+    __atomic_store_n(&b->count[id], b->count[id] + n, __ATOMIC_RELAXED);
+}
+#define MDOS_STAT_ADD(id, n) mdos_stats_add((id), (uint64_t)(n))
+#else
+#define MDOS_STAT_ADD(id, n) ((void)0)
+#endif
+
+/* The counters of every thread, summed */
+void mdos_stats_total(uint64_t total[MDOS_STAT_COUNT]);
+
+/*
+ * End the current phase and start one called name (NULL: none). Phases
+ * with the same name add up. Call from the main thread only.
+ */
+void mdos_stats_phase(const char *name);
+
+/* End the current phase and print counters and phase times, as text or JSON */
+void mdos_stats_print(FILE *out, int format);
+
+/* MDOS_STATS_TEXT for "--stats" or "--stats=text", MDOS_STATS_JSON for "--stats=json", else 0 */
+int mdos_stats_option(const char *arg);
+
+#ifdef MDOS_STATS_IMPLEMENTATION
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char *const mdos_stats_names[MDOS_STAT_COUNT] = {
+    "sectors_read", "sectors_written", "cache_hits", "cache_misses",
+    "bytes_decoded", "bytes_encoded", "syscalls", "sdws_walked",
+};
+
+#ifdef MDOS_STATS_ENABLED
+__thread mdos_stats_block_t *mdos_stats_self;
+static mdos_stats_block_t *mdos_stats_blocks;
+
+mdos_stats_block_t* mdos_stats_attach(void) {
+    static mdos_stats_block_t dropped;  /* Out of memory: count into the void */
+    mdos_stats_block_t *b = calloc(1, sizeof(*b));
+    if (!b) {
+        mdos_stats_self = &dropped;
+        return &dropped;
+    }
+    b->next = __atomic_load_n(&mdos_stats_blocks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&mdos_stats_blocks, &b->next, b, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    mdos_stats_self = b;
+    return b;
+}
+#endif
+
+void mdos_stats_total(uint64_t total[MDOS_STAT_COUNT]) {
+    memset(total, 0, MDOS_STAT_COUNT * sizeof(uint64_t));
+#ifdef MDOS_STATS_ENABLED
+    for (mdos_stats_block_t *b = __atomic_load_n(&mdos_stats_blocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+        for (int i = 0; i < MDOS_STAT_COUNT; i++) {
+            total[i] += __atomic_load_n(&b->count[i], __ATOMIC_RELAXED);
+        }
+    }
+#endif
+}
+
+/* Milliseconds of wall (monotonic) or process CPU time */
+static double mdos_stats_clock(int cpu) {
+#if defined(CLOCK_MONOTONIC) && defined(CLOCK_PROCESS_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(cpu ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_MONOTONIC, &ts) == 0) {
+        return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+    }
+#endif
+    (void)cpu;
+    return (double)clock() * 1e3 / CLOCKS_PER_SEC;
+}
+
+static struct {
+    const char *name;
+    double wall_ms, cpu_ms;
+} mdos_stats_phases[MDOS_STATS_MAX_PHASES];
+static int mdos_stats_nphases;
+static int mdos_stats_current = -1;
+static double mdos_stats_wall0, mdos_stats_cpu0;
+
+void mdos_stats_phase(const char *name) {
+    double wall = mdos_stats_clock(0), cpu = mdos_stats_clock(1);
+    if (mdos_stats_current >= 0) {
+        mdos_stats_phases[mdos_stats_current].wall_ms += wall - mdos_stats_wall0;
+        mdos_stats_phases[mdos_stats_current].cpu_ms += cpu - mdos_stats_cpu0;
+    }
+    mdos_stats_current = -1;
+    mdos_stats_wall0 = wall;
+    mdos_stats_cpu0 = cpu;
+    if (!name) {
+        return;
+    }
+    for (int i = 0; i < mdos_stats_nphases; i++) {
+        if (strcmp(mdos_stats_phases[i].name, name) == 0) {
+            mdos_stats_current = i;
+            return;
+        }
+    }
+    if (mdos_stats_nphases < MDOS_STATS_MAX_PHASES) {
+        mdos_stats_current = mdos_stats_nphases++;
+        mdos_stats_phases[mdos_stats_current].name = name;
+    }
+}
+
+void mdos_stats_print(FILE *out, int format) {
+    uint64_t total[MDOS_STAT_COUNT];
+    mdos_stats_phase(NULL);
+    mdos_stats_total(total);
+    double wall = 0, cpu = 0;
+    for (int i = 0; i < mdos_stats_nphases; i++) {
+        wall += mdos_stats_phases[i].wall_ms;
+        cpu += mdos_stats_phases[i].cpu_ms;
+    }
+
+    if (format == MDOS_STATS_JSON) {
+        fprintf(out, "{\"counters\":{");
+        for (int i = 0; i < MDOS_STAT_COUNT; i++) {
+            fprintf(out, "%s\"%s\":%llu", i ? "," : "", mdos_stats_names[i], (unsigned long long)total[i]);
+        }
+        fprintf(out, "},\"phases\":[");
+        for (int i = 0; i < mdos_stats_nphases; i++) {
+            fprintf(out, "%s{\"name\":\"%s\",\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", i ? "," : "",
+                    mdos_stats_phases[i].name, mdos_stats_phases[i].wall_ms, mdos_stats_phases[i].cpu_ms);
+        }
+#ifdef MDOS_STATS_ENABLED
+        fprintf(out, "],\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"counting\":true}\n", wall, cpu);
+#else
+        fprintf(out, "],\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"counting\":false}\n", wall, cpu);
+#endif
+        return;
+    }
+
+    fprintf(out, "\nStatistics:\n");
+#ifdef MDOS_STATS_ENABLED
+    for (int i = 0; i < MDOS_STAT_COUNT; i++) {
+        fprintf(out, "  %-18s %12llu\n", mdos_stats_names[i], (unsigned long long)total[i]);
+    }
+#else
+    fprintf(out, "  (counters compiled out with MDOS_NO_STATS)\n");
+#endif
+    fprintf(out, "  %-18s %12s %10s\n", "phase", "wall ms", "cpu ms");
+    for (int i = 0; i < mdos_stats_nphases; i++) {
+        fprintf(out, "  %-18s %12.3f %10.3f\n", mdos_stats_phases[i].name,
+                mdos_stats_phases[i].wall_ms, mdos_stats_phases[i].cpu_ms);
+    }
+    fprintf(out, "  %-18s %12.3f %10.3f\n", "total", wall, cpu);
+}
+
+int mdos_stats_option(const char *arg) {
+    if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0) {
+        return MDOS_STATS_TEXT;
+    }
+    return strcmp(arg, "--stats=json") == 0 ? MDOS_STATS_JSON : 0;
+}
+
+#endif /* MDOS_STATS_IMPLEMENTATION */
+
+#endif /* MDOS_STATS_H */
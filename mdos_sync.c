@@ -0,0 +1,440 @@
+/*
+ * MDOS Filesystem Library - Directory Sync
+ * Copyright (C) 2025
+ *
+ * Incremental host directory to image sync with a host-side hash cache
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* opendir, stat */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "mdos_internal.h"
+#include "mdos_hash.h"
+#include "mdos_sync.h"
+
+/* One host file and what is known about its MDOS form */
+typedef struct {
+    char host_name[256];
+    char host_path[1024];
+    long long mtime;
+    long mtime_nsec;
+    long long host_size;
+    size_t size;                /* Size after conversion */
+    uint64_t hash;
+    int hashed;
+    int loaded;                 /* file.data is valid */
+    mdos_bulk_file_t file;
+} sync_item_t;
+
+/* A changed file that fits its current extents */
+typedef struct {
+    sync_item_t *item;
+    int rib_sector;
+    mdos_rib_t rib;
+    uint8_t *old_data;
+} sync_rewrite_t;
+
+static int compare_items(const void *a, const void *b) {
+    return strcmp(((const sync_item_t *)a)->host_name, ((const sync_item_t *)b)->host_name);
+}
+
+static int sync_scan_dir(const char *local_dir, sync_item_t **items, int *count) {
+    DIR *dir = opendir(local_dir);
+    if (!dir) {
+        return MDOS_ENOENT;
+    }
+
+    sync_item_t *list = NULL;
+    int n = 0, capacity = 0;
+    struct dirent *de;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue; /* Hidden files, including the cache */
+        }
+
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", local_dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        if (n == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 64;
+            sync_item_t *grown = realloc(list, new_capacity * sizeof(*list));
+            if (!grown) {
+                free(list);
+                closedir(dir);
+                return MDOS_ENOSPC;
+            }
+            list = grown;
+            capacity = new_capacity;
+        }
+
+        sync_item_t *item = &list[n++];
+        memset(item, 0, sizeof(*item));
+        snprintf(item->host_name, sizeof(item->host_name), "%s", de->d_name);
+        snprintf(item->host_path, sizeof(item->host_path), "%s", path);
+        item->mtime = (long long)st.st_mtim.tv_sec;
+        item->mtime_nsec = st.st_mtim.tv_nsec;
+        item->host_size = (long long)st.st_size;
+    }
+    closedir(dir);
+
+    if (n > 1) {
+        qsort(list, n, sizeof(*list), compare_items);
+    }
+    *items = list;
+    *count = n;
+    return MDOS_EOK;
+}
+
+/*
+ * Cache lines are "mtime.nsec host_size size hash name"; an entry is reused
+ * only while the host file's mtime, to the nanosecond, and size are
+ * unchanged. Lines without the nanoseconds, from older caches, never match.
+ */
+static void sync_load_cache(const char *local_dir, sync_item_t *items, int count) {
+    char path[1024], line[512];
+    snprintf(path, sizeof(path), "%s/%s", local_dir, MDOS_SYNC_CACHE);
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        long long mtime, host_size;
+        long mtime_nsec;
+        size_t size;
+        uint64_t hash;
+        int name_pos;
+
+        if (line[0] == '#' ||
+            sscanf(line, "%lld.%ld %lld %zu %" SCNx64 " %n",
+                   &mtime, &mtime_nsec, &host_size, &size, &hash, &name_pos) != 5) {
+            continue;
+        }
+        char *name = line + name_pos;
+        name[strcspn(name, "\n")] = '\0';
+
+        sync_item_t key;
+        snprintf(key.host_name, sizeof(key.host_name), "%s", name);
+        sync_item_t *item = bsearch(&key, items, count, sizeof(*items), compare_items);
+        if (item && item->mtime == mtime && item->mtime_nsec == mtime_nsec &&
+            item->host_size == host_size) {
+            item->size = size;
+            item->hash = hash;
+            item->hashed = 1;
+        }
+    }
+    fclose(fp);
+}
+
+static void sync_save_cache(const char *local_dir, const sync_item_t *items, int count) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", local_dir, MDOS_SYNC_CACHE);
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        return; /* The cache is only an optimisation */
+    }
+
+    fprintf(fp, "# mdostool sync cache: mtime.nsec host_size size hash name\n");
+    for (int i = 0; i < count; i++) {
+        if (items[i].hashed) {
+            fprintf(fp, "%lld.%09ld %lld %zu %016" PRIx64 " %s\n", items[i].mtime, items[i].mtime_nsec,
+                    items[i].host_size, items[i].size, items[i].hash, items[i].host_name);
+        }
+    }
+    fclose(fp);
+}
+
+static int sync_load_item(sync_item_t *item) {
+    if (item->loaded) {
+        return MDOS_EOK;
+    }
+
+    char name[MDOS_MAX_FILENAME];
+    memcpy(name, item->file.name, sizeof(name));
+
+    int result = mdos_bulk_load_file(item->host_path, name, &item->file);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+
+    item->loaded = 1;
+    item->size = item->file.size;
+    item->hash = mdos_hash64(item->file.data, item->file.size);
+    item->hashed = 1;
+    return MDOS_EOK;
+}
+
+/* Data sectors the RIB's extents can hold (the RIB takes one) */
+static int sync_capacity(const mdos_rib_t *rib) {
+    int sectors = 0;
+
+    for (int x = 0; x < 114; x += 2) {
+        int sdw = (rib->sdw[x] << 8) | rib->sdw[x + 1];
+        if (sdw & 0x8000) {
+            break;
+        }
+        sectors += (((sdw >> 10) & 0x1F) + 1) * 4;
+    }
+    return sectors - 1;
+}
+
+/*
+ * Rewrite a file within its extents; returns the number of sectors written.
+ * A file that shrank gives back the clusters it no longer needs and has the
+ * stale sectors left in its last cluster zeroed.
+ */
+static int sync_rewrite(mdos_fs_t *fs, mdos_meta_t *meta, sync_rewrite_t *rw) {
+    mdos_bulk_file_t *f = &rw->item->file;
+    mdos_rib_t *rib = &rw->rib;
+    int old_sects = (rib->size_high << 8) | rib->size_low;
+    int sects = (f->size + MDOS_SECTOR_SIZE - 1) / MDOS_SECTOR_SIZE;
+    int keep = (sects + 1 + 3) / 4; /* Clusters for the RIB and the data */
+    uint8_t buffer[MDOS_SECTOR_SIZE];
+    int written = 0;
+
+    for (int lsn = 1; lsn <= old_sects && lsn < keep * 4; lsn++) {
+        memset(buffer, 0, sizeof(buffer));
+        if (lsn <= sects) {
+            size_t offset = (size_t)(lsn - 1) * MDOS_SECTOR_SIZE;
+            size_t chunk = f->size - offset;
+            if (chunk > MDOS_SECTOR_SIZE) chunk = MDOS_SECTOR_SIZE;
+            memcpy(buffer, f->data + offset, chunk);
+        }
+
+        if (memcmp(buffer, rw->old_data + (size_t)(lsn - 1) * MDOS_SECTOR_SIZE, MDOS_SECTOR_SIZE) == 0) {
+            continue; /* Sector already holds these bytes */
+        }
+        mdos_putsect(fs, buffer, mdos_lsn_to_psn(rib, lsn));
+        written++;
+    }
+    for (int lsn = old_sects + 1; lsn <= sects; lsn++) {
+        size_t offset = (size_t)(lsn - 1) * MDOS_SECTOR_SIZE;
+        size_t chunk = f->size - offset;
+        if (chunk > MDOS_SECTOR_SIZE) chunk = MDOS_SECTOR_SIZE;
+
+        memset(buffer, 0, sizeof(buffer));
+        memcpy(buffer, f->data + offset, chunk);
+        mdos_putsect(fs, buffer, mdos_lsn_to_psn(rib, lsn));
+        written++;
+    }
+
+    /* New length: trimmed extents, SDW end marker, size and last sector bytes */
+    mdos_rib_t new_rib = *rib;
+    int x = 0, left = keep;
+    for (; x < 114; x += 2) {
+        int sdw = (rib->sdw[x] << 8) | rib->sdw[x + 1];
+        if ((sdw & 0x8000) || left == 0) {
+            break;
+        }
+        int count = ((sdw >> 10) & 0x1F) + 1;
+        if (count > left) {
+            int cluster = sdw & 0x3FF;
+            for (int c = cluster + left; c < cluster + count && c < MDOS_CAT_CLUSTERS; c++) {
+                meta->cat[c >> 3] &= ~(1 << (7 - (c & 7)));
+            }
+            new_rib.sdw[x] = (uint8_t)((((left - 1) << 10) | cluster) >> 8);
+            new_rib.sdw[x + 1] = cluster & 0xFF;
+            meta->cat_dirty = 1;
+            count = left;
+        }
+        left -= count;
+    }
+    if (x < 114) {
+        /* Extents past the new end go back to the CAT */
+        mdos_rib_t tail;
+        memset(&tail, 0, sizeof(tail));
+        memcpy(tail.sdw, rib->sdw + x, 114 - x);
+        if (!(tail.sdw[0] & 0x80)) {
+            mdos_cat_release(meta->cat, &tail);
+            meta->cat_dirty = 1;
+        }
+
+        memset(new_rib.sdw + x, 0, 114 - x);
+        new_rib.sdw[x] = 0x80 | ((sects >> 8) & 0x7F);
+        new_rib.sdw[x + 1] = sects & 0xFF;
+    }
+
+    int last = f->size % MDOS_SECTOR_SIZE;
+    new_rib.last_size = last ? last : MDOS_SECTOR_SIZE;
+    new_rib.size_high = (sects >> 8) & 0xFF;
+    new_rib.size_low = sects & 0xFF;
+
+    if (memcmp(&new_rib, rib, sizeof(new_rib)) != 0) {
+        mdos_putsect(fs, (uint8_t *)&new_rib, rw->rib_sector);
+        written++;
+    }
+    return written;
+}
+
+int mdos_sync_dir(mdos_fs_t *fs, const char *local_dir, int delete_missing,
+                  mdos_sync_stats_t *stats, FILE *log) {
+    if (!fs || !local_dir || !stats) {
+        return MDOS_EINVAL;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    sync_item_t *items = NULL;
+    int count = 0;
+    int result = sync_scan_dir(local_dir, &items, &count);
+    if (result != MDOS_EOK) {
+        return result;
+    }
+
+    mdos_meta_t *meta = malloc(sizeof(mdos_meta_t));
+    mdos_bulk_file_t *bulk = malloc((count ? count : 1) * sizeof(mdos_bulk_file_t));
+    sync_rewrite_t *rewrites = malloc((count ? count : 1) * sizeof(sync_rewrite_t));
+    int *bulk_items = malloc((count ? count : 1) * sizeof(int));
+    int nbulk = 0, nrewrites = 0;
+    uint8_t claimed[MDOS_DIR_ENTRIES] = {0};
+
+    if (!meta || !bulk || !rewrites || !bulk_items) {
+        result = MDOS_ENOSPC;
+        goto out;
+    }
+
+    /* Names first, so clashes are reported before anything is read */
+    for (int i = 0; i < count; i++) {
+        result = mdos_bulk_name(items[i].host_name, NULL, items[i].file.name);
+        if (result != MDOS_EOK) {
+            if (log) fprintf(log, "  %s: no valid MDOS name\n", items[i].host_name);
+            goto out;
+        }
+        for (int j = 0; j < i; j++) {
+            if (strcasecmp(items[i].file.name, items[j].file.name) == 0) {
+                if (log) fprintf(log, "  %s and %s both map to %s\n",
+                                 items[j].host_name, items[i].host_name, items[i].file.name);
+                result = MDOS_EEXIST;
+                goto out;
+            }
+        }
+    }
+
+    sync_load_cache(local_dir, items, count);
+    mdos_meta_load(fs, meta);
+
+    /* Classify every host file against the image */
+    for (int i = 0; i < count; i++) {
+        sync_item_t *item = &items[i];
+        int slot;
+        int rib_sector = mdos_meta_find(meta, item->file.name, &slot);
+
+        if (!item->hashed && (result = sync_load_item(item)) != MDOS_EOK) {
+            goto out;
+        }
+
+        if (rib_sector < 0) {
+            if ((result = sync_load_item(item)) != MDOS_EOK) goto out;
+            if (log) fprintf(log, "  A %-12s %6zu bytes\n", item->file.name, item->size);
+            bulk_items[nbulk] = i;
+            bulk[nbulk++] = item->file;
+            stats->added++;
+            continue;
+        }
+        claimed[slot] = 1;
+
+        sync_rewrite_t *rw = &rewrites[nrewrites];
+        size_t old_size;
+        result = mdos_read_contents(fs, rib_sector, &rw->rib, &rw->old_data, &old_size);
+        if (result != MDOS_EOK) goto out;
+
+        int type = mdos_meta_entry(meta, slot)[12];
+        int host_type = mdos_bulk_host_type(item->host_name);
+
+        if (old_size == item->size && type == host_type &&
+            mdos_hash64(rw->old_data, old_size) == item->hash) {
+            free(rw->old_data);
+            stats->unchanged++;
+            continue;
+        }
+
+        if ((result = sync_load_item(item)) != MDOS_EOK) {
+            free(rw->old_data);
+            goto out;
+        }
+
+        int sects = (item->size + MDOS_SECTOR_SIZE - 1) / MDOS_SECTOR_SIZE;
+        if (type == host_type && sects <= sync_capacity(&rw->rib)) {
+            rw->item = item;
+            rw->rib_sector = rib_sector;
+            nrewrites++;
+            stats->updated++;
+            continue;
+        }
+
+        /* Reallocate, keeping the addresses the image had */
+        item->file.load_addr = (rw->rib.addr_high << 8) | rw->rib.addr_low;
+        item->file.start_addr = (rw->rib.pc_high << 8) | rw->rib.pc_low;
+        free(rw->old_data);
+        if (log) fprintf(log, "  R %-12s %6zu bytes (reallocated)\n", item->file.name, item->size);
+        bulk_items[nbulk] = i;
+        bulk[nbulk++] = item->file;
+        stats->replaced++;
+    }
+
+    if (delete_missing) {
+        for (int slot = 0; slot < MDOS_DIR_ENTRIES; slot++) {
+            uint8_t *entry = mdos_meta_entry(meta, slot);
+            if (claimed[slot] || entry[0] == 0x00 || entry[0] == 0xFF) {
+                continue;
+            }
+
+            char name[MDOS_MAX_FILENAME];
+            mdos_rib_t rib;
+            mdos_meta_entry_name(entry, name);
+            mdos_getsect(fs, (uint8_t *)&rib, (entry[10] << 8) | entry[11]);
+            mdos_cat_release(meta->cat, &rib);
+            mdos_meta_delete_entry(meta, slot);
+            meta->cat_dirty = 1;
+            if (log) fprintf(log, "  D %s\n", name);
+            stats->deleted++;
+        }
+    }
+
+    /* New and outgrown files: one allocation plan; fails before writing */
+    int sectors = mdos_bulk_import_meta(fs, meta, bulk, nbulk);
+    if (sectors < 0) {
+        result = sectors;
+        goto out;
+    }
+    for (int b = 0; b < nbulk; b++) {
+        items[bulk_items[b]].file.rib_sector = bulk[b].rib_sector;
+    }
+
+    for (int r = 0; r < nrewrites; r++) {
+        int written = sync_rewrite(fs, meta, &rewrites[r]);
+        if (log) fprintf(log, "  M %-12s %6zu bytes (in place, %d sectors written)\n",
+                         rewrites[r].item->file.name, rewrites[r].item->size, written);
+        sectors += written;
+    }
+
+    sectors += mdos_meta_commit(fs, meta);
+    stats->bytes_written = (long)sectors * MDOS_SECTOR_SIZE;
+    sync_save_cache(local_dir, items, count);
+
+out:
+    for (int r = 0; r < nrewrites; r++) {
+        free(rewrites[r].old_data);
+    }
+    for (int i = 0; i < count; i++) {
+        if (items[i].loaded) mdos_bulk_free(&items[i].file, 1);
+    }
+    free(bulk_items);
+    free(rewrites);
+    free(bulk);
+    free(meta);
+    free(items);
+    return result;
+}
@@ -0,0 +1,40 @@
+/*
+ * MDOS Filesystem Library - Directory Sync
+ * Copyright (C) 2025
+ *
+ * Push a host directory into an image, rewriting only what changed
+ */
+
+#ifndef MDOS_SYNC_H
+#define MDOS_SYNC_H
+
+#include "mdos_fs.h"
+
+/* Host-side hash cache kept in the synced directory */
+#define MDOS_SYNC_CACHE ".mdossync"
+
+typedef struct {
+    int unchanged;          /* Same size and hash: not touched */
+    int updated;            /* Rewritten within their existing extents */
+    int replaced;           /* Outgrew their extents or changed type */
+    int added;
+    int deleted;
+    long bytes_written;     /* Sectors actually written, in bytes */
+} mdos_sync_stats_t;
+
+/*
+ * Make the image match the regular files of local_dir (hidden files are
+ * skipped). Files are named and converted like mdos_import_file and
+ * compared with the image by size and content hash; host hashes are cached
+ * in local_dir/MDOS_SYNC_CACHE and reused while a file's size and mtime (to
+ * the nanosecond) are unchanged. A changed file that still fits its extents is rewritten in
+ * place, sector by sector, writing only sectors that differ and keeping its
+ * load/start addresses; one that shrank releases its unused clusters.
+ * Everything else goes through one bulk allocation.
+ * With delete_missing, image files without a host counterpart are removed.
+ * The CAT and directory are written once.
+ */
+int mdos_sync_dir(mdos_fs_t *fs, const char *local_dir, int delete_missing,
+                  mdos_sync_stats_t *stats, FILE *log);
+
+#endif /* MDOS_SYNC_H */
@@ -0,0 +1,420 @@
+/*
+ * MDOS Filesystem Library - Tar Streams
+ * Copyright (C) 2025
+ *
+ * POSIX.1-2001 (pax) tar export and import of whole images
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "mdos_internal.h"
+#include "mdos_tar.h"
+
+#define TAR_BLOCK_SIZE   512
+#define TAR_MAX_FILE     (MDOS_CAT_CLUSTERS * 4 * MDOS_SECTOR_SIZE)
+#define TAR_MAX_HEADER   (64 * 1024)    /* pax and GNU long name payloads */
+
+/* ustar header block */
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tar_header_t;
+
+/* Writing */
+
+static void tar_octal(char *field, size_t width, unsigned long value) {
+    snprintf(field, width, "%0*lo", (int)(width - 1), value);
+}
+
+static unsigned int tar_checksum(const tar_header_t *header) {
+    const uint8_t *p = (const uint8_t *)header;
+    unsigned int sum = 0;
+
+    for (size_t i = 0; i < sizeof(*header); i++) {
+        /* The checksum field itself counts as blanks */
+        if (i >= offsetof(tar_header_t, chksum) &&
+            i < offsetof(tar_header_t, chksum) + sizeof(header->chksum)) {
+            sum += ' ';
+        } else {
+            sum += p[i];
+        }
+    }
+    return sum;
+}
+
+/*
+ * Members get mode 0644, no owner and mtime 0: MDOS keeps no timestamps, and
+ * the same image always produces the same tar.
+ */
+static int tar_write_header(FILE *out, const char *name, size_t size, char typeflag) {
+    tar_header_t header;
+
+    memset(&header, 0, sizeof(header));
+    snprintf(header.name, sizeof(header.name), "%s", name);
+    tar_octal(header.mode, sizeof(header.mode), 0644);
+    tar_octal(header.uid, sizeof(header.uid), 0);
+    tar_octal(header.gid, sizeof(header.gid), 0);
+    tar_octal(header.size, sizeof(header.size), size);
+    tar_octal(header.mtime, sizeof(header.mtime), 0);
+    header.typeflag = typeflag;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    snprintf(header.chksum, sizeof(header.chksum), "%06o", tar_checksum(&header));
+    header.chksum[7] = ' ';
+
+    return fwrite(&header, sizeof(header), 1, out) == 1 ? MDOS_EOK : MDOS_EIO;
+}
+
+static int tar_write_data(FILE *out, const void *data, size_t size) {
+    static const uint8_t zeros[TAR_BLOCK_SIZE];
+    size_t pad = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+    if (size && fwrite(data, 1, size, out) != size) return MDOS_EIO;
+    if (pad && fwrite(zeros, 1, pad, out) != pad) return MDOS_EIO;
+    return MDOS_EOK;
+}
+
+/* Append one "<len> key=value\n" record; len counts its own digits */
+static size_t pax_record(char *buf, size_t pos, const char *key, const char *value) {
+    size_t body = strlen(key) + strlen(value) + 3; /* ' ', '=', '\n' */
+    size_t len = body + 1;
+
+    while (len != body + (size_t)snprintf(NULL, 0, "%zu", len)) {
+        len = body + snprintf(NULL, 0, "%zu", len);
+    }
+    return pos + sprintf(buf + pos, "%zu %s=%s\n", len, key, value);
+}
+
+int mdos_export_tar(mdos_fs_t *fs, FILE *out, FILE *log) {
+    if (!fs || !out) {
+        return MDOS_EINVAL;
+    }
+
+    mdos_meta_t *meta = malloc(sizeof(mdos_meta_t));
+    if (!meta) {
+        return MDOS_ENOSPC;
+    }
+    mdos_meta_load(fs, meta);
+
+    int count = 0;
+    int result = MDOS_EOK;
+
+    for (int slot = 0; slot < MDOS_DIR_ENTRIES && result == MDOS_EOK; slot++) {
+        uint8_t *entry = mdos_meta_entry(meta, slot);
+        if (entry[0] == 0x00 || entry[0] == 0xFF) {
+            continue;
+        }
+
+        char name[MDOS_MAX_FILENAME];
+        mdos_meta_entry_name(entry, name);
+
+        mdos_rib_t rib;
+        uint8_t *data;
+        size_t size;
+        result = mdos_read_contents(fs, (entry[10] << 8) | entry[11], &rib, &data, &size);
+        if (result != MDOS_EOK) {
+            break;
+        }
+
+        char pax[TAR_BLOCK_SIZE], value[8], pax_name[100];
+        size_t pax_len = 0;
+        snprintf(value, sizeof(value), "%04X", (rib.addr_high << 8) | rib.addr_low);
+        pax_len = pax_record(pax, pax_len, MDOS_PAX_LOAD, value);
+        snprintf(value, sizeof(value), "%04X", (rib.pc_high << 8) | rib.pc_low);
+        pax_len = pax_record(pax, pax_len, MDOS_PAX_START, value);
+        snprintf(value, sizeof(value), "%04X", (entry[12] << 8) | entry[13]);
+        pax_len = pax_record(pax, pax_len, MDOS_PAX_ATTR, value);
+        snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%s", name);
+
+        if ((result = tar_write_header(out, pax_name, pax_len, 'x')) == MDOS_EOK &&
+            (result = tar_write_data(out, pax, pax_len)) == MDOS_EOK &&
+            (result = tar_write_header(out, name, size, '0')) == MDOS_EOK) {
+            result = tar_write_data(out, data, size);
+        }
+        free(data);
+
+        if (result == MDOS_EOK) {
+            if (log) {
+                fprintf(log, "  %-12s %6zu bytes  load=%04X start=%04X attr=%02X%02X\n",
+                        name, size, (rib.addr_high << 8) | rib.addr_low,
+                        (rib.pc_high << 8) | rib.pc_low, entry[12], entry[13]);
+            }
+            count++;
+        }
+    }
+
+    free(meta);
+
+    /* End of archive: two zero blocks */
+    if (result == MDOS_EOK) {
+        static const uint8_t zeros[2 * TAR_BLOCK_SIZE];
+        if (fwrite(zeros, 1, sizeof(zeros), out) != sizeof(zeros) || fflush(out) != 0) {
+            result = MDOS_EIO;
+        }
+    }
+
+    return (result == MDOS_EOK) ? count : result;
+}
+
+/* Reading */
+
+/* Member metadata gathered from pax and GNU long name headers */
+typedef struct {
+    char path[256];
+    long load;
+    long start;
+    long attr;
+} tar_pending_t;
+
+static unsigned long tar_parse_octal(const char *field, size_t width) {
+    unsigned long value = 0;
+
+    for (size_t i = 0; i < width && field[i]; i++) {
+        if (field[i] >= '0' && field[i] <= '7') {
+            value = value * 8 + (field[i] - '0');
+        } else if (field[i] != ' ') {
+            break;
+        }
+    }
+    return value;
+}
+
+/* Read a member's payload (and its padding); data may be NULL to skip it */
+static int tar_read_data(FILE *in, uint8_t *data, size_t size) {
+    uint8_t block[TAR_BLOCK_SIZE];
+
+    for (size_t done = 0; done < size; done += TAR_BLOCK_SIZE) {
+        if (fread(block, 1, TAR_BLOCK_SIZE, in) != TAR_BLOCK_SIZE) {
+            return MDOS_EIO;
+        }
+        if (data) {
+            size_t chunk = size - done;
+            memcpy(data + done, block, chunk < TAR_BLOCK_SIZE ? chunk : TAR_BLOCK_SIZE);
+        }
+    }
+    return MDOS_EOK;
+}
+
+/* A record's key is this metadata keyword, current or pre-xattr */
+static int pax_key_is(const char *key, size_t key_len, const char *keyword, const char *legacy) {
+    return (key_len == strlen(keyword) && strncmp(key, keyword, key_len) == 0) ||
+           (key_len == strlen(legacy) && strncmp(key, legacy, key_len) == 0);
+}
+
+/* buf holds len bytes of records followed by a NUL */
+static void pax_parse(const char *buf, size_t len, tar_pending_t *pending) {
+    size_t pos = 0;
+
+    while (pos < len) {
+        const char *record = buf + pos;
+        char *end;
+        long rec_len = strtol(record, &end, 10);
+        if (rec_len <= 0 || (size_t)rec_len > len - pos) {
+            return; /* Malformed; keep what was parsed */
+        }
+
+        /* "<len> key=value\n": the newline ends the record, the key starts after the space */
+        const char *last = record + rec_len - 1;
+        if (*last != '\n' || end >= last || *end != ' ') {
+            return;
+        }
+        const char *key = end + 1;
+        const char *eq = memchr(key, '=', last - key);
+        if (!eq) {
+            return;
+        }
+
+        size_t key_len = eq - key;
+        size_t value_len = last - (eq + 1);
+        char value[256];
+
+        if (value_len >= sizeof(value)) value_len = sizeof(value) - 1;
+        memcpy(value, eq + 1, value_len);
+        value[value_len] = '\0';
+
+        if (key_len == 4 && strncmp(key, "path", 4) == 0) {
+            strcpy(pending->path, value);
+        } else if (pax_key_is(key, key_len, MDOS_PAX_LOAD, MDOS_PAX_LEGACY_LOAD)) {
+            pending->load = strtol(value, NULL, 16);
+        } else if (pax_key_is(key, key_len, MDOS_PAX_START, MDOS_PAX_LEGACY_START)) {
+            pending->start = strtol(value, NULL, 16);
+        } else if (pax_key_is(key, key_len, MDOS_PAX_ATTR, MDOS_PAX_LEGACY_ATTR)) {
+            pending->attr = strtol(value, NULL, 16);
+        }
+        pos += rec_len;
+    }
+}
+
+static void pending_reset(tar_pending_t *pending) {
+    pending->path[0] = '\0';
+    pending->load = -1;
+    pending->start = -1;
+    pending->attr = -1;
+}
+
+/* Turn a regular member into a bulk entry; takes ownership of data */
+static int tar_make_file(const tar_pending_t *pending, const char *path,
+                         uint8_t *data, size_t size, mdos_bulk_file_t *file) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    memset(file, 0, sizeof(*file));
+
+    int result = mdos_bulk_name(base, NULL, file->name);
+    if (result != MDOS_EOK) {
+        free(data);
+        return result;
+    }
+
+    if (pending->attr >= 0) {
+        /* Exported by mdos_export_tar: already in MDOS form */
+        file->type = (pending->attr >> 8) & 0xFF;
+        file->buffer = data;
+        file->data = data;
+        file->size = size;
+    } else {
+        result = mdos_bulk_set_host_data(file, base, data, size);
+        if (result != MDOS_EOK) {
+            return result;
+        }
+    }
+
+    if (pending->load >= 0) file->load_addr = pending->load;
+    if (pending->start >= 0) file->start_addr = pending->start;
+    return MDOS_EOK;
+}
+
+int mdos_import_tar(mdos_fs_t *fs, FILE *in, FILE *log) {
+    if (!fs || !in) {
+        return MDOS_EINVAL;
+    }
+
+    mdos_bulk_file_t *files = NULL;
+    int count = 0, capacity = 0;
+    int result = MDOS_EOK;
+    tar_pending_t pending;
+    tar_header_t header;
+
+    pending_reset(&pending);
+
+    for (;;) {
+        if (fread(&header, sizeof(header), 1, in) != 1) {
+            result = MDOS_EIO; /* Truncated: no end-of-archive blocks */
+            break;
+        }
+
+        static const tar_header_t zero_header;
+        if (memcmp(&header, &zero_header, sizeof(header)) == 0) {
+            break; /* End of archive */
+        }
+        if (tar_parse_octal(header.chksum, sizeof(header.chksum)) != tar_checksum(&header)) {
+            result = MDOS_EIO;
+            break;
+        }
+
+        size_t size = tar_parse_octal(header.size, sizeof(header.size));
+
+        if (header.typeflag == 'x' || header.typeflag == 'L') {
+            if (size > TAR_MAX_HEADER) {
+                result = MDOS_EIO; /* No name or metadata of ours is this long */
+                break;
+            }
+            char *buf = malloc(size + 1);
+            if (!buf) {
+                result = MDOS_ENOSPC;
+                break;
+            }
+            result = tar_read_data(in, (uint8_t *)buf, size);
+            if (result == MDOS_EOK) {
+                buf[size] = '\0';
+                if (header.typeflag == 'x') {
+                    pax_parse(buf, size, &pending);
+                } else {
+                    strncpy(pending.path, buf, sizeof(pending.path) - 1);
+                }
+            }
+            free(buf);
+            if (result != MDOS_EOK) break;
+            continue;
+        }
+
+        if (header.typeflag != '0' && header.typeflag != '\0' && header.typeflag != '7') {
+            /* Directories, links, global headers: nothing to import */
+            result = tar_read_data(in, NULL, size);
+            if (result != MDOS_EOK) break;
+            pending_reset(&pending);
+            continue;
+        }
+
+        char path[256 + 2];
+        if (pending.path[0]) {
+            strcpy(path, pending.path);
+        } else if (header.prefix[0]) {
+            snprintf(path, sizeof(path), "%.155s/%.100s", header.prefix, header.name);
+        } else {
+            snprintf(path, sizeof(path), "%.100s", header.name);
+        }
+
+        if (size > TAR_MAX_FILE) {
+            result = MDOS_ENOSPC;
+            break;
+        }
+        uint8_t *data = malloc(size ? size : 1);
+        if (!data) {
+            result = MDOS_ENOSPC;
+            break;
+        }
+        result = tar_read_data(in, data, size);
+        if (result != MDOS_EOK) {
+            free(data);
+            break;
+        }
+
+        if (count == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 32;
+            mdos_bulk_file_t *grown = realloc(files, new_capacity * sizeof(*files));
+            if (!grown) {
+                free(data);
+                result = MDOS_ENOSPC;
+                break;
+            }
+            files = grown;
+            capacity = new_capacity;
+        }
+
+        result = tar_make_file(&pending, path, data, size, &files[count]);
+        pending_reset(&pending);
+        if (result != MDOS_EOK) break;
+
+        if (log) {
+            fprintf(log, "  %-24s -> %-12s %6zu bytes\n", path, files[count].name, files[count].size);
+        }
+        count++;
+    }
+
+    if (result == MDOS_EOK) {
+        result = mdos_bulk_import(fs, files, count);
+    }
+
+    mdos_bulk_free(files, count);
+    free(files);
+    return (result == MDOS_EOK) ? count : result;
+}
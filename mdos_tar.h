@@ -0,0 +1,46 @@
+/*
+ * MDOS Filesystem Library - Tar Streams
+ * Copyright (C) 2025
+ *
+ * Export a whole image to a single POSIX (pax) tar stream, and import one
+ * back with a single allocation pass and metadata commit
+ */
+
+#ifndef MDOS_TAR_H
+#define MDOS_TAR_H
+
+#include "mdos_fs.h"
+
+/*
+ * pax keywords carrying the MDOS metadata of each member, as hex:
+ *   SCHILY.xattr.user.mdos.load   RIB load address
+ *   SCHILY.xattr.user.mdos.start  RIB start address
+ *   SCHILY.xattr.user.mdos.attr   directory attribute bytes 12-13
+ * They use the extended attribute namespace so that other tars accept
+ * them silently (GNU tar --xattrs restores them as user.mdos.*).
+ * Archives with the earlier MDOS.* keywords are still read.
+ */
+#define MDOS_PAX_LOAD   "SCHILY.xattr.user.mdos.load"
+#define MDOS_PAX_START  "SCHILY.xattr.user.mdos.start"
+#define MDOS_PAX_ATTR   "SCHILY.xattr.user.mdos.attr"
+#define MDOS_PAX_LEGACY_LOAD   "MDOS.load"
+#define MDOS_PAX_LEGACY_START  "MDOS.start"
+#define MDOS_PAX_LEGACY_ATTR   "MDOS.attr"
+
+/*
+ * Write every file of the image to out, in directory order, as raw MDOS
+ * contents with a pax header per file. Progress goes to log (may be NULL).
+ * Returns the number of files written or a negative error code.
+ */
+int mdos_export_tar(mdos_fs_t *fs, FILE *out, FILE *log);
+
+/*
+ * Import every regular file of the tar stream in using mdos_bulk_import.
+ * Members with MDOS.attr are stored as-is; others are named, typed and
+ * converted like mdos_import_file. Directory components are dropped.
+ * Returns the number of files imported or a negative error code; on error
+ * the image is left unmodified.
+ */
+int mdos_import_tar(mdos_fs_t *fs, FILE *in, FILE *log);
+
+#endif /* MDOS_TAR_H */
@@ -0,0 +1,11 @@
+/*
+ * MDOS Filesystem Library - Timeline Tracing
+ * Copyright (C) 2025
+ *
+ * The library's one copy of the event ring and the trace writer
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* clock_gettime */
+
+#define MDOS_TRACE_IMPLEMENTATION
+#include "mdos_trace.h"
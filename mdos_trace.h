@@ -0,0 +1,251 @@
+/*
+ * MDOS Filesystem Library - Timeline Tracing
+ * Copyright (C) 2025
+ *
+ * Spans (phase, image, file) recorded per thread into a lock-free ring and
+ * written at exit in the Chrome trace event format, for Perfetto or
+ * about:tracing. Header only, like mdos_stats.h: exactly one file of a
+ * program defines MDOS_TRACE_IMPLEMENTATION before including it
+ * (mdos_trace.c for the library). Until mdos_trace_start is called a span
+ * costs one load and a branch.
+ */
+
+#ifndef MDOS_TRACE_H
+#define MDOS_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && !defined(MDOS_NO_TRACE)
+#define MDOS_TRACE_ENABLED 1
+#endif
+
+#define MDOS_TRACE_EVENTS  65536    /* Ring size; the oldest events are overwritten */
+#define MDOS_TRACE_DETAIL  48       /* Bytes of a span's detail (image or file name) kept */
+
+typedef struct {
+    const char *name;       /* NULL: tracing was off when the span began */
+    const char *detail;     /* Must stay valid until mdos_trace_end */
+    double start;           /* Microseconds since mdos_trace_start */
+} mdos_trace_span_t;
+
+extern int mdos_trace_on;
+double mdos_trace_now(void);
+
+/*
+ * Begin a span called name (a string literal: it is kept by reference)
+ * with an optional detail, copied when the span ends
+ */
+static inline mdos_trace_span_t mdos_trace_begin(const char *name, const char *detail) {
+    mdos_trace_span_t span = { NULL, detail, 0 };
+    if (mdos_trace_on) {
+        span.name = name;
+        span.start = mdos_trace_now();
+    }
+    return span;
+}
+
+/* Record the span as one complete event on the calling thread */
+void mdos_trace_end(mdos_trace_span_t *span);
+
+/*
+ * Start recording, to be written to path by mdos_trace_finish. process
+ * names the timeline; the calling thread is shown as "main". Returns 0, or
+ * -1 if tracing is compiled out or the ring cannot be allocated.
+ */
+int mdos_trace_start(const char *path, const char *process);
+
+/* End the current phase span on the main thread and begin one called name (NULL: none) */
+void mdos_trace_phase(const char *name);
+
+/* End the current phase, write the trace file and stop recording. Returns 0 or -1. */
+int mdos_trace_finish(void);
+
+/*
+ * "--trace FILE" or "--trace=FILE" at argv[*i]: returns FILE and steps *i
+ * past a separate value, else NULL
+ */
+const char* mdos_trace_option(int argc, char *argv[], int *i);
+
+#ifdef MDOS_TRACE_IMPLEMENTATION
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+    uint64_t seq;           /* Ticket + 1 once the event is complete */
+    const char *name;
+    char detail[MDOS_TRACE_DETAIL];
+    double start, duration;
+    int tid;
+} mdos_trace_event_t;
+
+int mdos_trace_on;
+
+static struct {
+    mdos_trace_event_t *ring;
+    uint64_t head;          /* Tickets handed out */
+    int threads;            /* Thread ids handed out */
+    double epoch;
+    const char *path;
+    const char *process;
+    mdos_trace_span_t phase;
+} mdos_trace;
+
+static double mdos_trace_clock(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+    }
+#endif
+    return (double)clock() * 1e6 / CLOCKS_PER_SEC;
+}
+
+double mdos_trace_now(void) {
+    return mdos_trace_clock() - mdos_trace.epoch;
+}
+
+#ifdef MDOS_TRACE_ENABLED
+static __thread int mdos_trace_tid = -1;
+
+static uint64_t mdos_trace_seq(const mdos_trace_event_t *e) {
+    return __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+}
+
+void mdos_trace_end(mdos_trace_span_t *span) {
+    if (!span->name || !mdos_trace_on) {
+        return;
+    }
+    double end = mdos_trace_now();
+    if (mdos_trace_tid < 0) {
+        mdos_trace_tid = __atomic_fetch_add(&mdos_trace.threads, 1, __ATOMIC_RELAXED);
+    }
+
+    /* A ticket picks the slot; seq tells the writer a complete event from a torn one */
+    uint64_t ticket = __atomic_fetch_add(&mdos_trace.head, 1, __ATOMIC_RELAXED);
+    mdos_trace_event_t *e = &mdos_trace.ring[ticket % MDOS_TRACE_EVENTS];
+    __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+    e->name = span->name;
+    e->detail[0] = '\0';
+    if (span->detail) {
+        strncat(e->detail, span->detail, MDOS_TRACE_DETAIL - 1);
+    }
+    e->start = span->start;
+    e->duration = end - span->start;
+    e->tid = mdos_trace_tid;
+    __atomic_store_n(&e->seq, ticket + 1, __ATOMIC_RELEASE);
+    span->name = NULL;
+}
+
+int mdos_trace_start(const char *path, const char *process) {
+    mdos_trace.ring = calloc(MDOS_TRACE_EVENTS, sizeof(mdos_trace_event_t));
+    if (!mdos_trace.ring) {
+        return -1;
+    }
+    mdos_trace.path = path;
+    mdos_trace.process = process;
+    mdos_trace.epoch = mdos_trace_clock();
+    mdos_trace_tid = mdos_trace.threads++;
+    mdos_trace_on = 1;
+    return 0;
+}
+#else
+static uint64_t mdos_trace_seq(const mdos_trace_event_t *e) {
+    return e->seq;
+}
+
+void mdos_trace_end(mdos_trace_span_t *span) {
+    span->name = NULL;
+}
+
+int mdos_trace_start(const char *path, const char *process) {
+    (void)path;
+    (void)process;
+    return -1;
+}
+#endif
+
+void mdos_trace_phase(const char *name) {
+    mdos_trace_end(&mdos_trace.phase);
+    mdos_trace.phase = mdos_trace_begin(name, NULL);
+}
+
+/* A JSON string without the quotes */
+static void mdos_trace_string(FILE *out, const char *s) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7F) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+}
+
+int mdos_trace_finish(void) {
+    if (!mdos_trace_on) {
+        return 0;
+    }
+    mdos_trace_phase(NULL);
+    mdos_trace_on = 0;
+
+    FILE *out = fopen(mdos_trace.path, "w");
+    if (!out) {
+        return -1;
+    }
+    fprintf(out, "{\"traceEvents\":[\n");
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"");
+    mdos_trace_string(out, mdos_trace.process ? mdos_trace.process : "mdos");
+    fprintf(out, "\"}}");
+    for (int t = 0; t < mdos_trace.threads; t++) {
+        fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", t);
+        if (t) {
+            fprintf(out, "worker %d\"}}", t);
+        } else {
+            fprintf(out, "main\"}}");
+        }
+    }
+
+    uint64_t head = mdos_trace.head;
+    uint64_t first = head > MDOS_TRACE_EVENTS ? head - MDOS_TRACE_EVENTS : 0;
+    long written = 0;
+    for (uint64_t ticket = first; ticket < head; ticket++) {
+        const mdos_trace_event_t *e = &mdos_trace.ring[ticket % MDOS_TRACE_EVENTS];
+        if (mdos_trace_seq(e) != ticket + 1) {
+            continue;   /* Still being written by a thread that outlived main */
+        }
+        fprintf(out, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                e->name, e->tid, e->start, e->duration);
+        if (e->detail[0]) {
+            fprintf(out, ",\"args\":{\"detail\":\"");
+            mdos_trace_string(out, e->detail);
+            fprintf(out, "\"}");
+        }
+        fprintf(out, "}");
+        written++;
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"events\":%ld,\"dropped\":%llu}}\n",
+            written, (unsigned long long)first);
+
+    free(mdos_trace.ring);
+    mdos_trace.ring = NULL;
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+const char* mdos_trace_option(int argc, char *argv[], int *i) {
+    if (strncmp(argv[*i], "--trace=", 8) == 0) {
+        return argv[*i] + 8;
+    }
+    if (strcmp(argv[*i], "--trace") == 0 && *i + 1 < argc) {
+        return argv[++*i];
+    }
+    return NULL;
+}
+
+#endif /* MDOS_TRACE_IMPLEMENTATION */
+
+#endif /* MDOS_TRACE_H */
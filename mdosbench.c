@@ -0,0 +1,568 @@
+/*
+ * MDOS Filesystem Benchmark Harness
+ * Copyright (C) 2025
+ *
+ * Times the library's common operations and the extractor end-to-end over
+ * a fixed corpus of generated images, and compares the medians against a
+ * saved baseline. Built and run by "make bench".
+ */
+
+#define _POSIX_C_SOURCE 200809L  /* clock_gettime, dup, fork */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "mdos_fs.h"
+#include "mdos_imd.h"
+
+#define BENCH_MAX_RUNS      1000
+#define BENCH_MAX_RESULTS   32
+#define BENCH_SEED          0x4D444F53ULL   /* "MDOS": the corpus is the same on every run */
+#define BENCH_SMALL_FILES   40
+#define BENCH_TEXT_FILES    10
+#define BENCH_LARGE_SIZE    (64 * 1024)
+#define BENCH_SEEKS         256
+
+typedef struct {
+    const char *name;
+    int ops;                    /* Operations per sample */
+    int n;
+    double sample[BENCH_MAX_RUNS];  /* Microseconds */
+    double median, p90, p99, min, max, mean;
+    double baseline;            /* Baseline median, or < 0 */
+    int regression;
+} bench_result_t;
+
+static bench_result_t results[BENCH_MAX_RESULTS];
+static int nresults;
+static int runs = 25;
+static const char *dir = "bench_corpus";
+
+/* Deterministic corpus contents */
+static uint64_t rng_state = BENCH_SEED;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void corpus_path(char *path, size_t cap, const char *name) {
+    snprintf(path, cap, "%s/%s", dir, name);
+}
+
+static bench_result_t* bench_new(const char *name, int ops) {
+    if (nresults == BENCH_MAX_RESULTS) {
+        return NULL;
+    }
+    bench_result_t *r = &results[nresults++];
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->ops = ops;
+    r->baseline = -1;
+    return r;
+}
+
+static void bench_add(bench_result_t *r, double us) {
+    if (r && r->n < BENCH_MAX_RUNS) {
+        r->sample[r->n++] = us;
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(const double *sorted, int n, double p) {
+    double exact = p / 100.0 * n;
+    int rank = (int)exact;
+    if (rank < exact) rank++;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void bench_summarize(bench_result_t *r) {
+    if (r->n == 0) {
+        return;
+    }
+    double sorted[BENCH_MAX_RUNS];
+    memcpy(sorted, r->sample, r->n * sizeof(double));
+    qsort(sorted, r->n, sizeof(double), compare_double);
+    r->min = sorted[0];
+    r->max = sorted[r->n - 1];
+    r->median = (r->n % 2) ? sorted[r->n / 2] : (sorted[r->n / 2 - 1] + sorted[r->n / 2]) / 2;
+    r->p90 = percentile(sorted, r->n, 90);
+    r->p99 = percentile(sorted, r->n, 99);
+    double sum = 0;
+    for (int i = 0; i < r->n; i++) sum += sorted[i];
+    r->mean = sum / r->n;
+}
+
+/* Corpus */
+
+/* MDOS text: CR line ends, runs of spaces as 0x80 + count */
+static size_t make_text(uint8_t *out, size_t size) {
+    static const char *const words[] = {
+        "LDAA", "STAA", "JSR", "BRA", "BNE", "LDX", "#$20", "TABLE,X", "LOOP", "START",
+        "RTS", "CMPA", "ORG", "FCB", "FDB", "EQU", "* comment",
+    };
+    size_t n = 0;
+    while (n + 40 < size) {
+        out[n++] = 0x80 | (1 + rng_next() % 8);
+        int count = 1 + rng_next() % 4;
+        for (int w = 0; w < count; w++) {
+            const char *word = words[rng_next() % (sizeof(words) / sizeof(words[0]))];
+            size_t len = strlen(word);
+            memcpy(out + n, word, len);
+            n += len;
+            out[n++] = ' ';
+        }
+        out[n - 1] = '\r';
+    }
+    return n;
+}
+
+static int make_image(const char *name, int sides, int large) {
+    char path[1024];
+    corpus_path(path, sizeof(path), name);
+    int result = mdos_mkfs(path, sides);
+    mdos_fs_t *fs = (result == MDOS_EOK) ? mdos_mount(path, 0) : NULL;
+    if (!fs) {
+        fprintf(stderr, "Error: cannot create %s\n", path);
+        return -1;
+    }
+
+    uint8_t *data = malloc(BENCH_LARGE_SIZE);
+    for (int i = 0; i < BENCH_SMALL_FILES && data && result == MDOS_EOK; i++) {
+        size_t size = 64 + rng_next() % 960;
+        for (size_t b = 0; b < size; b++) data[b] = (uint8_t)rng_next();
+        char file[16];
+        snprintf(file, sizeof(file), "small%02d.bi", i);
+        result = mdos_create_file(fs, file, MDOS_TYPE_USER_DEFINED, data, size);
+    }
+    for (int i = 0; i < BENCH_TEXT_FILES && data && result == MDOS_EOK; i++) {
+        size_t size = make_text(data, 1024 + rng_next() % 6144);
+        char file[16];
+        snprintf(file, sizeof(file), "text%02d.sa", i);
+        result = mdos_create_file(fs, file, MDOS_TYPE_ASCII, data, size);
+    }
+    for (int i = 0; i < large && data && result == MDOS_EOK; i++) {
+        for (size_t b = 0; b < BENCH_LARGE_SIZE; b++) data[b] = (uint8_t)rng_next();
+        char file[16];
+        snprintf(file, sizeof(file), "large%d.bi", i);
+        result = mdos_create_file(fs, file, MDOS_TYPE_IMAGE, data, BENCH_LARGE_SIZE);
+    }
+    free(data);
+    int unmount_result = mdos_unmount(fs);
+    if (!data || result != MDOS_EOK || unmount_result != MDOS_EOK) {
+        fprintf(stderr, "Error: cannot fill %s: %s\n", path,
+                mdos_strerror(result != MDOS_EOK ? result : unmount_result));
+        return -1;
+    }
+
+    char imd[1024];
+    snprintf(imd, sizeof(imd), "%.*s.imd", (int)(strlen(path) - 4), path);
+    if (mdos_convert_dsk_to_imd(path, imd) != MDOS_EOK) {
+        fprintf(stderr, "Error: cannot convert %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int make_corpus(void) {
+    struct stat st;
+    if (stat(dir, &st) != 0 && mkdir(dir, 0755) != 0) {
+        perror(dir);
+        return -1;
+    }
+    rng_state = BENCH_SEED;
+    if (make_image("small.dsk", 1, 0) != 0 || make_image("large.dsk", 2, 3) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Benchmarks */
+
+static void bench_mount(const char *name, const char *image) {
+    char path[1024];
+    corpus_path(path, sizeof(path), image);
+    bench_result_t *r = bench_new(name, 1);
+    for (int i = 0; i <= runs; i++) {
+        double t0 = now_us();
+        mdos_fs_t *fs = mdos_mount_image(path, 1);
+        if (!fs) return;
+        mdos_unmount_image(fs);
+        if (i) bench_add(r, now_us() - t0);     /* Run 0 warms the caches */
+    }
+}
+
+/* ls, stat of every file, and reads, on one read-only mount of image */
+static void bench_reads(const char *image, const char *ls_name, const char *stat_name,
+                        const char *small_name, const char *large_name, const char *seek_name) {
+    char path[1024];
+    corpus_path(path, sizeof(path), image);
+    mdos_fs_t *fs = mdos_mount_image(path, 1);
+    if (!fs) {
+        fprintf(stderr, "Error: cannot mount %s\n", path);
+        return;
+    }
+    mdos_file_info_t *files = NULL;
+    int count = 0;
+    if (mdos_readdir(fs, &files, &count) != MDOS_EOK) {
+        mdos_unmount_image(fs);
+        return;
+    }
+
+    bench_result_t *ls = bench_new(ls_name, 1);
+    bench_result_t *st = bench_new(stat_name, count);
+    bench_result_t *small = bench_new(small_name, BENCH_SMALL_FILES);
+    bench_result_t *large = large_name ? bench_new(large_name, 1) : NULL;
+    bench_result_t *seek = seek_name ? bench_new(seek_name, BENCH_SEEKS) : NULL;
+    uint8_t *buf = malloc(BENCH_LARGE_SIZE + MDOS_SECTOR_SIZE);
+
+    for (int i = 0; i <= runs && buf; i++) {
+        double t0 = now_us();
+        mdos_file_info_t *list = NULL;
+        int n = 0;
+        mdos_readdir(fs, &list, &n);
+        free(list);
+        double t1 = now_us();
+        for (int f = 0; f < count; f++) {
+            mdos_file_info_t info;
+            mdos_stat(fs, files[f].name, &info);
+        }
+        double t2 = now_us();
+        for (int f = 0; f < BENCH_SMALL_FILES; f++) {
+            char name[16];
+            snprintf(name, sizeof(name), "small%02d.bi", f);
+            int fd = mdos_open(fs, name, MDOS_O_RDONLY, 0);
+            if (fd >= 0) {
+                while (mdos_read(fs, fd, buf, MDOS_SECTOR_SIZE * 8) > 0) {
+                }
+                mdos_close(fs, fd);
+            }
+        }
+        double t3 = now_us();
+        if (i) {
+            bench_add(ls, t1 - t0);
+            bench_add(st, t2 - t1);
+            bench_add(small, t3 - t2);
+        }
+
+        if (large) {
+            t0 = now_us();
+            int fd = mdos_open(fs, "large0.bi", MDOS_O_RDONLY, 0);
+            if (fd >= 0) {
+                while (mdos_read(fs, fd, buf, BENCH_LARGE_SIZE) > 0) {
+                }
+                mdos_close(fs, fd);
+            }
+            if (i) bench_add(large, now_us() - t0);
+        }
+        if (seek) {
+            int fd = mdos_open(fs, "large1.bi", MDOS_O_RDONLY, 0);
+            if (fd >= 0) {
+                t0 = now_us();
+                for (int s = 0; s < BENCH_SEEKS; s++) {
+                    mdos_lseek(fs, fd, rng_next() % BENCH_LARGE_SIZE, MDOS_SEEK_SET);
+                    mdos_read(fs, fd, buf, 1);
+                }
+                if (i) bench_add(seek, now_us() - t0);
+                mdos_close(fs, fd);
+            }
+        }
+    }
+    free(buf);
+    free(files);
+    mdos_unmount_image(fs);
+}
+
+/* put of a small and a large file on a scratch copy; the file is removed untimed */
+static void bench_writes(const char *image, const char *small_name, const char *large_name) {
+    char path[1024], work[1024];
+    corpus_path(path, sizeof(path), image);
+    corpus_path(work, sizeof(work), "work.dsk");
+    if (mdos_convert_imd_to_dsk(path, work) != MDOS_EOK) {
+        return;
+    }
+    mdos_fs_t *fs = mdos_mount_image(work, 0);
+    uint8_t *data = malloc(BENCH_LARGE_SIZE);
+    if (!fs || !data) {
+        free(data);
+        if (fs) mdos_unmount_image(fs);
+        return;
+    }
+    for (int b = 0; b < BENCH_LARGE_SIZE; b++) data[b] = (uint8_t)rng_next();
+
+    bench_result_t *small = bench_new(small_name, 1);
+    bench_result_t *large = bench_new(large_name, 1);
+    for (int i = 0; i <= runs; i++) {
+        double t0 = now_us();
+        int result = mdos_create_file(fs, "put.bi", MDOS_TYPE_USER_DEFINED, data, 700);
+        double t1 = now_us();
+        if (result != MDOS_EOK) break;
+        mdos_unlink(fs, "put.bi");
+        double t2 = now_us();
+        result = mdos_create_file(fs, "put.bi", MDOS_TYPE_IMAGE, data, BENCH_LARGE_SIZE);
+        double t3 = now_us();
+        if (result != MDOS_EOK) break;
+        mdos_unlink(fs, "put.bi");
+        if (i) {
+            bench_add(small, t1 - t0);
+            bench_add(large, t3 - t2);
+        }
+    }
+    free(data);
+    mdos_unmount_image(fs);
+    remove(work);
+}
+
+static void bench_convert(void) {
+    char dsk[1024], imd[1024], out_dsk[1024], out_imd[1024];
+    corpus_path(dsk, sizeof(dsk), "large.dsk");
+    corpus_path(imd, sizeof(imd), "large.imd");
+    corpus_path(out_dsk, sizeof(out_dsk), "out.dsk");
+    corpus_path(out_imd, sizeof(out_imd), "out.imd");
+
+    bench_result_t *to_dsk = bench_new("imd2dsk", 1);
+    bench_result_t *to_imd = bench_new("dsk2imd", 1);
+    for (int i = 0; i <= runs; i++) {
+        double t0 = now_us();
+        mdos_convert_imd_to_dsk(imd, out_dsk);
+        double t1 = now_us();
+        mdos_convert_dsk_to_imd(dsk, out_imd);
+        double t2 = now_us();
+        if (i) {
+            bench_add(to_dsk, t1 - t0);
+            bench_add(to_imd, t2 - t1);
+        }
+    }
+    remove(out_dsk);
+    remove(out_imd);
+}
+
+/* mdosextract on the large IMD, as a separate process with its output discarded */
+static void bench_extract(const char *tool) {
+    if (access(tool, X_OK) != 0) {
+        fprintf(stderr, "Skipping mdosextract: %s not found (make mdosextract)\n", tool);
+        return;
+    }
+    char imd[1024], out[1024];
+    corpus_path(imd, sizeof(imd), "large.imd");
+    corpus_path(out, sizeof(out), "extracted");
+
+    bench_result_t *r = bench_new("mdosextract", 1);
+    for (int i = 0; i <= runs; i++) {
+        double t0 = now_us();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, 1);
+            dup2(null, 2);
+            execl(tool, tool, imd, "-o", out, (char *)NULL);
+            _exit(127);
+        }
+        int status = -1;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Error: %s failed on %s\n", tool, imd);
+            nresults--;
+            return;
+        }
+        if (i) bench_add(r, now_us() - t0);
+    }
+}
+
+/* Baseline */
+
+/* The median recorded for name in a saved run, or -1 */
+static double baseline_median(const char *json, const char *name) {
+    char key[128];
+    snprintf(key, sizeof(key), "\"name\":\"%s\"", name);
+    const char *p = strstr(json, key);
+    const char *end = p ? strchr(p, '}') : NULL;
+    const char *m = p ? strstr(p, "\"median\":") : NULL;
+    if (!m || (end && m > end)) {
+        return -1;
+    }
+    return strtod(m + 9, NULL);
+}
+
+static int compare_baseline(const char *path, double threshold) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    char *json = malloc(len + 1);
+    if (!json || fseek(fp, 0, SEEK_SET) != 0 || fread(json, 1, len, fp) != (size_t)len) {
+        fclose(fp);
+        free(json);
+        return -1;
+    }
+    json[len] = '\0';
+    fclose(fp);
+
+    int regressions = 0;
+    for (int i = 0; i < nresults; i++) {
+        bench_result_t *r = &results[i];
+        r->baseline = baseline_median(json, r->name);
+        if (r->baseline > 0 && r->median > r->baseline * (1 + threshold / 100)) {
+            r->regression = 1;
+            regressions++;
+        }
+    }
+    free(json);
+    return regressions;
+}
+
+/* Output */
+
+static void write_json(FILE *out, double threshold, int with_baseline) {
+    fprintf(out, "{\n  \"harness\": \"mdosbench\",\n  \"version\": 1,\n  \"unit\": \"us\",\n");
+    fprintf(out, "  \"runs\": %d,\n  \"seed\": %llu,\n", runs, (unsigned long long)BENCH_SEED);
+    if (with_baseline) {
+        fprintf(out, "  \"threshold_pct\": %.1f,\n", threshold);
+    }
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < nresults; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(out, "    {\"name\":\"%s\",\"ops\":%d,\"n\":%d,\"median\":%.3f,\"p90\":%.3f,"
+                "\"p99\":%.3f,\"min\":%.3f,\"max\":%.3f,\"mean\":%.3f",
+                r->name, r->ops, r->n, r->median, r->p90, r->p99, r->min, r->max, r->mean);
+        if (with_baseline && r->baseline > 0) {
+            fprintf(out, ",\"baseline_median\":%.3f,\"change_pct\":%.1f,\"regression\":%s",
+                    r->baseline, (r->median / r->baseline - 1) * 100, r->regression ? "true" : "false");
+        }
+        fprintf(out, "}%s\n", i + 1 < nresults ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void print_table(int with_baseline) {
+    fprintf(stderr, "%-22s %5s %12s %12s %12s", "benchmark", "ops", "median us", "p90 us", "p99 us");
+    fprintf(stderr, with_baseline ? " %12s %8s\n" : "\n", "baseline", "change");
+    for (int i = 0; i < nresults; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(stderr, "%-22s %5d %12.1f %12.1f %12.1f", r->name, r->ops, r->median, r->p90, r->p99);
+        if (with_baseline && r->baseline > 0) {
+            fprintf(stderr, " %12.1f %+7.1f%%%s", r->baseline, (r->median / r->baseline - 1) * 100,
+                    r->regression ? "  REGRESSION" : "");
+        } else if (with_baseline) {
+            fprintf(stderr, " %12s", "-");
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static void print_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [options]\n", program_name);
+    fprintf(stderr, "Time MDOS library operations over a generated corpus; results as JSON\n");
+    fprintf(stderr, "  --out FILE          Write the JSON results to FILE (default: stdout)\n");
+    fprintf(stderr, "  --runs N            Timed runs per benchmark, after one warm-up (default 25)\n");
+    fprintf(stderr, "  --dir DIR           Corpus directory (default bench_corpus)\n");
+    fprintf(stderr, "  --extract PATH      mdosextract binary to time (default ./mdosextract)\n");
+    fprintf(stderr, "  --baseline FILE     Compare medians with a saved run; exit 1 on a regression\n");
+    fprintf(stderr, "  --threshold PCT     Slowdown counted as a regression (default 10)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL;
+    const char *baseline_path = NULL;
+    const char *extract_tool = "./mdosextract";
+    double threshold = 10;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--out") == 0) {
+            out_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--runs") == 0) {
+            runs = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--dir") == 0) {
+            dir = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--extract") == 0) {
+            extract_tool = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--threshold") == 0) {
+            threshold = atof(argv[++i]);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1 || runs > BENCH_MAX_RUNS - 1 || threshold < 0) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    /* The library reports progress on stdout; keep it out of the results */
+    fflush(stdout);
+    int saved_stdout = dup(1);
+    int null = open("/dev/null", O_WRONLY);
+    if (saved_stdout < 0 || null < 0 || dup2(null, 1) < 0) {
+        perror("/dev/null");
+        return 2;
+    }
+    close(null);
+
+    fprintf(stderr, "Generating corpus in %s/...\n", dir);
+    int ok = make_corpus() == 0;
+    if (ok) {
+        fprintf(stderr, "Running %d timed runs per benchmark...\n", runs);
+        bench_mount("mount_unmount_dsk", "large.dsk");
+        bench_mount("mount_unmount_imd", "large.imd");
+        bench_reads("large.dsk", "ls_dsk", "stat_all_dsk", "get_small_dsk", "get_large_dsk", "seek_random_dsk");
+        bench_reads("large.imd", "ls_imd", "stat_all_imd", "get_small_imd", "get_large_imd", "seek_random_imd");
+        bench_reads("small.dsk", "ls_small_dsk", "stat_all_small_dsk", "get_small_small_dsk", NULL, NULL);
+        bench_writes("large.imd", "put_small", "put_large");
+        bench_convert();
+        bench_extract(extract_tool);
+    }
+    fflush(stdout);
+    dup2(saved_stdout, 1);
+    close(saved_stdout);
+    if (!ok) {
+        return 2;
+    }
+
+    for (int i = 0; i < nresults; i++) {
+        bench_summarize(&results[i]);
+    }
+    int regressions = baseline_path ? compare_baseline(baseline_path, threshold) : 0;
+    if (regressions < 0) {
+        return 2;
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror(out_path);
+        return 2;
+    }
+    write_json(out, threshold, baseline_path != NULL);
+    if (out != stdout && fclose(out) != 0) {
+        perror(out_path);
+        return 2;
+    }
+    print_table(baseline_path != NULL);
+    if (regressions) {
+        fprintf(stderr, "%d benchmark%s slower than the baseline by more than %.1f%%\n",
+                regressions, regressions == 1 ? "" : "s", threshold);
+        return 1;
+    }
+    return 0;
+}
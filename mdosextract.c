@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <sys/stat.h>
@@ -15,10 +16,14 @@
     #include <libgen.h>
 #endif
 
-#define MAX_TRACKS 77
-#define MAX_SECTORS_PER_TRACK 26
-#define SECTOR_SIZE 128
-#define MAX_SECTORS (MAX_TRACKS * MAX_SECTORS_PER_TRACK)
+#include "mdos_geometry.h"
+#include "mdos_checksum.h"
+#define MDOS_STATS_IMPLEMENTATION
+#include "mdos_stats.h"
+#define MDOS_TRACE_IMPLEMENTATION
+#include "mdos_trace.h"
+
+#define SECTOR_SIZE MDOS_GEOM_SECTOR_SIZE   // MDOS logical sector
 #define CLUSTER_SIZE (SECTOR_SIZE * 4)
 #define MAX_WILDCARDS 16
 
@@ -31,17 +36,13 @@ typedef struct {
     bool custom_output_dir;
     char wildcards[MAX_WILDCARDS][64];
     int wildcard_count;
+    bool tar_output;
+    char tar_path[512];
+    bool sha256;            // Add SHA-256 next to the CRC32C checksums
+    int stats;              // --stats[=json]: MDOS_STATS_TEXT or MDOS_STATS_JSON
+    const char *trace_path; // --trace: Chrome trace written at exit
 } cmdline_options_t;
 
-// IMD track header structure
-typedef struct {
-    uint8_t mode;          // Recording mode
-    uint8_t cylinder;      // Track number
-    uint8_t head;          // Head number + flags
-    uint8_t sector_count;  // Sectors in this track
-    uint8_t sector_size;   // Sector size code
-} imd_track_header_t;
-
 // MDOS RIB structure (from official code)
 struct rib {
     unsigned char sdw[114];      // 114 bytes of SDWs
@@ -87,11 +88,24 @@ typedef struct {
     uint8_t last_sector_bytes;
     int rib_sector;
     bool extracted_ok;
+    uint32_t crc32c;        // Checksum of the extracted contents
+    char sha256[2 * MDOS_SHA256_SIZE + 1];
 } file_info_t;
 
-// Global storage for disk sectors
-uint8_t disk_sectors[MAX_TRACKS][MAX_SECTORS_PER_TRACK][SECTOR_SIZE];
-bool sector_valid[MAX_TRACKS][MAX_SECTORS_PER_TRACK];
+// Output sink: a host file, or a growable memory buffer
+typedef struct {
+    FILE *fp;
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} sink_t;
+
+// Global storage for disk sectors: the linear image in logical sector
+// order, laid out by the geometry found in the IMD
+mdos_geometry_t disk_geometry;
+uint8_t *disk_image = NULL;
+bool *sector_valid = NULL;          // Per logical (128-byte) sector
+int max_sectors = 0;                // Logical sectors in disk_image
 int total_sectors = 0;
 int valid_sectors = 0;
 
@@ -108,27 +122,67 @@ void verify_mdos_structure();
 void scan_directory();
 void extract_filename(struct dirent *d, char *output);
 void extract_file(struct dirent *d);
-void read_file(int rib_sector, const char *filename);
+long read_file_data(int rib_sector, sink_t *out);
 void get_sector(unsigned char *buf, int sect);
 uint16_t read_little_endian_16(uint8_t *data, int offset);
 void create_packlist(const char *imd_filename);
 void create_output_directory(const char *imd_filename);
 int analyze_sdw_chain(struct rib *rib);
-void fix_rib_after_extraction(file_info_t *info, const char *extracted_file);
-void create_s19_file(const char *binary_path, const char *filename, uint16_t load_addr, uint16_t start_addr);
+void fix_rib_after_extraction(file_info_t *info, long actual_file_size);
+void create_s19_data(const char *filename, const uint8_t *data, size_t len, uint16_t load_addr, uint16_t start_addr, sink_t *out);
 uint8_t calculate_s19_checksum(uint8_t *data, int length);
 bool parse_command_line(int argc, char *argv[], char **imd_filename);
 void print_usage(const char *program_name);
 bool matches_wildcard(const char *filename, const char *pattern);
 bool should_extract_file(const char *filename);
-void decode_text_file(const char *input_path, const char *output_path);
+void decode_text_data(const char *filename, const uint8_t *data, size_t len, sink_t *out);
 bool is_text_file(uint16_t attributes);
+void sink_write(sink_t *sink, const void *buf, size_t len);
+void sink_putc(sink_t *sink, int c);
+void sink_printf(sink_t *sink, const char *format, ...);
+void sink_free(sink_t *sink);
+void emit_output(const char *name, const uint8_t *data, size_t len, const file_info_t *info);
+void tar_write_header(const char *name, size_t size, char typeflag);
+void tar_write_data(const uint8_t *data, size_t len);
+size_t pax_record(char *buf, size_t pos, const char *key, unsigned int value);
+void tar_write_member(const char *name, const uint8_t *data, size_t len, const file_info_t *info);
+bool tar_finish(void);
 
 // Global output directory and base paths
 char output_dir[512];
 char base_dir[512];
 char base_name[256];
 
+// Archive written with --tar (NULL: extract into output_dir)
+FILE *tar_file = NULL;
+
+// Set when an output file or the archive could not be written in full
+bool write_failed = false;
+
+// Checksums of the whole image file, taken while it is parsed
+long image_bytes = 0;
+uint32_t image_crc32c = 0;
+char image_sha256[2 * MDOS_SHA256_SIZE + 1];
+
+// Counters and phase times, printed on stderr at exit with --stats
+static void print_stats(void) {
+    fflush(stdout);
+    mdos_stats_print(stderr, options.stats);
+}
+
+// The --trace timeline, written at exit
+static void write_trace(void) {
+    if (mdos_trace_finish() != 0) {
+        fprintf(stderr, "ERROR: Cannot write trace %s\n", options.trace_path);
+    }
+}
+
+// Start a phase of both the --stats report and the --trace timeline
+static void phase(const char *name) {
+    mdos_stats_phase(name);
+    mdos_trace_phase(name);
+}
+
 int main(int argc, char *argv[]) {
     char *imd_filename = NULL;
     
@@ -144,12 +198,20 @@ int main(int argc, char *argv[]) {
     if (!parse_command_line(argc, argv, &imd_filename)) {
         return 1;
     }
+    if (options.stats) {
+        atexit(print_stats);
+    }
+    if (options.trace_path) {
+        if (mdos_trace_start(options.trace_path, "mdosextract") != 0) {
+            printf("ERROR: Tracing is not available in this build\n");
+            return 1;
+        }
+        atexit(write_trace);
+    }
     
     printf("MDOS IMD File Extractor with Packlist and S19 Generator\n");
     printf("======================================================\n\n");
 
-    // Initialize sector validity array
-    memset(sector_valid, false, sizeof(sector_valid));
     file_info_count = 0;
 
     printf("INFO: Analyzing file: %s\n", imd_filename);
@@ -172,9 +234,17 @@ int main(int argc, char *argv[]) {
         printf("INFO: File filter: *.* (all files)\n");
     }
     
-    // Create output directory
+    // Create output directory (or open the archive)
     create_output_directory(imd_filename);
+    if (options.tar_output) {
+        tar_file = fopen(options.tar_path, "wb");
+        if (!tar_file) {
+            printf("ERROR: Cannot create tar archive %s\n", options.tar_path);
+            return 1;
+        }
+    }
     
+    phase("parse");
     if (!parse_imd_file(imd_filename)) {
         printf("ERROR: Failed to parse IMD file\n");
         return 1;
@@ -182,13 +252,19 @@ int main(int argc, char *argv[]) {
 
     printf("INFO: Successfully parsed %d valid sectors\n", valid_sectors);
     
+    phase("extract");
     verify_mdos_structure();
     scan_directory();
     
     // Create packlist with RIB information
+    phase("packlist");
     create_packlist(imd_filename);
 
-    return 0;
+    if (tar_file && !tar_finish()) {
+        return 1;
+    }
+
+    return write_failed ? 1 : 0;
 }
 
 void create_output_directory(const char *imd_filename) {
@@ -247,7 +323,7 @@ void create_output_directory(const char *imd_filename) {
     
     // Create directory if it doesn't exist (Windows version)
     struct _stat st = {0};
-    if (_stat(output_dir, &st) == -1) {
+    if (!options.tar_output && _stat(output_dir, &st) == -1) {
         if (_mkdir(output_dir) != 0) {
             printf("ERROR: Cannot create output directory %s\n", output_dir);
             perror("mkdir");
@@ -293,7 +369,7 @@ void create_output_directory(const char *imd_filename) {
     
     // Create directory if it doesn't exist (Unix version)
     struct stat st = {0};
-    if (stat(output_dir, &st) == -1) {
+    if (!options.tar_output && stat(output_dir, &st) == -1) {
         if (mkdir(output_dir, 0755) != 0) {
             printf("ERROR: Cannot create output directory %s\n", output_dir);
             perror("mkdir");
@@ -305,51 +381,209 @@ void create_output_directory(const char *imd_filename) {
     free(path_copy2);
 #endif
     
-    printf("INFO: Output directory: %s/\n", output_dir);
+    if (options.tar_output) {
+        printf("INFO: Output archive: %s\n", options.tar_path);
+    } else {
+        printf("INFO: Output directory: %s/\n", output_dir);
+    }
     printf("INFO: Base directory: %s\n", base_dir);
     printf("INFO: Base name: %s\n", base_name);
 }
 
-// Calculate checksum for S19 record
-uint8_t calculate_s19_checksum(uint8_t *data, int length) {
-    uint8_t sum = 0;
-    for (int i = 0; i < length; i++) {
-        sum += data[i];
+// Append bytes to a sink
+void sink_write(sink_t *sink, const void *buf, size_t len) {
+    if (sink->fp) {
+        if (fwrite(buf, 1, len, sink->fp) != len) {
+            write_failed = true;
+        }
+        sink->len += len;
+        return;
+    }
+    
+    if (sink->len + len > sink->cap) {
+        size_t cap = sink->cap ? sink->cap : 4096;
+        while (cap < sink->len + len) cap *= 2;
+        
+        uint8_t *grown = realloc(sink->data, cap);
+        if (!grown) {
+            printf("ERROR: Out of memory\n");
+            exit(1);
+        }
+        sink->data = grown;
+        sink->cap = cap;
+    }
+    memcpy(sink->data + sink->len, buf, len);
+    sink->len += len;
+}
+
+void sink_putc(sink_t *sink, int c) {
+    uint8_t byte = (uint8_t)c;
+    sink_write(sink, &byte, 1);
+}
+
+void sink_printf(sink_t *sink, const char *format, ...) {
+    char line[1024];
+    va_list args;
+    
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    
+    if (len > 0) {
+        sink_write(sink, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
     }
-    return ~sum;  // One's complement
 }
 
-// Create Motorola S19 file from binary data
-void create_s19_file(const char *binary_path, const char *filename, uint16_t load_addr, uint16_t start_addr) {
-    FILE *bin_file = fopen(binary_path, "rb");
-    if (!bin_file) {
-        printf("    ERROR: Cannot open %s for S19 conversion\n", binary_path);
+void sink_free(sink_t *sink) {
+    free(sink->data);
+    memset(sink, 0, sizeof(*sink));
+}
+
+// Write one output file into the tar archive, or into the output directory.
+// info (may be NULL) supplies the MDOS metadata for the archive's pax header.
+void emit_output(const char *name, const uint8_t *data, size_t len, const file_info_t *info) {
+    if (tar_file) {
+        tar_write_member(name, data, len, info);
+        printf("  Archived %s (%zu bytes)\n", name, len);
         return;
     }
     
-    // Create S19 filename
-    char s19_filename[512];
-    snprintf(s19_filename, sizeof(s19_filename), "%s/%s.s19", output_dir, filename);
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", output_dir, name);
     
-    FILE *s19_file = fopen(s19_filename, "w");
-    if (!s19_file) {
-        printf("    ERROR: Cannot create %s\n", s19_filename);
-        fclose(bin_file);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        printf("  ERROR: Cannot create %s\n", path);
         return;
     }
+    bool ok = (len == 0 || fwrite(data, 1, len, f) == len);
+    if (fclose(f) != 0 || !ok) {
+        printf("  ERROR: Failed writing %s\n", path);
+        write_failed = true;
+        return;
+    }
+    printf("  Extracted %s (%zu bytes)\n", path, len);
+}
+
+// Write a ustar header block. Mode 0644, no owner and mtime 0 like mdostool
+// export-tar, so the same image always gives the same archive.
+void tar_write_header(const char *name, size_t size, char typeflag) {
+    uint8_t header[512] = {0};
+    
+    snprintf((char *)header, 100, "%s", name);                   // name
+    snprintf((char *)header + 100, 8, "%07o", 0644);             // mode
+    snprintf((char *)header + 108, 8, "%07o", 0);                // uid
+    snprintf((char *)header + 116, 8, "%07o", 0);                // gid
+    snprintf((char *)header + 124, 12, "%011lo", (unsigned long)size);
+    snprintf((char *)header + 136, 12, "%011o", 0);              // mtime
+    header[156] = typeflag;
+    memcpy(header + 257, "ustar", 6);                            // magic
+    memcpy(header + 263, "00", 2);                               // version
+    
+    // Checksum is computed with its own field set to blanks
+    memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (int i = 0; i < 512; i++) {
+        sum += header[i];
+    }
+    snprintf((char *)header + 148, 8, "%06o", sum);
+    
+    if (fwrite(header, 1, sizeof(header), tar_file) != sizeof(header)) {
+        write_failed = true;
+    }
+}
+
+// Write member data padded to a whole number of 512 byte blocks
+void tar_write_data(const uint8_t *data, size_t len) {
+    static const uint8_t zeros[512];
+    
+    if (len > 0 && fwrite(data, 1, len, tar_file) != len) {
+        write_failed = true;
+    }
+    if (len % 512 && fwrite(zeros, 1, 512 - len % 512, tar_file) != 512 - len % 512) {
+        write_failed = true;
+    }
+}
+
+// Append one pax "<len> key=value\n" record; len counts its own digits
+size_t pax_record(char *buf, size_t pos, const char *key, unsigned int value) {
+    char body[64];
+    int body_len = snprintf(body, sizeof(body), " %s=%04X\n", key, value);
+    int len = body_len + 1;
     
-    printf("    Creating S19 file: %s\n", s19_filename);
+    while (len != body_len + snprintf(NULL, 0, "%d", len)) {
+        len = body_len + snprintf(NULL, 0, "%d", len);
+    }
+    return pos + sprintf(buf + pos, "%d%s", len, body);
+}
+
+// Write one archive member; MDOS metadata goes into a pax extended header,
+// as user.mdos.* extended attribute keywords so other tars accept it silently
+void tar_write_member(const char *name, const uint8_t *data, size_t len, const file_info_t *info) {
+    if (info) {
+        char pax[256];
+        char pax_name[100];
+        size_t pax_len = 0;
+        
+        pax_len = pax_record(pax, pax_len, "SCHILY.xattr.user.mdos.load", info->load_addr);
+        pax_len = pax_record(pax, pax_len, "SCHILY.xattr.user.mdos.start", info->start_addr);
+        pax_len = pax_record(pax, pax_len, "SCHILY.xattr.user.mdos.attr", info->attributes);
+        snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%s", name);
+        
+        tar_write_header(pax_name, pax_len, 'x');
+        tar_write_data((const uint8_t *)pax, pax_len);
+    }
+    
+    tar_write_header(name, len, '0');
+    tar_write_data(data, len);
+}
+
+// End the archive with two zero blocks and close it; false if any part of
+// the archive failed to write
+bool tar_finish(void) {
+    static const uint8_t zeros[1024];
+    
+    if (fwrite(zeros, 1, sizeof(zeros), tar_file) != sizeof(zeros)) {
+        write_failed = true;
+    }
+    if (fclose(tar_file) != 0) {
+        write_failed = true;
+    }
+    tar_file = NULL;
+    if (write_failed) {
+        printf("ERROR: Failed writing tar archive %s\n", options.tar_path);
+        return false;
+    }
+    printf("INFO: Tar archive written: %s\n", options.tar_path);
+    return true;
+}
+
+// Calculate checksum for S19 record
+uint8_t calculate_s19_checksum(uint8_t *data, int length) {
+    uint8_t sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += data[i];
+    }
+    return ~sum;  // One's complement
+}
+
+// Create Motorola S19 records from binary data
+void create_s19_data(const char *filename, const uint8_t *data, size_t len, uint16_t load_addr, uint16_t start_addr, sink_t *out) {
+    printf("    Creating S19 file: %s.s19\n", filename);
     
     // Write S0 header record
-    fprintf(s19_file, "S00F000068656C6C6F202020202000003C\n");
+    sink_printf(out, "S00F000068656C6C6F202020202000003C\n");
     
-    // Read binary data and create S1 records
-    uint8_t buffer[16];  // 16 bytes per S1 record (good balance)
+    // Create S1 records from the binary data
     uint16_t address = load_addr;
-    size_t bytes_read;
+    size_t offset = 0;
     int total_records = 0;
     
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), bin_file)) > 0) {
+    while (offset < len) {
+        size_t bytes_read = len - offset;
+        if (bytes_read > 16) bytes_read = 16;  // 16 bytes per S1 record (good balance)
+        const uint8_t *buffer = data + offset;
+        
         // Prepare S1 record data
         uint8_t record_data[32];  // Max size for address + data + checksum calculation
         int record_length = 3 + bytes_read;  // 3 bytes (length + address) + data bytes
@@ -367,44 +601,28 @@ void create_s19_file(const char *binary_path, const char *filename, uint16_t loa
         uint8_t checksum = calculate_s19_checksum(record_data, record_length);
         
         // Write S1 record
-        fprintf(s19_file, "S1%02X%04X", record_length, address);
+        sink_printf(out, "S1%02X%04X", record_length, address);
         for (size_t i = 0; i < bytes_read; i++) {
-            fprintf(s19_file, "%02X", buffer[i]);
+            sink_printf(out, "%02X", buffer[i]);
         }
-        fprintf(s19_file, "%02X\n", checksum);
+        sink_printf(out, "%02X\n", checksum);
         
         address += bytes_read;
+        offset += bytes_read;
         total_records++;
     }
     
     // Write S9 termination record with start address
     uint8_t term_data[3] = {0x03, (start_addr >> 8) & 0xFF, start_addr & 0xFF};
     uint8_t term_checksum = calculate_s19_checksum(term_data, 3);
-    fprintf(s19_file, "S903%04X%02X\n", start_addr, term_checksum);
-    
-    fclose(bin_file);
-    fclose(s19_file);
+    sink_printf(out, "S903%04X%02X\n", start_addr, term_checksum);
     
     printf("    S19 conversion complete: %d data records, load=0x%04X, start=0x%04X\n", 
            total_records, load_addr, start_addr);
 }
 
 // Add this function to decode MDOS text files with space compression
-void decode_text_file(const char *input_path, const char *output_path) {
-    FILE *input = fopen(input_path, "rb");
-    if (!input) {
-        printf("    ERROR: Cannot open %s for text decoding\n", input_path);
-        return;
-    }
-    
-    FILE *output = fopen(output_path, "wb");
-    if (!output) {
-        printf("    ERROR: Cannot create %s\n", output_path);
-        fclose(input);
-        return;
-    }
-    
-    int c;
+void decode_text_data(const char *filename, const uint8_t *data, size_t len, sink_t *output) {
     int decoded_bytes = 0;
     int original_bytes = 0;
     int space_expansions = 0;
@@ -412,7 +630,8 @@ void decode_text_file(const char *input_path, const char *output_path) {
     int null_bytes_skipped = 0;
     int control_chars_found = 0;
     
-    while ((c = fgetc(input)) != EOF) {
+    for (size_t pos = 0; pos < len; pos++) {
+        int c = data[pos];
         original_bytes++;
         
         if (c == 0x00) {
@@ -427,13 +646,13 @@ void decode_text_file(const char *input_path, const char *output_path) {
             // High bit set - this is compressed spaces
             int space_count = c & 0x7F;  // Get bits 0-6
             for (int i = 0; i < space_count; i++) {
-                fputc(' ', output);
+                sink_putc(output, ' ');
                 decoded_bytes++;
             }
             space_expansions++;
         } else if (c == 0x0D) {
             // Convert MDOS carriage return to Unix line feed
-            fputc(0x0A, output);
+            sink_putc(output, 0x0A);
             decoded_bytes++;
             line_conversions++;
         } else if (c == 0x7F) {
@@ -448,15 +667,13 @@ void decode_text_file(const char *input_path, const char *output_path) {
             continue;
         } else {
             // Normal character - copy as-is
-            fputc(c, output);
+            sink_putc(output, c);
             decoded_bytes++;
         }
     }
     
-    fclose(input);
-    fclose(output);
-    
-    printf("    Text decoded: %s -> %s\n", input_path, output_path);
+    MDOS_STAT_ADD(MDOS_STAT_BYTES_DECODED, len);
+    printf("    Text decoded: %s -> %s.txt\n", filename, filename);
     printf("    Stats: %d bytes -> %d bytes, %d space expansions, %d line endings converted, %d null/EOF bytes removed, %d control chars filtered\n", 
            original_bytes, decoded_bytes, space_expansions, line_conversions, null_bytes_skipped, control_chars_found);
 }
@@ -484,135 +701,103 @@ bool parse_imd_file(const char *filename) {
     // Read comment block until 0x1A
     char comment[1024];
     int pos = 0;
+    int c = EOF;
     while (pos < sizeof(comment) - 1) {
-        int c = fgetc(file);
+        c = fgetc(file);
         if (c == 0x1A || c == EOF) break;
         comment[pos++] = c;
     }
     comment[pos] = '\0';
     printf("INFO: IMD Comment: %s\n", comment);
 
-    // Parse tracks
-    int tracks_parsed = 0;
-    while (tracks_parsed < 200) { // Safety limit
-        imd_track_header_t header;
-        if (fread(&header, sizeof(header), 1, file) != 1) {
-            break; // End of file
-        }
-
-        int track_num = header.cylinder; // Use actual cylinder number
-
-        if (header.sector_count == 0) {
-            tracks_parsed++;
-            continue;
-        }
-
-        // Safety check
-        if (track_num >= MAX_TRACKS) {
-            tracks_parsed++;
-            continue;
-        }
-
-        // Read sector number map
-        uint8_t sector_map[header.sector_count];
-        if (fread(sector_map, header.sector_count, 1, file) != 1) {
-            break;
-        }
-
-        // Read optional cylinder map if present
-        if (header.head & 0x80) {
-            uint8_t cylinder_map[header.sector_count];
-            if (fread(cylinder_map, header.sector_count, 1, file) != 1) {
-                break;
-            }
-        }
-
-        // Read optional head map if present
-        if (header.head & 0x40) {
-            uint8_t head_map[header.sector_count];
-            if (fread(head_map, header.sector_count, 1, file) != 1) {
-                break;
-            }
-        }
-
-        // Read sector data
-        for (int s = 0; s < header.sector_count; s++) {
-            int sector_type_int = fgetc(file);
-            if (sector_type_int == EOF) {
-                fclose(file);
-                return false;
-            }
-            uint8_t sector_type = (uint8_t)sector_type_int;
+    // The image checksums cover every byte of the file, read this once
+    mdos_sha256_t sha;
+    mdos_sha256_init(&sha);
+    image_crc32c = mdos_crc32c(0, comment, pos);
+    if (options.sha256) mdos_sha256_update(&sha, comment, pos);
+    if (c == 0x1A) {
+        uint8_t eof_mark = 0x1A;
+        image_crc32c = mdos_crc32c(image_crc32c, &eof_mark, 1);
+        if (options.sha256) mdos_sha256_update(&sha, &eof_mark, 1);
+    }
 
-            uint8_t sector_data[SECTOR_SIZE];
-            int sector_num = sector_map[s];
+    // Read the track records in one go; they are walked twice, once for the
+    // geometry and once to place the sectors
+    long start = ftell(file);
+    long len = st.st_size - start;
+    uint8_t *imd = malloc(len > 0 ? len : 1);
+    MDOS_STAT_ADD(MDOS_STAT_SYSCALLS, 1);
+    if (!imd || fread(imd, 1, len, file) != (size_t)len) {
+        free(imd);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
 
-            switch (sector_type) {
-                case 0: // Data unavailable
-                    memset(sector_data, 0, SECTOR_SIZE);
-                    break;
+    image_crc32c = mdos_crc32c(image_crc32c, imd, len);
+    image_bytes = start + len;
+    if (options.sha256) {
+        uint8_t digest[MDOS_SHA256_SIZE];
+        mdos_sha256_update(&sha, imd, len);
+        mdos_sha256_final(&sha, digest);
+        mdos_sha256_hex(digest, image_sha256);
+    }
+    printf("INFO: Image CRC32C: %08X (%s)\n", (unsigned)image_crc32c,
+           mdos_crc32c_hardware() ? "hardware" : "software");
+
+    long sectors;
+    int tracks = mdos_geometry_scan_imd(&disk_geometry, imd, len, 0, &sectors);
+    if (tracks < 0) {
+        printf("ERROR: %s\n", tracks == -2 ? "Tracks differ in sector size" : "Bad or truncated track record");
+        free(imd);
+        return false;
+    }
+    total_sectors = (int)sectors;
+    printf("INFO: Geometry: %d cylinders, %d head(s), %d sectors of %d bytes\n",
+           disk_geometry.cylinders, disk_geometry.heads, disk_geometry.sectors,
+           disk_geometry.sector_size);
+
+    max_sectors = mdos_geometry_bytes(&disk_geometry) / SECTOR_SIZE;
+    disk_image = calloc(max_sectors, SECTOR_SIZE);
+    sector_valid = calloc(max_sectors, sizeof(bool));
+    if (!disk_image || !sector_valid) {
+        printf("ERROR: Out of memory\n");
+        free(imd);
+        return false;
+    }
 
-                case 1: // Normal data
-                    if (fread(sector_data, SECTOR_SIZE, 1, file) != 1) {
-                        fclose(file);
-                        return false;
-                    }
-                    break;
-
-                case 2: // Compressed - all same byte
-                    {
-                        int fill_byte = fgetc(file);
-                        if (fill_byte == EOF) {
-                            fclose(file);
-                            return false;
-                        }
-                        memset(sector_data, fill_byte, SECTOR_SIZE);
-                    }
-                    break;
+    valid_sectors = (int)mdos_geometry_place_imd(&disk_geometry, imd, len, 0, disk_image, sector_valid);
+    MDOS_STAT_ADD(MDOS_STAT_BYTES_DECODED, (long)valid_sectors * disk_geometry.sector_size);
 
-                default:
-                    if (fread(sector_data, SECTOR_SIZE, 1, file) != 1) {
-                        fclose(file);
-                        return false;
-                    }
-                    break;
-            }
+    free(imd);
+    return true;
+}
 
-            // Convert from 1-based to 0-based sector numbering
-            int mdos_sector = sector_num - 1;  // Convert 1-26 to 0-25
-            
-            if (mdos_sector >= 0 && mdos_sector < MAX_SECTORS_PER_TRACK) {
-                memcpy(disk_sectors[track_num][mdos_sector], sector_data, SECTOR_SIZE);
-                sector_valid[track_num][mdos_sector] = true;
-                valid_sectors++;
-            }
-            total_sectors++;
-        }
-        
-        tracks_parsed++;
+// Logical sector data, or NULL if the image does not hold the sector
+uint8_t *logical_sector(int sect) {
+    if (sect < 0 || sect >= max_sectors || !sector_valid[sect]) {
+        return NULL;
     }
-
-    fclose(file);
-    return true;
+    return disk_image + (long)sect * SECTOR_SIZE;
 }
 
 void verify_mdos_structure() {
     printf("INFO: Verifying MDOS file system structure...\n");
 
-    if (!sector_valid[0][0]) {
+    if (!logical_sector(0)) {
         printf("ERROR: Disk ID sector (0,0) not available\n");
         return;
     }
 
-    mdos_disk_id_t *disk_id = (mdos_disk_id_t *)disk_sectors[0][0];
+    mdos_disk_id_t *disk_id = (mdos_disk_id_t *)logical_sector(0);
     
     printf("INFO: Disk ID: %.8s\n", disk_id->disk_id);
     printf("INFO: Date: %.6s\n", disk_id->date);
     printf("INFO: User: %.20s\n", disk_id->user_name);
 
     // Verify Cluster Allocation Table (sector 1)
-    if (sector_valid[0][1]) {
-        uint8_t *cat = disk_sectors[0][1];
+    if (logical_sector(1)) {
+        uint8_t *cat = logical_sector(1);
         int allocated = 0;
         for (int i = 0; i < 128; i++) {
             for (int bit = 0; bit < 8; bit++) {
@@ -634,9 +819,8 @@ void scan_directory() {
 
     // Directory is in sectors 3-22 (20 sectors)
     for (int dir_sector = 3; dir_sector <= 22; dir_sector++) {
-        if (!sector_valid[0][dir_sector]) continue;
-
-        uint8_t *sector_data = disk_sectors[0][dir_sector];
+        uint8_t *sector_data = logical_sector(dir_sector);
+        if (!sector_data) continue;
 
         // Each sector contains 8 directory entries (128 / 16 = 8)
         for (int entry = 0; entry < 8; entry++) {
@@ -668,24 +852,26 @@ void scan_directory() {
             printf("File %d: %s (RIB: %d, Attr: 0x%04X)\n", 
                    file_count, filename, rib_sector, attributes);
 
-            // Store file information for packlist
+            // Store file information for packlist (info stays NULL once the
+            // table is full)
+            file_info_t *info = NULL;
             if (file_info_count < 320) {
-                file_info_t *info = &file_info[file_info_count];
+                info = &file_info[file_info_count];
                 strcpy(info->filename, filename);
-                snprintf(info->filepath, sizeof(info->filepath), "%s/%s", output_dir, filename);
+                if (tar_file) {
+                    snprintf(info->filepath, sizeof(info->filepath), "%s", filename);
+                } else {
+                    snprintf(info->filepath, sizeof(info->filepath), "%s/%s", output_dir, filename);
+                }
                 info->rib_sector = rib_sector;
                 info->attributes = attributes;
                 info->extracted_ok = false;
                 
                 // Get RIB information if sector is valid
-                if (rib_sector < MAX_SECTORS) {
-                    int track = rib_sector / MAX_SECTORS_PER_TRACK;
-                    int sector = rib_sector % MAX_SECTORS_PER_TRACK;
-                    
-                    if (track < MAX_TRACKS && sector < MAX_SECTORS_PER_TRACK && 
-                        sector_valid[track][sector]) {
+                if (rib_sector < max_sectors) {
+                    if (logical_sector(rib_sector)) {
                         
-                        struct rib *rib = (struct rib *)disk_sectors[track][sector];
+                        struct rib *rib = (struct rib *)logical_sector(rib_sector);
                         info->load_addr = (rib->addr_high << 8) | rib->addr_low;
                         info->start_addr = (rib->pc_high << 8) | rib->pc_low;
                         info->file_size_sectors = (rib->size_high << 8) | rib->size_low;
@@ -725,14 +911,21 @@ void scan_directory() {
             }
 
             // Verify RIB address is in valid range
-            if (rib_sector >= MAX_SECTORS) {
+            if (rib_sector >= max_sectors) {
                 printf("  ERROR: RIB sector %d is out of range\n", rib_sector);
                 continue;
             }
 
-            // Extract the file using correct MDOS algorithm
+            // Read the file once using correct MDOS algorithm; every output
+            // format is generated from this copy
+            mdos_trace_span_t file_span = mdos_trace_begin("extract file", filename);
+            mdos_trace_span_t span = mdos_trace_begin("read file", filename);
+            sink_t contents = {0};
+            long file_size = read_file_data(rib_sector, &contents);
+            mdos_trace_end(&span);
+            
             if (options.extract_original) {
-                read_file(rib_sector, filename);
+                emit_output(filename, contents.data, contents.len, info);
             }
 
             // Check if this is a text file and decode it (if text extraction enabled)
@@ -776,23 +969,12 @@ void scan_directory() {
                     char decoded_filename[256];
                     snprintf(decoded_filename, sizeof(decoded_filename), "%s.txt", filename);
                     
-                    char decoded_path[512];
-                    snprintf(decoded_path, sizeof(decoded_path), "%s/%s", output_dir, decoded_filename);
-                    
-                    // Create full path for the original file
-                    char original_path[512];
-                    snprintf(original_path, sizeof(original_path), "%s/%s", output_dir, filename);
-                    
-                    printf("  DEBUG: Original path: %s\n", original_path);
-                    printf("  DEBUG: Decoded path: %s\n", decoded_path);
-                    
-                    // If original file wasn't extracted, extract it now for text processing
-                    if (!options.extract_original) {
-                        printf("  Extracting original file for text processing...\n");
-                        read_file(rib_sector, filename);
-                    }
-                    
-                    decode_text_file(original_path, decoded_path);
+                    span = mdos_trace_begin("text decode", filename);
+                    sink_t text = {0};
+                    decode_text_data(filename, contents.data, contents.len, &text);
+                    emit_output(decoded_filename, text.data, text.len, NULL);
+                    sink_free(&text);
+                    mdos_trace_end(&span);
                 } else {
                     printf("  Not a text file, skipping text decode\n");
                 }
@@ -800,27 +982,43 @@ void scan_directory() {
             
             // Create S19 file if enabled
             if (options.extract_s19) {
-                if (file_info_count > 0) {
-                    file_info_t *info = &file_info[file_info_count - 1];
-                    char original_path[512];
-                    snprintf(original_path, sizeof(original_path), "%s/%s", output_dir, filename);
-                    
-                    // If original file wasn't extracted, extract it now for S19 processing
-                    if (!options.extract_original) {
-                        printf("  Extracting original file for S19 processing...\n");
-                        read_file(rib_sector, filename);
-                    }
+                if (info) {
+                    char s19_filename[256];
+                    snprintf(s19_filename, sizeof(s19_filename), "%s.s19", filename);
                     
                     printf("  Creating S19 file for %s...\n", filename);
-                    create_s19_file(original_path, filename, info->load_addr, info->start_addr);
+                    span = mdos_trace_begin("s19", filename);
+                    sink_t s19 = {0};
+                    create_s19_data(filename, contents.data, contents.len, info->load_addr, info->start_addr, &s19);
+                    emit_output(s19_filename, s19.data, s19.len, NULL);
+                    sink_free(&s19);
+                    mdos_trace_end(&span);
                 }
             }
             
-            // Mark as successfully extracted and fix RIB information using actual extracted file
-            if (file_info_count > 0) {
-                file_info[file_info_count - 1].extracted_ok = true;
-                fix_rib_after_extraction(&file_info[file_info_count - 1], filename);
+            // Mark as successfully extracted and fix RIB information using actual file size
+            if (info) {
+                info->extracted_ok = true;
+                fix_rib_after_extraction(info, file_size);
+
+                // Checksum the contents in the same pass, cut to the length
+                // the packlist gives (what pack rebuilds and verify reads)
+                size_t len = info->file_size_sectors ?
+                    (size_t)(info->file_size_sectors - 1) * SECTOR_SIZE + info->last_sector_bytes : 0;
+                if (len > contents.len) len = contents.len;
+                info->crc32c = mdos_crc32c(0, contents.data, len);
+                if (options.sha256) {
+                    uint8_t digest[MDOS_SHA256_SIZE];
+                    mdos_sha256_t sha;
+                    mdos_sha256_init(&sha);
+                    mdos_sha256_update(&sha, contents.data, len);
+                    mdos_sha256_final(&sha, digest);
+                    mdos_sha256_hex(digest, info->sha256);
+                }
+                printf("  Checksum: CRC32C=%08X over %zu bytes\n", (unsigned)info->crc32c, len);
             }
+            sink_free(&contents);
+            mdos_trace_end(&file_span);
             
             extracted_count++;
         }
@@ -864,19 +1062,19 @@ void extract_filename(struct dirent *d, char *output) {
 
 // Get sector data (helper function)
 void get_sector(unsigned char *buf, int sect) {
-    int track = sect / MAX_SECTORS_PER_TRACK;
-    int sector = sect % MAX_SECTORS_PER_TRACK;
+    uint8_t *data = logical_sector(sect);
     
-    if (track < MAX_TRACKS && sector < MAX_SECTORS_PER_TRACK && 
-        sector_valid[track][sector]) {
-        memcpy(buf, disk_sectors[track][sector], SECTOR_SIZE);
+    MDOS_STAT_ADD(MDOS_STAT_SECTORS_READ, 1);
+    if (data) {
+        memcpy(buf, data, SECTOR_SIZE);
     } else {
         memset(buf, 0, SECTOR_SIZE);
         printf("    Warning: Missing sector %d\n", sect);
     }
 }
 
-void read_file(int rib_sector, const char *filename) {
+// Read a file's data through its SDW chain; returns the number of bytes
+long read_file_data(int rib_sector, sink_t *out) {
     unsigned char rib_buf[SECTOR_SIZE];
     struct rib *r = (struct rib *)rib_buf;
     
@@ -900,6 +1098,7 @@ void read_file(int rib_sector, const char *filename) {
     // First pass: find the end marker to get actual file size
     for (int x = 0; x < 114; x += 2) {
         int sdw = (r->sdw[x] << 8) | r->sdw[x + 1];
+        MDOS_STAT_ADD(MDOS_STAT_SDWS, 1);
         
         if (sdw & 0x8000) {
             // End marker found
@@ -924,17 +1123,6 @@ void read_file(int rib_sector, const char *filename) {
     
     printf("  Using: %d sectors, last sector: %d bytes\n", actual_file_size, actual_last_size);
     
-    // Create full path for output file
-    char filepath[512];
-    snprintf(filepath, sizeof(filepath), "%s/%s", output_dir, filename);
-    
-    // Open output file
-    FILE *f = fopen(filepath, "wb");
-    if (!f) {
-        printf("  ERROR: Cannot create %s\n", filepath);
-        return;
-    }
-    
     int logical_sector = 0;
     int total_bytes = 0;
     
@@ -942,6 +1130,7 @@ void read_file(int rib_sector, const char *filename) {
     for (int x = 0; x < 114; x += 2) {
         // Read SDW as big-endian (official format)
         int sdw = (r->sdw[x] << 8) | r->sdw[x + 1];
+        MDOS_STAT_ADD(MDOS_STAT_SDWS, 1);
         
         if (sdw & 0x8000) {
             // End marker found
@@ -976,12 +1165,12 @@ void read_file(int rib_sector, const char *filename) {
                     // Write sector to file
                     if (logical_sector + 1 == actual_file_size && actual_last_size < SECTOR_SIZE) {
                         // Last sector - only write specified number of bytes
-                        fwrite(buf, actual_last_size, 1, f);
+                        sink_write(out, buf, actual_last_size);
                         total_bytes += actual_last_size;
                         printf("    Sector %d -> %d bytes (last)\n", physical_sector, actual_last_size);
                     } else {
                         // Full sector
-                        fwrite(buf, SECTOR_SIZE, 1, f);
+                        sink_write(out, buf, SECTOR_SIZE);
                         total_bytes += SECTOR_SIZE;
                         printf("    Sector %d -> %d bytes\n", physical_sector, SECTOR_SIZE);
                     }
@@ -992,15 +1181,15 @@ void read_file(int rib_sector, const char *filename) {
     }
     
 done:
-    fclose(f);
-    printf("  Extracted %s (%d bytes total, %d logical sectors)\n", 
-           filepath, total_bytes, logical_sector);
+    printf("  Read %d bytes total, %d logical sectors\n", total_bytes, logical_sector);
     
     // Verify extraction
     if (logical_sector != actual_file_size) {
         printf("  Warning: Expected %d sectors, extracted %d sectors\n", 
                actual_file_size, logical_sector);
     }
+    
+    return total_bytes;
 }
 
 void create_packlist(const char *imd_filename) {
@@ -1008,45 +1197,51 @@ void create_packlist(const char *imd_filename) {
     char packlist_path[512];
     snprintf(packlist_path, sizeof(packlist_path), "%s/%s.packlist", output_dir, base_name);
     
-    FILE *fp = fopen(packlist_path, "w");
-    if (!fp) {
-        printf("ERROR: Cannot create packlist file %s\n", packlist_path);
-        return;
-    }
+    sink_t packlist = {0};
+    
+    char packlist_name[300];
+    snprintf(packlist_name, sizeof(packlist_name), "%s.packlist", base_name);
     
-    printf("\nINFO: Creating packlist: %s\n", packlist_path);
+    printf("\nINFO: Creating packlist: %s\n", tar_file ? packlist_name : packlist_path);
     
     // Write header
-    fprintf(fp, "# MDOS Packlist generated by mdosextract.c\n");
-    fprintf(fp, "# Source IMD: %s\n", imd_filename);
-    fprintf(fp, "# Extracted to: %s/\n", output_dir);
+    sink_printf(&packlist, "# MDOS Packlist generated by mdosextract.c\n");
+    sink_printf(&packlist, "# Source IMD: %s\n", imd_filename);
+    if (tar_file) {
+        sink_printf(&packlist, "# Archived to: %s\n", options.tar_path);
+    } else {
+        sink_printf(&packlist, "# Extracted to: %s/\n", output_dir);
+    }
     
     time_t now = time(NULL);
     struct tm *tm_info = localtime(&now);
-    fprintf(fp, "# Generated: %04d-%02d-%02d %02d:%02d:%02d\n",
+    sink_printf(&packlist, "# Generated: %04d-%02d-%02d %02d:%02d:%02d\n",
             tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
             tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
     
-    fprintf(fp, "#\n");
-    fprintf(fp, "# Format: filename load_addr start_addr attr file_size last_bytes rib_sector\n");
-    fprintf(fp, "# All addresses and values in hexadecimal\n");
+    sink_printf(&packlist, "#\n");
+    sink_printf(&packlist, "# Format: filename load_addr start_addr attr file_size last_bytes rib_sector crc32c [sha256]\n");
+    sink_printf(&packlist, "# All addresses and values in hexadecimal\n");
+    sink_printf(&packlist, "# image format=imd bytes=%lX crc32c=%08X", image_bytes, (unsigned)image_crc32c);
+    if (options.sha256) sink_printf(&packlist, " sha256=%s", image_sha256);
+    sink_printf(&packlist, "\n");
     
-    fprintf(fp, "# Note: Files extracted based on command line options:\n");
-    fprintf(fp, "# Formats: ");
-    if (options.extract_original) fprintf(fp, "ORIGINAL ");
-    if (options.extract_text) fprintf(fp, "TEXT ");
-    if (options.extract_s19) fprintf(fp, "S19 ");
-    fprintf(fp, "\n");
+    sink_printf(&packlist, "# Note: Files extracted based on command line options:\n");
+    sink_printf(&packlist, "# Formats: ");
+    if (options.extract_original) sink_printf(&packlist, "ORIGINAL ");
+    if (options.extract_text) sink_printf(&packlist, "TEXT ");
+    if (options.extract_s19) sink_printf(&packlist, "S19 ");
+    sink_printf(&packlist, "\n");
     
     if (options.wildcard_count > 0) {
-        fprintf(fp, "# Wildcards used: ");
+        sink_printf(&packlist, "# Wildcards used: ");
         for (int i = 0; i < options.wildcard_count; i++) {
-            fprintf(fp, "%s ", options.wildcards[i]);
+            sink_printf(&packlist, "%s ", options.wildcards[i]);
         }
-        fprintf(fp, "\n");
+        sink_printf(&packlist, "\n");
     }
     
-    fprintf(fp, "#\n\n");
+    sink_printf(&packlist, "#\n\n");
     
     int successful_count = 0;
     int failed_count = 0;
@@ -1056,32 +1251,50 @@ void create_packlist(const char *imd_filename) {
         file_info_t *info = &file_info[i];
         
         if (info->extracted_ok) {
-            fprintf(fp, "%s load=%04X start=%04X attr=%04X size=%04X last=%02X rib=%04X\n",
+            sink_printf(&packlist, "%s load=%04X start=%04X attr=%04X size=%04X last=%02X rib=%04X crc32c=%08X",
                     info->filepath,
                     info->load_addr,
                     info->start_addr, 
                     info->attributes,
                     info->file_size_sectors,
                     info->last_sector_bytes,
-                    info->rib_sector);
+                    info->rib_sector,
+                    (unsigned)info->crc32c);
+            if (options.sha256) sink_printf(&packlist, " sha256=%s", info->sha256);
+            sink_printf(&packlist, "\n");
             successful_count++;
         } else {
-            fprintf(fp, "# FAILED: %s (RIB sector %d not accessible)\n", 
+            sink_printf(&packlist, "# FAILED: %s (RIB sector %d not accessible)\n", 
                     info->filename, info->rib_sector);
             failed_count++;
         }
     }
     
-    fprintf(fp, "\n# Summary: %d files extracted, %d failed\n", successful_count, failed_count);
+    sink_printf(&packlist, "\n# Summary: %d files extracted, %d failed\n", successful_count, failed_count);
     
     int total_files_created = 0;
     if (options.extract_original) total_files_created += successful_count;
     if (options.extract_text) total_files_created += successful_count;  // Approximate
     if (options.extract_s19) total_files_created += successful_count;
     
-    fprintf(fp, "# Total files created: approximately %d\n", total_files_created);
+    sink_printf(&packlist, "# Total files created: approximately %d\n", total_files_created);
     
-    fclose(fp);
+    if (tar_file) {
+        tar_write_member(packlist_name, packlist.data, packlist.len, NULL);
+    } else {
+        FILE *fp = fopen(packlist_path, "w");
+        if (!fp) {
+            printf("ERROR: Cannot create packlist file %s\n", packlist_path);
+            sink_free(&packlist);
+            return;
+        }
+        bool ok = (fwrite(packlist.data, 1, packlist.len, fp) == packlist.len);
+        if (fclose(fp) != 0 || !ok) {
+            printf("ERROR: Failed writing packlist file %s\n", packlist_path);
+            write_failed = true;
+        }
+    }
+    sink_free(&packlist);
     
     printf("INFO: Packlist created with %d entries (%d successful, %d failed)\n", 
            file_info_count, successful_count, failed_count);
@@ -1105,6 +1318,7 @@ int analyze_sdw_chain(struct rib *rib) {
     
     for (int x = 0; x < 114; x += 2) {
         int sdw = (rib->sdw[x] << 8) | rib->sdw[x + 1];
+        MDOS_STAT_ADD(MDOS_STAT_SDWS, 1);
         
         if (sdw & 0x8000) {
             // End marker found - return the sector count indicated
@@ -1122,14 +1336,8 @@ int analyze_sdw_chain(struct rib *rib) {
 }
 
 // Fix RIB information after extraction using actual extracted file size
-void fix_rib_after_extraction(file_info_t *info, const char *filename) {
-    char filepath[512];
-    snprintf(filepath, sizeof(filepath), "%s/%s", output_dir, filename);
-    
-    // Get actual extracted file size
-    struct stat st;
-    if (stat(filepath, &st) == 0) {
-        long actual_file_size = st.st_size;
+void fix_rib_after_extraction(file_info_t *info, long actual_file_size) {
+    if (actual_file_size >= 0) {
         int actual_sectors_needed = (actual_file_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
         int actual_last_bytes = actual_file_size % SECTOR_SIZE;
         if (actual_last_bytes == 0) actual_last_bytes = SECTOR_SIZE;
@@ -1165,10 +1373,14 @@ void print_usage(const char *program_name) {
     printf("\nExtracts MDOS files from IMD disk images\n\n");
     printf("Options:\n");
     printf("  -o <dir>      Output directory (default: <filename>_extracted)\n");
+    printf("  --tar <file>  Write everything into one POSIX tar archive instead\n");
     printf("  --all         Extract all formats (original + text + s19) [DEFAULT]\n");
     printf("  --original    Extract only original binary format\n");
     printf("  --text        Extract only text format (.txt)\n");
     printf("  --s19         Extract only S19 format (.s19)\n");
+    printf("  --sha256      Add SHA-256 checksums to the packlist (CRC32C is always there)\n");
+    printf("  --stats[=json] Print I/O and decode counters and phase times on exit (stderr)\n");
+    printf("  --trace <file> Write a Chrome trace of phases and files (Perfetto, about:tracing)\n");
     printf("  -h, --help    Show this help message\n\n");
     printf("Wildcards (can specify multiple):\n");
     printf("  *.xx          Extract only files ending with extension 'xx'\n");
@@ -1182,6 +1394,9 @@ void print_usage(const char *program_name) {
     printf("  %s disk.imd --text *.sa        # Only text format, only .sa files\n", program_name);
     printf("  %s disk.imd --s19 game*.*      # Only S19 format, files starting with 'game'\n", program_name);
     printf("  %s disk.imd *.cm *.sa          # All formats, only .cm and .sa files\n", program_name);
+    printf("  %s disk.imd --tar disk.tar     # All formats, into a single tar archive\n", program_name);
+    printf("  %s disk.imd --sha256           # Packlist with CRC32C and SHA-256 checksums\n", program_name);
+    printf("  %s disk.imd --trace t.json     # Timeline of the run, open in Perfetto\n", program_name);
 }
 
 // Parse command line arguments
@@ -1207,6 +1422,15 @@ bool parse_command_line(int argc, char *argv[], char **imd_filename) {
             options.output_dir[sizeof(options.output_dir) - 1] = '\0';
             options.custom_output_dir = true;
             i++; // Skip the directory argument
+        } else if (strcmp(argv[i], "--tar") == 0) {
+            if (i + 1 >= argc) {
+                printf("ERROR: --tar option requires an archive filename\n");
+                return false;
+            }
+            strncpy(options.tar_path, argv[i + 1], sizeof(options.tar_path) - 1);
+            options.tar_path[sizeof(options.tar_path) - 1] = '\0';
+            options.tar_output = true;
+            i++; // Skip the archive argument
         } else if (strcmp(argv[i], "--all") == 0) {
             options.extract_original = true;
             options.extract_text = true;
@@ -1239,6 +1463,15 @@ bool parse_command_line(int argc, char *argv[], char **imd_filename) {
             }
             options.extract_s19 = true;
             found_format_option = true;
+        } else if (strcmp(argv[i], "--sha256") == 0) {
+            options.sha256 = true;
+        } else if (mdos_stats_option(argv[i])) {
+            options.stats = mdos_stats_option(argv[i]);
+        } else if (strncmp(argv[i], "--trace", 7) == 0) {
+            if (!(options.trace_path = mdos_trace_option(argc, argv, &i))) {
+                printf("ERROR: --trace option requires a filename\n");
+                return false;
+            }
         } else if (argv[i][0] == '-') {
             printf("ERROR: Unknown option: %s\n", argv[i]);
             return false;
@@ -6,14 +6,42 @@
  * Uses the modular MDOS filesystem library
  */
 
+#define _POSIX_C_SOURCE 200809L  /* strdup, glob, mkdir, dup, fdopen */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "mdos_fs.h"
+#include "mdos_bulk.h"
+#include "mdos_tar.h"
+#include "mdos_pack.h"
+#include "mdos_sync.h"
+#include "mdos_imd.h"
+#include "mdos_sparse.h"
+#include "mdos_mdz.h"
+#include "mdos_archive.h"
+#include "mdos_catalog.h"
+#include "mdos_diff.h"
+#include "mdos_overlay.h"
+#include "mdos_grep.h"
+#include "mdos_fsck.h"
+#include "mdos_recover.h"
+#include "mdos_map.h"
+#include "mdos_stats.h"
+#include "mdos_trace.h"
+#include "mdos_gen.h"
+
+#define BATCH_MAX_ARGS 16   /* Arguments per batch script line */
 
 void print_usage(const char *program_name) {
     fprintf(stderr, "MDOS Filesystem Utility v1.1\n");
-    fprintf(stderr, "Usage: %s <mdos-disk-image> [command] [args...]\n", program_name);
+    fprintf(stderr, "Usage: %s [--overlay delta.ovl] <mdos-disk-image> [command] [args...]\n", program_name);
     fprintf(stderr, "\nCommands:\n");
     fprintf(stderr, "  ls                    - List directory contents\n");
     fprintf(stderr, "  cat <filename>        - Display file contents (with ASCII conversion)\n");
@@ -21,21 +49,119 @@ void print_usage(const char *program_name) {
     fprintf(stderr, "  get <filename> [out]  - Export file from MDOS to local filesystem\n");
     fprintf(stderr, "  put <local> [mdos]    - Import file from local to MDOS filesystem\n");
     fprintf(stderr, "  mkfs <sides>          - Create new MDOS filesystem (1=single, 2=double sided)\n");
+    fprintf(stderr, "  pack <packlist> [--sides N] - Create image from an mdosextract packlist\n");
+    fprintf(stderr, "                          (writes IMD when the image name ends in .imd)\n");
     fprintf(stderr, "  seek <filename>       - Test seek operations on file\n");
     fprintf(stderr, "  info <filename>       - Show detailed file information\n");
     fprintf(stderr, "  free                  - Show free space information\n");
     fprintf(stderr, "  rm <filename>         - Delete file from MDOS filesystem\n");
+    fprintf(stderr, "  mget <pattern> [dir]  - Export all matching files to a local directory\n");
+    fprintf(stderr, "  mput <local...>       - Import many local files (globs allowed) at once\n");
+    fprintf(stderr, "  mrm <pattern...>      - Delete all matching files\n");
+    fprintf(stderr, "  sync <dir> [--delete] - Update image from a local directory (changed files only)\n");
+    fprintf(stderr, "  save-imd <out.imd> [--preserve] [--source src.imd] [--comment text]\n");
+    fprintf(stderr, "           [--interleave N] [--skew K]\n");
+    fprintf(stderr, "                        - Write the mounted image as IMD (no DSK step)\n");
+    fprintf(stderr, "  save-mdz <out.mdz>    - Write the mounted image as a compressed .mdz\n");
+    fprintf(stderr, "  punch [--free]        - Turn zero sectors of a DSK into holes in place\n");
+    fprintf(stderr, "                          (--free: also clusters the CAT marks free)\n");
+    fprintf(stderr, "  manifest [out|-] [--sha256] - Write a packlist with CRC32C (and SHA-256)\n");
+    fprintf(stderr, "                          checksums of the image and every file\n");
+    fprintf(stderr, "  verify <packlist>     - Check the image against a packlist's checksums\n");
+    fprintf(stderr, "  patch <delta.mdp>     - Apply a diff patch in place (checks the image first)\n");
+    fprintf(stderr, "  fsck [--repair]       - Cross-check directory, RIBs and CAT; fix RIB sizes\n");
+    fprintf(stderr, "                          and the CAT with --repair\n");
+    fprintf(stderr, "  recover [--extract DIR] [--min-score N]\n");
+    fprintf(stderr, "                        - List deleted and orphaned files found by a scan\n");
+    fprintf(stderr, "                          of every cluster, with a confidence score\n");
+    fprintf(stderr, "  damage                - Files and byte ranges hit by the unreadable sectors\n");
+    fprintf(stderr, "                          of an IMD (nothing is extracted)\n");
+    fprintf(stderr, "  gen [--seed S] [--files N] [--sides N] [--size-dist small|mixed|large|MIN-MAX]\n");
+    fprintf(stderr, "      [--fragmentation F] [--text-ratio R] [--imd [--missing-sectors P]] [--count K]\n");
+    fprintf(stderr, "                        - Generate a synthetic image (IMD if named .imd);\n");
+    fprintf(stderr, "                          --count: K images, out-0001.dsk... seeds S, S+1...\n");
+    fprintf(stderr, "  export-tar [out|-]    - Write all files to one tar (default: stdout)\n");
+    fprintf(stderr, "  import-tar <in|->     - Import all files of a tar in one pass\n");
+    fprintf(stderr, "\nOverlay Mode:\n");
+    fprintf(stderr, "  --overlay delta.ovl   - Leave the image untouched; writes go to a sparse\n");
+    fprintf(stderr, "                          delta file (created on first use), reads fall through\n");
+    fprintf(stderr, "  commit                - Write the delta's sectors into the image, drop the delta\n");
+    fprintf(stderr, "  flatten <out>         - Write image plus delta as a new DSK, IMD or .mdz\n");
+    fprintf(stderr, "\nStatistics:\n");
+    fprintf(stderr, "  --stats[=json]        - On exit, print I/O, cache, codec and SDW counters and\n");
+    fprintf(stderr, "                          per-phase wall/CPU times to stderr (anywhere in args)\n");
+    fprintf(stderr, "  --trace out.json      - On exit, write a Chrome trace (Perfetto, about:tracing)\n");
+    fprintf(stderr, "                          of phases, images and files per thread\n");
+    fprintf(stderr, "\nBatch Mode:\n");
+    fprintf(stderr, "  -b <script|-> [--atomic] - Run commands from script (or stdin) under one mount\n");
+    fprintf(stderr, "                          --atomic: leave image untouched if any command fails\n");
     fprintf(stderr, "\nImage Conversion Commands:\n");
-    fprintf(stderr, "  imd2dsk <input.imd> <output.dsk> - Convert IMD to DSK format\n");
-    fprintf(stderr, "  dsk2imd <input.dsk> <output.imd> - Convert DSK to IMD format\n");
+    fprintf(stderr, "  imd2dsk <input.imd> <output.dsk> [--free] - Convert IMD to a sparse DSK\n");
+    fprintf(stderr, "  dsk2imd <input.dsk> <output.imd> [--interleave N] [--skew K]\n");
+    fprintf(stderr, "                        - Convert DSK to IMD format (optionally interleaved)\n");
+    fprintf(stderr, "  interleave <image> [--rpm R] [--host-ms M] [--step-ms S]\n");
+    fprintf(stderr, "                        - Report sector interleave and model sequential read time\n");
+    fprintf(stderr, "  imdindex <input.imd> [cyl head sector] - Write the sector index sidecar,\n");
+    fprintf(stderr, "                          or dump one sector through it\n");
+    fprintf(stderr, "  mdz2dsk <input.mdz> <output.dsk> [--free] - Convert .mdz to a sparse DSK\n");
+    fprintf(stderr, "  mdzbench <image...> [--rounds N] - Compare .mdz and IMD size and decode speed\n");
+    fprintf(stderr, "  diff <old> <new> [--patch delta.mdp]\n");
+    fprintf(stderr, "                        - Changed sectors and the files they belong to;\n");
+    fprintf(stderr, "                          --patch also writes them as a patch\n");
+    fprintf(stderr, "  grep <pattern> <image...> [-i] [--jobs N]\n");
+    fprintf(stderr, "                        - Search the text files of many images (parallel),\n");
+    fprintf(stderr, "                          printing image:file:line:text\n");
+    fprintf(stderr, "  fsck <image...> [--repair] - Check (and repair) many images, one line each\n");
+    fprintf(stderr, "  recover <image...> [--extract DIR] [--min-score N]\n");
+    fprintf(stderr, "                        - Sweep many images for recoverable files\n");
+    fprintf(stderr, "  damage <image.imd...> - Damage report for many IMDs, one summary line each\n");
+    fprintf(stderr, "\nArchive Commands:\n");
+    fprintf(stderr, "  archive add <store> <image...> [--jobs N]\n");
+    fprintf(stderr, "                        - Add images to a deduplicating store (parallel)\n");
+    fprintf(stderr, "  archive get <store> <name> <out.dsk|out.imd>\n");
+    fprintf(stderr, "                        - Rebuild a stored image byte for byte\n");
+    fprintf(stderr, "  archive ls <store>    - List stored images and the space saved\n");
+    fprintf(stderr, "  catalog build <dir> [--catalog FILE]\n");
+    fprintf(stderr, "                        - Index every file of every image below dir\n");
+    fprintf(stderr, "  catalog find [pattern] [--load=ADDR] [--start=ADDR] [--user=GLOB]\n");
+    fprintf(stderr, "                        - Search the index without opening any image\n");
+    fprintf(stderr, "                          (catalog: --catalog, $MDOS_CATALOG or %s)\n", MDOS_CATALOG_FILE);
     fprintf(stderr, "\nExamples:\n");
     fprintf(stderr, "  %s disk.dsk ls\n", program_name);
     fprintf(stderr, "  %s disk.dsk cat readme.txt\n", program_name);
     fprintf(stderr, "  %s disk.dsk put myfile.txt\n", program_name);
     fprintf(stderr, "  %s disk.dsk get data.bin exported.bin\n", program_name);
     fprintf(stderr, "  %s newdisk.dsk mkfs 2\n", program_name);
+    fprintf(stderr, "  %s newdisk.imd pack disk_extracted/disk.packlist\n", program_name);
     fprintf(stderr, "  %s - imd2dsk disk.imd disk.dsk\n", program_name);
+    fprintf(stderr, "  %s disk.dsk punch --free\n", program_name);
+    fprintf(stderr, "  %s disk.imd manifest disk.packlist --sha256\n", program_name);
+    fprintf(stderr, "  %s disk.dsk verify disk_extracted/disk.packlist\n", program_name);
+    fprintf(stderr, "  %s disk.imd save-mdz disk.mdz\n", program_name);
+    fprintf(stderr, "  %s disk.mdz ls\n", program_name);
     fprintf(stderr, "  %s - dsk2imd disk.dsk disk.imd\n", program_name);
+    fprintf(stderr, "  %s - dsk2imd disk.dsk floppy.imd --interleave 3 --skew 6\n", program_name);
+    fprintf(stderr, "  %s - interleave floppy.imd --host-ms 8\n", program_name);
+    fprintf(stderr, "  %s - diff sys1.dsk sys1-edited.imd --patch sys1.mdp\n", program_name);
+    fprintf(stderr, "  %s sys1.imd patch sys1.mdp\n", program_name);
+    fprintf(stderr, "  %s disk.imd fsck --repair\n", program_name);
+    fprintf(stderr, "  %s - fsck disks/*.imd disks/*.dsk\n", program_name);
+    fprintf(stderr, "  %s disk.imd recover --extract rescued --min-score 70\n", program_name);
+    fprintf(stderr, "  %s - damage disks/*.imd\n", program_name);
+    fprintf(stderr, "  %s scale/disk.imd gen --seed 7 --fragmentation 0.3 --missing-sectors 0.01 --count 1000\n", program_name);
+    fprintf(stderr, "  %s - grep XTREK disks/*.imd -i\n", program_name);
+    fprintf(stderr, "  %s - archive add store/ disks/*.imd --jobs 8\n", program_name);
+    fprintf(stderr, "  %s - archive get store/ sys1.imd sys1.imd\n", program_name);
+    fprintf(stderr, "  %s - catalog build disks/\n", program_name);
+    fprintf(stderr, "  %s - catalog find 'XT*.SA' --load=0x2000\n", program_name);
+    fprintf(stderr, "  %s disk.dsk mget '*.sa' sources/\n", program_name);
+    fprintf(stderr, "  %s disk.dsk mput build/*.sa\n", program_name);
+    fprintf(stderr, "  %s disk.dsk -b script.txt --atomic\n", program_name);
+    fprintf(stderr, "  %s --overlay mine.ovl shared.imd put test.sa\n", program_name);
+    fprintf(stderr, "  %s --overlay mine.ovl shared.imd flatten mine.dsk\n", program_name);
+    fprintf(stderr, "  %s disk.dsk sync src/ --delete\n", program_name);
+    fprintf(stderr, "  %s disk.dsk export-tar - | gzip > disk.tar.gz\n", program_name);
+    fprintf(stderr, "  %s --stats=json disk.imd get xtrek.sa\n", program_name);
 }
 
 void print_error(const char *operation, int error) {
@@ -56,6 +182,20 @@ int handle_mkfs(const char *disk_path, int sides) {
     return 0;
 }
 
+int handle_pack(const char *disk_path, const char *packlist_path, int sides) {
+    printf("Packing %s from %s (%s sided)...\n", disk_path, packlist_path,
+           (sides == 1) ? "single" : "double");
+    
+    int result = mdos_pack(disk_path, packlist_path, sides, stdout);
+    if (result < 0) {
+        print_error("pack", result);
+        return 1;
+    }
+    
+    printf("Packed %d files into %s\n", result, disk_path);
+    return 0;
+}
+
 int handle_ls(mdos_fs_t *fs) {
     printf("Directory listing:\n");
     printf("==================\n");
@@ -156,192 +296,2181 @@ int handle_free(mdos_fs_t *fs) {
     return 0;
 }
 
-int handle_imd_to_dsk(const char *imd_filename, const char *dsk_filename) {
+int handle_imd_to_dsk(const char *imd_filename, const char *dsk_filename, int flags) {
     printf("Converting IMD to DSK format...\n");
     printf("Input:  %s\n", imd_filename);
     printf("Output: %s\n", dsk_filename);
     
-    int result = mdos_convert_imd_to_dsk(imd_filename, dsk_filename);
-    if (result != MDOS_EOK) {
-        print_error("imd2dsk", result);
+    long holes = mdos_imd_to_dsk(imd_filename, dsk_filename, flags);
+    if (holes < 0) {
+        print_error("imd2dsk", (int)holes);
         return 1;
     }
     
+    printf("Left %ld bytes as holes\n", holes);
     printf("IMD to DSK conversion completed successfully!\n");
     return 0;
 }
 
-int handle_dsk_to_imd(const char *dsk_filename, const char *imd_filename) {
-    printf("Converting DSK to IMD format...\n");
-    printf("Input:  %s\n", dsk_filename);
-    printf("Output: %s\n", imd_filename);
+int handle_punch(const char *disk_path, int flags) {
+    printf("Punching holes in %s%s...\n", disk_path,
+           (flags & MDOS_SPARSE_FREE) ? " (zero sectors and free clusters)" : "");
     
-    int result = mdos_convert_dsk_to_imd(dsk_filename, imd_filename);
-    if (result != MDOS_EOK) {
-        print_error("dsk2imd", result);
+    long punched = mdos_punch_holes(disk_path, flags);
+    if (punched == MDOS_EINVAL) {
+        fprintf(stderr, "Error: punching holes is not supported for %s\n", disk_path);
+        return 1;
+    }
+    if (punched < 0) {
+        print_error("punch", (int)punched);
         return 1;
     }
     
-    printf("DSK to IMD conversion completed successfully!\n");
+    printf("Punched %ld bytes (%ld KB)\n", punched, punched / 1024);
     return 0;
 }
 
-int handle_rm(mdos_fs_t *fs, const char *filename) {
-    printf("Deleting '%s'...\n", filename);
+int handle_manifest(const char *disk_path, const char *out_path, int flags) {
+    FILE *out = stdout;
+    if (out_path && strcmp(out_path, "-") != 0) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            perror(out_path);
+            return 1;
+        }
+    }
     
-    /* Check if file exists first */
-    mdos_file_info_t info;
-    int stat_result = mdos_stat(fs, filename, &info);
-    if (stat_result != MDOS_EOK) {
-        print_error("stat", stat_result);
+    int result = mdos_pack_manifest(disk_path, out, flags);
+    if (out != stdout && fclose(out) != 0 && result == MDOS_EOK) {
+        result = MDOS_EIO;
+    }
+    if (result != MDOS_EOK) {
+        print_error("manifest", result);
         return 1;
     }
+    if (out != stdout) {
+        printf("Wrote %s\n", out_path);
+    }
+    return 0;
+}
+
+int handle_verify(const char *disk_path, const char *packlist_path) {
+    printf("Verifying %s against %s...\n", disk_path, packlist_path);
     
-    printf("File found: %d bytes, type %d\n", info.size, info.type);
+    mdos_pack_verify_t verify;
+    int result = mdos_pack_verify(disk_path, packlist_path, &verify, stdout);
+    if (result != MDOS_EOK) {
+        print_error("verify", result);
+        return 1;
+    }
     
-    int result = mdos_unlink(fs, filename);
+    printf("%d files: %d ok, %d changed, %d missing, %d not listed",
+           verify.files, verify.ok, verify.changed, verify.missing, verify.extra);
+    if (verify.unchecked) {
+        printf(", %d without checksum", verify.unchecked);
+    }
+    printf("; image file %s\n", verify.image < 0 ? "not checked" :
+                                 verify.image ? "matches" : "differs");
+    if (verify.files == 0 && verify.image < 0) {
+        fprintf(stderr, "Error: %s has no checksums for this image\n", packlist_path);
+        return 1;
+    }
+    return (verify.changed || verify.missing || verify.image == 0) ? 1 : 0;
+}
+
+/*
+ * fsck, one image or many: exit status as e2fsck, 0 clean, 1 problems all
+ * repaired, 4 problems left, 8 an image could not be checked (or-ed together)
+ */
+int handle_fsck(char *images[], int count, int flags) {
+    int status = 0;
+    long total_problems = 0;
+    for (int i = 0; i < count; i++) {
+        mdos_fsck_stats_t stats;
+        mdos_trace_span_t span = mdos_trace_begin("fsck image", images[i]);
+        int result = mdos_fsck(images[i], flags, &stats, stdout);
+        mdos_trace_end(&span);
+        if (result != MDOS_EOK) {
+            fprintf(stderr, "%s: %s\n", images[i], mdos_strerror(result));
+            status |= 8;
+            continue;
+        }
+        
+        printf("%s: %d files, %ld of %ld clusters allocated, ", images[i], stats.files,
+               stats.allocated, stats.clusters);
+        if (stats.problems == 0) {
+            printf("clean\n");
+        } else if (flags & MDOS_FSCK_REPAIR) {
+            printf("%d problems, %d repaired (%d sectors written)\n",
+                   stats.problems, stats.repaired, stats.sectors_written);
+        } else {
+            printf("%d problems\n", stats.problems);
+        }
+        total_problems += stats.problems;
+        if (stats.problems > stats.repaired) {
+            status |= 4;
+        } else if (stats.problems) {
+            status |= 1;
+        }
+    }
+    if (count > 1) {
+        printf("Checked %d images, %ld problems\n", count, total_problems);
+    }
+    return status;
+}
+
+/* Where a recovered file goes: its entry's name with '_' for lost letters, or rib<N>.bin */
+static void recover_out_path(const char *dir, const mdos_recover_file_t *file, char *path, size_t cap) {
+    char name[MDOS_MAX_FILENAME + 8];
+    struct stat st;
+    if (file->slot < 0) {
+        snprintf(name, sizeof(name), "rib%d.bin", file->rib_sector);
+    } else {
+        snprintf(name, sizeof(name), "%s", file->name);
+        for (char *p = name; *p; p++) {
+            if (*p == '?' || *p == '/') *p = '_';
+        }
+    }
+    snprintf(path, cap, "%s/%s", dir, name);
+    if (file->slot >= 0 && stat(path, &st) == 0) {
+        snprintf(path, cap, "%s/%s-%d", dir, name, file->rib_sector);
+    }
+}
+
+/*
+ * recover, one image or many: exit status 0 something recoverable found,
+ * 1 nothing, 2 an image could not be scanned or a file not written
+ */
+int handle_recover(char *images[], int count, const char *extract_dir, int min_score) {
+    int status = 1;
+    long total = 0;
+    struct stat st;
+    if (extract_dir && stat(extract_dir, &st) != 0 && mkdir(extract_dir, 0755) != 0) {
+        perror(extract_dir);
+        return 2;
+    }
+    for (int i = 0; i < count; i++) {
+        mdos_recover_t scan;
+        mdos_trace_span_t span = mdos_trace_begin("recover scan", images[i]);
+        int result = mdos_recover_scan(images[i], &scan);
+        mdos_trace_end(&span);
+        if (result != MDOS_EOK) {
+            fprintf(stderr, "%s: %s\n", images[i], mdos_strerror(result));
+            status = 2;
+            continue;
+        }
+
+        /* Many images: one subdirectory each, named after the image */
+        char dir[1024];
+        if (extract_dir && count > 1) {
+            const char *base = strrchr(images[i], '/');
+            snprintf(dir, sizeof(dir), "%s/%s", extract_dir, base ? base + 1 : images[i]);
+            if (stat(dir, &st) != 0 && mkdir(dir, 0755) != 0) {
+                perror(dir);
+                mdos_recover_free(&scan);
+                status = 2;
+                continue;
+            }
+        } else if (extract_dir) {
+            snprintf(dir, sizeof(dir), "%s", extract_dir);
+        }
+
+        int orphans = 0, recoverable = 0;
+        for (int f = 0; f < scan.count; f++) {
+            const mdos_recover_file_t *file = &scan.files[f];
+            if (file->slot < 0) orphans++;
+            if (file->rib_sector < 0) {
+                printf("%s: %s (slot %d): RIB overwritten, not recoverable\n",
+                       images[i], file->name, file->slot);
+                continue;
+            }
+            if (file->score < min_score) {
+                continue;
+            }
+            recoverable++;
+            if (file->slot >= 0) {
+                printf("%s: %s (slot %d): ", images[i], file->name, file->slot);
+            } else {
+                printf("%s: orphan: ", images[i]);
+            }
+            printf("RIB %d, %ld bytes in %d clusters, %d overwritten, %d%%",
+                   file->rib_sector, file->size, file->clusters, file->overwritten, file->score);
+            if (extract_dir) {
+                char path[1100];
+                recover_out_path(dir, file, path, sizeof(path));
+                span = mdos_trace_begin("recover extract", path);
+                result = mdos_recover_extract(&scan, f, path);
+                mdos_trace_end(&span);
+                if (result != MDOS_EOK) {
+                    printf("\n");
+                    fprintf(stderr, "%s: %s\n", path, mdos_strerror(result));
+                    status = 2;
+                    continue;
+                }
+                printf(" -> %s", path);
+            }
+            printf("\n");
+        }
+        printf("%s: %d deleted entries, %d orphan RIBs, %d recoverable (%ld of %ld sectors "
+               "passed the pre-filter)\n", images[i], scan.deleted, orphans, recoverable,
+               scan.candidates, scan.sectors);
+        total += recoverable;
+        if (recoverable && status == 1) status = 0;
+        mdos_recover_free(&scan);
+    }
+    if (count > 1) {
+        printf("Scanned %d images, %ld recoverable files\n", count, total);
+    }
+    return status;
+}
+
+/*
+ * damage, one IMD or many: exit status 0 no damaged sectors, 1 some, 2 an
+ * image could not be read (or is not an IMD)
+ */
+int handle_damage(char *images[], int count) {
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        mdos_damage_stats_t stats;
+        mdos_trace_span_t span = mdos_trace_begin("damage image", images[i]);
+        int result = mdos_damage(images[i], &stats, stdout);
+        mdos_trace_end(&span);
+        if (result == MDOS_EINVAL) {
+            fprintf(stderr, "%s: not an IMD; only IMD images record unreadable sectors\n", images[i]);
+            status = 2;
+            continue;
+        }
+        if (result != MDOS_EOK) {
+            fprintf(stderr, "%s: %s\n", images[i], mdos_strerror(result));
+            status = 2;
+            continue;
+        }
+        
+        long damaged = stats.unavailable + stats.data_errors;
+        if (damaged == 0) {
+            printf("%s: no damaged sectors\n", images[i]);
+            continue;
+        }
+        printf("%s: %ld damaged sectors (%ld unavailable, %ld with data errors): "
+               "%d files, %ld bytes; %ld system, %ld unused\n", images[i], damaged,
+               stats.unavailable, stats.data_errors, stats.files, stats.bytes,
+               stats.system_sectors, stats.spare_sectors);
+        if (status == 0) status = 1;
+    }
+    return status;
+}
+
+/*
+ * gen: one image, or count images numbered out-0001.dsk, ... with seeds
+ * seed, seed + 1, ...
+ */
+int handle_gen(const char *disk_path, const mdos_gen_opts_t *opts, int count) {
+    const char *dot = strrchr(disk_path, '.');
+    const char *slash = strrchr(disk_path, '/');
+    int stem = (dot && (!slash || dot > slash)) ? (int)(dot - disk_path) : (int)strlen(disk_path);
+    
+    for (int i = 0; i < count; i++) {
+        char path[1024];
+        if (count > 1) {
+            snprintf(path, sizeof(path), "%.*s-%04d%s", stem, disk_path, i + 1, disk_path + stem);
+        } else {
+            snprintf(path, sizeof(path), "%s", disk_path);
+        }
+        
+        mdos_gen_opts_t image_opts = *opts;
+        image_opts.seed = opts->seed + i;
+        mdos_gen_stats_t stats;
+        mdos_trace_span_t span = mdos_trace_begin("gen image", path);
+        int result = mdos_gen(path, &image_opts, &stats);
+        mdos_trace_end(&span);
+        if (result != MDOS_EOK) {
+            fprintf(stderr, "%s: %s\n", path, mdos_strerror(result));
+            return 1;
+        }
+        
+        printf("%s: seed %llu, %d files (%d text), %ld bytes, %d fragmented, %d extents",
+               path, (unsigned long long)image_opts.seed, stats.files, stats.text_files,
+               stats.bytes, stats.fragmented, stats.extents);
+        if (opts->missing_sectors > 0) {
+            printf(", %ld missing sectors", stats.missing_sectors);
+        }
+        if (stats.full) {
+            printf(" (disk full after %d of %d files)", stats.files, opts->files);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+/* --size-dist small|mixed|large|MIN-MAX (bytes) */
+static int parse_size_dist(const char *value, mdos_gen_opts_t *opts) {
+    char *end;
+    if (strcmp(value, "small") == 0) {
+        opts->size_dist = MDOS_GEN_SIZES_SMALL;
+    } else if (strcmp(value, "mixed") == 0) {
+        opts->size_dist = MDOS_GEN_SIZES_MIXED;
+    } else if (strcmp(value, "large") == 0) {
+        opts->size_dist = MDOS_GEN_SIZES_LARGE;
+    } else {
+        opts->size_dist = MDOS_GEN_SIZES_UNIFORM;
+        opts->min_size = strtol(value, &end, 10);
+        if (end == value || *end != '-') {
+            return -1;
+        }
+        value = end + 1;
+        opts->max_size = strtol(value, &end, 10);
+        if (end == value || *end) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* diff: exit status 0 identical, 1 different, 2 trouble (as diff(1)) */
+int handle_diff(const char *old_path, const char *new_path, const char *patch_path) {
+    mdos_diff_stats_t stats;
+    int result = mdos_diff(old_path, new_path, patch_path, &stats, stdout);
     if (result != MDOS_EOK) {
-        print_error("rm", result);
+        print_error("diff", result);
+        return 2;
+    }
+    
+    printf("%ld of %ld sectors differ in %ld runs (%ld of %ld tracks); "
+           "%d files modified, %d added, %d deleted\n",
+           stats.changed, stats.sectors, stats.runs, stats.tracks_changed, stats.tracks,
+           stats.modified, stats.added, stats.deleted);
+    if (patch_path) {
+        printf("Wrote %s (%ld bytes)\n", patch_path, stats.patch_bytes);
+    }
+    return stats.changed ? 1 : 0;
+}
+
+int handle_patch(const char *disk_path, const char *patch_path) {
+    printf("Patching %s with %s...\n", disk_path, patch_path);
+    
+    long written = mdos_patch(disk_path, patch_path);
+    if (written == MDOS_EINVAL) {
+        fprintf(stderr, "Error: %s was not made against this image\n", patch_path);
+        return 1;
+    }
+    if (written < 0) {
+        print_error("patch", (int)written);
         return 1;
     }
     
-    printf("File '%s' deleted successfully\n", filename);
+    if (written == 0) {
+        printf("Image already patched, nothing written\n");
+    } else {
+        printf("Wrote %ld sectors\n", written);
+    }
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        print_usage(argv[0]);
+int handle_commit(const char *disk_path, const char *overlay_path) {
+    printf("Committing %s into %s...\n", overlay_path, disk_path);
+    
+    long written = mdos_overlay_commit(disk_path, overlay_path);
+    if (written == MDOS_EINVAL) {
+        fprintf(stderr, "Error: %s is not a delta over this image\n", overlay_path);
+        return 1;
+    }
+    if (written < 0) {
+        print_error("commit", (int)written);
         return 1;
     }
     
-    const char *disk_path = argv[1];
-    const char *command = (argc > 2) ? argv[2] : "ls";
+    printf("Wrote %ld sectors, removed %s\n", written, overlay_path);
+    return 0;
+}
+
+int handle_flatten(const char *disk_path, const char *overlay_path, const char *out_path) {
+    printf("Flattening %s over %s into %s...\n", overlay_path, disk_path, out_path);
     
-    /* Handle conversion commands specially (don't need MDOS disk) */
-    if (strcmp(command, "imd2dsk") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: imd2dsk requires input and output filenames\n");
-            fprintf(stderr, "Usage: %s - imd2dsk <input.imd> <output.dsk>\n", argv[0]);
-            return 1;
-        }
-        return handle_imd_to_dsk(argv[3], argv[4] ? argv[4] : "output.dsk");
+    int result = mdos_overlay_flatten(disk_path, overlay_path, out_path);
+    if (result == MDOS_EINVAL) {
+        fprintf(stderr, "Error: %s is not a delta over this image\n", overlay_path);
+        return 1;
+    }
+    if (result != MDOS_EOK) {
+        print_error("flatten", result);
+        return 1;
     }
+    return 0;
+}
+
+int handle_mdz_to_dsk(const char *mdz_filename, const char *dsk_filename, int flags) {
+    printf("Converting MDZ to DSK format...\n");
+    printf("Input:  %s\n", mdz_filename);
+    printf("Output: %s\n", dsk_filename);
     
-    if (strcmp(command, "dsk2imd") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: dsk2imd requires input and output filenames\n");
-            fprintf(stderr, "Usage: %s - dsk2imd <input.dsk> <output.imd>\n", argv[0]);
-            return 1;
-        }
-        return handle_dsk_to_imd(argv[3], argv[4] ? argv[4] : "output.imd");
+    long holes = mdos_mdz_to_dsk(mdz_filename, dsk_filename, flags);
+    if (holes < 0) {
+        print_error("mdz2dsk", (int)holes);
+        return 1;
     }
     
-    /* Handle mkfs command specially (doesn't need mounting) */
-    if (strcmp(command, "mkfs") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: mkfs requires sides parameter (1 or 2)\n");
-            print_usage(argv[0]);
-            return 1;
+    printf("Left %ld bytes as holes\n", holes);
+    printf("MDZ to DSK conversion completed successfully!\n");
+    return 0;
+}
+
+/* Seconds to mount an image, read its whole linear view and unmount, rounds times */
+static double bench_decode(const char *path, long length, int rounds) {
+    uint8_t *buffer = malloc(length ? length : 1);
+    if (!buffer) {
+        return -1;
+    }
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ok = 1;
+    for (int r = 0; r < rounds && ok; r++) {
+        mdos_fs_t *fs = mdos_mount_image(path, 1);
+        ok = fs && fseek(fs->fp, 0, SEEK_SET) == 0 &&
+             fread(buffer, 1, length, fs->fp) == (size_t)length;
+        if (fs) mdos_unmount_image(fs);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    free(buffer);
+    return ok ? (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9 : -1;
+}
+
+/*
+ * Write each image as IMD and as .mdz into the temporary directory and
+ * compare the sizes and how fast a mount decodes every track of each.
+ */
+int handle_mdz_bench(int nimages, char *images[], int rounds) {
+    const char *tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char imd_path[1024], mdz_path[1024];
+    snprintf(imd_path, sizeof(imd_path), "%s/mdzbench-%d.imd", tmpdir, (int)getpid());
+    snprintf(mdz_path, sizeof(mdz_path), "%s/mdzbench-%d.mdz", tmpdir, (int)getpid());
+    
+    printf("%-24s %9s %9s %6s %9s %6s %9s %9s\n",
+           "Image", "Raw", "IMD", "ratio", "MDZ", "ratio", "IMD MB/s", "MDZ MB/s");
+    
+    long long total_raw = 0, total_imd = 0, total_mdz = 0;
+    double imd_seconds = 0, mdz_seconds = 0;
+    int failed = 0;
+    
+    for (int i = 0; i < nimages; i++) {
+        mdos_fs_t *fs = mdos_mount_image(images[i], 1);
+        if (!fs) {
+            fprintf(stderr, "Failed to mount MDOS disk: %s\n", images[i]);
+            failed++;
+            continue;
         }
+        long length = (fseek(fs->fp, 0, SEEK_END) == 0) ? ftell(fs->fp) : -1;
+        int result = (length < 0) ? MDOS_EIO : mdos_save_imd(fs, imd_path, NULL);
+        if (result == MDOS_EOK) result = mdos_save_mdz(fs, mdz_path);
+        mdos_unmount_image(fs);
         
-        int sides = atoi(argv[3]);
-        if (sides != 1 && sides != 2) {
-            fprintf(stderr, "Error: sides must be 1 (single) or 2 (double)\n");
-            return 1;
+        struct stat imd_st, mdz_st;
+        double imd_time = -1, mdz_time = -1;
+        if (result == MDOS_EOK && stat(imd_path, &imd_st) == 0 && stat(mdz_path, &mdz_st) == 0) {
+            imd_time = bench_decode(imd_path, length, rounds);
+            mdz_time = bench_decode(mdz_path, length, rounds);
+        }
+        remove(imd_path);
+        remove(mdz_path);
+        if (imd_time <= 0 || mdz_time <= 0) {
+            print_error(images[i], (result != MDOS_EOK) ? result : MDOS_EIO);
+            failed++;
+            continue;
         }
         
-        return handle_mkfs(disk_path, sides);
-    }    
-    /* Determine if we need write access */
-    int need_write = (strcmp(command, "put") == 0 || strcmp(command, "rm") == 0);
+        double mb = (double)length * rounds / (1024 * 1024);
+        printf("%-24s %9ld %9ld %5.1f%% %9ld %5.1f%% %9.1f %9.1f\n", images[i], length,
+               (long)imd_st.st_size, 100.0 * imd_st.st_size / length,
+               (long)mdz_st.st_size, 100.0 * mdz_st.st_size / length,
+               mb / imd_time, mb / mdz_time);
+        
+        total_raw += length;
+        total_imd += imd_st.st_size;
+        total_mdz += mdz_st.st_size;
+        imd_seconds += imd_time;
+        mdz_seconds += mdz_time;
+    }
     
-    /* Mount the MDOS filesystem */
-    printf("Mounting MDOS disk: %s (%s mode)\n", 
-           disk_path, need_write ? "read-write" : "read-only");
+    if (total_raw > 0 && nimages > 1) {
+        double mb = (double)total_raw * rounds / (1024 * 1024);
+        printf("%-24s %9lld %9lld %5.1f%% %9lld %5.1f%% %9.1f %9.1f\n", "Total", total_raw,
+               total_imd, 100.0 * total_imd / total_raw, total_mdz, 100.0 * total_mdz / total_raw,
+               mb / imd_seconds, mb / mdz_seconds);
+    }
+    printf("Decode: mount, read every byte of the image, unmount; %d rounds\n", rounds);
+    return failed ? 1 : 0;
+}
+
+int handle_dsk_to_imd(const char *dsk_filename, const char *imd_filename, int interleave, int skew) {
+    printf("Converting DSK to IMD format...\n");
+    printf("Input:  %s\n", dsk_filename);
+    printf("Output: %s\n", imd_filename);
     
-    mdos_fs_t *fs = mdos_mount(disk_path, !need_write);
-    if (!fs) {
-        fprintf(stderr, "Failed to mount MDOS disk: %s\n", disk_path);
-        fprintf(stderr, "Make sure the file exists and is a valid MDOS disk image.\n");
+    int result;
+    if (interleave || skew) {
+        /* The library conversion only writes 1..n; go through a mount */
+        printf("Sector interleave %d, skew %d\n", interleave ? interleave : 1, skew);
+        mdos_imd_save_opts_t opts = { 0, NULL, NULL, interleave, skew };
+        mdos_fs_t *fs = mdos_mount_image(dsk_filename, 1);
+        result = fs ? mdos_save_imd(fs, imd_filename, &opts) : MDOS_EIO;
+        if (fs) mdos_unmount_image(fs);
+    } else {
+        result = mdos_convert_dsk_to_imd(dsk_filename, imd_filename);
+    }
+    if (result != MDOS_EOK) {
+        print_error("dsk2imd", result);
         return 1;
     }
     
-    int result = 0;
+    printf("DSK to IMD conversion completed successfully!\n");
+    return 0;
+}
+
+/* Modelled seconds to read the disk with every track laid out by interleave and skew */
+static double interleave_read_seconds(const mdos_geometry_t *g, uint8_t *maps, const uint8_t *present,
+                                      int interleave, int skew, const mdos_drive_timing_t *timing) {
+    for (long t = 0; t < (long)g->cylinders * g->heads; t++) {
+        mdos_geometry_interleave_map(g, t, interleave, skew, maps + t * g->sectors);
+    }
+    return mdos_geometry_read_us(g, maps, present, timing) / 1e6;
+}
+
+/*
+ * Report the interleave and skew an image's sector maps were written with,
+ * then model a sequential read for each interleave (with the best skew for
+ * it) to show which layout suits the drive. An IMD is modelled over the
+ * tracks it holds, a DSK over the whole disk.
+ */
+int handle_interleave(const char *image_path, const mdos_drive_timing_t *timing) {
+    mdos_fs_t *fs = mdos_mount_image(image_path, 1);
+    if (!fs) {
+        fprintf(stderr, "Failed to mount MDOS disk: %s\n", image_path);
+        return 1;
+    }
+    mdos_geometry_t g;
+    int result = mdos_image_geometry(fs, &g);
+    mdos_unmount_image(fs);
+    if (result != MDOS_EOK) {
+        print_error("interleave", result);
+        return 1;
+    }
     
-    /* Dispatch commands */
-    if (strcmp(command, "ls") == 0) {
-        result = handle_ls(fs);
+    long tracks = (long)g.cylinders * g.heads;
+    uint8_t *maps = malloc(tracks * g.sectors);
+    uint8_t *present = calloc(tracks, 1);
+    if (!maps || !present) {
+        free(maps);
+        free(present);
+        print_error("interleave", MDOS_ENOSPC);
+        return 1;
     }
-    else if (strcmp(command, "cat") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: cat command requires filename\n");
-            result = 1;
-        } else {
-            result = handle_cat(fs, argv[3], 0); /* Normal mode */
+    
+    /* Recorded maps; tracks without a usable one count as 1..n */
+    mdos_imd_index_t *index = mdos_is_imd(image_path) ? mdos_imd_index_open(image_path, MDOS_IMD_INDEX_LOAD) : NULL;
+    int interleaves[256] = { 0 }, skews[256] = { 0 };
+    int recorded = 0, previous_first = -1;
+    for (long t = 0; t < tracks; t++) {
+        uint8_t map[255];
+        int count = index ? mdos_imd_sector_map(index, t / g.heads, t % g.heads, map) : MDOS_ENOENT;
+        present[t] = !index || count > 0;
+        int interleave = (count == g.sectors) ? mdos_geometry_detect_interleave(map, count, g.first_sector) : 0;
+        if (interleave == 0) {
+            mdos_geometry_interleave_map(&g, t, 1, 0, maps + t * g.sectors);
+            previous_first = -1;
+            continue;
         }
+        memcpy(maps + t * g.sectors, map, count);
+        interleaves[interleave]++;
+        recorded++;
+        
+        int first = 0;
+        while (map[first] != g.first_sector) first++;
+        if (previous_first >= 0) skews[(first - previous_first + count) % count]++;
+        previous_first = first;
     }
-    else if (strcmp(command, "rawcat") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: rawcat command requires filename\n");
-            result = 1;
-        } else {
-            result = handle_cat(fs, argv[3], 1); /* Raw mode */
+    mdos_imd_index_close(index);
+    
+    printf("Interleave analysis: %s\n", image_path);
+    printf("Geometry: %d cylinders, %d head(s), %d sectors of %d bytes\n",
+           g.cylinders, g.heads, g.sectors, g.sector_size);
+    if (recorded == 0) {
+        printf("Recorded sector maps: none (DSK images keep no sector order)\n");
+    } else {
+        printf("Recorded sector maps: %d of %ld tracks\n", recorded, tracks);
+        for (int i = 1; i < 256; i++) {
+            if (interleaves[i]) printf("  Interleave %d: %d tracks\n", i, interleaves[i]);
         }
-    }
-    else if (strcmp(command, "get") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: get command requires MDOS filename\n");
-            result = 1;
-        } else {
-            const char *local_name = (argc > 4) ? argv[4] : argv[3];
-            result = handle_get(fs, argv[3], local_name);
+        int skew = 0;
+        for (int i = 1; i < 256; i++) {
+            if (skews[i] > skews[skew]) skew = i;
         }
+        printf("  Skew: %d (between %d of the track pairs)\n", skew, skews[skew]);
     }
-    else if (strcmp(command, "put") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: put command requires local filename\n");
-            result = 1;
-        } else {
-            const char *mdos_name = (argc > 4) ? argv[4] : NULL;
-            result = handle_put(fs, argv[3], mdos_name);
+    
+    printf("\nDrive model: %.0f rpm (%.1f ms per revolution), host %.1f ms per sector, step %.1f ms\n",
+           timing->rpm, 60000.0 / timing->rpm, timing->host_ms, timing->step_ms);
+    double current = mdos_geometry_read_us(&g, maps, present, timing) / 1e6;
+    printf("Sequential read as recorded: %.1f s\n\n", current);
+    
+    printf("Interleave  Skew  Read time\n");
+    int best_interleave = 1, best_skew = 0;
+    double best = 0;
+    int last = (g.sectors / 2 > 1) ? g.sectors / 2 : 1;
+    for (int interleave = 1; interleave <= last; interleave++) {
+        int row_skew = 0;
+        double row = 0;
+        for (int skew = 0; skew < g.sectors; skew++) {
+            double seconds = interleave_read_seconds(&g, maps, present, interleave, skew, timing);
+            if (skew == 0 || seconds < row) {
+                row = seconds;
+                row_skew = skew;
+            }
         }
-    }
-    else if (strcmp(command, "info") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: info command requires filename\n");
-            result = 1;
-        } else {
-            result = handle_info(fs, argv[3]);
+        printf("%10d  %4d  %7.1f s\n", interleave, row_skew, row);
+        if (interleave == 1 || row < best) {
+            best = row;
+            best_interleave = interleave;
+            best_skew = row_skew;
         }
     }
-    else if (strcmp(command, "seek") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: seek command requires filename\n");
-            result = 1;
-        } else {
-            result = handle_seek(fs, argv[3]);
-        }
+    printf("\nFastest: --interleave %d --skew %d (%.1f s, %.1fx faster than recorded)\n",
+           best_interleave, best_skew, best, current / best);
+    
+    free(present);
+    free(maps);
+    return 0;
+}
+
+/* archive add|get|ls: the deduplicating image store */
+int handle_archive(const char *action, const char *store_path, int nargs, char *args[]) {
+    int add = strcmp(action, "add") == 0;
+    mdos_archive_t *archive = mdos_archive_open(store_path, add);
+    if (!archive) {
+        fprintf(stderr, "Error: cannot open archive store '%s'\n", store_path);
+        return 1;
     }
-    else if (strcmp(command, "free") == 0) {
+
+    int result;
+    if (add) {
+        int jobs = 0, nimages = 0;
+        for (int i = 0; i < nargs; i++) {
+            if (strcmp(args[i], "--jobs") == 0 && i + 1 < nargs) {
+                jobs = atoi(args[++i]);
+            } else {
+                args[nimages++] = args[i];
+            }
+        }
+        mdos_archive_stats_t stats;
+        result = mdos_archive_add(archive, args, nimages, jobs, &stats, stdout);
+        printf("Added %d of %d images: %lld bytes, %ld chunks referenced, "
+               "%ld new (%lld bytes appended)\n",
+               stats.images, nimages, stats.bytes, stats.chunks, stats.chunks_new, stats.bytes_new);
+    } else if (strcmp(action, "get") == 0) {
+        result = mdos_archive_get(archive, args[0], args[1]);
+        if (result == MDOS_EOK) {
+            printf("Rebuilt %s as %s\n", args[0], args[1]);
+        }
+    } else {
+        result = mdos_archive_list(archive, stdout);
+    }
+
+    int closed = mdos_archive_close(archive);
+    if (result == MDOS_EOK) result = closed;
+    if (result != MDOS_EOK) {
+        print_error("archive", result);
+        return 1;
+    }
+    return 0;
+}
+
+/* Parse "--name=value" or "--name value"; returns the value or NULL */
+static const char* option_value(const char *name, int argc, char *argv[], int *i) {
+    size_t n = strlen(name);
+    if (strncmp(argv[*i], name, n) != 0) {
+        return NULL;
+    }
+    if (argv[*i][n] == '=') {
+        return argv[*i] + n + 1;
+    }
+    if (argv[*i][n] == '\0' && *i + 1 < argc) {
+        return argv[++*i];
+    }
+    return NULL;
+}
+
+/* catalog build|find: the collection-wide file index */
+int handle_catalog(const char *action, int argc, char *argv[]) {
+    const char *catalog_path = getenv("MDOS_CATALOG") ? getenv("MDOS_CATALOG") : MDOS_CATALOG_FILE;
+    mdos_catalog_query_t query = { NULL, NULL, -1, -1 };
+    const char *arg = NULL;
+    
+    for (int i = 0; i < argc; i++) {
+        const char *value;
+        if ((value = option_value("--catalog", argc, argv, &i))) {
+            catalog_path = value;
+        } else if ((value = option_value("--load", argc, argv, &i))) {
+            query.load = strtol(value, NULL, 0);
+        } else if ((value = option_value("--start", argc, argv, &i))) {
+            query.start = strtol(value, NULL, 0);
+        } else if ((value = option_value("--user", argc, argv, &i))) {
+            query.user = value;
+        } else if (argv[i][0] == '-' || arg) {
+            fprintf(stderr, "Error: Unknown catalog argument '%s'\n", argv[i]);
+            return 1;
+        } else {
+            arg = argv[i];
+        }
+    }
+    
+    if (strcmp(action, "build") == 0) {
+        if (!arg) {
+            fprintf(stderr, "Error: catalog build requires a directory\n");
+            return 1;
+        }
+        mdos_catalog_stats_t stats;
+        int result = mdos_catalog_build(catalog_path, arg, &stats, stdout);
+        if (result != MDOS_EOK) {
+            print_error("catalog", result);
+            return 1;
+        }
+        printf("%s: %d images, %ld files (%d parsed, %d unchanged, %d rehashed, %d dropped)\n",
+               catalog_path, stats.images, stats.files, stats.parsed, stats.unchanged,
+               stats.rehashed, stats.dropped);
+        return 0;
+    }
+    
+    query.pattern = arg;
+    long matches = mdos_catalog_find(catalog_path, &query, stdout);
+    if (matches < 0) {
+        print_error("catalog", (int)matches);
+        return 1;
+    }
+    return matches > 0 ? 0 : 1;
+}
+
+/* grep: exit status 0 lines found, 1 none, 2 trouble (as grep(1)) */
+int handle_grep(int argc, char *argv[]) {
+    const char *pattern = NULL;
+    int flags = 0, jobs = 0, nimages = 0;
+    for (int i = 0; i < argc; i++) {
+        const char *value;
+        if (strcmp(argv[i], "-i") == 0) {
+            flags |= MDOS_GREP_ICASE;
+        } else if ((value = option_value("--jobs", argc, argv, &i))) {
+            jobs = atoi(value);
+        } else if (!pattern) {
+            pattern = argv[i];
+        } else {
+            argv[nimages++] = argv[i];
+        }
+    }
+    if (!pattern || !*pattern || nimages == 0) {
+        fprintf(stderr, "Error: grep requires a pattern and at least one image\n");
+        return 2;
+    }
+    
+    mdos_grep_stats_t stats;
+    long matches = mdos_grep(pattern, argv, nimages, jobs, flags, &stats, stdout, stderr);
+    if (matches < 0) {
+        print_error("grep", (int)matches);
+        return 2;
+    }
+    return stats.failed ? 2 : (matches ? 0 : 1);
+}
+
+int handle_imd_index(const char *imd_filename, int argc, char *argv[]) {
+    /* With coordinates: fetch one sector through the (sidecar) index */
+    if (argc == 3) {
+        int cylinder = atoi(argv[0]), head = atoi(argv[1]), sector = atoi(argv[2]);
+        mdos_imd_index_t *index = mdos_imd_index_open(imd_filename, MDOS_IMD_INDEX_LOAD);
+        if (!index) {
+            print_error("imdindex", MDOS_EIO);
+            return 1;
+        }
+
+        uint8_t buf[MDOS_SECTOR_SIZE << 6];
+        int size = mdos_imd_read_sector(index, cylinder, head, sector, buf);
+        mdos_imd_index_close(index);
+        if (size < 0) {
+            print_error("imdindex", size);
+            return 1;
+        }
+
+        printf("Cylinder %d, head %d, sector %d (%d bytes):\n", cylinder, head, sector, size);
+        for (int i = 0; i < size; i += 16) {
+            printf("%04X:", i);
+            for (int j = i; j < i + 16 && j < size; j++) {
+                printf(" %02X", buf[j]);
+            }
+            printf("\n");
+        }
+        return 0;
+    }
+
+    printf("Indexing IMD file: %s\n", imd_filename);
+    mdos_imd_index_t *index = mdos_imd_index_open(imd_filename, MDOS_IMD_INDEX_SAVE);
+    if (!index) {
+        print_error("imdindex", MDOS_EIO);
+        return 1;
+    }
+    mdos_imd_index_close(index);
+
+    printf("Sidecar written: %s%s\n", imd_filename, MDOS_IMD_SIDECAR_EXT);
+    return 0;
+}
+
+int handle_rm(mdos_fs_t *fs, const char *filename) {
+    printf("Deleting '%s'...\n", filename);
+    
+    /* Check if file exists first */
+    mdos_file_info_t info;
+    int stat_result = mdos_stat(fs, filename, &info);
+    if (stat_result != MDOS_EOK) {
+        print_error("stat", stat_result);
+        return 1;
+    }
+    
+    printf("File found: %d bytes, type %d\n", info.size, info.type);
+    
+    int result = mdos_unlink(fs, filename);
+    if (result != MDOS_EOK) {
+        print_error("rm", result);
+        return 1;
+    }
+    
+    printf("File '%s' deleted successfully\n", filename);
+    return 0;
+}
+
+/* Case-insensitive match of an MDOS filename against a pattern with * and ? */
+int match_pattern(const char *name, const char *pattern) {
+    while (*pattern) {
+        if (*pattern == '*') {
+            while (*pattern == '*') pattern++;
+            if (*pattern == '\0') return 1;
+            for (; *name; name++) {
+                if (match_pattern(name, pattern)) return 1;
+            }
+            return 0;
+        }
+        if (*name == '\0') return 0;
+        if (*pattern != '?' && tolower((unsigned char)*pattern) != tolower((unsigned char)*name)) {
+            return 0;
+        }
+        name++;
+        pattern++;
+    }
+    return *name == '\0';
+}
+
+/* Resolve patterns once against the directory; returns the number of matches */
+int match_directory(mdos_fs_t *fs, char **patterns, int npatterns,
+                    mdos_file_info_t **matches) {
+    mdos_file_info_t *files;
+    int count;
+    
+    int result = mdos_readdir(fs, &files, &count);
+    if (result != MDOS_EOK) {
+        print_error("readdir", result);
+        return -1;
+    }
+    
+    int matched = 0;
+    for (int i = 0; i < count; i++) {
+        for (int p = 0; p < npatterns; p++) {
+            if (match_pattern(files[i].name, patterns[p])) {
+                files[matched++] = files[i];
+                break;
+            }
+        }
+    }
+    
+    *matches = files;
+    return matched;
+}
+
+int handle_mget(mdos_fs_t *fs, const char *pattern, const char *out_dir) {
+    char *patterns[] = { (char *)pattern };
+    mdos_file_info_t *files;
+    
+    int count = match_directory(fs, patterns, 1, &files);
+    if (count < 0) return 1;
+    if (count == 0) {
+        fprintf(stderr, "No files match '%s'\n", pattern);
+        free(files);
+        return 1;
+    }
+    
+    struct stat st;
+    if (stat(out_dir, &st) != 0 && mkdir(out_dir, 0755) != 0) {
+        perror(out_dir);
+        free(files);
+        return 1;
+    }
+    
+    printf("Exporting %d files matching '%s' to '%s'...\n", count, pattern, out_dir);
+    
+    int failed = 0;
+    long total = 0;
+    for (int i = 0; i < count; i++) {
+        char local_name[1024];
+        snprintf(local_name, sizeof(local_name), "%s/%s", out_dir, files[i].name);
+        
+        int result = mdos_export_file(fs, files[i].name, local_name);
+        if (result < 0) {
+            fprintf(stderr, "  %s: %s\n", files[i].name, mdos_strerror(result));
+            failed++;
+        } else {
+            printf("  %-12s %8d bytes\n", files[i].name, result);
+            total += result;
+        }
+    }
+    
+    printf("Exported %d files, %ld bytes", count - failed, total);
+    if (failed) printf(", %d failed", failed);
+    printf("\n");
+    
+    free(files);
+    return failed ? 1 : 0;
+}
+
+/* Add one local path to the import set, expanding globs the shell left alone */
+int collect_local_files(const char *arg, char ***paths, int *count, int *capacity) {
+    glob_t g;
+    int has_magic = strpbrk(arg, "*?[") != NULL;
+    
+    if (has_magic) {
+        if (glob(arg, 0, NULL, &g) != 0) {
+            fprintf(stderr, "No local files match '%s'\n", arg);
+            return -1;
+        }
+    }
+    
+    size_t n = has_magic ? g.gl_pathc : 1;
+    for (size_t i = 0; i < n; i++) {
+        if (*count == *capacity) {
+            int new_capacity = *capacity ? *capacity * 2 : 64;
+            char **grown = realloc(*paths, new_capacity * sizeof(char *));
+            if (!grown) {
+                if (has_magic) globfree(&g);
+                return -1;
+            }
+            *paths = grown;
+            *capacity = new_capacity;
+        }
+        (*paths)[(*count)++] = strdup(has_magic ? g.gl_pathv[i] : arg);
+    }
+    
+    if (has_magic) globfree(&g);
+    return 0;
+}
+
+int handle_mput(mdos_fs_t *fs, int nargs, char *args[]) {
+    char **paths = NULL;
+    int count = 0, capacity = 0;
+    int result = 0;
+    
+    for (int i = 0; i < nargs; i++) {
+        if (collect_local_files(args[i], &paths, &count, &capacity) != 0) {
+            result = 1;
+            goto out;
+        }
+    }
+    
+    mdos_bulk_file_t *files = calloc(count, sizeof(mdos_bulk_file_t));
+    if (!files) {
+        result = 1;
+        goto out;
+    }
+    
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        int load_result = mdos_bulk_load_file(paths[i], NULL, &files[i]);
+        if (load_result != MDOS_EOK) {
+            fprintf(stderr, "Error: cannot load '%s': %s\n", paths[i], mdos_strerror(load_result));
+            result = 1;
+            break;
+        }
+        total += files[i].size;
+    }
+    
+    if (result == 0) {
+        printf("Importing %d files (%lu bytes)...\n", count, (unsigned long)total);
+        
+        int import_result = mdos_bulk_import(fs, files, count);
+        if (import_result != MDOS_EOK) {
+            print_error("mput", import_result);
+            result = 1;
+        } else {
+            for (int i = 0; i < count; i++) {
+                printf("  %-24s -> %-12s %8lu bytes (RIB %d)\n", paths[i], files[i].name,
+                       (unsigned long)files[i].size, files[i].rib_sector);
+            }
+            printf("Successfully imported %d files\n", count);
+        }
+    }
+    
+    mdos_bulk_free(files, count);
+    free(files);
+    
+out:
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    return result;
+}
+
+int handle_mrm(mdos_fs_t *fs, int npatterns, char *patterns[]) {
+    mdos_file_info_t *files;
+    
+    int count = match_directory(fs, patterns, npatterns, &files);
+    if (count < 0) return 1;
+    if (count == 0) {
+        fprintf(stderr, "No files match\n");
+        free(files);
+        return 1;
+    }
+    
+    const char **names = malloc(count * sizeof(char *));
+    if (!names) {
+        free(files);
+        return 1;
+    }
+    
+    printf("Deleting %d files...\n", count);
+    for (int i = 0; i < count; i++) {
+        names[i] = files[i].name;
+        printf("  %-12s %8d bytes\n", files[i].name, files[i].size);
+    }
+    
+    int result = mdos_bulk_unlink(fs, names, count);
+    free(names);
+    free(files);
+    
+    if (result != MDOS_EOK) {
+        print_error("mrm", result);
+        return 1;
+    }
+    
+    printf("Deleted %d files\n", count);
+    return 0;
+}
+
+/*
+ * Stream for binary data written to standard output. The first call moves
+ * stdout onto stderr, so status messages cannot corrupt the data.
+ */
+FILE *data_stdout(void) {
+    static FILE *stream = NULL;
+    
+    if (!stream) {
+        fflush(stdout);
+        int fd = dup(STDOUT_FILENO);
+        if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            return NULL;
+        }
+        stream = fdopen(fd, "wb");
+    }
+    return stream;
+}
+
+int handle_export_tar(mdos_fs_t *fs, const char *tar_path) {
+    int to_stdout = strcmp(tar_path, "-") == 0;
+    FILE *out = to_stdout ? data_stdout() : fopen(tar_path, "wb");
+    if (!out) {
+        perror(tar_path);
+        return 1;
+    }
+    
+    printf("Exporting all files to tar '%s'...\n", tar_path);
+    
+    int result = mdos_export_tar(fs, out, stdout);
+    if (!to_stdout && fclose(out) != 0 && result >= 0) {
+        result = MDOS_EIO;
+    }
+    if (result < 0) {
+        print_error("export-tar", result);
+        return 1;
+    }
+    
+    printf("Exported %d files\n", result);
+    return 0;
+}
+
+int handle_import_tar(mdos_fs_t *fs, const char *tar_path) {
+    int from_stdin = strcmp(tar_path, "-") == 0;
+    FILE *in = from_stdin ? stdin : fopen(tar_path, "rb");
+    if (!in) {
+        perror(tar_path);
+        return 1;
+    }
+    
+    printf("Importing files from tar '%s'...\n", tar_path);
+    
+    int result = mdos_import_tar(fs, in, stdout);
+    if (!from_stdin) fclose(in);
+    if (result < 0) {
+        print_error("import-tar", result);
+        return 1;
+    }
+    
+    printf("Imported %d files\n", result);
+    return 0;
+}
+
+int handle_save_imd(mdos_fs_t *fs, int nargs, char *args[]) {
+    mdos_imd_save_opts_t opts = { 0, NULL, NULL, 0, 0 };
+    
+    for (int i = 2; i < nargs; i++) {
+        if (strcmp(args[i], "--interleave") == 0 && i + 1 < nargs) {
+            opts.interleave = atoi(args[++i]);
+        } else if (strcmp(args[i], "--skew") == 0 && i + 1 < nargs) {
+            opts.skew = atoi(args[++i]);
+        } else if (strcmp(args[i], "--preserve") == 0) {
+            opts.preserve = 1;
+        } else if (strcmp(args[i], "--source") == 0 && i + 1 < nargs) {
+            opts.source = args[++i];
+            opts.preserve = 1;
+        } else if (strcmp(args[i], "--comment") == 0 && i + 1 < nargs) {
+            opts.comment = args[++i];
+        } else {
+            fprintf(stderr, "Error: Unknown save-imd option '%s'\n", args[i]);
+            return 1;
+        }
+    }
+    
+    printf("Saving image as IMD: %s%s\n", args[1], opts.preserve ? " (preserving comment and track modes)" : "");
+    if (opts.interleave || opts.skew) {
+        printf("Sector interleave %d, skew %d\n", opts.interleave ? opts.interleave : 1, opts.skew);
+    }
+    
+    int result = mdos_save_imd(fs, args[1], &opts);
+    if (result != MDOS_EOK) {
+        print_error("save-imd", result);
+        return 1;
+    }
+    return 0;
+}
+
+int handle_save_mdz(mdos_fs_t *fs, const char *mdz_filename) {
+    printf("Saving image as MDZ: %s\n", mdz_filename);
+    
+    int result = mdos_save_mdz(fs, mdz_filename);
+    if (result != MDOS_EOK) {
+        print_error("save-mdz", result);
+        return 1;
+    }
+    
+    struct stat st;
+    if (stat(mdz_filename, &st) == 0) {
+        printf("Wrote %ld bytes\n", (long)st.st_size);
+    }
+    return 0;
+}
+
+int handle_sync(mdos_fs_t *fs, const char *local_dir, int delete_missing) {
+    mdos_sync_stats_t stats;
+    
+    printf("Syncing '%s' into image%s...\n", local_dir, delete_missing ? " (with delete)" : "");
+    
+    int result = mdos_sync_dir(fs, local_dir, delete_missing, &stats, stdout);
+    if (result != MDOS_EOK) {
+        print_error("sync", result);
+        return 1;
+    }
+    
+    printf("%d unchanged, %d updated in place, %d reallocated, %d added, %d deleted\n",
+           stats.unchanged, stats.updated, stats.replaced, stats.added, stats.deleted);
+    printf("%ld bytes written\n", stats.bytes_written);
+    return 0;
+}
+
+/* Commands that modify the image and therefore need a read-write mount */
+int command_needs_write(const char *command) {
+    return (strcmp(command, "put") == 0 || strcmp(command, "rm") == 0 ||
+            strcmp(command, "mput") == 0 || strcmp(command, "mrm") == 0 ||
+            strcmp(command, "import-tar") == 0 || strcmp(command, "sync") == 0);
+}
+
+/*
+ * Run one filesystem command against an already mounted image.
+ * args[0] is the command name, args[1..nargs-1] its arguments.
+ */
+int dispatch_command(mdos_fs_t *fs, int nargs, char *args[]) {
+    const char *command = args[0];
+    int result = 0;
+    
+    if (strcmp(command, "ls") == 0) {
+        result = handle_ls(fs);
+    }
+    else if (strcmp(command, "cat") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: cat command requires filename\n");
+            result = 1;
+        } else {
+            result = handle_cat(fs, args[1], 0); /* Normal mode */
+        }
+    }
+    else if (strcmp(command, "rawcat") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: rawcat command requires filename\n");
+            result = 1;
+        } else {
+            result = handle_cat(fs, args[1], 1); /* Raw mode */
+        }
+    }
+    else if (strcmp(command, "get") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: get command requires MDOS filename\n");
+            result = 1;
+        } else {
+            const char *local_name = (nargs > 2) ? args[2] : args[1];
+            result = handle_get(fs, args[1], local_name);
+        }
+    }
+    else if (strcmp(command, "put") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: put command requires local filename\n");
+            result = 1;
+        } else {
+            const char *mdos_name = (nargs > 2) ? args[2] : NULL;
+            result = handle_put(fs, args[1], mdos_name);
+        }
+    }
+    else if (strcmp(command, "info") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: info command requires filename\n");
+            result = 1;
+        } else {
+            result = handle_info(fs, args[1]);
+        }
+    }
+    else if (strcmp(command, "seek") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: seek command requires filename\n");
+            result = 1;
+        } else {
+            result = handle_seek(fs, args[1]);
+        }
+    }
+    else if (strcmp(command, "free") == 0) {
         result = handle_free(fs);
     }
-    else if (strcmp(command, "rm") == 0) {
-        if (argc < 4) {
-            fprintf(stderr, "Error: rm command requires filename\n");
+    else if (strcmp(command, "rm") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: rm command requires filename\n");
+            result = 1;
+        } else {
+            result = handle_rm(fs, args[1]);
+        }
+    }
+    else if (strcmp(command, "mget") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: mget command requires a pattern\n");
+            result = 1;
+        } else {
+            result = handle_mget(fs, args[1], (nargs > 2) ? args[2] : ".");
+        }
+    }
+    else if (strcmp(command, "mput") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: mput command requires local filenames\n");
+            result = 1;
+        } else {
+            result = handle_mput(fs, nargs - 1, args + 1);
+        }
+    }
+    else if (strcmp(command, "mrm") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: mrm command requires a pattern\n");
+            result = 1;
+        } else {
+            result = handle_mrm(fs, nargs - 1, args + 1);
+        }
+    }
+    else if (strcmp(command, "save-imd") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: save-imd command requires an output filename\n");
+            result = 1;
+        } else {
+            result = handle_save_imd(fs, nargs, args);
+        }
+    }
+    else if (strcmp(command, "save-mdz") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: save-mdz command requires an output filename\n");
+            result = 1;
+        } else {
+            result = handle_save_mdz(fs, args[1]);
+        }
+    }
+    else if (strcmp(command, "sync") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: sync command requires a local directory\n");
+            result = 1;
+        } else if (nargs > 2 && strcmp(args[2], "--delete") != 0) {
+            fprintf(stderr, "Error: Unknown sync option '%s'\n", args[2]);
+            result = 1;
+        } else {
+            result = handle_sync(fs, args[1], nargs > 2);
+        }
+    }
+    else if (strcmp(command, "export-tar") == 0) {
+        result = handle_export_tar(fs, (nargs > 1) ? args[1] : "-");
+    }
+    else if (strcmp(command, "import-tar") == 0) {
+        if (nargs < 2) {
+            fprintf(stderr, "Error: import-tar command requires a tar filename (or - for stdin)\n");
+            result = 1;
+        } else {
+            result = handle_import_tar(fs, args[1]);
+        }
+    }
+    else {
+        fprintf(stderr, "Error: Unknown command '%s'\n", command);
+        result = 2; /* Distinguish usage errors from failed operations */
+    }
+    
+    return result;
+}
+
+/* One parsed line of a batch script */
+typedef struct {
+    int line;                       /* Line number in the script */
+    int nargs;
+    char *args[BATCH_MAX_ARGS];
+} batch_command_t;
+
+typedef struct {
+    batch_command_t *commands;
+    int count;
+    int capacity;
+    char *text;                     /* Whole script; args point into it */
+} batch_script_t;
+
+/*
+ * Split a script line into arguments in place.  Arguments are separated by
+ * blanks and may be enclosed in double quotes; '#' starts a comment.
+ */
+int split_batch_line(char *line, char *args[], int max_args) {
+    int nargs = 0;
+    char *p = line;
+    
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+        if (*p == '\0' || *p == '#') break;
+        
+        if (nargs == max_args) return -1;
+        
+        if (*p == '"') {
+            args[nargs++] = ++p;
+            while (*p && *p != '"') p++;
+            if (*p == '\0') return -1; /* Unterminated quote */
+        } else {
+            args[nargs++] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r') p++;
+        }
+        if (*p) *p++ = '\0';
+    }
+    
+    return nargs;
+}
+
+void free_batch_script(batch_script_t *script) {
+    free(script->commands);
+    free(script->text);
+    memset(script, 0, sizeof(*script));
+}
+
+/* Read a whole batch script ("-" = stdin) and split it into commands */
+int load_batch_script(const char *script_path, batch_script_t *script) {
+    memset(script, 0, sizeof(*script));
+    
+    FILE *fp = (strcmp(script_path, "-") == 0) ? stdin : fopen(script_path, "r");
+    if (!fp) {
+        perror(script_path);
+        return -1;
+    }
+    
+    size_t size = 0, capacity = 4096;
+    script->text = malloc(capacity);
+    while (script->text) {
+        if (size + 1 >= capacity) {
+            char *grown = realloc(script->text, capacity * 2);
+            if (!grown) break;
+            script->text = grown;
+            capacity *= 2;
+        }
+        size_t n = fread(script->text + size, 1, capacity - size - 1, fp);
+        if (n == 0) break;
+        size += n;
+    }
+    if (fp != stdin) fclose(fp);
+    
+    if (!script->text) {
+        fprintf(stderr, "Error: out of memory reading batch script\n");
+        return -1;
+    }
+    script->text[size] = '\0';
+    
+    int line_number = 0;
+    char *line = script->text;
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line_number++;
+        
+        batch_command_t cmd;
+        cmd.line = line_number;
+        cmd.nargs = split_batch_line(line, cmd.args, BATCH_MAX_ARGS);
+        if (cmd.nargs < 0) {
+            fprintf(stderr, "Error: %s:%d: malformed command line\n", script_path, line_number);
+            free_batch_script(script);
+            return -1;
+        }
+        
+        if (cmd.nargs > 0) {
+            if (script->count == script->capacity) {
+                int new_capacity = script->capacity ? script->capacity * 2 : 64;
+                batch_command_t *grown = realloc(script->commands, 
+                                                 new_capacity * sizeof(batch_command_t));
+                if (!grown) {
+                    fprintf(stderr, "Error: out of memory reading batch script\n");
+                    free_batch_script(script);
+                    return -1;
+                }
+                script->commands = grown;
+                script->capacity = new_capacity;
+            }
+            script->commands[script->count++] = cmd;
+        }
+        
+        line = next;
+    }
+    
+    return 0;
+}
+
+/*
+ * Copy the image so an atomic batch can work on a scratch version. Zero
+ * sectors stay holes in the copy, so a sparse DSK does not become fully
+ * allocated.
+ */
+int copy_image_file(const char *src_path, const char *dst_path) {
+    FILE *src = fopen(src_path, "rb");
+    if (!src) {
+        perror(src_path);
+        return -1;
+    }
+    
+    long length = (fseek(src, 0, SEEK_END) == 0) ? ftell(src) : -1;
+    uint8_t *image = (length >= 0) ? malloc(length ? length : 1) : NULL;
+    int result = (image && mdos_sparse_read(src, image, length) >= 0) ? 0 : -1;
+    fclose(src);
+    
+    if (result == 0) {
+        FILE *dst = fopen(dst_path, "wb");
+        if (!dst) {
+            perror(dst_path);
+            free(image);
+            return -1;
+        }
+        if (mdos_sparse_write(dst, image, length, 0) < 0) result = -1;
+        if (fclose(dst) != 0) result = -1;
+        if (result != 0) remove(dst_path);
+    }
+    free(image);
+    
+    if (result != 0) {
+        fprintf(stderr, "Error: cannot copy %s to %s\n", src_path, dst_path);
+    }
+    return result;
+}
+
+/* Start a phase of the --stats report and the --trace timeline */
+static void phase(const char *name) {
+    mdos_stats_phase(name);
+    mdos_trace_phase(name);
+}
+
+/* Mount the image, or with --overlay the image under its delta */
+static mdos_fs_t* mount_disk(const char *disk_path, const char *overlay_path, int read_only) {
+    return overlay_path ? mdos_mount_overlay(disk_path, overlay_path)
+                        : mdos_mount_image(disk_path, read_only);
+}
+
+/*
+ * Execute a script of commands under a single mount.  The image is synced
+ * once at the end instead of after every command.  In atomic mode the
+ * commands run against a scratch copy of the image which only replaces the
+ * original when every command succeeded; over an overlay, the delta is the
+ * file that gets copied.
+ */
+int handle_batch(const char *disk_path, const char *overlay_path, const char *script_path, int atomic) {
+    batch_script_t script;
+    if (load_batch_script(script_path, &script) != 0) {
+        return 1;
+    }
+    
+    int need_write = 0;
+    for (int i = 0; i < script.count; i++) {
+        const char *command = script.commands[i].args[0];
+        if (strcmp(command, "mkfs") == 0 || strcmp(command, "imd2dsk") == 0 ||
+            strcmp(command, "dsk2imd") == 0 || strcmp(command, "pack") == 0 ||
+            strcmp(command, "punch") == 0 || strcmp(command, "mdz2dsk") == 0 ||
+            strcmp(command, "mdzbench") == 0 || strcmp(command, "interleave") == 0 ||
+            strcmp(command, "archive") == 0 || strcmp(command, "catalog") == 0 ||
+            strcmp(command, "manifest") == 0 || strcmp(command, "verify") == 0 ||
+            strcmp(command, "diff") == 0 || strcmp(command, "patch") == 0 ||
+            strcmp(command, "commit") == 0 || strcmp(command, "flatten") == 0 ||
+            strcmp(command, "grep") == 0 || strcmp(command, "fsck") == 0 ||
+            strcmp(command, "recover") == 0 || strcmp(command, "damage") == 0 ||
+            strcmp(command, "gen") == 0) {
+            fprintf(stderr, "Error: %s:%d: '%s' cannot be used in batch mode\n",
+                    script_path, script.commands[i].line, command);
+            free_batch_script(&script);
+            return 1;
+        }
+        if (command_needs_write(command)) need_write = 1;
+    }
+    
+    /* Atomic mode only matters when something is written */
+    char work_path[1024];
+    const char *target_path = overlay_path ? overlay_path : disk_path;
+    const char *mount_path = target_path;
+    if (atomic && need_write) {
+        snprintf(work_path, sizeof(work_path), "%s.batch", target_path);
+        if (overlay_path && access(overlay_path, F_OK) != 0) {
+            remove(work_path);      /* No delta yet: the mount starts a fresh one */
+        } else if (copy_image_file(target_path, work_path) != 0) {
+            free_batch_script(&script);
+            return 1;
+        }
+        mount_path = work_path;
+    }
+    
+    printf("Mounting MDOS disk: %s (%s mode, batch of %d commands%s%s)\n",
+           disk_path, need_write ? "read-write" : "read-only", script.count,
+           (mount_path != target_path) ? ", atomic" : "", overlay_path ? ", overlay" : "");
+    
+    phase("mount");
+    mdos_fs_t *fs = overlay_path ? mount_disk(disk_path, mount_path, 0)
+                                 : mount_disk(mount_path, NULL, !need_write);
+    if (!fs) {
+        fprintf(stderr, "Failed to mount MDOS disk: %s\n", disk_path);
+        fprintf(stderr, "Make sure the file exists and is a valid MDOS disk image.\n");
+        if (mount_path != target_path) remove(mount_path);
+        free_batch_script(&script);
+        return 1;
+    }
+    
+    int failed = 0;
+    int executed = 0;
+    phase("batch");
+    for (int i = 0; i < script.count; i++) {
+        batch_command_t *cmd = &script.commands[i];
+        
+        printf("\n[%d] %s", cmd->line, cmd->args[0]);
+        for (int a = 1; a < cmd->nargs; a++) {
+            printf(" %s", cmd->args[a]);
+        }
+        printf("\n");
+        
+        executed++;
+        if (dispatch_command(fs, cmd->nargs, cmd->args) != 0) {
+            fprintf(stderr, "Error: %s:%d: command '%s' failed\n",
+                    script_path, cmd->line, cmd->args[0]);
+            failed++;
+            if (atomic) break;
+        }
+    }
+    
+    int result = (failed > 0) ? 1 : 0;
+    
+    if (need_write && !(atomic && failed)) {
+        phase("sync");
+        int sync_result = mdos_sync(fs);
+        if (sync_result != MDOS_EOK) {
+            print_error("sync", sync_result);
             result = 1;
+        }
+    }
+    
+    phase("unmount");
+    int unmount_result = mdos_unmount_image(fs);
+    if (unmount_result != MDOS_EOK) {
+        print_error("unmount", unmount_result);
+        result = 1;
+    }
+    
+    if (mount_path != target_path) {
+        if (result == 0) {
+            struct stat st;
+            if (stat(target_path, &st) == 0) {
+                chmod(mount_path, st.st_mode & 07777); /* The rename must not change the permissions */
+            }
+            if (rename(mount_path, target_path) != 0) {
+                perror("rename");
+                remove(mount_path);
+                result = 1;
+            }
         } else {
-            result = handle_rm(fs, argv[3]);
+            remove(mount_path);
+            printf("\nBatch aborted, %s left untouched.\n", target_path);
         }
     }
-    else {
-        fprintf(stderr, "Error: Unknown command '%s'\n", command);
+    
+    printf("\nBatch summary: %d of %d commands executed, %d failed\n",
+           executed, script.count, failed);
+    
+    free_batch_script(&script);
+    return result;
+}
+
+/* --stats[=json]: counters and phase times on stderr at exit */
+static int stats_format;
+
+static void print_stats(void) {
+    fflush(stdout);
+    mdos_stats_print(stderr, stats_format);
+}
+
+/* --trace FILE: the timeline, written at exit */
+static const char *trace_path;
+
+static void write_trace(void) {
+    if (mdos_trace_finish() != 0) {
+        fprintf(stderr, "Error: cannot write trace %s\n", trace_path);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    /* --stats and --trace may appear anywhere and are dropped before anything else parses */
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        int format = mdos_stats_option(argv[i]);
+        const char *path;
+        if (format) {
+            stats_format = format;
+        } else if ((path = mdos_trace_option(argc, argv, &i))) {
+            trace_path = path;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    argc = kept;
+    if (stats_format) {
+        atexit(print_stats);
+    }
+    if (trace_path) {
+        if (mdos_trace_start(trace_path, "mdostool") != 0) {
+            fprintf(stderr, "Error: tracing is not available in this build\n");
+            return 1;
+        }
+        atexit(write_trace);
+    }
+
+    /* --overlay comes first and is dropped, so the rest parses as usual */
+    const char *overlay_path = NULL;
+    if (argc > 1) {
+        int i = 1;
+        if ((overlay_path = option_value("--overlay", argc, argv, &i))) {
+            argv[i] = argv[0];
+            argv += i;
+            argc -= i;
+        }
+    }
+    
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    const char *disk_path = argv[1];
+    const char *command = (argc > 2) ? argv[2] : "ls";
+    phase(command);
+    
+    /* Overlay mode: only commands that go through the mount, plus commit and flatten */
+    if (overlay_path) {
+        if (strcmp(disk_path, "-") == 0 || strcmp(command, "mkfs") == 0 ||
+            strcmp(command, "pack") == 0 || strcmp(command, "punch") == 0 ||
+            strcmp(command, "manifest") == 0 || strcmp(command, "verify") == 0 ||
+            strcmp(command, "patch") == 0 || strcmp(command, "fsck") == 0 ||
+            strcmp(command, "recover") == 0 || strcmp(command, "damage") == 0 ||
+            strcmp(command, "gen") == 0) {
+            fprintf(stderr, "Error: '%s' cannot be used with --overlay\n",
+                    strcmp(disk_path, "-") == 0 ? disk_path : command);
+            return 1;
+        }
+        if (strcmp(command, "commit") == 0) {
+            if (argc != 3) {
+                fprintf(stderr, "Error: commit takes no arguments\n");
+                return 1;
+            }
+            return handle_commit(disk_path, overlay_path);
+        }
+        if (strcmp(command, "flatten") == 0) {
+            if (argc != 4) {
+                fprintf(stderr, "Error: flatten requires an output filename\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+            return handle_flatten(disk_path, overlay_path, argv[3]);
+        }
+    } else if (strcmp(command, "commit") == 0 || strcmp(command, "flatten") == 0) {
+        fprintf(stderr, "Error: %s needs --overlay delta.ovl before the image name\n", command);
+        return 1;
+    }
+    
+    /* Batch mode: many commands under one mount */
+    if (strcmp(command, "-b") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Error: -b requires a script filename (or - for stdin)\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        
+        int atomic = 0;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "--atomic") == 0) {
+                atomic = 1;
+            } else {
+                fprintf(stderr, "Error: Unknown batch option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        
+        int result = handle_batch(disk_path, overlay_path, argv[3], atomic);
+        if (result == 0) {
+            printf("\nOperation completed successfully.\n");
+        }
+        return result;
+    }
+    
+    /* Handle conversion commands specially (don't need MDOS disk) */
+    if (strcmp(command, "imd2dsk") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Error: imd2dsk requires input and output filenames\n");
+            fprintf(stderr, "Usage: %s - imd2dsk <input.imd> <output.dsk> [--free]\n", argv[0]);
+            return 1;
+        }
+        int flags = 0;
+        for (int i = 5; i < argc; i++) {
+            if (strcmp(argv[i], "--free") == 0) {
+                flags |= MDOS_SPARSE_FREE;
+            } else {
+                fprintf(stderr, "Error: Unknown imd2dsk option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        return handle_imd_to_dsk(argv[3], argv[4] ? argv[4] : "output.dsk", flags);
+    }
+    
+    if (strcmp(command, "imdindex") == 0) {
+        if (argc != 4 && argc != 7) {
+            fprintf(stderr, "Error: imdindex requires an IMD filename\n");
+            fprintf(stderr, "Usage: %s - imdindex <input.imd> [cylinder head sector]\n", argv[0]);
+            return 1;
+        }
+        return handle_imd_index(argv[3], argc - 4, argv + 4);
+    }
+    
+    if (strcmp(command, "mdz2dsk") == 0) {
+        if (argc < 5) {
+            fprintf(stderr, "Error: mdz2dsk requires input and output filenames\n");
+            fprintf(stderr, "Usage: %s - mdz2dsk <input.mdz> <output.dsk> [--free]\n", argv[0]);
+            return 1;
+        }
+        int flags = 0;
+        for (int i = 5; i < argc; i++) {
+            if (strcmp(argv[i], "--free") == 0) {
+                flags |= MDOS_SPARSE_FREE;
+            } else {
+                fprintf(stderr, "Error: Unknown mdz2dsk option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        return handle_mdz_to_dsk(argv[3], argv[4], flags);
+    }
+    
+    if (strcmp(command, "mdzbench") == 0) {
+        int rounds = 20;
+        int nimages = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+                rounds = atoi(argv[++i]);
+            } else {
+                argv[3 + nimages++] = argv[i];
+            }
+        }
+        if (nimages == 0 || rounds < 1) {
+            fprintf(stderr, "Error: mdzbench requires at least one image\n");
+            fprintf(stderr, "Usage: %s - mdzbench <image...> [--rounds N]\n", argv[0]);
+            return 1;
+        }
+        return handle_mdz_bench(nimages, argv + 3, rounds);
+    }
+    
+    if (strcmp(command, "dsk2imd") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Error: dsk2imd requires input and output filenames\n");
+            fprintf(stderr, "Usage: %s - dsk2imd <input.dsk> <output.imd> [--interleave N] [--skew K]\n", argv[0]);
+            return 1;
+        }
+        int interleave = 0, skew = 0;
+        for (int i = 5; i < argc; i++) {
+            if (strcmp(argv[i], "--interleave") == 0 && i + 1 < argc) {
+                interleave = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--skew") == 0 && i + 1 < argc) {
+                skew = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Unknown dsk2imd option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        return handle_dsk_to_imd(argv[3], argv[4] ? argv[4] : "output.imd", interleave, skew);
+    }
+    
+    if (strcmp(command, "interleave") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Error: interleave requires an image filename\n");
+            fprintf(stderr, "Usage: %s - interleave <image> [--rpm R] [--host-ms M] [--step-ms S]\n", argv[0]);
+            return 1;
+        }
+        mdos_drive_timing_t timing = MDOS_DRIVE_TIMING_DEFAULT;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "--rpm") == 0 && i + 1 < argc) {
+                timing.rpm = atof(argv[++i]);
+            } else if (strcmp(argv[i], "--host-ms") == 0 && i + 1 < argc) {
+                timing.host_ms = atof(argv[++i]);
+            } else if (strcmp(argv[i], "--step-ms") == 0 && i + 1 < argc) {
+                timing.step_ms = atof(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Unknown interleave option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        if (timing.rpm <= 0 || timing.host_ms < 0 || timing.step_ms < 0) {
+            fprintf(stderr, "Error: drive timings must be positive\n");
+            return 1;
+        }
+        return handle_interleave(argv[3], &timing);
+    }
+    
+    if (strcmp(command, "archive") == 0) {
+        const char *action = (argc > 3) ? argv[3] : "";
+        int nargs = argc - 5;
+        if (argc < 5 ||
+            (strcmp(action, "add") == 0 && nargs < 1) ||
+            (strcmp(action, "get") == 0 && nargs != 2) ||
+            (strcmp(action, "ls") == 0 && nargs != 0) ||
+            (strcmp(action, "add") != 0 && strcmp(action, "get") != 0 && strcmp(action, "ls") != 0)) {
+            fprintf(stderr, "Error: archive requires add, get or ls and a store directory\n");
+            fprintf(stderr, "Usage: %s - archive add <store> <image...> [--jobs N]\n", argv[0]);
+            fprintf(stderr, "       %s - archive get <store> <name> <out.dsk|out.imd>\n", argv[0]);
+            fprintf(stderr, "       %s - archive ls <store>\n", argv[0]);
+            return 1;
+        }
+        return handle_archive(action, argv[4], nargs, argv + 5);
+    }
+    
+    if (strcmp(command, "diff") == 0) {
+        const char *patch_path = NULL;
+        const char *paths[2] = { NULL, NULL };
+        int npaths = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--patch") == 0 && i + 1 < argc) {
+                patch_path = argv[++i];
+            } else if (argv[i][0] != '-' && npaths < 2) {
+                paths[npaths++] = argv[i];
+            } else {
+                fprintf(stderr, "Error: Unknown diff argument '%s'\n", argv[i]);
+                return 2;
+            }
+        }
+        if (npaths != 2) {
+            fprintf(stderr, "Error: diff requires two images\n");
+            fprintf(stderr, "Usage: %s - diff <old> <new> [--patch delta.mdp]\n", argv[0]);
+            return 2;
+        }
+        return handle_diff(paths[0], paths[1], patch_path);
+    }
+    
+    if (strcmp(command, "catalog") == 0) {
+        const char *action = (argc > 3) ? argv[3] : "";
+        if (strcmp(action, "build") != 0 && strcmp(action, "find") != 0) {
+            fprintf(stderr, "Error: catalog requires build or find\n");
+            fprintf(stderr, "Usage: %s - catalog build <dir> [--catalog FILE]\n", argv[0]);
+            fprintf(stderr, "       %s - catalog find [pattern] [--load=ADDR] [--start=ADDR] [--user=GLOB]\n"
+                            "                             [--catalog FILE]\n", argv[0]);
+            return 1;
+        }
+        return handle_catalog(action, argc - 4, argv + 4);
+    }
+    
+    if (strcmp(command, "grep") == 0) {
+        if (argc < 5) {
+            fprintf(stderr, "Error: grep requires a pattern and at least one image\n");
+            fprintf(stderr, "Usage: %s - grep <pattern> <image...> [-i] [--jobs N]\n", argv[0]);
+            return 2;
+        }
+        return handle_grep(argc - 3, argv + 3);
+    }
+    
+    /* fsck of one image or, from '-', of many */
+    if (strcmp(command, "fsck") == 0) {
+        int flags = 0, nimages = 0;
+        char **images = argv + 3;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--repair") == 0) {
+                flags |= MDOS_FSCK_REPAIR;
+            } else if (strcmp(disk_path, "-") == 0) {
+                images[nimages++] = argv[i];
+            } else {
+                fprintf(stderr, "Error: Unknown fsck argument '%s'\n", argv[i]);
+                return 8;
+            }
+        }
+        if (strcmp(disk_path, "-") != 0) {
+            images = argv + 1;
+            nimages = 1;
+        } else if (nimages == 0) {
+            fprintf(stderr, "Error: fsck requires at least one image\n");
+            fprintf(stderr, "Usage: %s - fsck <image...> [--repair]\n", argv[0]);
+            return 8;
+        }
+        return handle_fsck(images, nimages, flags);
+    }
+    
+    /* recover from one image or, from '-', sweep many */
+    if (strcmp(command, "recover") == 0) {
+        const char *extract_dir = NULL;
+        int min_score = 0, nimages = 0;
+        char **images = argv + 3;
+        for (int i = 3; i < argc; i++) {
+            const char *value;
+            if ((value = option_value("--extract", argc, argv, &i))) {
+                extract_dir = value;
+            } else if ((value = option_value("--min-score", argc, argv, &i))) {
+                min_score = atoi(value);
+            } else if (strcmp(disk_path, "-") == 0) {
+                images[nimages++] = argv[i];
+            } else {
+                fprintf(stderr, "Error: Unknown recover argument '%s'\n", argv[i]);
+                return 2;
+            }
+        }
+        if (strcmp(disk_path, "-") != 0) {
+            images = argv + 1;
+            nimages = 1;
+        } else if (nimages == 0) {
+            fprintf(stderr, "Error: recover requires at least one image\n");
+            fprintf(stderr, "Usage: %s - recover <image...> [--extract DIR] [--min-score N]\n", argv[0]);
+            return 2;
+        }
+        return handle_recover(images, nimages, extract_dir, min_score);
+    }
+    
+    /* damage report of one IMD or, from '-', of many */
+    if (strcmp(command, "damage") == 0) {
+        if (strcmp(disk_path, "-") != 0) {
+            if (argc > 3) {
+                fprintf(stderr, "Error: damage takes no arguments\n");
+                return 2;
+            }
+            return handle_damage(argv + 1, 1);
+        }
+        if (argc < 4) {
+            fprintf(stderr, "Error: damage requires at least one image\n");
+            fprintf(stderr, "Usage: %s - damage <image.imd...>\n", argv[0]);
+            return 2;
+        }
+        return handle_damage(argv + 3, argc - 3);
+    }
+    
+    /* gen builds its images from scratch, like mkfs */
+    if (strcmp(command, "gen") == 0) {
+        mdos_gen_opts_t opts = MDOS_GEN_DEFAULTS;
+        const char *ext = strrchr(disk_path, '.');
+        int count = 1;
+        opts.imd = ext && strcasecmp(ext, ".imd") == 0;
+        for (int i = 3; i < argc; i++) {
+            const char *value;
+            if ((value = option_value("--seed", argc, argv, &i))) {
+                opts.seed = strtoull(value, NULL, 0);
+            } else if ((value = option_value("--files", argc, argv, &i))) {
+                opts.files = atoi(value);
+            } else if ((value = option_value("--sides", argc, argv, &i))) {
+                opts.sides = atoi(value);
+            } else if ((value = option_value("--size-dist", argc, argv, &i))) {
+                if (parse_size_dist(value, &opts) != 0) {
+                    fprintf(stderr, "Error: --size-dist is small, mixed, large or MIN-MAX\n");
+                    return 1;
+                }
+            } else if ((value = option_value("--fragmentation", argc, argv, &i))) {
+                opts.fragmentation = atof(value);
+            } else if ((value = option_value("--text-ratio", argc, argv, &i))) {
+                opts.text_ratio = atof(value);
+            } else if ((value = option_value("--missing-sectors", argc, argv, &i))) {
+                opts.missing_sectors = atof(value);
+            } else if ((value = option_value("--count", argc, argv, &i))) {
+                count = atoi(value);
+            } else if (strcmp(argv[i], "--imd") == 0) {
+                opts.imd = 1;
+            } else {
+                fprintf(stderr, "Error: Unknown gen argument '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        if (strcmp(disk_path, "-") == 0 || count < 1) {
+            fprintf(stderr, "Error: gen requires an output image name and a count of at least 1\n");
+            return 1;
+        }
+        if (opts.missing_sectors > 0 && !opts.imd) {
+            fprintf(stderr, "Error: --missing-sectors needs IMD output (--imd); a DSK cannot record them\n");
+            return 1;
+        }
+        return handle_gen(disk_path, &opts, count);
+    }
+    
+    /* Handle mkfs command specially (doesn't need mounting) */
+    if (strcmp(command, "mkfs") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Error: mkfs requires sides parameter (1 or 2)\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        
+        int sides = atoi(argv[3]);
+        if (sides != 1 && sides != 2) {
+            fprintf(stderr, "Error: sides must be 1 (single) or 2 (double)\n");
+            return 1;
+        }
+        
+        return handle_mkfs(disk_path, sides);
+    }
+    
+    /* punch works on the file, not through a mount */
+    if (strcmp(command, "punch") == 0) {
+        int flags = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--free") == 0) {
+                flags |= MDOS_SPARSE_FREE;
+            } else {
+                fprintf(stderr, "Error: Unknown punch option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        if (mdos_is_imd(disk_path) || mdos_is_mdz(disk_path)) {
+            fprintf(stderr, "Error: punch works on DSK images only\n");
+            return 1;
+        }
+        return handle_punch(disk_path, flags);
+    }
+    
+    /* manifest and verify read the image file once themselves */
+    if (strcmp(command, "manifest") == 0) {
+        const char *out_path = NULL;
+        int flags = 0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--sha256") == 0) {
+                flags |= MDOS_PACK_SHA256;
+            } else if (!out_path && (argv[i][0] != '-' || argv[i][1] == '\0')) {
+                out_path = argv[i];
+            } else {
+                fprintf(stderr, "Error: Unknown manifest argument '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        return handle_manifest(disk_path, out_path, flags);
+    }
+    
+    /* patch checks the whole image before it writes */
+    if (strcmp(command, "patch") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "Error: patch requires a patch filename\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return handle_patch(disk_path, argv[3]);
+    }
+    
+    if (strcmp(command, "verify") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "Error: verify requires a packlist filename\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return handle_verify(disk_path, argv[3]);
+    }
+    
+    /* pack creates the image itself */
+    if (strcmp(command, "pack") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Error: pack requires a packlist filename\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        
+        int sides = 1;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "--sides") == 0 && i + 1 < argc) {
+                sides = atoi(argv[++i]);
+            } else {
+                fprintf(stderr, "Error: Unknown pack option '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        if (sides != 1 && sides != 2) {
+            fprintf(stderr, "Error: sides must be 1 (single) or 2 (double)\n");
+            return 1;
+        }
+        
+        return handle_pack(disk_path, argv[3], sides);
+    }    
+    /* Keep status messages out of a tar streamed to stdout */
+    if (strcmp(command, "export-tar") == 0 && (argc < 4 || strcmp(argv[3], "-") == 0)) {
+        if (!data_stdout()) {
+            perror("stdout");
+            return 1;
+        }
+    }
+    
+    /* Determine if we need write access */
+    int need_write = command_needs_write(command);
+    
+    /* Mount the MDOS filesystem */
+    if (overlay_path) {
+        printf("Mounting MDOS disk: %s (overlay %s)\n", disk_path, overlay_path);
+    } else {
+        printf("Mounting MDOS disk: %s (%s mode)\n", 
+               disk_path, need_write ? "read-write" : "read-only");
+    }
+    
+    phase("mount");
+    mdos_fs_t *fs = mount_disk(disk_path, overlay_path, !need_write);
+    if (!fs) {
+        fprintf(stderr, "Failed to mount MDOS disk: %s\n", disk_path);
+        fprintf(stderr, "Make sure the file exists and is a valid MDOS disk image.\n");
+        return 1;
+    }
+    
+    /* Dispatch commands (ls when no command was given) */
+    phase(command);
+    char *default_args[] = { "ls" };
+    int result = (argc > 2) ? dispatch_command(fs, argc - 2, argv + 2)
+                            : dispatch_command(fs, 1, default_args);
+    if (result == 2) {
         print_usage(argv[0]);
         result = 1;
     }
     
     /* Clean up */
-    int unmount_result = mdos_unmount(fs);
+    phase("unmount");
+    int unmount_result = mdos_unmount_image(fs);
     if (unmount_result != MDOS_EOK) {
         print_error("unmount", unmount_result);
         if (result == 0) result = 1; /* Don't override existing error */